@@ -1,16 +1,48 @@
 import os
 import sys
 import re
-from flask import Flask, render_template, request, jsonify
-from xhell_wrapper import XhellWrapper
+import json
+import base64
+import hashlib
+from flask import Flask, render_template, request, jsonify, Response, g
+from xhell_wrapper import XhellClients
+from file_pages import FileCache
 
 app = Flask(__name__)
 
-# Initialize Xhell Wrapper
-workspace_dir = "./demo_workspace"
-if not os.path.exists(workspace_dir):
-    os.makedirs(workspace_dir)
-xhell = XhellWrapper(workspace_dir=workspace_dir)
+# Every client gets a workspace of its own under demo_workspace/<id>,
+# named by a cookie. Several worker processes can serve the same client
+# (see start.sh): what they share is the workspace on disk.
+workspace_root = "./demo_workspace"
+if not os.path.exists(workspace_root):
+    os.makedirs(workspace_root)
+# Largest output one streamed command may send, in bytes
+stream_cap = int(os.environ.get('XHELL_STREAM_CAP', 1 << 20))
+clients = XhellClients(workspace_root,
+                       idle_timeout=int(os.environ.get('XHELL_IDLE_TIMEOUT', 900)),
+                       stream_cap=stream_cap)
+CLIENT_COOKIE = 'xhell_client'
+
+def client():
+    """The XhellWrapper of the client making this request"""
+    if 'client_id' not in g:
+        client_id = request.cookies.get(CLIENT_COOKIE)
+        if not clients.valid_id(client_id):
+            client_id = clients.new_id()
+            g.new_client = True
+        g.client_id = client_id
+    return clients.get(g.client_id)
+
+def workspace():
+    client()
+    return clients.workspace(g.client_id)
+
+@app.after_request
+def remember_client(response):
+    if g.get('new_client'):
+        response.set_cookie(CLIENT_COOKIE, g.client_id, httponly=True, samesite='Lax',
+                            max_age=30 * 24 * 3600)
+    return response
 
 def strip_ansi(text):
     """Remove ANSI escape sequences from text"""
@@ -19,10 +51,12 @@ def strip_ansi(text):
 
 @app.route('/')
 def index():
+    client()
     return render_template('index.html')
 
 @app.route('/cli')
 def cli():
+    client()
     return render_template('cli.html')
 
 @app.route('/execute', methods=['POST'])
@@ -33,7 +67,7 @@ def execute_command():
     if not cmd:
         return jsonify({'error': 'No command provided'}), 400
         
-    result = xhell.execute_command(cmd)
+    result = client().execute_command(cmd)
     
     response = {
         'command': cmd,
@@ -43,32 +77,125 @@ def execute_command():
     }
     return jsonify(response)
 
+@app.route('/execute_stream', methods=['GET'])
+def execute_stream():
+    """Server-Sent Events: 'start' with the stream id, 'stdout' and
+    'stderr' chunks as the command writes them, then 'done'. The events
+    are produced only as fast as the client reads them."""
+    cmd = request.args.get('command')
+    if not cmd:
+        return jsonify({'error': 'No command provided'}), 400
+    cap = min(request.args.get('cap', stream_cap, type=int), stream_cap)
+    xhell = client()
+
+    def events():
+        for kind, data in xhell.stream_command(cmd, cap):
+            if kind in ('stdout', 'stderr'):
+                data = strip_ansi(data)
+            yield f'event: {kind}\ndata: {json.dumps(data)}\n\n'
+
+    return Response(events(), mimetype='text/event-stream',
+                    headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+
+@app.route('/cancel', methods=['POST'])
+def cancel():
+    """Kill the process group of a running stream"""
+    stream_id = (request.json or {}).get('id', '')
+    if not client().cancel(stream_id):
+        return jsonify({'error': 'No such stream'}), 404
+    return jsonify({'cancelled': stream_id})
+
+@app.route('/records', methods=['POST'])
+def records():
+    """Structured output of xls, xsearch, xhistory or xjournalctl"""
+    cmd = (request.json or {}).get('command', '')
+    if cmd.split()[:1] not in (['xls'], ['xsearch'], ['xhistory'], ['xjournalctl']):
+        return jsonify({'error': 'Not a listing command'}), 400
+    return jsonify({'command': cmd, 'records': client().execute_records(cmd)})
+
 @app.route('/files', methods=['GET'])
 def list_files():
     try:
-        files = sorted([f for f in os.listdir(workspace_dir) if not f.startswith('.')])
+        files = sorted([f for f in os.listdir(workspace()) if not f.startswith('.')])
         return jsonify({'files': files})
     except Exception as e:
         return jsonify({'error': str(e)}), 500
 
+# Largest page /read_file returns, in bytes and in lines
+READ_PAGE_DEFAULT = 64 * 1024
+READ_PAGE_MAX = 1 << 20
+READ_LINES_MAX = 10000
+mapped_files = FileCache()
+
 @app.route('/read_file', methods=['GET'])
 def read_file():
+    """A page of a file in the client's workspace, by bytes (offset,
+    length) or by lines (line, lines; counted from 0). encoding=base64
+    returns the bytes exactly; text replaces what is not UTF-8. Pages
+    come from a mapping of the file kept between requests, and carry an
+    ETag from the file's identity and the range, so a page already seen
+    costs a 304."""
     filename = request.args.get('filename')
     if not filename:
         return jsonify({'error': 'No filename provided'}), 400
         
+    workspace_dir = workspace()
     filepath = os.path.join(workspace_dir, filename)
     
     # Security check to prevent directory traversal
-    if not os.path.abspath(filepath).startswith(os.path.abspath(workspace_dir)):
+    if not os.path.abspath(filepath).startswith(os.path.abspath(workspace_dir) + os.sep):
          return jsonify({'error': 'Access denied'}), 403
 
+    encoding = request.args.get('encoding', 'text')
+    if encoding not in ('text', 'base64'):
+        return jsonify({'error': 'encoding must be text or base64'}), 400
+    offset = request.args.get('offset', 0, type=int)
+    length = request.args.get('length', READ_PAGE_DEFAULT, type=int)
+    line = request.args.get('line', type=int)
+    lines = request.args.get('lines', 100, type=int)
+    if min(offset, length, lines, line or 0) < 0:
+        return jsonify({'error': 'Negative range'}), 400
+    length = min(length, READ_PAGE_MAX)
+    lines = min(lines, READ_LINES_MAX)
+
     try:
-        with open(filepath, 'r') as f:
-            content = f.read(2000) # Limit size
-            return jsonify({'content': content})
-    except Exception as e:
+        mapped = mapped_files.get(os.path.abspath(filepath))
+    except FileNotFoundError:
+        return jsonify({'error': 'No such file'}), 404
+    except (OSError, ValueError) as e:
         return jsonify({'error': str(e)}), 500
 
+    by_lines = f'l{line}+{lines}' if line is not None else f'b{offset}+{length}'
+    tag = hashlib.blake2b(repr((mapped.identity, by_lines, encoding)).encode(), digest_size=12).hexdigest()
+    if request.if_none_match.contains(tag):
+        response = Response(status=304)
+        response.set_etag(tag)
+        return response
+
+    page = {'filename': filename, 'size': mapped.size, 'encoding': encoding}
+    if line is not None:
+        begin, end, count, total = mapped.line_range(line, lines)
+        # A line longer than a page is cut; the rest is read by offset
+        end = min(end, begin + READ_PAGE_MAX)
+        page.update({'line': line, 'lines': count, 'total_lines': total})
+    else:
+        begin = min(offset, mapped.size)
+        end = min(begin + length, mapped.size)
+    data = mapped.read(begin, end - begin)
+    page.update({
+        'offset': begin,
+        'length': len(data),
+        'next_offset': end if end < mapped.size else None,
+        'eof': end >= mapped.size,
+        'content': base64.b64encode(data).decode() if encoding == 'base64'
+                   else data.decode('utf-8', errors='replace'),
+    })
+
+    response = jsonify(page)
+    response.set_etag(tag)
+    response.headers['Cache-Control'] = 'private, no-cache'
+    return response
+
 if __name__ == '__main__':
-    app.run(debug=True, port=8505)
+    # Development server; start.sh runs several workers under gunicorn
+    app.run(debug=True, port=8505, threaded=True)
@@ -0,0 +1,118 @@
+"""Load test of the web back end: requests per second through /execute
+for 1, 2, 4, ... worker processes, up to the number of cores.
+
+Each load process is a separate client with its own cookie, workspace
+and sessions, and keeps one connection busy. With enough clients the
+throughput should grow with the workers until it reaches the cores.
+
+Usage: python3 bench/load_test.py [--duration S] [--clients N]
+                                  [--workers 1,2,4] [--command 'xecho ok']
+"""
+
+import argparse
+import http.client
+import json
+import multiprocessing
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+APP_DIR = os.path.dirname(HERE)
+
+
+def client(port, command, start, stop, counts, index):
+    conn = http.client.HTTPConnection('127.0.0.1', port)
+    body = json.dumps({'command': command})
+    headers = {'Content-Type': 'application/json'}
+
+    # The first response names this client; later requests send it back
+    conn.request('GET', '/cli')
+    response = conn.getresponse()
+    response.read()
+    cookie = response.getheader('Set-Cookie', '').split(';')[0]
+    headers['Cookie'] = cookie
+
+    done = 0
+    while time.time() < start:
+        time.sleep(0.001)
+    while time.time() < stop:
+        conn.request('POST', '/execute', body, headers)
+        response = conn.getresponse()
+        response.read()
+        if response.status == 200:
+            done += 1
+    counts[index] = done
+
+
+def wait_ready(port, timeout=30):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            conn = http.client.HTTPConnection('127.0.0.1', port, timeout=1)
+            conn.request('GET', '/files')
+            conn.getresponse().read()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def run(workers, clients, duration, command, port):
+    work = tempfile.mkdtemp()
+    # The app finds ./xhell/xhell and ./demo_workspace from its directory
+    os.symlink(os.path.join(APP_DIR, 'xhell'), os.path.join(work, 'xhell'))
+    server = subprocess.Popen(
+        [sys.executable, '-m', 'gunicorn', '--workers', str(workers), '--threads', '4',
+         '--bind', f'127.0.0.1:{port}', '--pythonpath', APP_DIR, '--log-level', 'warning', 'app:app'],
+        cwd=work, start_new_session=True)
+    try:
+        if not wait_ready(port):
+            raise RuntimeError('server did not start')
+        counts = multiprocessing.Array('l', clients)
+        start = time.time() + 1.0               # time for every client to connect
+        stop = start + duration
+        procs = [multiprocessing.Process(target=client, args=(port, command, start, stop, counts, i))
+                 for i in range(clients)]
+        for p in procs:
+            p.start()
+        for p in procs:
+            p.join()
+        return sum(counts) / duration
+    finally:
+        os.killpg(server.pid, signal.SIGTERM)
+        server.wait()
+        shutil.rmtree(work, ignore_errors=True)
+
+
+def main():
+    cores = os.cpu_count() or 1
+    steps = []
+    n = 1
+    while n < cores:
+        steps.append(n)
+        n *= 2
+    steps.append(cores)
+
+    parser = argparse.ArgumentParser(description='Throughput of /execute by worker count')
+    parser.add_argument('--duration', type=float, default=10)
+    parser.add_argument('--clients', type=int, default=4 * cores)
+    parser.add_argument('--workers', default=','.join(map(str, steps)))
+    parser.add_argument('--command', default='xecho ok')
+    parser.add_argument('--port', type=int, default=8599)
+    args = parser.parse_args()
+
+    print(f'cores: {cores}, clients: {args.clients}, {args.duration:g} s each, command: {args.command}')
+    base = None
+    for workers in map(int, args.workers.split(',')):
+        rate = run(workers, args.clients, args.duration, args.command, args.port)
+        base = base or rate
+        print(f'workers {workers:3d}: {rate:9.0f} req/s  x{rate / base:.2f}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+import mmap
+import operator
+import os
+import threading
+from array import array
+from collections import OrderedDict
+from itertools import accumulate, count, islice
+
+INDEX_CHUNK = 4 << 20
+INDEX_STRIDE = 64
+
+
+class MappedFile:
+    """A file mapped read-only, with its lines indexed as far as they have
+    been asked for. Both stay valid while the file's identity (dev,
+    inode, size, mtime) does. The index keeps the start of every
+    INDEX_STRIDE-th line, a few MB for a log of hundreds of millions;
+    the lines between are found from there."""
+
+    def __init__(self, path, identity):
+        self.identity = identity
+        self.size = identity[2]
+        self.map = None
+        if self.size > 0:
+            with open(path, 'rb') as f:
+                self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.starts = array('Q', [0] if self.size > 0 else [])  # of lines 0, STRIDE, 2 * STRIDE...
+        self.lines = 1 if self.size > 0 else 0  # lines found so far
+        self.indexed = self.size == 0   # every line found
+        self.scanned = 0                # bytes searched for newlines
+        self.lock = threading.Lock()
+
+    def read(self, offset, length):
+        if self.map is None:
+            return b''
+        return self.map[offset:offset + length]
+
+    def _index_to(self, line):
+        # Called with the lock held. Scans on a chunk at a time, with the
+        # per-line work done by C iterators: the line after the k-th
+        # newline of a chunk starts after the k first parts and their
+        # newlines. Of those lines, only the ones on the stride are kept.
+        while self.lines <= line and not self.indexed:
+            start = self.scanned
+            parts = self.map[start:start + INDEX_CHUNK].split(b'\n')
+            found = map(operator.add, accumulate(map(len, parts[:-1])), count(start + 1))
+            self.starts.extend(islice(found, -self.lines % INDEX_STRIDE, None, INDEX_STRIDE))
+            self.lines += len(parts) - 1
+            self.scanned = min(start + INDEX_CHUNK, self.size)
+            if self.scanned == self.size:
+                # After a final newline there is no line left to start
+                if self.map[-1:] == b'\n':
+                    self.lines -= 1
+                    if self.starts[-1] == self.size:
+                        self.starts.pop()
+                self.indexed = True
+
+    def _offset(self, line):
+        # Where line starts, or the size past the last line; indexed to it
+        if line >= self.lines:
+            return self.size
+        pos = self.starts[line // INDEX_STRIDE]
+        for _ in range(line % INDEX_STRIDE):
+            pos = self.map.find(b'\n', pos) + 1
+        return pos
+
+    def line_range(self, first, number):
+        """Byte span of lines [first, first + number), the number of them
+        there are, and the number of lines in the file if known by now"""
+        with self.lock:
+            self._index_to(first + number)
+            begin = self._offset(first)
+            end = self._offset(first + number)
+            found = max(0, min(first + number, self.lines) - first)
+            return begin, end, found, self.lines if self.indexed else None
+
+
+class FileCache:
+    """MappedFile by path, dropped when the file's identity changes or
+    when more than max_files are open. A dropped map is unmapped once
+    the last request reading it lets go of it."""
+
+    def __init__(self, max_files=32):
+        self.max_files = max_files
+        self.files = OrderedDict()
+        self.lock = threading.Lock()
+
+    @staticmethod
+    def identity(st):
+        return (st.st_dev, st.st_ino, st.st_size, st.st_mtime_ns)
+
+    def get(self, path):
+        st = os.stat(path)
+        identity = self.identity(st)
+        with self.lock:
+            cached = self.files.get(path)
+            if cached is not None and cached.identity == identity:
+                self.files.move_to_end(path)
+                return cached
+        # Mapped outside the lock; a racing request may map it too
+        mapped = MappedFile(path, identity)
+        with self.lock:
+            self.files.pop(path, None)
+            self.files[path] = mapped
+            while len(self.files) > self.max_files:
+                self.files.popitem(last=False)
+        return mapped
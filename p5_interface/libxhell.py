@@ -0,0 +1,89 @@
+import ctypes
+import os
+import threading
+
+
+class _Result(ctypes.Structure):
+    # XhellResult in xhell/include/libxhell.h
+    _fields_ = [
+        ('out', ctypes.c_void_p),
+        ('out_len', ctypes.c_size_t),
+        ('err', ctypes.c_void_p),
+        ('err_len', ctypes.c_size_t),
+        ('status', ctypes.c_int),
+        ('duration', ctypes.c_double),
+        ('exited', ctypes.c_int),
+    ]
+
+
+class XhellLibrary:
+    """xhell loaded into this process through libxhell.so: commands run
+    without starting a process per call, builtins without any. The shell
+    state is per process, so there is one instance, for one workspace
+    until it is closed, and lines run one at a time; there is no timeout,
+    since nothing can interrupt a builtin running on the caller's
+    thread."""
+
+    _instance = None
+    _instance_lock = threading.Lock()
+
+    def __new__(cls, library_path=None, workspace_dir='.'):
+        with cls._instance_lock:
+            if cls._instance is None or not cls._instance.session:
+                instance = super().__new__(cls)
+                instance._open(library_path, workspace_dir)
+                cls._instance = instance
+            elif cls._instance.workspace_dir != os.path.abspath(workspace_dir):
+                raise ValueError(f'xhell session is open in {cls._instance.workspace_dir}')
+            return cls._instance
+
+    def _open(self, library_path, workspace_dir):
+        if library_path is None:
+            library_path = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'xhell', 'libxhell.so')
+        lib = ctypes.CDLL(library_path, use_errno=True)
+        lib.xhell_session_new.argtypes = [ctypes.c_char_p]
+        lib.xhell_session_new.restype = ctypes.c_void_p
+        lib.xhell_exec.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(_Result)]
+        lib.xhell_exec.restype = ctypes.c_int
+        lib.xhell_result_free.argtypes = [ctypes.POINTER(_Result)]
+        lib.xhell_result_free.restype = None
+        lib.xhell_session_free.argtypes = [ctypes.c_void_p]
+        lib.xhell_session_free.restype = None
+
+        self.lib = lib
+        self.lock = threading.Lock()
+        self.workspace_dir = os.path.abspath(workspace_dir)
+        self.session = lib.xhell_session_new(self.workspace_dir.encode())
+        if not self.session:
+            errno = ctypes.get_errno()
+            raise OSError(errno, os.strerror(errno))
+
+    def run(self, line):
+        """Run one line; returns the same frame as `xhell --session`:
+        command, stdout, stderr, status and duration"""
+        result = _Result()
+        with self.lock:
+            if not self.session:
+                raise ValueError('xhell session is closed')
+            if self.lib.xhell_exec(self.session, line.encode(), ctypes.byref(result)) != 0:
+                errno = ctypes.get_errno()
+                raise OSError(errno, os.strerror(errno))
+            try:
+                stdout = ctypes.string_at(result.out, result.out_len)
+                stderr = ctypes.string_at(result.err, result.err_len)
+            finally:
+                self.lib.xhell_result_free(ctypes.byref(result))
+        return {
+            'command': line,
+            'stdout': stdout.decode('utf-8', errors='replace'),
+            'stderr': stderr.decode('utf-8', errors='replace'),
+            'status': result.status,
+            'duration': result.duration
+        }
+
+    def close(self):
+        """Save the history, close the log and end the session"""
+        with self.lock:
+            if self.session:
+                self.lib.xhell_session_free(self.session)
+                self.session = None
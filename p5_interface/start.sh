@@ -36,20 +36,11 @@ if [ $? -ne 0 ]; then
     exit 1
 fi
 
-# 5. Check Xhell Binary
-if [ ! -f "./xhell/xhell" ]; then
-    echo "[WARNING] Xhell binary not found in ./xhell/xhell"
-    echo "[INFO] Attempting to compile..."
-    if [ -d "./xhell" ]; then
-        cd xhell
-        make
-        cd ..
-    fi
-fi
-
-# Ensure executable permissions
-if [ -f "./xhell/xhell" ]; then
-    chmod +x ./xhell/xhell
+# 5. Build Xhell (make only rebuilds what changed since the last run)
+echo "[INFO] Building xhell..."
+if ! make -C xhell; then
+    echo "[ERROR] Failed to build xhell."
+    exit 1
 fi
 
 # 6. Run the App
@@ -65,4 +56,12 @@ echo "[INFO] Starting Server on http://localhost:8505"
 echo "Press Ctrl+C to stop."
 echo "=================================================="
 
-$PYTHON_BIN app.py
+# One worker process per core, each with threads for concurrent and
+# streaming requests; the Flask development server is the fallback
+WORKERS=${XHELL_WORKERS:-$(nproc)}
+if [ -x "$VENV_DIR/bin/gunicorn" ]; then
+    echo "[INFO] Running $WORKERS workers"
+    "$VENV_DIR/bin/gunicorn" --workers "$WORKERS" --threads 8 --bind 0.0.0.0:8505 app:app
+else
+    $PYTHON_BIN app.py
+fi
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Compare loading an xsh script with and without the .xshc cache.
+# "xsh -n" loads the script without running it, so the timings show
+# only what it costs to get from source to executable instructions.
+#
+# Usage: bench/bench_xsh.sh [lines]
+
+XHELL=${XHELL:-./xhell}
+LINES=${1:-20000}
+RUNS=20
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export XHELL_CACHE_DIR="$WORK/cache"
+
+# A script of typical provisioning lines
+i=0
+while [ $i -lt "$LINES" ]; do
+    echo "xecho step $i of the setup | xsearch step > /dev/null"
+    echo "xtouch $WORK/file_$i 2> $WORK/err.log"
+    i=$((i + 2))
+done > "$WORK/script.x"
+
+now_ns() { date +%s%N; }
+
+run() {
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        echo "xsh -n $WORK/script.x"
+        i=$((i + 1))
+    done > "$WORK/input"
+    start=$(now_ns)
+    "$XHELL" < "$WORK/input" > /dev/null
+    end=$(now_ns)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+# Cold: force a recompile on every load by removing the cache
+cold_total=0
+i=0
+while [ $i -lt "$RUNS" ]; do
+    rm -rf "$XHELL_CACHE_DIR"
+    start=$(now_ns)
+    echo "xsh -n $WORK/script.x" | "$XHELL" > /dev/null
+    end=$(now_ns)
+    cold_total=$((cold_total + (end - start) / 1000))
+    i=$((i + 1))
+done
+
+# Warm: every load is served from the cache
+echo "xsh -n $WORK/script.x" | "$XHELL" > /dev/null
+warm=$(run)
+
+echo "script lines      : $LINES"
+echo "parse + cache     : $((cold_total / RUNS)) us per load"
+echo "cached load       : $warm us per load"
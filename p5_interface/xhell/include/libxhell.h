@@ -0,0 +1,45 @@
+#ifndef LIBXHELL_H
+#define LIBXHELL_H
+
+// libxhell: the xhell parser, executor and builtins as a library, for
+// programs that would otherwise start the xhell binary per command.
+//
+// Builtins run in the calling process; external commands and pipelines
+// are forked as in the shell. While a line runs, the process's fds 1
+// and 2 point at the capture, so nothing else in the process should
+// write to them, and lines must not run on two threads at once. The
+// shell's variables, functions and history belong to the process, so
+// only one session may exist at a time.
+
+#include <stddef.h>
+
+typedef struct XhellSession XhellSession;
+
+// What one line did. The buffers are NUL terminated and belong to the
+// caller, who releases them with xhell_result_free.
+typedef struct {
+    char *out;              // everything written to stdout
+    size_t out_len;
+    char *err;              // everything written to stderr
+    size_t err_len;
+    int status;             // exit status of the last command
+    double duration;        // seconds
+    int exited;             // the line called exit
+} XhellResult;
+
+// Start a session whose lines run in dir (NULL: the current directory);
+// the caller's working directory is restored after every line. History
+// and log live in dir. NULL with errno set on failure, EBUSY if another
+// session exists.
+XhellSession *xhell_session_new(const char *dir);
+
+// Run one line, which may hold several commands and control flow.
+// 0 on success, -1 with errno set if the line could not be run.
+int xhell_exec(XhellSession *session, const char *line, XhellResult *result);
+
+void xhell_result_free(XhellResult *result);
+
+// Save the history, close the log and end the session
+void xhell_session_free(XhellSession *session);
+
+#endif // LIBXHELL_H
@@ -0,0 +1,516 @@
+#include "../include/xhell.h"
+#include <pthread.h>
+
+// Tab completion sources
+//
+// Command names come from the built-in table and from a trie of every
+// executable on PATH. The trie is built by a background thread so the
+// first prompt never waits for it, and is rebuilt (again in the
+// background) when PATH or the mtime of one of its directories changes.
+// Lookups walk the trie straight to the prefix, so their cost does not
+// depend on how many executables are installed.
+//
+// File names come from a small cache of directory listings, keyed by
+// the directory itself (device and inode) rather than the name typed,
+// which means another directory after an xcd. A listing is re-read
+// only when the directory's mtime changes.
+
+#define PATH_RECHECK_NS 1000000000L
+#define DIR_CACHE_SIZE 8
+
+typedef struct {
+    char c;
+    unsigned char terminal;
+    int child;              // first child, children sorted by c
+    int sibling;
+} TrieNode;
+
+typedef struct {
+    TrieNode *nodes;
+    int count;
+    int cap;
+} Trie;
+
+typedef struct {
+    char *path;
+    struct timespec mtime;
+} PathDir;
+
+typedef struct {
+    int used;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char **names;
+    unsigned char *is_dir;
+    int count;
+} DirCache;
+
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+static Trie *path_trie = NULL;          // guarded by path_lock
+static PathDir *path_dirs = NULL;       // directories path_trie was built from
+static int path_dir_count = 0;
+static char *path_value = NULL;         // PATH path_trie was built from
+static int path_building = 0;
+static struct timespec path_checked;
+
+static DirCache dir_cache[DIR_CACHE_SIZE];
+static int dir_cache_next = 0;
+
+// --- Trie ---
+
+static int trie_node(Trie *trie, char c) {
+    if (trie->count == trie->cap) {
+        int cap = trie->cap ? trie->cap * 2 : 1024;
+        TrieNode *nodes = realloc(trie->nodes, cap * sizeof(TrieNode));
+        if (nodes == NULL) {
+            return -1;
+        }
+        trie->nodes = nodes;
+        trie->cap = cap;
+    }
+
+    TrieNode *node = &trie->nodes[trie->count];
+    node->c = c;
+    node->terminal = 0;
+    node->child = -1;
+    node->sibling = -1;
+    return trie->count++;
+}
+
+static Trie *trie_new(void) {
+    Trie *trie = calloc(1, sizeof(Trie));
+    if (trie != NULL && trie_node(trie, '\0') != 0) {
+        free(trie);
+        return NULL;
+    }
+    return trie;
+}
+
+static void trie_free(Trie *trie) {
+    if (trie != NULL) {
+        free(trie->nodes);
+        free(trie);
+    }
+}
+
+static void trie_insert(Trie *trie, const char *word) {
+    int node = 0;
+    for (const char *p = word; *p; p++) {
+        // Find the child for *p, keeping the sibling list sorted
+        int prev = -1;
+        int child = trie->nodes[node].child;
+        while (child != -1 && trie->nodes[child].c < *p) {
+            prev = child;
+            child = trie->nodes[child].sibling;
+        }
+
+        if (child == -1 || trie->nodes[child].c != *p) {
+            int fresh = trie_node(trie, *p);
+            if (fresh == -1) {
+                return;
+            }
+            trie->nodes[fresh].sibling = child;
+            if (prev == -1) {
+                trie->nodes[node].child = fresh;
+            } else {
+                trie->nodes[prev].sibling = fresh;
+            }
+            child = fresh;
+        }
+        node = child;
+    }
+    trie->nodes[node].terminal = 1;
+}
+
+static int trie_find(const Trie *trie, const char *prefix) {
+    int node = 0;
+    for (const char *p = prefix; *p && node != -1; p++) {
+        int child = trie->nodes[node].child;
+        while (child != -1 && trie->nodes[child].c < *p) {
+            child = trie->nodes[child].sibling;
+        }
+        node = (child != -1 && trie->nodes[child].c == *p) ? child : -1;
+    }
+    return node;
+}
+
+static void trie_collect(const Trie *trie, int node, char *buf, size_t len,
+                         size_t size, CompletionList *out) {
+    if (trie->nodes[node].terminal) {
+        buf[len] = '\0';
+        completion_add(out, buf, 0);
+    }
+    if (len + 1 >= size) {
+        return;
+    }
+    for (int child = trie->nodes[node].child; child != -1; child = trie->nodes[child].sibling) {
+        buf[len] = trie->nodes[child].c;
+        trie_collect(trie, child, buf, len + 1, size, out);
+    }
+}
+
+// --- PATH scanning ---
+
+static int timespec_equal(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void path_dirs_free(PathDir *dirs, int count) {
+    for (int i = 0; i < count; i++) {
+        free(dirs[i].path);
+    }
+    free(dirs);
+}
+
+// Split PATH and record the current mtime of each directory
+static PathDir *path_dirs_read(const char *path, int *count) {
+    char *copy = strdup(path);
+    int cap = 8;
+    PathDir *dirs = malloc(cap * sizeof(PathDir));
+    *count = 0;
+    if (copy == NULL || dirs == NULL) {
+        free(copy);
+        free(dirs);
+        return NULL;
+    }
+
+    char *saveptr;
+    for (char *dir = strtok_r(copy, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        if (*count == cap) {
+            cap *= 2;
+            PathDir *grown = realloc(dirs, cap * sizeof(PathDir));
+            if (grown == NULL) {
+                break;
+            }
+            dirs = grown;
+        }
+
+        struct stat st;
+        PathDir *entry = &dirs[*count];
+        entry->path = strdup(dir);
+        entry->mtime.tv_sec = 0;
+        entry->mtime.tv_nsec = 0;
+        if (stat(dir, &st) == 0) {
+            entry->mtime = st.st_mtim;
+        }
+        (*count)++;
+    }
+
+    free(copy);
+    return dirs;
+}
+
+static void *path_scan_thread(void *arg) {
+    char *path = arg;
+    int count;
+    PathDir *dirs = path_dirs_read(path, &count);
+    Trie *trie = trie_new();
+
+    char full_path[MAX_PATH_LEN];
+    for (int i = 0; trie != NULL && dirs != NULL && i < count; i++) {
+        DIR *dir = opendir(dirs[i].path);
+        if (dir == NULL) {
+            continue;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            // Only stat what readdir cannot classify on its own
+            if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+                continue;
+            }
+            snprintf(full_path, sizeof(full_path), "%s/%s", dirs[i].path, entry->d_name);
+            if (access(full_path, X_OK) == 0) {
+                trie_insert(trie, entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+
+    pthread_mutex_lock(&path_lock);
+    if (trie != NULL) {
+        trie_free(path_trie);
+        path_trie = trie;
+        path_dirs_free(path_dirs, path_dir_count);
+        path_dirs = dirs;
+        path_dir_count = count;
+        free(path_value);
+        path_value = path;
+    } else {
+        path_dirs_free(dirs, count);
+        free(path);
+    }
+    path_building = 0;
+    pthread_mutex_unlock(&path_lock);
+    return NULL;
+}
+
+// Start a background rebuild. The caller must hold path_lock.
+static void path_scan_start(const char *path) {
+    if (path_building) {
+        return;
+    }
+
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, path_scan_thread, copy) == 0) {
+        path_building = 1;
+    } else {
+        free(copy);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Rebuild the trie if PATH or one of its directories changed.
+// Directories are stat()ed at most once per PATH_RECHECK_NS.
+static void path_refresh(void) {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "";
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&path_lock);
+    if (path_value == NULL || strcmp(path_value, path) != 0) {
+        path_scan_start(path);
+    } else {
+        long elapsed = (now.tv_sec - path_checked.tv_sec) * 1000000000L +
+                       (now.tv_nsec - path_checked.tv_nsec);
+        if (elapsed >= PATH_RECHECK_NS) {
+            path_checked = now;
+            for (int i = 0; i < path_dir_count; i++) {
+                struct stat st;
+                if (stat(path_dirs[i].path, &st) == 0 &&
+                    !timespec_equal(&st.st_mtim, &path_dirs[i].mtime)) {
+                    path_scan_start(path);
+                    break;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&path_lock);
+}
+
+// Kick off the first PATH scan in the background
+void completion_init(void) {
+    path_refresh();
+}
+
+// --- Directory cache ---
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void dir_cache_clear(DirCache *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->names[i]);
+    }
+    free(cache->names);
+    free(cache->is_dir);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static DirCache *dir_cache_get(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        DirCache *cache = &dir_cache[i];
+        if (cache->used && cache->dev == st.st_dev && cache->ino == st.st_ino) {
+            if (timespec_equal(&cache->mtime, &st.st_mtim)) {
+                return cache;
+            }
+            dir_cache_clear(cache);
+            break;
+        }
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    DirCache *cache = &dir_cache[dir_cache_next];
+    dir_cache_next = (dir_cache_next + 1) % DIR_CACHE_SIZE;
+    dir_cache_clear(cache);
+    cache->used = 1;
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->mtime = st.st_mtim;
+
+    int cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (cache->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **names = realloc(cache->names, cap * sizeof(char *));
+            if (names == NULL) {
+                break;
+            }
+            cache->names = names;
+        }
+        char *name = strdup(entry->d_name);
+        if (name == NULL) {
+            break;
+        }
+        cache->names[cache->count++] = name;
+    }
+    closedir(dir);
+
+    qsort(cache->names, cache->count, sizeof(char *), compare_names);
+
+    // Classify after sorting, so is_dir lines up with names
+    cache->is_dir = calloc(cache->count ? cache->count : 1, 1);
+    if (cache->is_dir == NULL) {
+        dir_cache_clear(cache);
+        return NULL;
+    }
+    char full_path[MAX_PATH_LEN];
+    for (int i = 0; i < cache->count; i++) {
+        snprintf(full_path, sizeof(full_path), "%s/%s", path, cache->names[i]);
+        cache->is_dir[i] = stat(full_path, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    return cache;
+}
+
+// --- Completion lists ---
+
+void completion_add(CompletionList *list, const char *text, int is_dir) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 32;
+        char **items = realloc(list->items, cap * sizeof(char *));
+        if (items == NULL) {
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+
+    size_t len = strlen(text);
+    char *item = malloc(len + 2);
+    if (item == NULL) {
+        return;
+    }
+    memcpy(item, text, len);
+    item[len] = is_dir ? '/' : '\0';
+    item[len + 1] = '\0';
+    list->items[list->count++] = item;
+}
+
+void completion_free(CompletionList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->cap = 0;
+}
+
+static void complete_command(const char *word, CompletionList *out) {
+    size_t len = strlen(word);
+    for (const BuiltinCommand *b = get_builtins(); b->name != NULL; b++) {
+        if (strncmp(b->name, word, len) == 0) {
+            completion_add(out, b->name, 0);
+        }
+    }
+
+    path_refresh();
+
+    pthread_mutex_lock(&path_lock);
+    if (path_trie != NULL) {
+        int node = trie_find(path_trie, word);
+        if (node != -1) {
+            char buf[MAX_PATH_LEN];
+            snprintf(buf, sizeof(buf), "%s", word);
+            trie_collect(path_trie, node, buf, strlen(buf), sizeof(buf), out);
+        }
+    }
+    pthread_mutex_unlock(&path_lock);
+}
+
+static void complete_file(const char *word, CompletionList *out) {
+    // Split "dir/base" into the directory to read and the name prefix
+    const char *slash = strrchr(word, '/');
+    char dir[MAX_PATH_LEN];
+    const char *base = word;
+    size_t dir_len = 0;
+
+    if (slash != NULL) {
+        dir_len = slash - word + 1;
+        if (dir_len >= sizeof(dir)) {
+            return;
+        }
+        memcpy(dir, word, dir_len);
+        dir[dir_len] = '\0';
+        base = slash + 1;
+    } else {
+        strcpy(dir, ".");
+    }
+
+    DirCache *cache = dir_cache_get(dir);
+    if (cache == NULL) {
+        return;
+    }
+
+    size_t base_len = strlen(base);
+    char candidate[MAX_PATH_LEN];
+    for (int i = 0; i < cache->count; i++) {
+        const char *name = cache->names[i];
+        // Hidden files only when asked for explicitly
+        if (name[0] == '.' && base[0] != '.') {
+            continue;
+        }
+        if (strncmp(name, base, base_len) == 0) {
+            snprintf(candidate, sizeof(candidate), "%.*s%s", (int)dir_len, word, name);
+            completion_add(out, candidate, cache->is_dir[i]);
+        }
+    }
+}
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Collect sorted, de-duplicated completions for word. A word in command
+// position completes against built-ins and PATH, anything else (or
+// anything containing '/') against file names.
+void complete_word(const char *word, int command_position, CompletionList *out) {
+    if (command_position && strchr(word, '/') == NULL) {
+        complete_command(word, out);
+    } else {
+        complete_file(word, out);
+    }
+
+    if (out->count > 1) {
+        qsort(out->items, out->count, sizeof(char *), compare_items);
+        int kept = 1;
+        for (int i = 1; i < out->count; i++) {
+            if (strcmp(out->items[i], out->items[kept - 1]) == 0) {
+                free(out->items[i]);
+            } else {
+                out->items[kept++] = out->items[i];
+            }
+        }
+        out->count = kept;
+    }
+}
@@ -0,0 +1,460 @@
+#include "../include/xhell.h"
+
+// History store
+//
+// Entries live in a fixed-capacity ring, so adding a command is O(1) even
+// when the ring is full. The strings themselves are carved out of large
+// arena chunks; since entries are evicted in the same order they were
+// added, a chunk can be released as soon as its last entry falls out of
+// the ring.
+// Every entry is also registered with the search index (history_index.c).
+//
+// The history file is kept open for the lifetime of the shell. Every
+// command is appended immediately under flock(), and anything other
+// sessions appended in the meantime is merged in from an mmap of the
+// file tail, so a crash never loses the session and concurrent shells
+// never clobber each other. Compaction writes the kept lines to a new
+// file and renames it over the old one; a session that finds the name
+// leads to another file once it holds the lock reads that one from the
+// start.
+//
+// Nothing is read at startup. Until something looks at the history, a
+// command is only appended to the file; the first lookup maps the file
+// and fills the ring, this session's commands included.
+
+#define HISTORY_CHUNK_SIZE (64 * 1024)
+
+typedef struct HistoryChunk {
+    struct HistoryChunk *next;
+    size_t size;
+    size_t used;
+    size_t live;            // entries still referencing this chunk
+    char data[];
+} HistoryChunk;
+
+typedef struct {
+    char *text;
+    HistoryChunk *chunk;
+    int slot;               // search index slot
+} HistoryEntry;
+
+static HistoryEntry *ring = NULL;
+static size_t ring_capacity = 0;
+static size_t ring_head = 0;        // index of the oldest entry
+static size_t ring_count = 0;
+static unsigned long ring_total = 0; // entries ever added
+
+static HistoryChunk *chunk_head = NULL;
+static HistoryChunk *chunk_tail = NULL;
+
+static int history_fd = -1;
+static off_t history_off = 0;       // bytes of the file already merged
+static int history_loaded = 0;      // the ring holds the file
+
+// Allocate the ring on first use
+static int history_init(void) {
+    if (ring != NULL) {
+        return 0;
+    }
+
+    ring_capacity = MAX_HISTORY;
+    char *env = getenv("XHELL_HISTSIZE");
+    if (env != NULL) {
+        long size = strtol(env, NULL, 10);
+        if (size > 0) {
+            ring_capacity = (size_t)size;
+        }
+    }
+
+    ring = calloc(ring_capacity, sizeof(HistoryEntry));
+    if (ring == NULL) {
+        perror("history");
+        ring_capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Copy a string into the arena
+static char *arena_store(const char *text, size_t len, HistoryChunk **owner) {
+    if (chunk_tail == NULL || chunk_tail->size - chunk_tail->used < len + 1) {
+        size_t size = len + 1 > HISTORY_CHUNK_SIZE ? len + 1 : HISTORY_CHUNK_SIZE;
+        HistoryChunk *chunk = malloc(sizeof(HistoryChunk) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->live = 0;
+
+        if (chunk_tail != NULL) {
+            chunk_tail->next = chunk;
+        } else {
+            chunk_head = chunk;
+        }
+        chunk_tail = chunk;
+    }
+
+    char *dst = chunk_tail->data + chunk_tail->used;
+    memcpy(dst, text, len);
+    dst[len] = '\0';
+    chunk_tail->used += len + 1;
+    chunk_tail->live++;
+    *owner = chunk_tail;
+    return dst;
+}
+
+// Drop the oldest entry and release arena chunks nobody references
+static void ring_evict(void) {
+    HistoryEntry *oldest = &ring[ring_head];
+    history_index_remove(oldest->slot);
+    oldest->chunk->live--;
+    oldest->text = NULL;
+    oldest->chunk = NULL;
+
+    ring_head = (ring_head + 1) % ring_capacity;
+    ring_count--;
+
+    while (chunk_head != NULL && chunk_head != chunk_tail && chunk_head->live == 0) {
+        HistoryChunk *next = chunk_head->next;
+        free(chunk_head);
+        chunk_head = next;
+    }
+}
+
+// Put a command into the ring without touching the history file
+static void ring_push(const char *command, size_t len) {
+    if (len == 0 || history_init() != 0) {
+        return;
+    }
+
+    if (ring_count == ring_capacity) {
+        ring_evict();
+    }
+
+    HistoryChunk *chunk;
+    char *text = arena_store(command, len, &chunk);
+    if (text == NULL) {
+        return;
+    }
+
+    HistoryEntry *slot = &ring[(ring_head + ring_count) % ring_capacity];
+    slot->text = text;
+    slot->chunk = chunk;
+    ring_count++;
+    ring_total++;
+    slot->slot = history_index_add(text, ring_total);
+}
+
+// Open the history file once, so later xcd calls do not move it
+static int history_open(void) {
+    if (history_fd != -1) {
+        return 0;
+    }
+
+    history_fd = openat(start_dir_fd(), HISTORY_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Forget what was merged, so the next merge reads the file from the start
+static void history_reset(void) {
+    while (ring_count > 0) {
+        ring_evict();
+    }
+    ring_total = 0;
+    history_off = 0;
+}
+
+// Is history_fd still the file the name leads to?
+static int history_current(void) {
+    struct stat held, named;
+    return fstat(history_fd, &held) == 0 &&
+           fstatat(start_dir_fd(), HISTORY_FILE, &named, 0) == 0 &&
+           held.st_dev == named.st_dev && held.st_ino == named.st_ino;
+}
+
+// flock() the history file. If another session compacted it into a new
+// file meanwhile, the lock is on the old one: move to the new file, to
+// be merged from the start, and lock that instead.
+static int history_lock(int operation) {
+    for (;;) {
+        flock(history_fd, operation);
+        if (history_current()) {
+            return 0;
+        }
+        flock(history_fd, LOCK_UN);
+        int fd = openat(start_dir_fd(), HISTORY_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            return -1;
+        }
+        close(history_fd);
+        history_fd = fd;
+        history_reset();
+    }
+}
+
+// Merge the lines in [history_off, size) into the ring. Only complete
+// lines are consumed, and at most ring_capacity of them are kept.
+// The caller must hold the file lock.
+static void history_merge(off_t size) {
+    if (size < history_off) {
+        // Cut short in place, which this version never does: start over
+        history_reset();
+    }
+    if (size == history_off || history_init() != 0) {
+        return;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    off_t map_off = history_off - (history_off % page);
+    size_t map_len = (size_t)(size - map_off);
+
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, history_fd, map_off);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const char *begin = map + (history_off - map_off);
+    const char *end = map + map_len;
+
+    // Ignore a trailing partial line
+    while (end > begin && end[-1] != '\n') {
+        end--;
+    }
+
+    // Walk back to the start of the last ring_capacity lines
+    const char *start = end;
+    size_t lines = 0;
+    while (start > begin && lines < ring_capacity) {
+        const char *p = start - 1;
+        while (p > begin && p[-1] != '\n') {
+            p--;
+        }
+        start = p;
+        lines++;
+    }
+
+    const char *line = start;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        ring_push(line, nl - line);
+        line = nl + 1;
+    }
+
+    history_off += end - begin;
+    munmap(map, map_len);
+}
+
+// Add command to history and append it to the history file
+void add_to_history(const char *command) {
+    size_t len = strlen(command);
+    if (len == 0) {
+        return;
+    }
+
+    if (history_open() != 0) {
+        ring_push(command, len);
+        return;
+    }
+
+    struct stat st;
+    if (history_lock(LOCK_EX) != 0 || fstat(history_fd, &st) != 0) {
+        flock(history_fd, LOCK_UN);
+        if (history_loaded) ring_push(command, len);
+        return;
+    }
+
+    // Terminate a partial line left behind by a crashed session
+    size_t lead;
+    if (history_loaded) {
+        // Pick up whatever other sessions wrote first, so ordering is kept
+        history_merge(st.st_size);
+        ring_push(command, len);
+        lead = history_off < st.st_size ? 1 : 0;
+    } else {
+        // Only appended; read back with the rest on first use
+        char last = '\n';
+        if (st.st_size > 0 && pread(history_fd, &last, 1, st.st_size - 1) != 1) {
+            last = '\n';
+        }
+        lead = last != '\n';
+    }
+    char *line = malloc(lead + len + 1);
+    if (line != NULL) {
+        line[0] = '\n';
+        memcpy(line + lead, command, len);
+        line[lead + len] = '\n';
+        // Writes only happen under the lock, so the end of file is stable
+        ssize_t total = (ssize_t)(lead + len + 1);
+        if (pwrite(history_fd, line, total, st.st_size) == total && history_loaded) {
+            history_off = st.st_size + total;
+        }
+        free(line);
+    }
+
+    flock(history_fd, LOCK_UN);
+}
+
+// Load history from file, merging entries added by other sessions
+void load_history(void) {
+    history_loaded = 1;
+    if (history_open() != 0) {
+        return;
+    }
+
+    // Nothing new: the same file, no longer than what was merged
+    struct stat st;
+    if (fstat(history_fd, &st) != 0 || (st.st_size == history_off && history_current())) {
+        return;
+    }
+
+    if (history_lock(LOCK_SH) == 0 && fstat(history_fd, &st) == 0) {
+        history_merge(st.st_size);
+    }
+    flock(history_fd, LOCK_UN);
+}
+
+// Compact the history file down to the last ring_capacity lines.
+// Commands are already on disk, so this only bounds the file size. The
+// lines kept go to a new file renamed over the old one, which tells the
+// other sessions to read it from the start.
+void save_history(void) {
+    if (history_fd == -1 || history_init() != 0) {
+        return;
+    }
+
+    struct stat st;
+    if (history_lock(LOCK_EX) != 0 || fstat(history_fd, &st) != 0 || st.st_size == 0) {
+        flock(history_fd, LOCK_UN);
+        return;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+    if (map == MAP_FAILED) {
+        flock(history_fd, LOCK_UN);
+        return;
+    }
+
+    // Find where the last ring_capacity lines start
+    size_t start = size;
+    size_t lines = 0;
+    while (start > 0 && lines < ring_capacity) {
+        size_t p = start - 1;
+        while (p > 0 && map[p - 1] != '\n') {
+            p--;
+        }
+        start = p;
+        lines++;
+    }
+
+    // Only rewrite once at least half of the file is stale
+    if (start > 0 && start >= size / 2) {
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "%s.%d", HISTORY_FILE, (int)getpid());
+        int fd = openat(start_dir_fd(), tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        size_t keep = size - start;
+        if (fd != -1) {
+            // Locked before it has the name, so nobody writes to it early
+            flock(fd, LOCK_EX);
+            if (write(fd, map + start, keep) == (ssize_t)keep &&
+                renameat(start_dir_fd(), tmp, start_dir_fd(), HISTORY_FILE) == 0) {
+                flock(history_fd, LOCK_UN);
+                close(history_fd);
+                history_fd = fd;
+                history_off = history_off > (off_t)start ? history_off - (off_t)start : 0;
+            } else {
+                unlinkat(start_dir_fd(), tmp, 0);
+                close(fd);
+            }
+        }
+    }
+
+    munmap(map, size);
+    flock(history_fd, LOCK_UN);
+}
+
+// Close the history file and forget the ring, so the next command opens
+// the file of whatever directory is then the start directory
+void history_close(void) {
+    if (history_fd != -1) {
+        close(history_fd);
+        history_fd = -1;
+    }
+    history_reset();
+    history_loaded = 0;
+    free(ring);
+    ring = NULL;
+    ring_capacity = 0;
+    ring_head = 0;
+    while (chunk_head != NULL) {
+        HistoryChunk *next = chunk_head->next;
+        free(chunk_head);
+        chunk_head = next;
+    }
+    chunk_tail = NULL;
+}
+
+// Number of entries currently in the ring
+int history_length(void) {
+    if (!history_loaded) load_history();
+    return (int)ring_count;
+}
+
+// Get an entry by position, 0 being the oldest
+const char *history_get(int index) {
+    if (!history_loaded) load_history();
+    if (index < 0 || (size_t)index >= ring_count) {
+        return NULL;
+    }
+    return ring[(ring_head + index) % ring_capacity].text;
+}
+
+// Sequence number (1-based) of the oldest entry in the ring
+unsigned long history_first_number(void) {
+    if (!history_loaded) load_history();
+    return ring_total - ring_count + 1;
+}
+
+// Expand a leading !!, !N or !prefix event designator of line into out.
+// Returns 1 if the line was expanded, 0 if it has no event designator,
+// and -1 if no history entry matches it.
+int history_expand(const char *line, char *out, size_t size) {
+    if (line[0] != '!' || line[1] == '\0' || line[1] == ' ' || line[1] == '\t') {
+        return 0;
+    }
+
+    size_t event_len = strcspn(line + 1, " \t");
+    char event[MAX_CMD_LEN];
+    if (event_len >= sizeof(event)) {
+        return -1;
+    }
+    memcpy(event, line + 1, event_len);
+    event[event_len] = '\0';
+
+    load_history();
+
+    const char *match = NULL;
+    if (strcmp(event, "!") == 0) {
+        match = history_get(history_length() - 1);
+    } else if (strspn(event, "0123456789") == event_len) {
+        unsigned long number = strtoul(event, NULL, 10);
+        unsigned long first = history_first_number();
+        if (number >= first) {
+            match = history_get((int)(number - first));
+        }
+    } else {
+        match = history_find_prefix(event);
+    }
+
+    if (match == NULL) {
+        return -1;
+    }
+
+    snprintf(out, size, "%s%s", match, line + 1 + event_len);
+    return 1;
+}
@@ -0,0 +1,382 @@
+#include "../include/xhell.h"
+
+// History search index
+//
+// Every distinct command in the history ring gets a slot that tracks how
+// often it occurs and when it was last used. Slots are found by text
+// through an open-addressing hash table, and by substring through a
+// trigram index: each trigram hashes to a bucket holding the slots whose
+// text contains it. A query only walks the smallest bucket among the
+// pattern's trigrams and verifies each candidate with strstr(), so its
+// cost depends on how selective the pattern is rather than on how long
+// the history is.
+//
+// Slots are recycled when their last occurrence leaves the ring. Postings
+// carry the slot generation, so stale ones are skipped during lookups and
+// dropped when the index is rebuilt once they outnumber live postings.
+
+#define TRIGRAM_BUCKETS 65536
+#define FRECENCY_HALF_LIFE 64.0
+
+typedef struct {
+    const char *text;       // newest occurrence, owned by the history arena
+    unsigned long last_seq;
+    unsigned int count;
+    unsigned int gen;
+    unsigned int hash;
+    unsigned int postings;
+} IndexSlot;
+
+typedef struct {
+    unsigned int slot;
+    unsigned int gen;
+} Posting;
+
+typedef struct {
+    Posting *items;
+    unsigned int len;
+    unsigned int cap;
+} PostingList;
+
+static IndexSlot *slots = NULL;
+static unsigned int slot_count = 0;     // slots ever handed out
+static unsigned int slot_cap = 0;
+static unsigned int *free_slots = NULL;
+static unsigned int free_count = 0;
+static unsigned int free_cap = 0;
+
+static int *table = NULL;               // text hash -> slot, -1 if empty
+static unsigned int table_size = 0;
+static unsigned int table_used = 0;
+
+static PostingList *buckets = NULL;
+static size_t live_postings = 0;
+static size_t total_postings = 0;
+
+static unsigned int hash_text(const char *text) {
+    unsigned int h = 2166136261u;
+    while (*text) {
+        h ^= (unsigned char)*text++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static unsigned int trigram_bucket(const char *p) {
+    unsigned int t = ((unsigned char)p[0] << 16) | ((unsigned char)p[1] << 8) | (unsigned char)p[2];
+    return (t * 2654435761u) >> 16;
+}
+
+static int table_grow(void) {
+    unsigned int new_size = table_size ? table_size * 2 : 1024;
+    int *new_table = malloc(new_size * sizeof(int));
+    if (new_table == NULL) {
+        return -1;
+    }
+    memset(new_table, -1, new_size * sizeof(int));
+
+    for (unsigned int i = 0; i < table_size; i++) {
+        if (table[i] >= 0) {
+            unsigned int pos = slots[table[i]].hash & (new_size - 1);
+            while (new_table[pos] >= 0) {
+                pos = (pos + 1) & (new_size - 1);
+            }
+            new_table[pos] = table[i];
+        }
+    }
+
+    free(table);
+    table = new_table;
+    table_size = new_size;
+    return 0;
+}
+
+// Find the table position holding text, or the empty position to put it in
+static unsigned int table_find(const char *text, unsigned int hash) {
+    unsigned int pos = hash & (table_size - 1);
+    while (table[pos] >= 0) {
+        IndexSlot *slot = &slots[table[pos]];
+        if (slot->hash == hash && strcmp(slot->text, text) == 0) {
+            break;
+        }
+        pos = (pos + 1) & (table_size - 1);
+    }
+    return pos;
+}
+
+// Backward-shift deletion keeps probe sequences intact without tombstones
+static void table_delete(unsigned int pos) {
+    unsigned int mask = table_size - 1;
+    unsigned int hole = pos;
+    unsigned int next = (pos + 1) & mask;
+
+    while (table[next] >= 0) {
+        unsigned int home = slots[table[next]].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table[hole] = table[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    table[hole] = -1;
+    table_used--;
+}
+
+static int posting_add(unsigned int bucket, unsigned int slot, unsigned int gen) {
+    PostingList *list = &buckets[bucket];
+
+    // Repeated trigrams of one text land next to each other
+    if (list->len > 0 && list->items[list->len - 1].slot == slot &&
+        list->items[list->len - 1].gen == gen) {
+        return 0;
+    }
+
+    if (list->len == list->cap) {
+        unsigned int cap = list->cap ? list->cap * 2 : 4;
+        Posting *items = realloc(list->items, cap * sizeof(Posting));
+        if (items == NULL) {
+            return 0;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+
+    list->items[list->len].slot = slot;
+    list->items[list->len].gen = gen;
+    list->len++;
+    live_postings++;
+    total_postings++;
+    return 1;
+}
+
+static void index_text(unsigned int slot) {
+    const char *text = slots[slot].text;
+    slots[slot].postings = 0;
+    for (size_t i = 0; text[i] && text[i + 1] && text[i + 2]; i++) {
+        slots[slot].postings += posting_add(trigram_bucket(text + i), slot, slots[slot].gen);
+    }
+}
+
+// Drop stale postings by re-indexing every live slot
+static void index_rebuild(void) {
+    for (unsigned int i = 0; i < TRIGRAM_BUCKETS; i++) {
+        buckets[i].len = 0;
+    }
+    live_postings = 0;
+    total_postings = 0;
+
+    for (unsigned int i = 0; i < slot_count; i++) {
+        if (slots[i].count > 0) {
+            index_text(i);
+        }
+    }
+}
+
+static int index_init(void) {
+    if (buckets != NULL) {
+        return 0;
+    }
+
+    buckets = calloc(TRIGRAM_BUCKETS, sizeof(PostingList));
+    if (buckets == NULL || table_grow() != 0) {
+        free(buckets);
+        buckets = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Record one more occurrence of text. Returns its slot, or -1 on failure.
+int history_index_add(const char *text, unsigned long seq) {
+    if (index_init() != 0) {
+        return -1;
+    }
+
+    if ((table_used + 1) * 4 > table_size * 3 && table_grow() != 0) {
+        return -1;
+    }
+
+    unsigned int hash = hash_text(text);
+    unsigned int pos = table_find(text, hash);
+
+    if (table[pos] >= 0) {
+        IndexSlot *slot = &slots[table[pos]];
+        slot->text = text;
+        slot->last_seq = seq;
+        slot->count++;
+        return table[pos];
+    }
+
+    unsigned int id;
+    if (free_count > 0) {
+        id = free_slots[--free_count];
+    } else {
+        if (slot_count == slot_cap) {
+            unsigned int cap = slot_cap ? slot_cap * 2 : 256;
+            IndexSlot *grown = realloc(slots, cap * sizeof(IndexSlot));
+            if (grown == NULL) {
+                return -1;
+            }
+            slots = grown;
+            slot_cap = cap;
+        }
+        id = slot_count++;
+        slots[id].gen = 0;
+    }
+
+    IndexSlot *slot = &slots[id];
+    slot->text = text;
+    slot->last_seq = seq;
+    slot->count = 1;
+    slot->hash = hash;
+
+    table[pos] = (int)id;
+    table_used++;
+    index_text(id);
+    return (int)id;
+}
+
+// Forget one occurrence of a slot, whose text is about to be released
+void history_index_remove(int id) {
+    if (id < 0 || (unsigned int)id >= slot_count) {
+        return;
+    }
+
+    IndexSlot *slot = &slots[id];
+    if (--slot->count > 0) {
+        return;
+    }
+
+    table_delete(table_find(slot->text, slot->hash));
+    live_postings -= slot->postings;
+    slot->text = NULL;
+    slot->gen++;
+
+    if (free_count == free_cap) {
+        unsigned int cap = free_cap ? free_cap * 2 : 256;
+        unsigned int *grown = realloc(free_slots, cap * sizeof(unsigned int));
+        if (grown == NULL) {
+            // The slot is simply never reused
+            return;
+        }
+        free_slots = grown;
+        free_cap = cap;
+    }
+    free_slots[free_count++] = id;
+
+    if (total_postings > 1024 && total_postings > live_postings * 2) {
+        index_rebuild();
+    }
+}
+
+// Frequency weighted by how recently the command was last used
+static double frecency(const IndexSlot *slot, unsigned long newest) {
+    double age = (double)(newest - slot->last_seq);
+    return slot->count / (1.0 + age / FRECENCY_HALF_LIFE);
+}
+
+static void consider(unsigned int id, const char *pattern, HistoryMatch *matches,
+                     double *scores, int *found, int max, unsigned long newest) {
+    IndexSlot *slot = &slots[id];
+    if (slot->count == 0 || strstr(slot->text, pattern) == NULL) {
+        return;
+    }
+
+    double score = frecency(slot, newest);
+    int n = *found;
+    if (n == max) {
+        if (score <= scores[max - 1]) {
+            return;
+        }
+        n--;
+    }
+
+    // Insertion into the small, sorted result array
+    int pos = n;
+    while (pos > 0 && scores[pos - 1] < score) {
+        scores[pos] = scores[pos - 1];
+        matches[pos] = matches[pos - 1];
+        pos--;
+    }
+    scores[pos] = score;
+    matches[pos].text = slot->text;
+    matches[pos].number = slot->last_seq;
+    matches[pos].count = slot->count;
+
+    if (*found < max) {
+        (*found)++;
+    }
+}
+
+// Find distinct commands containing pattern, best ranked first.
+// Returns the number of matches stored.
+int history_search(const char *pattern, HistoryMatch *matches, int max) {
+    load_history();
+
+    if (buckets == NULL || max <= 0) {
+        return 0;
+    }
+
+    double *scores = malloc(max * sizeof(double));
+    if (scores == NULL) {
+        return 0;
+    }
+
+    unsigned long newest = history_first_number() + history_length() - 1;
+    int found = 0;
+    size_t len = strlen(pattern);
+
+    if (len < 3) {
+        // Too short for a trigram, check every distinct command
+        for (unsigned int i = 0; i < slot_count; i++) {
+            consider(i, pattern, matches, scores, &found, max, newest);
+        }
+    } else {
+        // Walk the most selective bucket of the pattern
+        PostingList *best = NULL;
+        for (size_t i = 0; i + 2 < len; i++) {
+            PostingList *list = &buckets[trigram_bucket(pattern + i)];
+            if (best == NULL || list->len < best->len) {
+                best = list;
+            }
+        }
+
+        for (unsigned int i = 0; i < best->len; i++) {
+            Posting *p = &best->items[i];
+            if (slots[p->slot].gen == p->gen) {
+                consider(p->slot, pattern, matches, scores, &found, max, newest);
+            }
+        }
+    }
+
+    free(scores);
+    return found;
+}
+
+// Most recent command starting with prefix, for !prefix expansion
+const char *history_find_prefix(const char *prefix) {
+    load_history();
+
+    size_t len = strlen(prefix);
+    if (len < 3 || buckets == NULL) {
+        for (int i = history_length() - 1; i >= 0; i--) {
+            const char *text = history_get(i);
+            if (strncmp(text, prefix, len) == 0) {
+                return text;
+            }
+        }
+        return NULL;
+    }
+
+    PostingList *list = &buckets[trigram_bucket(prefix)];
+    IndexSlot *best = NULL;
+    for (unsigned int i = 0; i < list->len; i++) {
+        Posting *p = &list->items[i];
+        IndexSlot *slot = &slots[p->slot];
+        if (slot->gen == p->gen && strncmp(slot->text, prefix, len) == 0 &&
+            (best == NULL || slot->last_seq > best->last_seq)) {
+            best = slot;
+        }
+    }
+    return best ? best->text : NULL;
+}
@@ -0,0 +1,764 @@
+#include "../include/xhell.h"
+
+// xsh interpreter
+//
+// Runs a compiled program (see script.c) in the shell process. Variables,
+// tests, loops and function calls never fork; only commands that are not
+// built in start a child, exactly as they would at the prompt. Expanded
+// words live in a scratch list that is emptied after every command, while
+// literal words point straight into the program's string pool.
+//
+// Functions a script defines belong to its interpreter. Functions defined
+// on a line typed at the shell (script_run_line) are copied out of that
+// line's program, since it is freed afterwards, into a table that lasts
+// as long as the shell.
+
+#define MAX_CALL_DEPTH 200
+#define MAX_FOR_DEPTH 256
+#define MAX_FUNCS 128
+
+typedef struct {
+    WordList words;
+    int next;
+} ForLoop;
+
+typedef struct {
+    uint32_t ret;           // end of the body, where the call's run stops
+    int for_depth;          // for loops to drop on return
+    WordList argv;          // $0, $1, ... of the call
+    char **params;          // positional parameters, shift moves these
+    int old_argc;
+    char **old_argv;
+} CallFrame;
+
+// A function body copied out of its program, see script_extract
+typedef struct {
+    ScriptProgram prog;
+    int refs;               // the shell's table and the calls running it
+} FunctionCode;
+
+typedef struct {
+    const char *name;
+    ScriptProgram *prog;    // the program holding the body
+    uint32_t body;
+    uint32_t end;
+    FunctionCode *code;     // for shell functions, NULL otherwise
+} Function;
+
+// Shell functions, defined by earlier lines
+static Function shell_funcs[MAX_FUNCS];
+static int shell_func_count;
+
+struct Interp {
+    ScriptProgram *prog;    // the program running, a function's while it is called
+    int trace;
+    int keep_functions;     // definitions go to shell_funcs
+    int status;
+    int done;               // exit or top-level return
+    int exited;             // exit was called
+
+    Pipeline pipeline;
+    Command *cmd;
+    WordList scratch;       // expanded words of the command being built
+    int subst_base;         // substitutions opened before this interpreter
+
+    ForLoop loops[MAX_FOR_DEPTH];
+    int for_depth;
+    CallFrame frames[MAX_CALL_DEPTH];
+    int call_depth;
+    Function funcs[MAX_FUNCS];
+    int func_count;
+};
+
+// --- Shell builtins that must run in the shell itself ---
+
+static int test_unary(const char *op, const char *arg) {
+    struct stat st;
+    if (strcmp(op, "-n") == 0) return *arg != '\0';
+    if (strcmp(op, "-z") == 0) return *arg == '\0';
+    if (strcmp(op, "-e") == 0) return stat(arg, &st) == 0;
+    if (strcmp(op, "-f") == 0) return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+    if (strcmp(op, "-d") == 0) return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+    if (strcmp(op, "-s") == 0) return stat(arg, &st) == 0 && st.st_size > 0;
+    if (strcmp(op, "-r") == 0) return access(arg, R_OK) == 0;
+    if (strcmp(op, "-w") == 0) return access(arg, W_OK) == 0;
+    if (strcmp(op, "-x") == 0) return access(arg, X_OK) == 0;
+    return -1;
+}
+
+static int test_binary(const char *lhs, const char *op, const char *rhs) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(lhs, rhs) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(lhs, rhs) != 0;
+
+    long long a = strtoll(lhs, NULL, 10);
+    long long b = strtoll(rhs, NULL, 10);
+    if (strcmp(op, "-eq") == 0) return a == b;
+    if (strcmp(op, "-ne") == 0) return a != b;
+    if (strcmp(op, "-lt") == 0) return a < b;
+    if (strcmp(op, "-le") == 0) return a <= b;
+    if (strcmp(op, "-gt") == 0) return a > b;
+    if (strcmp(op, "-ge") == 0) return a >= b;
+    return -1;
+}
+
+// test EXPR / [ EXPR ]: 0 when true, 1 when false, 2 on bad usage
+static int builtin_test(int argc, char **argv) {
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    argv++;
+    argc--;
+    int negate = 0;
+    if (argc > 0 && strcmp(argv[0], "!") == 0) {
+        negate = 1;
+        argv++;
+        argc--;
+    }
+
+    int result;
+    switch (argc) {
+        case 0: result = 0; break;
+        case 1: result = *argv[0] != '\0'; break;
+        case 2: result = test_unary(argv[0], argv[1]); break;
+        case 3: result = test_binary(argv[0], argv[1], argv[2]); break;
+        default: result = -1; break;
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "test: bad expression\n");
+        return 2;
+    }
+    return (negate ? !result : result) ? 0 : 1;
+}
+
+static int builtin_export(int argc, char **argv) {
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!var_valid_name(argv[i], len)) {
+            fprintf(stderr, "export: %s: bad variable name\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        if (eq != NULL) {
+            *eq = '\0';
+            var_set(argv[i], eq + 1);
+        }
+        var_export(argv[i]);
+        if (eq != NULL) {
+            *eq = '=';
+        }
+    }
+    return status;
+}
+
+static int builtin_unset(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        var_unset(argv[i]);
+    }
+    return 0;
+}
+
+// Drop the first n positional parameters
+static int builtin_shift(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1;
+    int count = var_positional_count();
+    if (n < 0 || n > count - 1) {
+        fprintf(stderr, "shift: shift count out of range\n");
+        return 1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    // Keep $0 in place and slide the rest down
+    char **params = NULL;
+    var_set_positional(0, NULL, &count, &params);
+    memmove(params + 1, params + 1 + n, (count - 1 - n) * sizeof(char *));
+    var_set_positional(count - n, params, NULL, NULL);
+    return 0;
+}
+
+// --- Running ---
+
+static void reset_command(Interp *in) {
+    // Argument arrays are kept for the next command
+    for (int i = 0; i < in->pipeline.num_commands; i++) {
+        Command *cmd = &in->pipeline.commands[i];
+        char **args = cmd->args;
+        int args_cap = cmd->args_cap;
+        memset(cmd, 0, sizeof(Command));
+        cmd->args = args;
+        cmd->args_cap = args_cap;
+        if (args != NULL) args[0] = NULL;
+    }
+    in->pipeline.num_commands = 1;
+    in->cmd = &in->pipeline.commands[0];
+    wordlist_free(&in->scratch);
+    subst_release(in->subst_base);
+    glob_cache_clear();
+}
+
+static void add_arg(Interp *in, char *arg) {
+    Command *cmd = in->cmd;
+    if (cmd->argc + 1 >= cmd->args_cap) {
+        int cap = cmd->args_cap ? cmd->args_cap * 2 : 16;
+        char **args = realloc(cmd->args, cap * sizeof(char *));
+        if (args == NULL) {
+            fprintf(stderr, "xhell: too many arguments\n");
+            return;
+        }
+        cmd->args = args;
+        cmd->args_cap = cap;
+    }
+    cmd->args[cmd->argc++] = arg;
+    cmd->args[cmd->argc] = NULL;
+}
+
+static void set_status(Interp *in, int status) {
+    in->status = status & 0xff;
+    var_set_status(in->status);
+}
+
+// The interpreter running commands, for pipeline children
+static Interp *running;
+
+static Function *find_in(Function *funcs, int count, const char *name) {
+    for (int i = count - 1; i >= 0; i--) {
+        if (strcmp(funcs[i].name, name) == 0) {
+            return &funcs[i];
+        }
+    }
+    return NULL;
+}
+
+// The script's own functions first, then the shell's
+static Function *find_function(Interp *in, const char *name) {
+    Function *fn = in->func_count ? find_in(in->funcs, in->func_count, name) : NULL;
+    if (fn == NULL && shell_func_count > 0) {
+        fn = find_in(shell_funcs, shell_func_count, name);
+    }
+    return fn;
+}
+
+static void code_release(FunctionCode *code) {
+    if (code != NULL && --code->refs == 0) {
+        script_free(&code->prog);
+        free(code);
+    }
+}
+
+// OP_FUNC at pc: the body runs up to where the jump after it lands
+static void define_function(Interp *in, uint32_t pc) {
+    ScriptProgram *prog = in->prog;
+    const Instr *ins = &prog->code[pc];
+    Function def = {prog->strings + ins->a, prog, ins->b, prog->code[pc + 1].a, NULL};
+
+    if (!in->keep_functions) {
+        Function *fn = find_in(in->funcs, in->func_count, def.name);
+        if (fn == NULL && in->func_count < MAX_FUNCS) {
+            fn = &in->funcs[in->func_count++];
+        }
+        if (fn != NULL) {
+            *fn = def;
+        }
+        set_status(in, 0);
+        return;
+    }
+
+    Function *fn = find_in(shell_funcs, shell_func_count, def.name);
+    if (fn == NULL && shell_func_count == MAX_FUNCS) {
+        fprintf(stderr, "%s: too many functions\n", def.name);
+        set_status(in, 1);
+        return;
+    }
+
+    FunctionCode *code = calloc(1, sizeof(FunctionCode));
+    char *name = strdup(def.name);
+    if (code == NULL || name == NULL ||
+        script_extract(prog, def.body, def.end, &code->prog) != 0) {
+        free(code);
+        free(name);
+        fprintf(stderr, "%s: out of memory\n", def.name);
+        set_status(in, 1);
+        return;
+    }
+    code->refs = 1;
+
+    if (fn == NULL) {
+        fn = &shell_funcs[shell_func_count++];
+    } else {
+        free((char *)fn->name);
+        code_release(fn->code);
+    }
+    fn->name = name;
+    fn->prog = &code->prog;
+    fn->body = 0;
+    fn->end = code->prog.code_count;
+    fn->code = code;
+    set_status(in, 0);
+}
+
+static void drop_loops(Interp *in, int depth) {
+    while (in->for_depth > depth) {
+        wordlist_free(&in->loops[--in->for_depth].words);
+    }
+}
+
+// Return from the innermost function; returns the address to continue at
+static uint32_t return_from(Interp *in) {
+    CallFrame *frame = &in->frames[--in->call_depth];
+    drop_loops(in, frame->for_depth);
+    var_set_positional(frame->old_argc, frame->old_argv, NULL, NULL);
+    wordlist_free(&frame->argv);
+    free(frame->params);
+    return frame->ret;
+}
+
+// Run a function's body with cmd's words as its arguments. Returns the
+// status of the body, or of return.
+static int call_function(Interp *in, Function *found, Command *cmd) {
+    if (in->call_depth == MAX_CALL_DEPTH) {
+        fprintf(stderr, "%s: maximum function nesting exceeded\n", found->name);
+        return 1;
+    }
+
+    // The body may redefine the function; the call keeps what it started
+    Function fn = *found;
+    if (fn.code != NULL) {
+        fn.code->refs++;
+    }
+
+    // The call owns its arguments, the body starts a command of its own
+    int depth = in->call_depth;
+    CallFrame *frame = &in->frames[in->call_depth++];
+    memset(&frame->argv, 0, sizeof(frame->argv));
+    for (int i = 0; i < cmd->argc; i++) {
+        wordlist_add(&frame->argv, strdup(cmd->args[i]));
+    }
+    frame->params = malloc((frame->argv.count + 1) * sizeof(char *));
+    if (frame->params != NULL) {
+        memcpy(frame->params, frame->argv.items, (frame->argv.count + 1) * sizeof(char *));
+    }
+    frame->ret = fn.end;
+    frame->for_depth = in->for_depth;
+    var_set_positional(frame->params ? frame->argv.count : 0, frame->params,
+                       &frame->old_argc, &frame->old_argv);
+    reset_command(in);
+
+    // return jumps to the end of the body, exit leaves the frame behind
+    ScriptProgram *caller = in->prog;
+    in->prog = fn.prog;
+    interp_run(in, fn.body, fn.end);
+    in->prog = caller;
+    while (in->call_depth > depth) {
+        return_from(in);
+    }
+
+    code_release(fn.code);
+    return in->status;
+}
+
+// Run cmd in a pipeline child when it names a function. Returns its
+// status, or -1 when there is no such function.
+int interp_call(Command *cmd) {
+    Function *fn = running != NULL && cmd->argc > 0 ? find_function(running, cmd->args[0]) : NULL;
+    if (fn == NULL) {
+        return -1;
+    }
+    int status = call_function(running, fn, cmd);
+    fflush(stdout);
+    return status;
+}
+
+// Run the assembled command. Returns the next pc.
+static uint32_t exec_command(Interp *in, uint32_t pc) {
+    Pipeline *pipeline = &in->pipeline;
+    Command *first = &pipeline->commands[0];
+    uint32_t next_pc = pc + 1;
+    int status = 0;
+
+    if (in->trace) {
+        fprintf(stderr, "+");
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            Command *cmd = &pipeline->commands[i];
+            for (int j = 0; j < cmd->argc; j++) {
+                fprintf(stderr, " %s", cmd->args[j]);
+            }
+            if (i + 1 < pipeline->num_commands) {
+                fprintf(stderr, " |");
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (pipeline->num_commands == 1 && first->argc == 0) {
+        // Redirections alone: open the files and close them again
+        FdPlan plan;
+        status = redir_plan(first, &plan, 0) == 0 ? 0 : 1;
+        redir_plan_free(&plan);
+    } else if (pipeline->num_commands == 1) {
+        const char *name = first->args[0];
+        Function *fn = find_function(in, name);
+
+        if (fn != NULL) {
+            // Redirected in the shell itself, as builtins are
+            FdPlan plan;
+            if (redir_plan(first, &plan, 0) != 0) {
+                status = 1;
+            } else if (redir_push(&plan) != 0) {
+                status = 1;
+                redir_plan_free(&plan);
+            } else {
+                status = call_function(in, fn, first);
+                fflush(stdout);
+                redir_pop(&plan);
+                redir_plan_free(&plan);
+            }
+        } else if (strcmp(name, "test") == 0 || strcmp(name, "[") == 0) {
+            status = builtin_test(first->argc, first->args);
+        } else if (strcmp(name, "true") == 0 || strcmp(name, ":") == 0) {
+            status = 0;
+        } else if (strcmp(name, "false") == 0) {
+            status = 1;
+        } else if (strcmp(name, "export") == 0) {
+            status = builtin_export(first->argc, first->args);
+        } else if (strcmp(name, "unset") == 0) {
+            status = builtin_unset(first->argc, first->args);
+        } else if (strcmp(name, "shift") == 0) {
+            status = builtin_shift(first->argc, first->args);
+        } else if (strcmp(name, "return") == 0 || strcmp(name, "exit") == 0) {
+            status = first->argc > 1 ? atoi(first->args[1]) : in->status;
+            if (name[0] == 'r' && in->call_depth > 0) {
+                next_pc = return_from(in);
+            } else {
+                in->done = 1;
+                in->exited = name[0] == 'e';
+            }
+        } else {
+            status = execute_pipeline(pipeline);
+            fflush(stdout);
+        }
+    } else {
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            if (pipeline->commands[i].argc == 0) {
+                fprintf(stderr, "xsh: line %u: empty command in pipeline\n", in->prog->code[pc].line);
+                status = 2;
+                break;
+            }
+        }
+        if (status == 0) {
+            status = execute_pipeline(pipeline);
+            fflush(stdout);
+        }
+    }
+
+    set_status(in, status);
+    reset_command(in);
+    return next_pc;
+}
+
+// Expand a word into the current command's arguments
+static int expand_into(Interp *in, const char *raw, int flags) {
+    int from = in->scratch.count;
+    if ((flags & EXPAND_GLOB) && in->cmd->argc > 0 && strpbrk(raw, "*?[") != NULL) {
+        const BuiltinCommand *builtin = find_builtin(in->cmd->args[0]);
+        if (builtin != NULL && (builtin->flags & BUILTIN_NOGLOB)) {
+            flags &= ~EXPAND_GLOB;
+        }
+    }
+
+    if (expand_word(raw, flags, &in->scratch) != 0) {
+        return -1;
+    }
+
+    // Remember the longest expansion, it is what batching splits up
+    Command *cmd = in->cmd;
+    int first = cmd->argc;
+    for (int i = from; i < in->scratch.count; i++) {
+        add_arg(in, in->scratch.items[i]);
+    }
+    if (cmd->argc - first > cmd->batch_count) {
+        cmd->batch_from = first;
+        cmd->batch_count = cmd->argc - first;
+    }
+    return 0;
+}
+
+static int redirect(Interp *in, const char *file, uint32_t op) {
+    Command *cmd = in->cmd;
+    int kind = op & 0xff;
+    int fd = op >> REDIR_FD_SHIFT;
+    const char *target = file;
+
+    if (cmd->redir_count == MAX_REDIRS) {
+        fprintf(stderr, "xhell: too many redirections\n");
+        return -1;
+    }
+
+    if (kind == REDIR_HEREDOC) {
+        // The body goes to a memory file that fd is redirected from
+        char *body = op & REDIR_EXPAND ? expand_heredoc(file) : (char *)file;
+        if (body == NULL) {
+            return -1;
+        }
+        char *path = here_document(body, strlen(body));
+        if (body != file) free(body);
+        if (path == NULL) {
+            return -1;
+        }
+        wordlist_add(&in->scratch, path);
+        target = path;
+        kind = REDIR_IN;
+    } else if (op & REDIR_EXPAND) {
+        int from = in->scratch.count;
+        if (expand_word(file, 0, &in->scratch) != 0 || in->scratch.count != from + 1) {
+            return -1;
+        }
+        target = in->scratch.items[from];
+    }
+
+    if (kind == REDIR_HERESTRING) {
+        // The word plus a newline, like a one-line here-document
+        size_t len = strlen(target);
+        char *text = malloc(len + 2);
+        if (text == NULL) {
+            return -1;
+        }
+        memcpy(text, target, len);
+        text[len] = '\n';
+        text[len + 1] = '\0';
+        char *path = here_document(text, len + 1);
+        free(text);
+        if (path == NULL) {
+            return -1;
+        }
+        wordlist_add(&in->scratch, path);
+        target = path;
+        kind = REDIR_IN;
+    }
+
+    Redirect *r = &cmd->redirs[cmd->redir_count++];
+    r->kind = kind;
+    r->fd = fd;
+    r->target = target;
+    return 0;
+}
+
+// NAME=value; $? becomes 0, or the status of a $(command) in the value
+static int assign(Interp *in, const char *name, const char *raw) {
+    WordList value = {0};
+    if (!word_needs_expansion(raw)) {
+        var_set(name, raw);
+        set_status(in, 0);
+    } else {
+        var_set_status(0);
+        if (expand_word(raw, 0, &value) != 0) {
+            return -1;
+        }
+        var_set(name, value.count ? value.items[0] : "");
+        wordlist_free(&value);
+        set_status(in, var_get_status());
+    }
+    if (in->trace) {
+        fprintf(stderr, "+ %s=%s\n", name, var_get(name));
+    }
+    return 0;
+}
+
+// Start a for loop over the words assembled so far
+static void for_init(Interp *in, int positional) {
+    if (in->for_depth == MAX_FOR_DEPTH) {
+        fprintf(stderr, "xsh: for loops nested too deeply\n");
+        in->done = 1;
+        set_status(in, 2);
+        return;
+    }
+
+    ForLoop *loop = &in->loops[in->for_depth++];
+    memset(loop, 0, sizeof(*loop));
+    if (positional) {
+        int count = var_positional_count();
+        for (int i = 1; i < count; i++) {
+            wordlist_add(&loop->words, strdup(var_get_positional(i)));
+        }
+    } else {
+        for (int i = 0; i < in->cmd->argc; i++) {
+            wordlist_add(&loop->words, strdup(in->cmd->args[i]));
+        }
+    }
+    reset_command(in);
+}
+
+Interp *interp_new(ScriptProgram *prog, int trace) {
+    Interp *in = calloc(1, sizeof(Interp));
+    if (in == NULL) {
+        return NULL;
+    }
+    in->prog = prog;
+    in->trace = trace;
+    in->status = var_get_status();
+    in->pipeline.num_commands = 1;
+    in->cmd = &in->pipeline.commands[0];
+    in->subst_base = subst_mark();
+    return in;
+}
+
+// Execute instructions from start until control reaches end, or the
+// program exits. Returns the status of the last command.
+int interp_run(Interp *in, uint32_t start, uint32_t end) {
+    ScriptProgram *prog = in->prog;
+    const char *s = prog->strings;
+    uint32_t pc = start;
+    Interp *outer = running;
+    running = in;
+
+    if (end > prog->code_count) {
+        end = prog->code_count;
+    }
+
+    while (pc < end && !in->done) {
+        Instr *ins = &prog->code[pc];
+        uint32_t next_pc = pc + 1;
+
+        switch (ins->op) {
+            case OP_FAIL:
+                fprintf(stderr, "%s\n", s + ins->a);
+                set_status(in, 2);
+                in->done = 1;
+                break;
+            case OP_ARG:
+                add_arg(in, (char *)s + ins->a);
+                break;
+            case OP_WORD:
+                if (expand_into(in, s + ins->a, ins->b) != 0) {
+                    // A failed expansion ends the script, as in sh
+                    set_status(in, 1);
+                    in->done = 1;
+                }
+                break;
+            case OP_REDIR:
+                if (redirect(in, s + ins->a, ins->b) != 0) {
+                    set_status(in, 1);
+                    in->done = 1;
+                }
+                break;
+            case OP_PIPE:
+                if (in->pipeline.num_commands < MAX_ARGS) {
+                    in->cmd = &in->pipeline.commands[in->pipeline.num_commands++];
+                }
+                break;
+            case OP_EXEC:
+                next_pc = exec_command(in, pc);
+                break;
+            case OP_SET:
+                if (assign(in, s + ins->a, s + ins->b) != 0) {
+                    set_status(in, 1);
+                    in->done = 1;
+                }
+                break;
+            case OP_JUMP:
+                next_pc = ins->a;
+                break;
+            case OP_JUMP_IF_FAIL:
+                if (in->status != 0) next_pc = ins->a;
+                break;
+            case OP_JUMP_IF_OK:
+                if (in->status == 0) next_pc = ins->a;
+                break;
+            case OP_STATUS:
+                set_status(in, ins->a);
+                break;
+            case OP_NOT:
+                set_status(in, in->status == 0);
+                break;
+            case OP_FOR_INIT:
+                for_init(in, ins->b);
+                break;
+            case OP_FOR_NEXT: {
+                ForLoop *loop = &in->loops[in->for_depth - 1];
+                if (loop->next < loop->words.count) {
+                    var_set(s + ins->b, loop->words.items[loop->next++]);
+                } else {
+                    next_pc = ins->a;
+                }
+                break;
+            }
+            case OP_FOR_END:
+                drop_loops(in, in->for_depth - 1);
+                break;
+            case OP_FUNC:
+                define_function(in, pc);
+                break;
+            case OP_RETURN:
+                if (in->call_depth > 0) {
+                    next_pc = return_from(in);
+                }
+                break;
+            case OP_TASK:
+                // Only a boundary for xsh -j
+                break;
+        }
+        pc = next_pc;
+    }
+
+    running = outer;
+    return in->status;
+}
+
+// Did the program call exit?
+int interp_exited(Interp *in) {
+    return in->exited;
+}
+
+void interp_free(Interp *in) {
+    while (in->call_depth > 0) {
+        return_from(in);
+    }
+    drop_loops(in, 0);
+    reset_command(in);
+    for (int i = 0; i < MAX_ARGS; i++) {
+        free(in->pipeline.commands[i].args);
+    }
+    free(in);
+}
+
+// Run a compiled program. Returns the status of the last command; when
+// exited is given, it is set if the program called exit.
+int script_run(ScriptProgram *prog, int trace, int *exited) {
+    Interp *in = interp_new(prog, trace);
+    if (in == NULL) {
+        return -1;
+    }
+
+    int status = interp_run(in, 0, prog->code_count);
+    if (exited != NULL) {
+        *exited = interp_exited(in);
+    }
+    interp_free(in);
+    return status;
+}
+
+// Run a line typed at the shell: like script_run, but the functions it
+// defines are kept for the lines after it
+int script_run_line(ScriptProgram *prog, int *exited) {
+    Interp *in = interp_new(prog, 0);
+    if (in == NULL) {
+        return -1;
+    }
+
+    in->keep_functions = 1;
+    int status = interp_run(in, 0, prog->code_count);
+    if (exited != NULL) {
+        *exited = interp_exited(in);
+    }
+    interp_free(in);
+    return status;
+}
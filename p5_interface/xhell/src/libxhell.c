@@ -0,0 +1,129 @@
+#include "../include/xhell.h"
+#include "../include/libxhell.h"
+
+// The embedding API of libxhell.h, on top of run_line and Capture
+
+struct XhellSession {
+    Capture cap;
+    int dir;                // where lines run
+};
+
+static XhellSession *live_session = NULL;
+static char *session_argv[] = {"xhell", NULL};
+
+XhellSession *xhell_session_new(const char *dir) {
+    if (live_session != NULL) {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    XhellSession *session = malloc(sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    session->dir = open(dir != NULL ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (session->dir == -1 || capture_open(&session->cap) != 0) {
+        int saved = errno;
+        if (session->dir != -1) close(session->dir);
+        free(session);
+        errno = saved;
+        return NULL;
+    }
+
+    shell_embedded = 1;
+    var_set_positional(1, session_argv, NULL, NULL);
+    live_session = session;
+    return session;
+}
+
+// Move into the session's directory; returns the caller's, to go back to
+static int enter_dir(XhellSession *session) {
+    int caller = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (caller == -1 || fchdir(session->dir) != 0) {
+        int saved = errno;
+        if (caller != -1) close(caller);
+        errno = saved;
+        return -1;
+    }
+    return caller;
+}
+
+static void leave_dir(int caller) {
+    if (fchdir(caller) != 0) {
+        perror("xhell: fchdir");
+    }
+    close(caller);
+}
+
+int xhell_exec(XhellSession *session, const char *line, XhellResult *result) {
+    memset(result, 0, sizeof(*result));
+
+    // Room left for a !! expansion
+    size_t len = strlen(line);
+    char *text = malloc(len + MAX_CMD_LEN);
+    if (text == NULL) {
+        return -1;
+    }
+    memcpy(text, line, len + 1);
+
+    int caller = enter_dir(session);
+    if (caller == -1) {
+        free(text);
+        return -1;
+    }
+    if (capture_start(&session->cap) != 0) {
+        int saved = errno;
+        leave_dir(caller);
+        free(text);
+        errno = saved;
+        return -1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result->status = run_line(text, &result->exited);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    capture_stop(&session->cap);
+    leave_dir(caller);
+    free(text);
+
+    result->duration = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    result->out = capture_read(session->cap.out, &result->out_len);
+    result->err = capture_read(session->cap.err, &result->err_len);
+    if (result->out == NULL || result->err == NULL) {
+        xhell_result_free(result);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void xhell_result_free(XhellResult *result) {
+    free(result->out);
+    free(result->err);
+    result->out = result->err = NULL;
+    result->out_len = result->err_len = 0;
+}
+
+void xhell_session_free(XhellSession *session) {
+    if (session == NULL) {
+        return;
+    }
+    // The history file is found relative to the session's directory
+    int caller = enter_dir(session);
+    save_history();
+    if (caller != -1) {
+        leave_dir(caller);
+    }
+
+    // The next session's files are in its own directory
+    history_close();
+    log_close();
+    start_dir_unpin();
+    capture_close(&session->cap);
+    close(session->dir);
+    free(session);
+    live_session = NULL;
+    shell_embedded = 0;
+}
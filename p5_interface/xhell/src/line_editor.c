@@ -0,0 +1,435 @@
+#include "../include/xhell.h"
+#include <termios.h>
+#include <sys/ioctl.h>
+
+// Line editor
+//
+// When stdin is a terminal, input is read in raw mode and edited in place:
+// cursor movement, kill/yank, history navigation, reverse-incremental
+// history search (Ctrl-R) and tab completion. Otherwise lines are read
+// with plain fgets() so piped input behaves exactly as before.
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+#define COMPLETION_LIST_MAX 100
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t pos;
+    const char *prompt;
+    size_t prompt_len;
+    int history_index;      // history_length() when editing a new line
+} EditState;
+
+static struct termios saved_termios;
+static int raw_enabled = 0;
+static int editor_ready = 0;
+static char kill_buf[MAX_CMD_LEN];
+static char scratch_line[MAX_CMD_LEN];     // the new line while browsing history
+
+static void disable_raw_mode(void) {
+    if (raw_enabled) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        raw_enabled = 0;
+    }
+}
+
+static int enable_raw_mode(void) {
+    if (!editor_ready) {
+        if (tcgetattr(STDIN_FILENO, &saved_termios) == -1) {
+            return -1;
+        }
+        atexit(disable_raw_mode);
+        completion_init();
+        editor_ready = 1;
+    }
+
+    struct termios raw = saved_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+        return -1;
+    }
+    raw_enabled = 1;
+    return 0;
+}
+
+static size_t terminal_columns(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return 80;
+    }
+    return ws.ws_col;
+}
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Redraw prompt and buffer on the current row, scrolling horizontally
+// when the line is wider than the terminal
+static void refresh_line(EditState *st) {
+    size_t cols = terminal_columns();
+    const char *text = st->buf;
+    size_t len = st->len;
+    size_t pos = st->pos;
+
+    while (st->prompt_len + pos >= cols && len > 0) {
+        text++;
+        len--;
+        pos--;
+    }
+    while (st->prompt_len + len > cols) {
+        len--;
+    }
+
+    char out[MAX_CMD_LEN * 2 + 64];
+    int n = snprintf(out, sizeof(out), "\r%s%.*s\x1b[0K\r", st->prompt, (int)len, text);
+    if (n < 0 || (size_t)n >= sizeof(out)) {
+        return;
+    }
+    if (st->prompt_len + pos > 0) {
+        n += snprintf(out + n, sizeof(out) - n, "\x1b[%zuC", st->prompt_len + pos);
+    }
+    write_all(out, n);
+}
+
+static void insert_text(EditState *st, const char *text, size_t n) {
+    if (st->len + n >= st->size) {
+        n = st->size - 1 - st->len;
+    }
+    memmove(st->buf + st->pos + n, st->buf + st->pos, st->len - st->pos);
+    memcpy(st->buf + st->pos, text, n);
+    st->len += n;
+    st->pos += n;
+    st->buf[st->len] = '\0';
+}
+
+// Remove [from, to) and remember it for yanking
+static void kill_range(EditState *st, size_t from, size_t to) {
+    if (to <= from) {
+        return;
+    }
+    size_t n = to - from;
+    if (n >= sizeof(kill_buf)) {
+        n = sizeof(kill_buf) - 1;
+    }
+    memcpy(kill_buf, st->buf + from, n);
+    kill_buf[n] = '\0';
+
+    memmove(st->buf + from, st->buf + to, st->len - to);
+    st->len -= to - from;
+    st->buf[st->len] = '\0';
+    st->pos = from;
+}
+
+static size_t word_start(EditState *st, size_t pos) {
+    while (pos > 0 && st->buf[pos - 1] == ' ') pos--;
+    while (pos > 0 && st->buf[pos - 1] != ' ') pos--;
+    return pos;
+}
+
+static size_t word_end(EditState *st, size_t pos) {
+    while (pos < st->len && st->buf[pos] == ' ') pos++;
+    while (pos < st->len && st->buf[pos] != ' ') pos++;
+    return pos;
+}
+
+static void set_line(EditState *st, const char *text) {
+    snprintf(st->buf, st->size, "%s", text);
+    st->len = strlen(st->buf);
+    st->pos = st->len;
+}
+
+// Move through history; direction -1 is older, +1 is newer
+static void history_move(EditState *st, int direction) {
+    int count = history_length();
+    int target = st->history_index + direction;
+    if (target < 0 || target > count) {
+        return;
+    }
+
+    if (st->history_index == count) {
+        snprintf(scratch_line, sizeof(scratch_line), "%s", st->buf);
+    }
+    st->history_index = target;
+    set_line(st, target == count ? scratch_line : history_get(target));
+    refresh_line(st);
+}
+
+static void complete_line(EditState *st, int listed) {
+    // The word under the cursor, and whether it is in command position
+    size_t start = st->pos;
+    while (start > 0 && st->buf[start - 1] != ' ') {
+        start--;
+    }
+    size_t before = start;
+    while (before > 0 && st->buf[before - 1] == ' ') {
+        before--;
+    }
+    int command_position = before == 0 || st->buf[before - 1] == '|';
+
+    char word[MAX_CMD_LEN];
+    snprintf(word, sizeof(word), "%.*s", (int)(st->pos - start), st->buf + start);
+
+    CompletionList list = {0};
+    complete_word(word, command_position, &list);
+    if (list.count == 0) {
+        write_all("\x07", 1);
+        completion_free(&list);
+        return;
+    }
+
+    // Extend the word by the longest common prefix of all candidates
+    size_t common = strlen(list.items[0]);
+    for (int i = 1; i < list.count; i++) {
+        size_t j = 0;
+        while (j < common && list.items[i][j] == list.items[0][j]) j++;
+        common = j;
+    }
+
+    size_t word_len = strlen(word);
+    if (list.count == 1) {
+        insert_text(st, list.items[0] + word_len, common - word_len);
+        if (common == 0 || list.items[0][common - 1] != '/') {
+            insert_text(st, " ", 1);
+        }
+    } else if (common > word_len) {
+        insert_text(st, list.items[0] + word_len, common - word_len);
+    } else if (list.count > 1 && listed) {
+        // Second Tab without progress: show the candidates
+        write_all("\r\n", 2);
+        int shown = list.count < COMPLETION_LIST_MAX ? list.count : COMPLETION_LIST_MAX;
+        for (int i = 0; i < shown; i++) {
+            write_all(list.items[i], strlen(list.items[i]));
+            write_all(i + 1 < shown ? "  " : "\r\n", 2);
+        }
+        if (shown < list.count) {
+            char more[64];
+            int n = snprintf(more, sizeof(more), "... %d more\r\n", list.count - shown);
+            write_all(more, n);
+        }
+    } else {
+        write_all("\x07", 1);
+    }
+
+    completion_free(&list);
+    refresh_line(st);
+}
+
+static void draw_search(const char *pattern, const char *match) {
+    char out[MAX_CMD_LEN * 2 + 64];
+    int n = snprintf(out, sizeof(out), "\r(reverse-i-search)`%s': %s\x1b[0K",
+                     pattern, match ? match : "");
+    if (n > 0) {
+        write_all(out, (size_t)n < sizeof(out) ? (size_t)n : sizeof(out) - 1);
+    }
+}
+
+// Ctrl-R: ranked reverse-incremental search. Returns the key that ended
+// the search so the caller can act on it, or 0 if it was consumed.
+static int reverse_search(EditState *st) {
+    char pattern[MAX_CMD_LEN] = "";
+    size_t plen = 0;
+    HistoryMatch matches[HISTORY_SEARCH_MAX];
+    int found = 0;
+    int current = 0;
+
+    draw_search(pattern, NULL);
+
+    while (1) {
+        char c;
+        if (read(STDIN_FILENO, &c, 1) <= 0) {
+            return 0;
+        }
+
+        if (c == KEY_CTRL('r')) {
+            if (found > 0) {
+                current = (current + 1) % found;
+            }
+        } else if (c == KEY_BACKSPACE || c == KEY_CTRL('h')) {
+            if (plen > 0) {
+                pattern[--plen] = '\0';
+                found = plen ? history_search(pattern, matches, HISTORY_SEARCH_MAX) : 0;
+                current = 0;
+            }
+        } else if (c == KEY_CTRL('g')) {
+            refresh_line(st);
+            return 0;
+        } else if ((unsigned char)c >= 32 && plen + 1 < sizeof(pattern)) {
+            pattern[plen++] = c;
+            pattern[plen] = '\0';
+            found = history_search(pattern, matches, HISTORY_SEARCH_MAX);
+            current = 0;
+        } else {
+            // Any other key accepts the match and is then handled normally
+            if (found > 0) {
+                set_line(st, matches[current].text);
+            }
+            refresh_line(st);
+            return c;
+        }
+
+        draw_search(pattern, found > 0 ? matches[current].text : NULL);
+    }
+}
+
+// Handle the rest of an escape sequence
+static void handle_escape(EditState *st) {
+    char seq[3];
+    if (read(STDIN_FILENO, &seq[0], 1) <= 0) return;
+
+    if (seq[0] == 'b') { st->pos = word_start(st, st->pos); refresh_line(st); return; }
+    if (seq[0] == 'f') { st->pos = word_end(st, st->pos); refresh_line(st); return; }
+    if (seq[0] == 'd') { kill_range(st, st->pos, word_end(st, st->pos)); refresh_line(st); return; }
+
+    if (read(STDIN_FILENO, &seq[1], 1) <= 0) return;
+
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, &seq[2], 1) <= 0 || seq[2] != '~') return;
+        switch (seq[1]) {
+            case '1': case '7': st->pos = 0; break;
+            case '4': case '8': st->pos = st->len; break;
+            case '3':
+                if (st->pos < st->len) {
+                    memmove(st->buf + st->pos, st->buf + st->pos + 1, st->len - st->pos);
+                    st->len--;
+                }
+                break;
+            default: return;
+        }
+        refresh_line(st);
+        return;
+    }
+
+    if (seq[0] == '[' || seq[0] == 'O') {
+        switch (seq[1]) {
+            case 'A': history_move(st, -1); return;
+            case 'B': history_move(st, 1); return;
+            case 'C': if (st->pos < st->len) st->pos++; break;
+            case 'D': if (st->pos > 0) st->pos--; break;
+            case 'H': st->pos = 0; break;
+            case 'F': st->pos = st->len; break;
+            default: return;
+        }
+        refresh_line(st);
+    }
+}
+
+// Edit one line in raw mode. Returns the length, or -1 on EOF.
+static int edit_line(char *buf, size_t size, const char *prompt) {
+    EditState st = {
+        .buf = buf, .size = size, .len = 0, .pos = 0,
+        .prompt = prompt, .prompt_len = strlen(prompt),
+        .history_index = history_length(),
+    };
+    buf[0] = '\0';
+    scratch_line[0] = '\0';
+    int last_was_tab = 0;
+
+    write_all(prompt, st.prompt_len);
+
+    while (1) {
+        char c;
+        if (read(STDIN_FILENO, &c, 1) <= 0) {
+            return st.len > 0 ? (int)st.len : -1;
+        }
+
+        if (c == KEY_CTRL('r')) {
+            c = reverse_search(&st);
+            if (c == 0) {
+                continue;
+            }
+        }
+
+        int is_tab = c == '\t';
+        switch (c) {
+            case '\r':
+            case '\n':
+                write_all("\r\n", 2);
+                return (int)st.len;
+            case '\t':
+                complete_line(&st, last_was_tab);
+                break;
+            case KEY_CTRL('c'):
+                write_all("^C\r\n", 4);
+                st.len = st.pos = 0;
+                buf[0] = '\0';
+                st.history_index = history_length();
+                write_all(prompt, st.prompt_len);
+                break;
+            case KEY_CTRL('d'):
+                if (st.len == 0) {
+                    write_all("\r\n", 2);
+                    return -1;
+                }
+                if (st.pos < st.len) {
+                    memmove(buf + st.pos, buf + st.pos + 1, st.len - st.pos);
+                    st.len--;
+                    refresh_line(&st);
+                }
+                break;
+            case KEY_BACKSPACE:
+            case KEY_CTRL('h'):
+                if (st.pos > 0) {
+                    memmove(buf + st.pos - 1, buf + st.pos, st.len - st.pos + 1);
+                    st.pos--;
+                    st.len--;
+                    refresh_line(&st);
+                }
+                break;
+            case KEY_CTRL('a'): st.pos = 0; refresh_line(&st); break;
+            case KEY_CTRL('e'): st.pos = st.len; refresh_line(&st); break;
+            case KEY_CTRL('b'): if (st.pos > 0) st.pos--; refresh_line(&st); break;
+            case KEY_CTRL('f'): if (st.pos < st.len) st.pos++; refresh_line(&st); break;
+            case KEY_CTRL('p'): history_move(&st, -1); break;
+            case KEY_CTRL('n'): history_move(&st, 1); break;
+            case KEY_CTRL('k'): kill_range(&st, st.pos, st.len); refresh_line(&st); break;
+            case KEY_CTRL('u'): kill_range(&st, 0, st.pos); refresh_line(&st); break;
+            case KEY_CTRL('w'): kill_range(&st, word_start(&st, st.pos), st.pos); refresh_line(&st); break;
+            case KEY_CTRL('y'): insert_text(&st, kill_buf, strlen(kill_buf)); refresh_line(&st); break;
+            case KEY_CTRL('l'): write_all("\x1b[H\x1b[2J", 7); refresh_line(&st); break;
+            case KEY_ESC: handle_escape(&st); break;
+            default:
+                if ((unsigned char)c >= 32) {
+                    insert_text(&st, &c, 1);
+                    refresh_line(&st);
+                }
+                break;
+        }
+        last_was_tab = is_tab;
+    }
+}
+
+// Read one line of input, without the trailing newline.
+// Returns NULL on end of input.
+char *read_line(const char *prompt, char *buf, size_t size) {
+    if (isatty(STDIN_FILENO) && enable_raw_mode() == 0) {
+        fflush(stdout);
+        int len = edit_line(buf, size, prompt);
+        disable_raw_mode();
+        return len < 0 ? NULL : buf;
+    }
+
+    printf("%s", prompt);
+    if (fgets(buf, size, stdin) == NULL) {
+        return NULL;
+    }
+    buf[strcspn(buf, "\n")] = 0;
+    return buf;
+}
@@ -1,107 +1,315 @@
 #include "../include/xhell.h"
 
-// Parse a single command (handles redirections)
-static int parse_single_command(char *cmd_str, Command *cmd) {
-    cmd->argc = 0;
-    cmd->input_file = NULL;
-    cmd->output_file = NULL;
-    cmd->error_file = NULL;
-    cmd->append_output = 0;
-    cmd->append_error = 0;
-    
-    char *token;
-    char *saveptr;
-    int i = 0;
-    
-    // Tokenize by whitespace
-    token = strtok_r(cmd_str, " \t", &saveptr);
-    while (token != NULL && i < MAX_ARGS - 1) {
-        // Check for output redirection
-        if (strcmp(token, ">") == 0) {
-            token = strtok_r(NULL, " \t", &saveptr);
-            if (token == NULL) {
-                fprintf(stderr, "Error: missing filename after >\n");
-                return -1;
-            }
-            cmd->output_file = strdup(token);
-            cmd->append_output = 0;
-        }
-        // Check for append redirection
-        else if (strcmp(token, ">>") == 0) {
-            token = strtok_r(NULL, " \t", &saveptr);
-            if (token == NULL) {
-                fprintf(stderr, "Error: missing filename after >>\n");
-                return -1;
+// Lexer
+//
+// Splits command text into words and operators. Words are kept raw, with
+// their quotes and $ references intact, so the compiler can tell literal
+// words from ones that need expanding at run time. Quotes, backslashes,
+// ${...} and $(...) may all contain characters that would otherwise end
+// a word.
+//
+// A here-document body starts on the line after its "<<EOF" operator;
+// the operator is followed by a word token that gets the body once the
+// lexer reaches that line.
+
+static int token_add(TokenList *list, int type, int redir, const char *text, size_t len, uint32_t line) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 64;
+        Token *toks = realloc(list->toks, cap * sizeof(Token));
+        if (toks == NULL) {
+            return -1;
+        }
+        list->toks = toks;
+        list->cap = cap;
+    }
+
+    Token *tok = &list->toks[list->count++];
+    tok->type = type;
+    tok->redir = redir;
+    tok->fd = 0;
+    tok->quoted = 0;
+    tok->line = line;
+    tok->text = text ? strndup(text, len) : NULL;
+    return 0;
+}
+
+// Find the end of a $(...), $((...)) or ${...} starting at p
+static const char *skip_group(const char *p, const char *end, char open, char close) {
+    int depth = 0;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end) {
+            p += 2;
+            continue;
+        }
+        if (*p == '\'') {
+            const char *q = memchr(p + 1, '\'', end - p - 1);
+            p = q ? q + 1 : end;
+            continue;
+        }
+        if (*p == open) depth++;
+        if (*p == close && --depth == 0) return p + 1;
+        p++;
+    }
+    return end;
+}
+
+#define MAX_PENDING_HEREDOCS 16
+
+typedef struct {
+    int tok;                // index of the word token that gets the body
+    char delim[128];
+    int strip_tabs;         // <<- removes leading tabs
+} PendingHeredoc;
+
+// Read the bodies of the pending here-documents, which start at *pp.
+// A missing delimiter ends the body at the end of the input.
+static void read_heredocs(TokenList *list, PendingHeredoc *pending, int count,
+                          const char **pp, const char *end, uint32_t *line) {
+    const char *p = *pp;
+    for (int i = 0; i < count; i++) {
+        PendingHeredoc *h = &pending[i];
+        char *body = NULL;
+        size_t len = 0;
+        size_t delim_len = strlen(h->delim);
+
+        while (p < end) {
+            const char *eol = memchr(p, '\n', end - p);
+            const char *next = eol ? eol + 1 : end;
+            (*line)++;
+            if (h->strip_tabs) {
+                while (p < next && *p == '\t') p++;
             }
-            cmd->output_file = strdup(token);
-            cmd->append_output = 1;
-        }
-        // Check for error redirection
-        else if (strcmp(token, "2>") == 0) {
-            token = strtok_r(NULL, " \t", &saveptr);
-            if (token == NULL) {
-                fprintf(stderr, "Error: missing filename after 2>\n");
-                return -1;
+            size_t line_len = (eol ? eol : end) - p;
+            if (line_len == delim_len && memcmp(p, h->delim, delim_len) == 0) {
+                p = next;
+                break;
             }
-            cmd->error_file = strdup(token);
-            cmd->append_error = 0;
-        }
-        // Regular argument
-        else {
-            cmd->args[i++] = strdup(token);
+            char *grown = realloc(body, len + (next - p) + 1);
+            if (grown == NULL) break;
+            body = grown;
+            memcpy(body + len, p, next - p);
+            len += next - p;
+            p = next;
         }
-        
-        token = strtok_r(NULL, " \t", &saveptr);
+
+        free(list->toks[h->tok].text);
+        list->toks[h->tok].text = body ? body : strdup("");
+        if (body) body[len] = '\0';
+    }
+    *pp = p;
+}
+
+static int redir_token(TokenList *list, int kind, int fd, uint32_t line) {
+    if (token_add(list, TOK_REDIR, kind, NULL, 0, line) != 0) {
+        return -1;
     }
-    
-    cmd->args[i] = NULL;
-    cmd->argc = i;
-    
+    list->toks[list->count - 1].fd = fd;
     return 0;
 }
 
-// Parse command line (handles pipes)
-int parse_command_line(char *line, Pipeline *pipeline) {
-    pipeline->num_commands = 0;
-    
-    char *line_copy = strdup(line);
-    char *cmd_str;
-    char *saveptr;
-    
-    // Split by pipe
-    cmd_str = strtok_r(line_copy, "|", &saveptr);
-    while (cmd_str != NULL && pipeline->num_commands < MAX_ARGS) {
-        trim_whitespace(cmd_str);
-        
-        if (parse_single_command(cmd_str, &pipeline->commands[pipeline->num_commands]) != 0) {
-            free(line_copy);
+static int is_word_end(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' || c == '|' ||
+           c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+// Tokenize source. Returns 0 on success, or -1 with a message in list->error.
+int tokenize(const char *source, size_t len, TokenList *list) {
+    const char *p = source;
+    const char *end = source + len;
+    uint32_t line = 1;
+    PendingHeredoc pending[MAX_PENDING_HEREDOCS];
+    int pending_count = 0;
+
+    memset(list, 0, sizeof(*list));
+
+    while (p < end) {
+        char c = *p;
+
+        if (c == ' ' || c == '\t' || c == '\r') {
+            p++;
+            continue;
+        }
+        if (c == '\\' && p + 1 < end && p[1] == '\n') {
+            // Line continuation
+            p += 2;
+            line++;
+            continue;
+        }
+        if (c == '#' && p + 1 < end && p[1] == '@') {
+            // "#@ ..." directive for xsh -j, kept up to the end of the line
+            const char *start = p + 2;
+            while (p < end && *p != '\n') p++;
+            token_add(list, TOK_DIRECTIVE, 0, start, p - start, line);
+            continue;
+        }
+        if (c == '#') {
+            while (p < end && *p != '\n') p++;
+            continue;
+        }
+        if (c == '\n') {
+            token_add(list, TOK_NEWLINE, 0, NULL, 0, line);
+            p++;
+            if (pending_count > 0) {
+                read_heredocs(list, pending, pending_count, &p, end, &line);
+                pending_count = 0;
+            }
+            line++;
+            continue;
+        }
+
+        // Operators
+        if (c == ';') { token_add(list, TOK_SEMI, 0, NULL, 0, line); p++; continue; }
+        if (c == '(') { token_add(list, TOK_LPAREN, 0, NULL, 0, line); p++; continue; }
+        if (c == ')') { token_add(list, TOK_RPAREN, 0, NULL, 0, line); p++; continue; }
+        if (c == '&' && p + 1 < end && p[1] == '&') {
+            token_add(list, TOK_AND, 0, NULL, 0, line);
+            p += 2;
+            continue;
+        }
+        if (c == '|' && p + 1 < end && p[1] == '|') {
+            token_add(list, TOK_OR, 0, NULL, 0, line);
+            p += 2;
+            continue;
+        }
+        if (c == '|') { token_add(list, TOK_PIPE, 0, NULL, 0, line); p++; continue; }
+        if (c == '&' && p + 1 < end && p[1] == '>') {
+            // &>file and &>>file: stdout and stderr
+            int append = p + 2 < end && p[2] == '>';
+            redir_token(list, append ? REDIR_BOTH_APPEND : REDIR_BOTH, STDOUT_FILENO, line);
+            p += 2 + append;
+            continue;
+        }
+        if (c == '&') {
+            snprintf(list->error, sizeof(list->error), "line %u: background jobs (&) are not supported", line);
             return -1;
         }
-        
-        pipeline->num_commands++;
-        cmd_str = strtok_r(NULL, "|", &saveptr);
+
+        // Process substitution: <(cmd) and >(cmd) are words
+        if ((c == '<' || c == '>') && p + 1 < end && p[1] == '(') {
+            const char *start = p;
+            p = skip_group(p + 1, end, '(', ')');
+            token_add(list, TOK_WORD, 0, start, p - start, line);
+            continue;
+        }
+
+        // Redirections, with an optional fd digit: N<, N>, N>>, N<&M,
+        // N>&M, N<<EOF, N<<-EOF, N<<< word
+        if (c == '<' || c == '>' ||
+            (c >= '0' && c <= '9' && p + 1 < end && (p[1] == '<' || p[1] == '>'))) {
+            int fd = -1;
+            if (c >= '0' && c <= '9') {
+                fd = c - '0';
+                c = *++p;
+            }
+            int in = c == '<';
+            if (fd < 0) fd = in ? STDIN_FILENO : STDOUT_FILENO;
+
+            if (in && p + 2 < end && p[1] == '<' && p[2] == '<') {
+                redir_token(list, REDIR_HERESTRING, fd, line);
+                p += 3;
+                continue;
+            }
+            if (in && p + 1 < end && p[1] == '<') {
+                int strip_tabs = p + 2 < end && p[2] == '-';
+                p += 2 + strip_tabs;
+                while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+                if (pending_count == MAX_PENDING_HEREDOCS) {
+                    snprintf(list->error, sizeof(list->error), "line %u: too many here-documents", line);
+                    return -1;
+                }
+
+                // The delimiter, minus quotes; any quoting makes the body literal
+                PendingHeredoc *h = &pending[pending_count];
+                size_t n = 0;
+                int quoted = 0;
+                while (p < end && !is_word_end(*p)) {
+                    if (*p == '\'' || *p == '"' || *p == '\\') {
+                        quoted = 1;
+                        p++;
+                        continue;
+                    }
+                    if (n + 1 < sizeof(h->delim)) h->delim[n++] = *p;
+                    p++;
+                }
+                h->delim[n] = '\0';
+                if (n == 0) {
+                    snprintf(list->error, sizeof(list->error), "line %u: bad here-document", line);
+                    return -1;
+                }
+
+                redir_token(list, REDIR_HEREDOC, fd, line);
+                list->toks[list->count - 1].quoted = quoted;
+                token_add(list, TOK_WORD, 0, "", 0, line);
+                h->tok = list->count - 1;
+                h->strip_tabs = strip_tabs;
+                pending_count++;
+                continue;
+            }
+            if (p + 1 < end && p[1] == '&') {
+                redir_token(list, REDIR_DUP, fd, line);
+                p += 2;
+                continue;
+            }
+            int append = !in && p + 1 < end && p[1] == '>';
+            redir_token(list, in ? REDIR_IN : (append ? REDIR_APPEND : REDIR_OUT), fd, line);
+            p += 1 + append;
+            continue;
+        }
+
+        // A word
+        const char *start = p;
+        while (p < end && !is_word_end(*p)) {
+            if (*p == '\'') {
+                const char *q = memchr(p + 1, '\'', end - p - 1);
+                if (q == NULL) {
+                    snprintf(list->error, sizeof(list->error), "line %u: unterminated quote", line);
+                    return -1;
+                }
+                p = q + 1;
+            } else if (*p == '"') {
+                p++;
+                while (p < end && *p != '"') {
+                    if (*p == '\\' && p + 1 < end) p++;
+                    else if (*p == '$' && p + 1 < end && p[1] == '(') {
+                        p = skip_group(p + 1, end, '(', ')');
+                        continue;
+                    }
+                    if (*p == '\n') line++;
+                    p++;
+                }
+                if (p >= end) {
+                    snprintf(list->error, sizeof(list->error), "line %u: unterminated quote", line);
+                    return -1;
+                }
+                p++;
+            } else if (*p == '\\' && p + 1 < end) {
+                p += 2;
+            } else if (*p == '$' && p + 1 < end && p[1] == '(') {
+                p = skip_group(p + 1, end, '(', ')');
+            } else if (*p == '$' && p + 1 < end && p[1] == '{') {
+                p = skip_group(p + 1, end, '{', '}');
+            } else {
+                p++;
+            }
+        }
+        token_add(list, TOK_WORD, 0, start, p - start, line);
     }
-    
-    free(line_copy);
-    
-    if (pipeline->num_commands == 0) {
-        return -1;
+
+    if (pending_count > 0) {
+        // Here-documents on the last line have no body
+        read_heredocs(list, pending, pending_count, &p, end, &line);
     }
-    
+    token_add(list, TOK_EOF, 0, NULL, 0, line);
     return 0;
 }
 
-// Free pipeline resources
-void free_pipeline(Pipeline *pipeline) {
-    for (int i = 0; i < pipeline->num_commands; i++) {
-        Command *cmd = &pipeline->commands[i];
-        
-        for (int j = 0; j < cmd->argc; j++) {
-            free(cmd->args[j]);
-        }
-        
-        if (cmd->input_file) free(cmd->input_file);
-        if (cmd->output_file) free(cmd->output_file);
-        if (cmd->error_file) free(cmd->error_file);
+void free_tokens(TokenList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->toks[i].text);
     }
+    free(list->toks);
+    list->toks = NULL;
+    list->count = 0;
+    list->cap = 0;
 }
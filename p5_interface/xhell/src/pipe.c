@@ -1,51 +1,5 @@
 #include "../include/xhell.h"
 
-// Execute a single command
-static int execute_single_command(Command *cmd, int input_fd, int output_fd) {
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-        perror("fork");
-        return -1;
-    }
-    
-    if (pid == 0) {
-        // Child process
-        
-        // Setup input redirection
-        if (input_fd != STDIN_FILENO) {
-            dup2(input_fd, STDIN_FILENO);
-            close(input_fd);
-        }
-        
-        // Setup output redirection
-        if (output_fd != STDOUT_FILENO) {
-            dup2(output_fd, STDOUT_FILENO);
-            close(output_fd);
-        }
-        
-        // Setup file redirections
-        setup_redirections(cmd);
-        
-        // Execute command
-        if (is_builtin_command(cmd->args[0])) {
-            int status = execute_builtin(cmd);
-            exit(status);
-        } else {
-            char *program_path = find_in_path(cmd->args[0]);
-            if (program_path == NULL) {
-                fprintf(stderr, "%s: command not found\n", cmd->args[0]);
-                exit(127);
-            }
-            execv(program_path, cmd->args);
-            perror("execv");
-            exit(1);
-        }
-    }
-    
-    return pid;
-}
-
 // Execute pipeline
 // Execute pipeline
 int execute_pipeline(Pipeline *pipeline) {
@@ -56,33 +10,25 @@ int execute_pipeline(Pipeline *pipeline) {
     // Single command (no pipe)
     if (pipeline->num_commands == 1) {
         Command *cmd = &pipeline->commands[0];
+        int builtin = is_builtin_command(cmd->args[0]);
         
-        // Save original file descriptors
-        int saved_stdout = dup(STDOUT_FILENO);
-        int saved_stderr = dup(STDERR_FILENO);
-        int saved_stdin = dup(STDIN_FILENO);
-        
-        // Setup redirections
-        if (setup_redirections(cmd) != 0) {
-            restore_redirections(saved_stdout, saved_stderr, saved_stdin);
-            return -1;
+        // Open the redirection files once; a FIFO is left to the child
+        FdPlan plan;
+        if (redir_plan(cmd, &plan, !builtin) != 0) {
+            return 1;
         }
         
         int status;
         
         // Execute built-in or external
-        if (is_builtin_command(cmd->args[0])) {
-            status = execute_builtin(cmd);
-            // CRITICAL: Flush stdout to ensure data is written to the file
-            // before we restore the file descriptors!
-            fflush(stdout);
+        if (builtin) {
+            // Handed the plan's descriptors, the shell's own stay put
+            status = execute_builtin(cmd, &plan);
         } else {
-            status = execute_external(cmd);
+            status = execute_external(cmd, &plan);
         }
         
-        // Restore file descriptors
-        restore_redirections(saved_stdout, saved_stderr, saved_stdin);
-        
+        redir_plan_free(&plan);
         return status;
     }
     
@@ -91,6 +37,18 @@ int execute_pipeline(Pipeline *pipeline) {
     int pipes[num_cmds - 1][2];
     pid_t pids[num_cmds];
     
+    FdPlan plans[num_cmds];
+    
+    // Resolve every stage's redirections before anything runs
+    for (int i = 0; i < num_cmds; i++) {
+        if (redir_plan(&pipeline->commands[i], &plans[i], 1) != 0) {
+            for (int j = 0; j < i; j++) {
+                redir_plan_free(&plans[j]);
+            }
+            return 1;
+        }
+    }
+    
     // Create all pipes
     for (int i = 0; i < num_cmds - 1; i++) {
         if (pipe(pipes[i]) == -1) {
@@ -100,6 +58,9 @@ int execute_pipeline(Pipeline *pipeline) {
                 close(pipes[j][0]);
                 close(pipes[j][1]);
             }
+            for (int j = 0; j < num_cmds; j++) {
+                redir_plan_free(&plans[j]);
+            }
             return -1;
         }
     }
@@ -138,26 +99,35 @@ int execute_pipeline(Pipeline *pipeline) {
                 close(pipes[j][1]);
             }
             
-            // 4. Setup Redirections (Handle < > >> for this specific command)
+            // 4. Apply Redirections, opened by the parent (plus any FIFOs)
             // Note: This might override the pipe STDIN/STDOUT if user mixed pipe & redirect
             // e.g. "ls | cat > file". cat has pipe IN, but file OUT.
-            setup_redirections(&pipeline->commands[i]);
+            if (redir_apply(&plans[i]) != 0) {
+                exit(1);
+            }
             
             // 5. Execute Command
             Command *cmd = &pipeline->commands[i];
+            int fn_status = interp_call(cmd);
+            if (fn_status >= 0) {
+                // A shell function, run by this child's copy of the shell
+                _exit(fn_status);
+            }
             if (is_builtin_command(cmd->args[0])) {
-                int status = execute_builtin(cmd);
+                // The plan is applied already, fds 0-2 are the builtin's
+                int status = execute_builtin(cmd, NULL);
                 fflush(stdout); // Flush just in case
                 exit(status);
             } else {
                 char *program_path = find_in_path(cmd->args[0]);
                 if (program_path == NULL) {
-                    fprintf(stderr, "%s: command not found\n", cmd->args[0]);
-                    exit(127);
+                    exit(command_missing(cmd->args[0]));
+                }
+                if (!argv_fits(cmd)) {
+                    exit(execute_batched(program_path, cmd, NULL));
                 }
                 execv(program_path, cmd->args);
-                perror("execv");
-                exit(1);
+                exit(command_failed(cmd->args[0], errno));
             }
         }
     }
@@ -167,6 +137,9 @@ int execute_pipeline(Pipeline *pipeline) {
         close(pipes[i][0]);
         close(pipes[i][1]);
     }
+    for (int i = 0; i < num_cmds; i++) {
+        redir_plan_free(&plans[i]);
+    }
     
     // Wait for all children
     int status = 0;
@@ -1,5 +1,34 @@
+#define _GNU_SOURCE
 #include "../include/xhell.h"
 
+// The directory xhell started in, where its history and log live. The
+// files are opened on first use, and until the first xcd "." is still
+// that directory, so nothing has to be opened for it at startup.
+static int start_dir = AT_FDCWD;
+
+// Keep hold of the start directory; called before xcd leaves it
+void start_dir_pin(void) {
+    if (start_dir == AT_FDCWD) {
+        int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1) {
+            start_dir = fd;
+        }
+    }
+}
+
+// Let go of it, so the next xcd pins whatever directory is current then
+void start_dir_unpin(void) {
+    if (start_dir != AT_FDCWD) {
+        close(start_dir);
+        start_dir = AT_FDCWD;
+    }
+}
+
+// For openat() of the shell's own files
+int start_dir_fd(void) {
+    return start_dir;
+}
+
 // Trim leading and trailing whitespace
 void trim_whitespace(char *str) {
     if (str == NULL) return;
@@ -31,61 +60,17 @@ char *get_prompt(void) {
     return prompt;
 }
 
-// Add command to history
-void add_to_history(const char *command) {
-    if (history_count < MAX_HISTORY) {
-        history[history_count++] = strdup(command);
-    } else {
-        // Shift history and add new command
-        free(history[0]);
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            history[i] = history[i + 1];
-        }
-        history[MAX_HISTORY - 1] = strdup(command);
-    }
-}
-
-// Save history to file
-void save_history(void) {
-    FILE *file = fopen(HISTORY_FILE, "w");
-    if (file == NULL) {
-        return;
-    }
-    
-    for (int i = 0; i < history_count; i++) {
-        fprintf(file, "%s\n", history[i]);
-    }
-    
-    fclose(file);
-}
-
-// Load history from file
-void load_history(void) {
-    FILE *file = fopen(HISTORY_FILE, "r");
-    if (file == NULL) {
-        return;
-    }
-    
-    char line[MAX_CMD_LEN];
-    while (fgets(line, sizeof(line), file) != NULL && history_count < MAX_HISTORY) {
-        line[strcspn(line, "\n")] = 0;
-        history[history_count++] = strdup(line);
-    }
-    
-    fclose(file);
-}
-
 // Copy file
-int copy_file(const char *src, const char *dst) {
+int copy_file(const char *src, const char *dst, Sink *err) {
     FILE *src_file = fopen(src, "rb");
     if (src_file == NULL) {
-        perror("copy_file: source");
+        sink_perror(err, "copy_file: source");
         return -1;
     }
     
     FILE *dst_file = fopen(dst, "wb");
     if (dst_file == NULL) {
-        perror("copy_file: destination");
+        sink_perror(err, "copy_file: destination");
         fclose(src_file);
         return -1;
     }
@@ -95,7 +80,7 @@ int copy_file(const char *src, const char *dst) {
     
     while ((bytes = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
         if (fwrite(buffer, 1, bytes, dst_file) != bytes) {
-            perror("copy_file: write");
+            sink_perror(err, "copy_file: write");
             fclose(src_file);
             fclose(dst_file);
             return -1;
@@ -108,84 +93,266 @@ int copy_file(const char *src, const char *dst) {
     return 0;
 }
 
+// --- Directory trees ---
+//
+// A directory is read BATCH_NAMES entries at a time, and the calls for
+// those entries go to batch_run together: the stats the directory's own
+// entry types do not make unnecessary, the opens, a round of reads and
+// writes for every file, the closes and the unlinks. Subdirectories are
+// handled after the files of their batch, through descriptors, so the
+// depth of a tree is not limited by path length.
+
+#define COPY_CHUNK 32768        // bytes read per file and round
+
+static void report(Sink *err, const char *what, long res) {
+    errno = (int)-res;
+    sink_perror(err, what);
+}
+
+// Types of the entries the directory left DT_UNKNOWN (and, following
+// links as stat does, of symlinks) from a batch of statx. An entry that
+// cannot be stat'ed is reported and stays DT_UNKNOWN.
+static void resolve_types(int dirfd, DirName *names, size_t count, int follow, Sink *err,
+                          const char *what) {
+    BatchOp ops[BATCH_NAMES];
+    struct statx stx[BATCH_NAMES];
+    size_t index[BATCH_NAMES];
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (names[i].type == DT_UNKNOWN || (follow && names[i].type == DT_LNK)) {
+            ops[n] = (BatchOp){.op = BIO_STATX, .dirfd = dirfd, .path = names[i].name,
+                               .flags = follow ? 0 : AT_SYMLINK_NOFOLLOW, .stx = &stx[n]};
+            index[n++] = i;
+        }
+    }
+    batch_run(ops, n);
+    for (size_t k = 0; k < n; k++) {
+        if (ops[k].res != 0) {
+            report(err, what, ops[k].res);
+            names[index[k]].type = DT_UNKNOWN;
+        } else {
+            names[index[k]].type = IFTODT(stx[k].stx_mode);
+        }
+    }
+}
+
+// Copy files from one directory to another all at once: open both ends,
+// then a read and a write of every file per round until each is done.
+// bufs holds COPY_CHUNK bytes per file.
+static void copy_files(int from, int to, char **names, size_t count, char *bufs, Sink *err) {
+    BatchOp ops[BATCH_NAMES * 2];
+    int in[BATCH_NAMES], out[BATCH_NAMES];
+    off_t copied[BATCH_NAMES];
+    size_t active[BATCH_NAMES], writing[BATCH_NAMES];
+    size_t n_active = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        ops[2 * i] = (BatchOp){.op = BIO_OPENAT, .dirfd = from, .path = names[i],
+                               .flags = O_RDONLY | O_CLOEXEC};
+        ops[2 * i + 1] = (BatchOp){.op = BIO_OPENAT, .dirfd = to, .path = names[i],
+                                   .flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, .mode = 0666};
+    }
+    batch_run(ops, 2 * count);
+    for (size_t i = 0; i < count; i++) {
+        in[i] = (int)ops[2 * i].res;
+        out[i] = (int)ops[2 * i + 1].res;
+        copied[i] = 0;
+        if (in[i] < 0) {
+            report(err, "copy_file: source", in[i]);
+        } else if (out[i] < 0) {
+            report(err, "copy_file: destination", out[i]);
+        } else {
+            active[n_active++] = i;
+        }
+    }
+
+    while (n_active > 0) {
+        for (size_t k = 0; k < n_active; k++) {
+            size_t i = active[k];
+            ops[k] = (BatchOp){.op = BIO_READ, .fd = in[i], .buf = bufs + i * COPY_CHUNK,
+                               .len = COPY_CHUNK, .off = copied[i]};
+        }
+        batch_run(ops, n_active);
+
+        size_t n_writing = 0;
+        for (size_t k = 0; k < n_active; k++) {
+            size_t i = active[k];
+            if (ops[k].res < 0) {
+                report(err, "copy_file: read", ops[k].res);
+            } else if (ops[k].res > 0) {
+                ops[BATCH_NAMES + n_writing] = (BatchOp){.op = BIO_WRITE, .fd = out[i],
+                                                         .buf = bufs + i * COPY_CHUNK,
+                                                         .len = ops[k].res, .off = copied[i]};
+                writing[n_writing++] = i;
+            }
+        }
+        batch_run(ops + BATCH_NAMES, n_writing);
+
+        // A short write leaves the rest to be read again next round
+        n_active = 0;
+        for (size_t k = 0; k < n_writing; k++) {
+            long res = ops[BATCH_NAMES + k].res;
+            if (res <= 0) {
+                report(err, "copy_file: write", res < 0 ? res : -EIO);
+            } else {
+                copied[writing[k]] += res;
+                active[n_active++] = writing[k];
+            }
+        }
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (in[i] >= 0) ops[n++] = (BatchOp){.op = BIO_CLOSE, .fd = in[i]};
+        if (out[i] >= 0) ops[n++] = (BatchOp){.op = BIO_CLOSE, .fd = out[i]};
+    }
+    batch_run(ops, n);
+}
+
+static void copy_tree(int from, int to, char *bufs, Sink *err);
+
+static void copy_subdir(int from, int to, const char *name, char *bufs, Sink *err) {
+    if (mkdirat(to, name, 0755) != 0 && errno != EEXIST) {
+        sink_perror(err, "copy_directory: mkdir");
+        return;
+    }
+    int sub_from = openat(from, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int sub_to = sub_from == -1 ? -1 : openat(to, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sub_to == -1) {
+        sink_perror(err, "copy_directory: opendir");
+    } else {
+        copy_tree(sub_from, sub_to, bufs, err);
+    }
+    if (sub_from != -1) close(sub_from);
+    if (sub_to != -1) close(sub_to);
+}
+
+static void copy_tree(int from, int to, char *bufs, Sink *err) {
+    int fd = fcntl(from, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        sink_perror(err, "copy_directory: opendir");
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    DirName names[BATCH_NAMES];
+    size_t count;
+    while ((count = dir_read_names(dir, names, BATCH_NAMES)) > 0) {
+        resolve_types(from, names, count, 1, err, "copy_directory: stat");
+        char *files[BATCH_NAMES];
+        size_t n_files = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (names[i].type != DT_UNKNOWN && names[i].type != DT_DIR) {
+                files[n_files++] = names[i].name;
+            }
+        }
+        copy_files(from, to, files, n_files, bufs, err);
+        for (size_t i = 0; i < count; i++) {
+            if (names[i].type == DT_DIR) {
+                copy_subdir(from, to, names[i].name, bufs, err);
+            }
+        }
+        dir_free_names(names, count);
+    }
+    closedir(dir);
+}
+
 // Copy directory recursively
-int copy_directory(const char *src, const char *dst) {
+int copy_directory(const char *src, const char *dst, Sink *err) {
     // Create destination directory
     if (mkdir(dst, 0755) != 0 && errno != EEXIST) {
-        perror("copy_directory: mkdir");
+        sink_perror(err, "copy_directory: mkdir");
         return -1;
     }
     
-    DIR *dir = opendir(src);
-    if (dir == NULL) {
-        perror("copy_directory: opendir");
+    int from = open(src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int to = from == -1 ? -1 : open(dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *bufs = to == -1 ? NULL : malloc((size_t)BATCH_NAMES * COPY_CHUNK);
+    if (bufs == NULL) {
+        sink_perror(err, "copy_directory: opendir");
+        if (from != -1) close(from);
+        if (to != -1) close(to);
         return -1;
     }
     
-    struct dirent *entry;
-    struct stat st;
-    char src_path[MAX_PATH_LEN];
-    char dst_path[MAX_PATH_LEN];
+    copy_tree(from, to, bufs, err);
     
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    free(bufs);
+    close(from);
+    close(to);
+    return 0;
+}
+
+// Unlink a batch of a directory's entries, with flags 0 or AT_REMOVEDIR
+static void unlink_names(int dirfd, char **names, size_t count, int flags, Sink *err) {
+    BatchOp ops[BATCH_NAMES];
+    for (size_t i = 0; i < count; i++) {
+        ops[i] = (BatchOp){.op = BIO_UNLINKAT, .dirfd = dirfd, .path = names[i], .flags = flags};
+    }
+    batch_run(ops, count);
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].res != 0) {
+            report(err, flags ? "remove_directory: rmdir" : "remove_directory: unlink", ops[i].res);
         }
-        
-        snprintf(src_path, sizeof(src_path), "%s/%s", src, entry->d_name);
-        snprintf(dst_path, sizeof(dst_path), "%s/%s", dst, entry->d_name);
-        
-        if (stat(src_path, &st) != 0) {
-            perror("copy_directory: stat");
-            continue;
+    }
+}
+
+// Empty a directory. Symlinks are removed, not followed.
+static void remove_tree(int dirfd, Sink *err) {
+    int fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        sink_perror(err, "remove_directory: opendir");
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    DirName names[BATCH_NAMES];
+    char *batch[BATCH_NAMES];
+    size_t count;
+    while ((count = dir_read_names(dir, names, BATCH_NAMES)) > 0) {
+        resolve_types(dirfd, names, count, 0, err, "remove_directory: stat");
+
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (names[i].type != DT_UNKNOWN && names[i].type != DT_DIR) {
+                batch[n++] = names[i].name;
+            }
         }
-        
-        if (S_ISDIR(st.st_mode)) {
-            copy_directory(src_path, dst_path);
-        } else {
-            copy_file(src_path, dst_path);
+        unlink_names(dirfd, batch, n, 0, err);
+
+        n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (names[i].type != DT_DIR) continue;
+            int sub = openat(dirfd, names[i].name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub == -1) {
+                sink_perror(err, "remove_directory: opendir");
+                continue;
+            }
+            remove_tree(sub, err);
+            close(sub);
+            batch[n++] = names[i].name;
         }
+        unlink_names(dirfd, batch, n, AT_REMOVEDIR, err);
+        dir_free_names(names, count);
     }
-    
     closedir(dir);
-    return 0;
 }
 
 // Remove directory recursively
-int remove_directory(const char *path) {
-    DIR *dir = opendir(path);
-    if (dir == NULL) {
-        perror("remove_directory: opendir");
+int remove_directory(const char *path, Sink *err) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        sink_perror(err, "remove_directory: opendir");
         return -1;
     }
     
-    struct dirent *entry;
-    struct stat st;
-    char full_path[MAX_PATH_LEN];
-    
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-        
-        if (stat(full_path, &st) != 0) {
-            perror("remove_directory: stat");
-            continue;
-        }
-        
-        if (S_ISDIR(st.st_mode)) {
-            remove_directory(full_path);
-        } else {
-            unlink(full_path);
-        }
-    }
-    
-    closedir(dir);
+    remove_tree(fd, err);
+    close(fd);
     
     if (rmdir(path) != 0) {
-        perror("remove_directory: rmdir");
+        sink_perror(err, "remove_directory: rmdir");
         return -1;
     }
     
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include "../include/xhell.h"
+#include <limits.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// xrun: run a pipeline confined to some CPUs, at a lower CPU or I/O
+// priority, and with memory and descriptor limits.
+//
+// None of these can be undone by an unprivileged process, so the
+// pipeline runs in a subshell forked for it, which sets them on itself
+// before running the line. Every stage it spawns, external or builtin,
+// inherits them from there. Variables set and directories changed in
+// the pipeline stay in the subshell.
+//
+// When a cgroup v2 hierarchy is writable, the subshell also moves into
+// a cgroup of its own under the shell's (or under XHELL_CGROUP), which
+// is removed when the pipeline is done. If that cgroup has the memory
+// controller, --mem becomes its memory.max, which counts what the
+// pipeline really uses, all stages together; otherwise it is each
+// process's address space limit.
+
+// ioprio_set has no glibc wrapper; values from linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct {
+    const char *cpu_list;   // as given, for cpuset.cpus
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    int ioprio;             // -1: unchanged
+    long long mem;          // bytes, -1: unlimited
+    long long nofile;       // -1: unchanged
+    char cgroup[MAX_PATH_LEN];      // "" if not in one
+    int cgroup_mem;                 // --mem is the cgroup's memory.max
+} RunLimits;
+
+// "2-5,8": CPUs 2 to 5 and 8
+static int parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) return -1;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        if (last >= CPU_SETSIZE) return -1;
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+// "512M", "2G", or bytes
+static long long parse_size(const char *text) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text || errno != 0 || text[0] == '-') return -1;
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0' || n > (unsigned long long)LLONG_MAX >> shift) return -1;
+    return (long long)(n << shift);
+}
+
+// "idle", "best-effort[:0-7]" or "realtime[:0-7]", also "be" and "rt"
+static int parse_ionice(const char *text) {
+    int level = 4;
+    const char *colon = strchr(text, ':');
+    size_t name_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (colon != NULL) {
+        if (colon[1] < '0' || colon[1] > '7' || colon[2] != '\0') return -1;
+        level = colon[1] - '0';
+    }
+    int class;
+    if (strncmp(text, "idle", name_len) == 0 && name_len == 4) {
+        if (colon != NULL) return -1;
+        class = IOPRIO_CLASS_IDLE;
+        level = 0;
+    } else if ((name_len == 2 && strncmp(text, "be", 2) == 0) ||
+               (name_len == 11 && strncmp(text, "best-effort", 11) == 0)) {
+        class = IOPRIO_CLASS_BE;
+    } else if ((name_len == 2 && strncmp(text, "rt", 2) == 0) ||
+               (name_len == 8 && strncmp(text, "realtime", 8) == 0)) {
+        class = IOPRIO_CLASS_RT;
+    } else {
+        return -1;
+    }
+    return class << IOPRIO_CLASS_SHIFT | level;
+}
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+// Where new cgroups go: XHELL_CGROUP, or the shell's own cgroup in the
+// cgroup2 mount. 0 if there is one.
+static int cgroup_parent(char *dir, size_t size) {
+    const char *given = var_get("XHELL_CGROUP");
+    if (given != NULL && *given) {
+        snprintf(dir, size, "%s", given);
+        return 0;
+    }
+
+    char mount[MAX_PATH_LEN] = "";
+    char line[1024];
+    FILE *fp = fopen("/proc/self/mounts", "r");
+    if (fp == NULL) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        char where[MAX_PATH_LEN], type[64];
+        if (sscanf(line, "%*s %511s %63s", where, type) == 2 && strcmp(type, "cgroup2") == 0) {
+            snprintf(mount, sizeof(mount), "%s", where);
+            break;
+        }
+    }
+    fclose(fp);
+    if (!mount[0]) return -1;
+
+    // The unified hierarchy's line is "0::/path"
+    fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL) return -1;
+    int found = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            int n = snprintf(dir, size, "%s%s", mount, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            found = n < (int)size ? 0 : -1;
+            break;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Make the pipeline's cgroup and set its limits; silently nothing if
+// the hierarchy is not writable
+static void cgroup_create(RunLimits *lim) {
+    static unsigned serial = 0;
+    char parent[MAX_PATH_LEN];
+    lim->cgroup[0] = '\0';
+    if (cgroup_parent(parent, sizeof(parent)) != 0) return;
+
+    int n = snprintf(lim->cgroup, sizeof(lim->cgroup), "%s/xrun-%d-%u", parent, (int)getpid(), serial++);
+    if (n >= (int)sizeof(lim->cgroup) || mkdir(lim->cgroup, 0755) != 0) {
+        lim->cgroup[0] = '\0';
+        return;
+    }
+    if (lim->mem >= 0) {
+        char value[32];
+        snprintf(value, sizeof(value), "%lld", lim->mem);
+        lim->cgroup_mem = write_file(lim->cgroup, "memory.max", value) == 0;
+    }
+    if (lim->cpu_list != NULL) {
+        // Affinity confines the pipeline anyway; cpuset also binds its memory
+        write_file(lim->cgroup, "cpuset.cpus", lim->cpu_list);
+    }
+}
+
+// In the subshell: set the limits on itself, for everything it starts
+static int apply_limits(RunLimits *lim) {
+    if (lim->cgroup[0] && write_file(lim->cgroup, "cgroup.procs", "0") != 0 && lim->cgroup_mem) {
+        // Not in the cgroup after all: its memory.max would not apply
+        lim->cgroup_mem = 0;
+    }
+    if (lim->cpu_list != NULL && sched_setaffinity(0, sizeof(lim->cpus), &lim->cpus) != 0) {
+        perror("xrun: --cpus");
+        return -1;
+    }
+    if (lim->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, lim->ioprio) != 0) {
+        perror("xrun: --ionice");
+        return -1;
+    }
+    if (lim->has_nice && setpriority(PRIO_PROCESS, 0, lim->nice) != 0) {
+        perror("xrun: --nice");
+        return -1;
+    }
+    if (lim->mem >= 0 && !lim->cgroup_mem) {
+        struct rlimit rl = {(rlim_t)lim->mem, (rlim_t)lim->mem};
+        if (setrlimit(RLIMIT_AS, &rl) != 0) {
+            perror("xrun: --mem");
+            return -1;
+        }
+    }
+    if (lim->nofile >= 0) {
+        struct rlimit rl = {(rlim_t)lim->nofile, (rlim_t)lim->nofile};
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            perror("xrun: --nofile");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// The command as a line for the subshell: a single word is a line of
+// its own ("sort big | uniq -c"), several are quoted to stay as given
+static char *command_line(int argc, char **argv) {
+    if (argc == 1) {
+        return strdup(argv[0]);
+    }
+    Sink line;
+    sink_open_memory(&line);
+    for (int i = 0; i < argc; i++) {
+        sink_write(&line, i ? " '" : "'", i ? 2 : 1);
+        for (const char *p = argv[i]; *p; p++) {
+            if (*p == '\'') sink_write(&line, "'\\''", 4);
+            else sink_write(&line, p, 1);
+        }
+        sink_write(&line, "'", 1);
+    }
+    sink_write(&line, "", 1);
+    return line.failed ? (sink_close(&line), NULL) : sink_take(&line, NULL);
+}
+
+// xrun [--cpus LIST] [--nice N] [--ionice CLASS[:LEVEL]] [--mem SIZE]
+//      [--nofile N] [--] command...
+int cmd_xrun(int argc, char **argv, BuiltinIO *io) {
+    RunLimits lim;
+    memset(&lim, 0, sizeof(lim));
+    lim.ioprio = -1;
+    lim.mem = -1;
+    lim.nofile = -1;
+
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL) {
+            sink_printf(io->err, "xrun: %s needs a value\n", argv[i]);
+            return 1;
+        }
+        char *end;
+        int bad = 0;
+        if (strcmp(argv[i], "--cpus") == 0) {
+            lim.cpu_list = value;
+            bad = parse_cpus(value, &lim.cpus) != 0;
+        } else if (strcmp(argv[i], "--nice") == 0) {
+            lim.has_nice = 1;
+            lim.nice = (int)strtol(value, &end, 10);
+            bad = end == value || *end != '\0' || lim.nice < -20 || lim.nice > 19;
+        } else if (strcmp(argv[i], "--ionice") == 0) {
+            lim.ioprio = parse_ionice(value);
+            bad = lim.ioprio < 0;
+        } else if (strcmp(argv[i], "--mem") == 0) {
+            lim.mem = parse_size(value);
+            bad = lim.mem <= 0;
+        } else if (strcmp(argv[i], "--nofile") == 0) {
+            lim.nofile = strtoll(value, &end, 10);
+            bad = end == value || *end != '\0' || lim.nofile < 0;
+        } else {
+            sink_printf(io->err, "xrun: unknown option %s\n", argv[i]);
+            return 1;
+        }
+        if (bad) {
+            sink_printf(io->err, "xrun: bad value for %s: %s\n", argv[i], value);
+            return 1;
+        }
+        i++;
+    }
+
+    if (i >= argc) {
+        sink_printf(io->out, "Usage: xrun [--cpus LIST] [--nice N] [--ionice CLASS[:LEVEL]] "
+                             "[--mem SIZE] [--nofile N] [--] command...\n");
+        return 1;
+    }
+
+    char *line = command_line(argc - i, argv + i);
+    if (line == NULL) {
+        sink_perror(io->err, "xrun");
+        return 1;
+    }
+    ScriptProgram prog;
+    if (script_compile(line, strlen(line), &prog) != 0) {
+        // The program only reports the syntax error
+        script_run(&prog, 0, NULL);
+        script_free(&prog);
+        free(line);
+        return 2;
+    }
+    free(line);
+
+    cgroup_create(&lim);
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        sink_perror(io->err, "xrun: fork");
+        script_free(&prog);
+        if (lim.cgroup[0]) rmdir(lim.cgroup);
+        return 1;
+    }
+
+    if (pid == 0) {
+        if (apply_limits(&lim) != 0) {
+            _exit(126);
+        }
+        int status = script_run(&prog, 0, NULL);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status & 0xff);
+    }
+
+    script_free(&prog);
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            status = -1;
+            break;
+        }
+    }
+    // Still busy if the pipeline left something in the background
+    if (lim.cgroup[0]) rmdir(lim.cgroup);
+
+    if (status == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
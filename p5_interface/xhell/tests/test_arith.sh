@@ -0,0 +1,13 @@
+#!/bin/sh
+# $((...)) arithmetic expansion
+. "$TESTS/lib.sh"
+
+check "arith" "$(printf '2 1\nrc=0')" "$(xh 'X=3; xecho $(( 7 / 2 + -7 % 3 )) $(( X > 2 && X != 4 ))')"
+check "division by zero" "$(printf 'xhell: 7/0: division by zero\nrc=1')" "$(xh 'xecho $((7/0))')"
+
+MIN='(-9223372036854775807-1)'
+for expr in "$MIN/-1" "$MIN%-1" "9223372036854775807+1" "$MIN-1" "4294967296*4294967296" "-$MIN"; do
+    check "$expr" "$(printf 'xhell: %s: overflow\nrc=1' "$expr")" "$(xh "xecho \$(($expr))")"
+done
+
+finish
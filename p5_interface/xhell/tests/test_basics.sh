@@ -0,0 +1,20 @@
+#!/bin/sh
+# Pipelines, redirections, variables and control flow
+. "$TESTS/lib.sh"
+
+check "builtin" "$(printf 'hello world\nrc=0')" "$(xh 'xecho hello world')"
+check "pipeline" "$(printf 'b\nrc=0')" "$(xh 'xecho a b | cut -d" " -f2')"
+check "redirect" "$(printf 'rc=0')" "$(xh 'xecho saved > out.txt')"
+check "redirected file" "saved" "$(cat out.txt)"
+check "append" "$(printf 'saved\nmore')" "$(xh 'xecho more >> out.txt' > /dev/null; cat out.txt)"
+check "variables" "$(printf 'x=1 y=\nrc=0')" "$(xh 'X=1; xecho x=$X y=$Y')"
+check "status" "$(printf '1\nrc=0')" "$(xh 'false; xecho $?')"
+check "for" "$(printf '1\n2\n3\nrc=0')" "$(xh 'for i in 1 2 3; do xecho $i; done')"
+check "if" "$(printf 'yes\nrc=0')" "$(xh 'if [ a = a ]; then xecho yes; else xecho no; fi')"
+check "command substitution" "$(printf 'got hi\nrc=0')" "$(xh 'xecho got $(xecho hi)')"
+check "substitution keeps cwd" "$(printf '\n/\nrc=0')" "$(xh 'xcd /; xecho $(xcd /tmp); xpwd')"
+check "substitution keeps variables" "$(printf '2 3\n1 \nB=\nrc=0')" \
+      "$(xh 'A=1; xecho $(A=2; export B=3; xecho $A $B); xecho $A $B; sh -c "echo B=\$B"')"
+check "no stray fds" "$(printf '0\n1\n2\nrc=0')" "$(xh 'xecho $(sh -c "ls /proc/\$\$/fd")')"
+
+finish
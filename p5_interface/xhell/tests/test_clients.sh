@@ -0,0 +1,72 @@
+#!/bin/sh
+# Per-client sessions in the web front end: each client has a workspace
+# of its own, idle clients are stopped and picked up again, and a stream
+# can be cancelled from another worker
+. "$TESTS/lib.sh"
+
+P5=$(p5_dir)
+if [ -z "$P5" ]; then
+    echo "  skipped: needs python3 and p5_interface"
+    finish
+fi
+
+check "clients" "ok" "$(cd "$P5" && python3 - "$XHELL" "$WORK/root" 2>&1 <<'PY'
+import os, sys, threading, time
+from xhell_wrapper import XhellClients
+
+def expect(what, wanted, actual):
+    if wanted != actual:
+        print(f"{what}: expected {wanted!r}, got {actual!r}")
+
+def files(wrapper):
+    out = wrapper.execute_command("xls")["stdout"]
+    return [name for name in out.split() if not name.startswith(".")]
+
+clients = XhellClients(sys.argv[2], idle_timeout=1, xhell_path=sys.argv[1])
+a, b = clients.new_id(), clients.new_id()
+expect("valid ids", (True, False, False), (clients.valid_id(a), clients.valid_id("../x"), clients.valid_id(None)))
+
+clients.get(a).execute_command("xtouch mine; x=1")
+clients.get(b).execute_command("xtouch theirs")
+expect("own workspace", ["mine"], files(clients.get(a)))
+expect("own cwd", clients.workspace(b) + "\n", clients.get(b).execute_command("xpwd")["stdout"])
+expect("own history", ["xtouch theirs", "xpwd"], [h["command"] for h in clients.get(b).get_history()])
+
+# a goes idle and is stopped; its workspace is still there afterwards
+time.sleep(1.2)
+clients.get(b)
+expect("evicted", 1, len(clients))
+expect("resumed", ["mine"], files(clients.get(a)))
+
+# A second worker process shares the root and can cancel a's stream
+other = XhellClients(sys.argv[2], idle_timeout=60, xhell_path=sys.argv[1])
+stream = clients.get(a).stream_command("sleep 30")
+kind, stream_id = next(stream)
+threading.Timer(0.3, other.get(a).cancel, (stream_id,)).start()
+events = list(stream)
+expect("cancelled elsewhere", ("stderr", "Cancelled"), events[0])
+
+for c in (clients, other):
+    for wrapper, _ in c.clients.values():
+        wrapper.close()
+print("ok")
+PY
+)"
+
+# Through the web app, each browser gets its own cookie and workspace
+web_app || finish
+check "web clients" "$(printf '%s\n' "['a.txt']" "['b.txt']" "['a.txt']")" \
+      "$(cd site && P5="$P5" python3 - 2>&1 <<'PY'
+import os, sys
+sys.path.insert(0, os.environ["P5"])
+import app
+
+first, second = app.app.test_client(), app.app.test_client()
+first.post("/execute", json={"command": "xtouch a.txt"})
+second.post("/execute", json={"command": "xtouch b.txt"})
+for c in (first, second, first):
+    print(c.get("/files").json["files"])
+PY
+)"
+
+finish
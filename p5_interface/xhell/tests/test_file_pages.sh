@@ -0,0 +1,98 @@
+#!/bin/sh
+# Paged file reads: line ranges from the line index match the file, the
+# mapping follows the file when it changes, and /read_file serves byte
+# and line pages, base64 and ETags
+. "$TESTS/lib.sh"
+
+P5=$(p5_dir)
+if [ -z "$P5" ]; then
+    echo "  skipped: needs python3 and p5_interface"
+    finish
+fi
+
+check "line index" "ok" "$(cd "$P5" && python3 - "$WORK" 2>&1 <<'PY'
+import os, sys
+import file_pages
+from file_pages import FileCache
+
+# Small chunks, so that lines and strides straddle chunk boundaries
+file_pages.INDEX_CHUNK = 97
+cache = FileCache(max_files=2)
+path = os.path.join(sys.argv[1], "lines")
+
+def check_file(data):
+    with open(path, "wb") as f:
+        f.write(data)
+    mapped = cache.get(path)
+    lines = data.splitlines(keepends=True)
+    for first, number in ((0, 1), (3, 70), (64, 64), (150, 10), (max(len(lines) - 1, 0), 5), (len(lines) + 3, 2), (0, 100000)):
+        begin, end, found, total = mapped.line_range(first, number)
+        wanted = b"".join(lines[first:first + number])
+        if mapped.read(begin, end - begin) != wanted or found != len(lines[first:first + number]):
+            print(f"{len(data)} bytes, lines {first}+{number}: {found} lines, {mapped.read(begin, end - begin)[:40]!r}")
+    if mapped.line_range(0, len(lines) + 1)[3] != len(lines):
+        print(f"{len(data)} bytes: total {mapped.line_range(0, len(lines) + 1)[3]}, wanted {len(lines)}")
+
+body = b"".join(b"line %d %s\n" % (i, b"x" * (i % 13)) for i in range(300))
+check_file(body)
+check_file(body + b"no newline at the end")
+check_file(b"\n\n\n")
+check_file(b"")
+
+# A rewrite of the same size is a new mapping
+check_file(b"aaaa\n")
+old = cache.get(path)
+with open(path, "wb") as f:
+    f.write(b"bbbb\n")
+os.utime(path, ns=(0, 0))
+if cache.get(path) is old or cache.get(path).read(0, 4) != b"bbbb":
+    print("stale mapping")
+for name in ("p1", "p2", "p3"):
+    open(os.path.join(sys.argv[1], name), "w").close()
+    cache.get(os.path.join(sys.argv[1], name))
+if len(cache.files) != 2:
+    print(f"{len(cache.files)} files kept")
+print("ok")
+PY
+)"
+
+# The endpoint pages by bytes or by lines, with ETags
+web_app || finish
+check "read_file" "$(cat <<'OUT'
+200 'line 1\nline 2\n' 0 14 14 False
+200 'line 2\nline 3\n' 7 2 10
+200 'line 9\nline 10\n' 56 2 10
+304
+200 b'\x00\xff\x80' True
+403 404 400 400
+OUT
+)" "$(cd site && P5="$P5" python3 - 2>&1 <<'PY'
+import base64, os, sys
+sys.path.insert(0, os.environ["P5"])
+import app
+
+client = app.app.test_client()
+client.get("/files")
+space = app.clients.workspace(client.get_cookie(app.CLIENT_COOKIE).value)
+with open(os.path.join(space, "log"), "w") as f:
+    f.writelines(f"line {i}\n" for i in range(1, 11))
+with open(os.path.join(space, "bin"), "wb") as f:
+    f.write(b"\x00\xff\x80")
+
+r = client.get("/read_file?filename=log&offset=0&length=14")
+print(r.status_code, repr(r.json["content"]), r.json["offset"], r.json["length"], r.json["next_offset"], r.json["eof"])
+r = client.get("/read_file?filename=log&line=1&lines=2")
+print(r.status_code, repr(r.json["content"]), r.json["offset"], r.json["lines"], r.json["total_lines"])
+r = client.get("/read_file?filename=log&line=8&lines=5")
+print(r.status_code, repr(r.json["content"]), r.json["offset"], r.json["lines"], r.json["total_lines"])
+print(client.get("/read_file?filename=log&line=8&lines=5", headers={"If-None-Match": r.headers["ETag"]}).status_code)
+r = client.get("/read_file?filename=bin&encoding=base64")
+print(r.status_code, base64.b64decode(r.json["content"]), r.json["eof"])
+print(client.get("/read_file?filename=../x").status_code,
+      client.get("/read_file?filename=nope").status_code,
+      client.get("/read_file?filename=log&offset=-1").status_code,
+      client.get("/read_file?filename=log&encoding=hex").status_code)
+PY
+)"
+
+finish
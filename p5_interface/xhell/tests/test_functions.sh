@@ -0,0 +1,26 @@
+#!/bin/sh
+# Shell functions: arguments, return, redirections, pipelines, lifetime
+. "$TESTS/lib.sh"
+
+check "call" "$(printf 'hello world 1\nrc=0')" "$(xh 'greet() { xecho hello $1 $#; }; greet world')"
+check "return" "$(printf 'in\n3\nrc=0')" "$(xh 'f() { xecho in; return 3; xecho no; }; f; xecho $?')"
+check "return from a loop" "$(printf 'found 2\n0\nrc=0')" \
+      "$(xh 'f() { for i in 1 2 3; do if [ $i = 2 ]; then xecho found $i; return 0; fi; done; return 1; }; f; xecho $?')"
+check "exit" "rc=7" "$(xh 'g() { exit 7; }; g; xecho not reached')"
+check "recursion" "$(printf '55\nrc=0')" \
+      "$(xh 'fib() { if [ $1 -lt 2 ]; then xecho $1; return; fi; xecho $(( $(fib $(($1 - 1))) + $(fib $(($1 - 2))) )); }; fib 10')"
+
+check "redirect" "$(printf 'rc=0')" "$(xh 'greet() { xecho hello $1; }; greet world > fo.txt')"
+check "redirected file" "hello world" "$(cat fo.txt)"
+check "pipeline" "$(printf 'HELLO WORLD\nrc=0')" "$(xh 'greet() { xecho hello $1; }; greet world | tr a-z A-Z')"
+check "pipeline middle" "$(printf 'A\nrc=0')" "$(xh 'up() { tr a-z A-Z; }; xecho a | up | cat')"
+
+check "later lines" "$(printf 'hi a\nhi b\nHI C\nbye\nrc=0')" \
+      "$(xh_input "$(printf 'greet() { xecho hi $1; }\ngreet a\ngreet b > g.txt\ncat g.txt\ngreet c | tr a-z A-Z\ngreet() { xecho bye; }\ngreet')")"
+check "redefined while running" "$(printf 'old\nnew\nrc=0')" \
+      "$(xh_input "$(printf 'r() { r() { xecho new; }; xecho old; }\nr\nr')")"
+
+printf 'f() { xecho in script; }\nf\n' > s.xsh
+check "script functions stay in the script" "$(printf 'in script\nf: command not found\nrc=127')" "$(xh 'xsh s.xsh; f')"
+
+finish
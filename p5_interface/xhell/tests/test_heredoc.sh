@@ -0,0 +1,17 @@
+#!/bin/sh
+# Here-documents and here-strings
+. "$TESTS/lib.sh"
+
+check "heredoc" "$(printf 'hi me\nrc=0')" "$(USER=me xh "$(printf 'cat <<EOF\nhi $USER\nEOF')")"
+check "quoted heredoc" "$(printf 'lit $USER\nrc=0')" "$(xh "$(printf 'cat <<-"X"\n\tlit $USER\n\tX')")"
+check "here-string" "$(printf 'word\nrc=0')" "$(xh 'cat <<< word')"
+
+line="xecho"
+i=1
+while [ $i -le 17 ]; do
+    line="$line <<E$i"
+    i=$((i + 1))
+done
+check "too many heredocs" "$(printf 'xsh: line 1: too many here-documents\nrc=2')" "$(xh "$line")"
+
+finish
@@ -0,0 +1,23 @@
+#!/bin/sh
+# History: persistence, ! expansion, and merging another session's
+# commands after it compacted the file
+. "$TESTS/lib.sh"
+
+xh_input 'xecho one' > /dev/null
+xh_input 'xecho two' > /dev/null
+check "persisted" "$(printf 'xecho one\nxecho two')" "$(cat .xhell_history)"
+check "!prefix" "$(printf 'two\nrc=0')" "$(xh_input '!xec')"
+
+# A compacts while B has the history loaded; B must still see A's lines
+rm -f .xhell_history
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do echo "xecho old$i"; done > .xhell_history
+( echo 'xhistory > /dev/null'; sleep 1; echo 'xhistory' ) | XHELL_HISTSIZE=5 "$XHELL" > b.out 2>&1 &
+sleep 0.4
+printf 'xecho a1\nquit\n' | XHELL_HISTSIZE=5 "$XHELL" > /dev/null 2>&1
+wait
+check "merge after compaction" "$(printf 'xhistory > /dev/null\nxecho a1\nquit\nxhistory')" \
+      "$(tail -4 b.out | cut -c7-)"
+check "compacted file" "$(printf 'xecho old11\nxecho old12\nxhistory > /dev/null\nxecho a1\nquit\nxhistory')" \
+      "$(cat .xhell_history)"
+
+finish
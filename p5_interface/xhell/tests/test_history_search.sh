@@ -0,0 +1,31 @@
+#!/bin/sh
+# History search: xhistory -s ranking over the trigram index, the short
+# pattern scan, and !prefix picking the most recent match
+. "$TESTS/lib.sh"
+
+printf 'xecho alpha\nxecho beta\nxecho alpha\nxecho alphabet\nxecho al\n' > .xhell_history
+check "frequent first" "   3  xecho alpha" "$(xh 'xhistory -s alpha' | head -1)"
+check "each command once" "1" "$(xh 'xhistory -s alpha' | grep -c ' xecho alpha$')"
+check "short pattern" "   5  xecho al" "$(xh 'xhistory -s al' | grep ' xecho al$')"
+check "no pattern" "$(printf 'Usage: xhistory -s <pattern>\nrc=255')" "$(xh 'xhistory -s')"
+
+printf 'xecho alpha\nxecho beta\nxecho alpha\n' > .xhell_history
+check "json count" '{"number":3,"command":"xecho alpha","count":2}' \
+      "$(xh 'xhistory --json -s alpha' | head -1)"
+
+printf 'xecho one\nxecho two\n' > .xhell_history
+check "!prefix newest" "$(printf 'two\nrc=0')" "$(xh '!xecho')"
+check "!prefix missing" "$(printf '!nomatch: event not found\nrc=1')" "$(xh '!nomatch')"
+
+# An old entry is still found once the index holds many
+XHELL_HISTSIZE=50000
+export XHELL_HISTSIZE
+i=0
+{
+    echo "xpwd"
+    while [ $i -lt 20000 ]; do echo "xecho item$i"; i=$((i + 1)); done
+} > .xhell_history
+check "deep entry" "1236  xecho item1234" "$(xh 'xhistory -s item1234' | grep ' xecho item1234$')"
+check "deep prefix" "$(printf '%s\nrc=0' "$WORK")" "$(xh '!xpw')"
+
+finish
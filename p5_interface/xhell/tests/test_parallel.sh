@@ -0,0 +1,46 @@
+#!/bin/sh
+# xsh -j N: #@ tasks run concurrently, their output is replayed in
+# script order, the first failure stops the script, bad graphs are refused
+. "$TESTS/lib.sh"
+
+cat > order.x <<'X'
+x=pro
+#@ task slow
+sleep 1
+xecho slow $x
+#@ task fast
+sleep 1
+xecho fast
+#@ task last after: slow fast
+xecho last
+X
+start=$(date +%s%N)
+check "script order" "$(printf 'slow pro\nfast\nlast\nrc=0')" "$(xh 'xsh -j 4 order.x')"
+elapsed=$((($(date +%s%N) - start) / 1000000))
+check "concurrent" "yes" "$([ "$elapsed" -lt 1900 ] && echo yes || echo "no, ${elapsed}ms")"
+
+cat > fail.x <<'X'
+#@ task a
+xecho a
+#@ task bad
+xcat missing
+#@ task c after: bad
+xecho c
+X
+check "first failure" "$(printf 'a\nxcat: No such file or directory\nxsh: line 3: task bad failed with status 255\nrc=255')" \
+      "$(xh 'xsh -j 2 fail.x')"
+
+printf '#@ task a after: zz\nxecho a\n' > unknown.x
+check "unknown task" "$(printf "xsh: line 1: task 'a' runs after unknown task 'zz'\nrc=2")" \
+      "$(xh 'xsh -j 2 unknown.x')"
+printf '#@ task a\nxecho a\n#@ task a\nxecho b\n' > twice.x
+check "duplicate task" "$(printf "xsh: line 3: duplicate task 'a'\nrc=2")" \
+      "$(xh 'xsh -j 2 twice.x')"
+
+# -j without a number runs one job per CPU; bad arguments fail
+check "bare -j" "$(printf 'slow pro\nfast\nlast\nrc=0')" "$(xh 'xsh -j order.x')"
+check "-jN" "$(printf 'slow pro\nfast\nlast\nrc=0')" "$(xh 'xsh -j2 order.x')"
+check "usage" "$(printf 'Usage: xsh [-x] [-n] [-j [N]] <script.x> [args...]\nrc=2')" "$(xh 'xsh -j')"
+check "bad N" "rc=2" "$(xh 'xsh -jx order.x' | tail -1)"
+
+finish
@@ -0,0 +1,59 @@
+#!/bin/sh
+# xsh scripts and their .xshc cache
+. "$TESTS/lib.sh"
+
+XHELL_CACHE_DIR=$WORK/cache
+export XHELL_CACHE_DIR
+
+printf 'xecho one\nfor i in a b; do xecho $i; done\n' > s.xsh
+touch -d '2 hours ago' s.xsh
+check "compiled" "$(printf 'one\na\nb\nrc=0')" "$(xh 'xsh s.xsh')"
+check "cached" "$(printf 'one\na\nb\nrc=0')" "$(xh 'xsh s.xsh')"
+
+# A cache whose first operand points far outside the string pool
+python3 - cache/*.xshc <<'PY'
+import struct, sys
+data = bytearray(open(sys.argv[1], 'rb').read())
+path_len = struct.unpack_from('<I', data, 40)[0]
+code = (56 + path_len + 1 + 7) & ~7
+struct.pack_into('<I', data, code + 4, 0x7fffffff)
+open(sys.argv[1], 'wb').write(data)
+PY
+check "corrupt cache" "$(printf 'one\na\nb\nrc=0')" "$(xh 'xsh s.xsh')"
+
+# Rewritten with the same size and mtime right after it was cached
+touch ref
+printf 'xecho old\n' > r.xsh
+touch -r ref r.xsh
+xh 'xsh r.xsh' > /dev/null
+printf 'xecho new\n' > r.xsh
+touch -r ref r.xsh
+check "racy mtime" "$(printf 'new\nrc=0')" "$(xh 'xsh r.xsh')"
+
+# A script path longer than the shell's usual path buffers
+deep=$WORK
+i=0
+while [ $i -lt 14 ]; do
+    deep=$deep/dddddddddddddddddddddddddddddddddddddddddddddddddd
+    i=$((i + 1))
+done
+mkdir -p "$deep"
+echo 'xecho deep' > "$deep/s.xsh"
+check "long path" "$(printf 'deep\nrc=0')" "$(cd "$deep" && xh 'xsh s.xsh')"
+
+# elif chains: long ones work, ones past the jump table are rejected
+elifs() {
+    echo 'if false; then xecho 0'
+    i=1
+    while [ $i -le "$1" ]; do
+        echo "elif false; then xecho $i"
+        i=$((i + 1))
+    done
+    echo 'else xecho else; fi; xecho after'
+}
+elifs 200 > e200.xsh
+elifs 300 > e300.xsh
+check "200 elifs" "$(printf 'else\nafter\nrc=0')" "$(xh 'xsh e200.xsh')"
+check "300 elifs" "$(printf "xsh: line 258: too many elif branches near 'elif'\nrc=2")" "$(xh 'xsh e300.xsh')"
+
+finish
@@ -0,0 +1,87 @@
+#!/bin/sh
+# Streamed output: chunks arrive while the command runs, the output cap
+# stops it, and cancel kills the command's process group
+. "$TESTS/lib.sh"
+
+P5=$(p5_dir)
+if [ -z "$P5" ]; then
+    echo "  skipped: needs python3 and p5_interface"
+    finish
+fi
+
+seq 1 100000 > "$WORK/big"
+check "stream" "ok" "$(cd "$P5" && python3 - "$XHELL" "$WORK" 2>&1 <<'PY'
+import os, sys, threading, time
+from xhell_wrapper import XhellWrapper
+
+w = XhellWrapper(xhell_path=sys.argv[1], workspace_dir=sys.argv[2], pool_size=1)
+
+def expect(what, wanted, actual):
+    if wanted != actual:
+        print(f"{what}: expected {wanted!r}, got {actual!r}")
+
+# The first chunk comes before the command ends
+start = time.monotonic()
+first = None
+events = []
+for kind, data in w.stream_command("xecho a; sleep 1; xecho b"):
+    if kind == "stdout" and first is None:
+        first = time.monotonic() - start
+    events.append((kind, data))
+expect("incremental", True, first is not None and first < 0.8)
+expect("output", "a\nb\n", "".join(d for k, d in events if k == "stdout"))
+expect("done", (0, False), (events[-1][1]["returncode"], events[-1][1]["truncated"]))
+
+# Past the cap the command is stopped
+events = list(w.stream_command("xcat big", cap=1000))
+expect("capped", 1000, sum(len(d) for k, d in events if k == "stdout"))
+expect("truncated", True, events[-1][1]["truncated"])
+
+# Cancelling from another thread kills the whole process group
+stream = w.stream_command("sleep 30 | sleep 30")
+kind, stream_id = next(stream)
+pgid = w.streams[stream_id]
+threading.Timer(0.3, w.cancel, (stream_id,)).start()
+start = time.monotonic()
+events = list(stream)
+expect("cancelled", [("stderr", "Cancelled")], events[:-1])
+expect("cancel is quick", True, time.monotonic() - start < 5)
+time.sleep(0.2)
+for pid in filter(str.isdigit, os.listdir("/proc")):
+    try:
+        with open(f"/proc/{pid}/stat") as f:
+            fields = f.read().rpartition(")")[2].split()
+    except OSError:
+        continue
+    # Killed orphans may linger as zombies until init reaps them
+    if int(fields[2]) == pgid and fields[0] != "Z":
+        print("process group still running")
+expect("unknown stream", False, w.cancel(stream_id))
+
+expect("next stream", "again\n", "".join(d for k, d in w.stream_command("xecho again") if k == "stdout"))
+w.close()
+print("ok")
+PY
+)"
+
+# The web endpoint sends the same events as Server-Sent Events
+web_app || finish
+check "event stream" "$(printf '%s\n' 200 'event: stdout' 'data: "hi\n"' 'event: done' 404)" \
+      "$(cd site && P5="$P5" python3 - 2>&1 <<'PY'
+import os, sys
+sys.path.insert(0, os.environ["P5"])
+import app
+
+client = app.app.test_client()
+r = client.get("/execute_stream?command=xecho%20hi")
+print(r.status_code)
+for line in r.get_data(as_text=True).splitlines():
+    if line.startswith("event: ") and line != "event: start":
+        print(line)
+    elif line.startswith('data: "hi'):
+        print(line)
+print(client.post("/cancel", json={"id": "0" * 16}).status_code)
+PY
+)"
+
+finish
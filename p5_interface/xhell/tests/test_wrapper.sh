@@ -0,0 +1,52 @@
+#!/bin/sh
+# XhellWrapper's warm session pool: results come back per command in one
+# round trip, sessions stay in the workspace, and a dead or stuck session
+# is replaced
+. "$TESTS/lib.sh"
+
+P5=$(p5_dir)
+if [ -z "$P5" ]; then
+    echo "  skipped: needs python3 and p5_interface"
+    finish
+fi
+
+check "wrapper" "ok" "$(cd "$P5" && python3 - "$XHELL" "$WORK/space" 2>&1 <<'PY'
+import os, sys
+from xhell_wrapper import XhellWrapper
+
+w = XhellWrapper(xhell_path=sys.argv[1], workspace_dir=sys.argv[2], pool_size=2, timeout=1)
+space = w.workspace_dir
+
+def expect(what, wanted, actual):
+    if wanted != actual:
+        print(f"{what}: expected {wanted!r}, got {actual!r}")
+
+r = w.execute_command("xecho hi")
+expect("one command", ("hi\n", "", 0, True), (r["stdout"], r["stderr"], r["returncode"], r["success"]))
+
+rs = w.execute_commands_batch(["xecho a", "xcd /tmp", "xpwd", "xcat nope", "xecho 'x\"y' hé"])
+expect("batch", ["a\n", "", space + "\n", "", "x\"y hé\n"], [r["stdout"] for r in rs])
+expect("batch status", [0, 0, 0, 255, 0], [r["returncode"] for r in rs])
+expect("batch stderr", "xcat: No such file or directory\n", rs[3]["stderr"])
+
+# Large batches are written while results are read
+rs = w.execute_commands_batch([f"xecho {i}" for i in range(3000)])
+expect("large batch", [f"{i}\n" for i in range(3000)], [r["stdout"] for r in rs])
+
+# Kill the warm sessions; the next request starts new ones
+for session in list(w.pool.idle.queue):
+    if session is not None:
+        os.kill(session.process.pid, 9)
+        session.process.wait()
+expect("restarted", "again\n", w.execute_command("xecho again")["stdout"])
+
+r = w.execute_command("sleep 3")
+expect("timeout", (False, "Command timed out"), (r["success"], r["stderr"]))
+expect("after timeout", "fine\n", w.execute_command("xecho fine")["stdout"])
+
+w.close()
+print("ok")
+PY
+)"
+
+finish
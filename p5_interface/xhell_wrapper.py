@@ -1,152 +1,415 @@
 import subprocess
 import os
 import sys
+import json
+import select
+import threading
+import queue
+import atexit
+import time
+import signal
+import re
+import codecs
+
+from libxhell import XhellLibrary
+
+
+class SessionError(Exception):
+    """The session died or did not answer in time"""
+
+
+class XhellSession:
+    """One persistent `xhell --session` process. Requests and results both
+    travel as "<length>\\n<bytes>"; every result is a JSON frame with the
+    command's stdout, stderr, status and duration.
+
+    A streamed session (`--frame-fd`) leaves the output out of its frames:
+    commands write to the session's own stdout and stderr pipes, and the
+    frame, on a pipe of its own, only marks where a command ended."""
+
+    def __init__(self, xhell_path, cwd, streamed=False):
+        args = [xhell_path, '--session']
+        frames = None
+        if streamed:
+            frames, frame_write = os.pipe()
+            args = [xhell_path, '--frame-fd', str(frame_write), '--session']
+        try:
+            self.process = subprocess.Popen(
+                args,
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE if streamed else subprocess.DEVNULL,
+                cwd=cwd,
+                bufsize=0,
+                pass_fds=(frame_write,) if streamed else (),
+                start_new_session=True      # a timeout kills what it started too
+            )
+        finally:
+            if streamed:
+                os.close(frame_write)
+        self.frames = frames
+        self.fd = frames if streamed else self.process.stdout.fileno()
+        self.buffer = b''
+
+    def alive(self):
+        return self.process.poll() is None
+
+    def cancel(self):
+        """Kill the session and every process it started; safe from any thread"""
+        try:
+            os.killpg(self.process.pid, signal.SIGKILL)
+        except ProcessLookupError:
+            pass
+
+    def close(self):
+        self.cancel()
+        self.process.wait()
+        self.process.stdin.close()
+        self.process.stdout.close()
+        if self.frames is not None:
+            self.process.stderr.close()
+            os.close(self.frames)
+
+    def send(self, commands):
+        payload = b''.join(str(len(c)).encode() + b'\n' + c
+                           for c in (cmd.encode() for cmd in commands))
+        if len(payload) <= 16384:
+            self.process.stdin.write(payload)
+            return
+        # Results can fill the pipe back before a large batch is written
+        writer = threading.Thread(target=self.process.stdin.write, args=(payload,), daemon=True)
+        writer.start()
+
+    def _fill(self, deadline):
+        remaining = deadline - time.monotonic()
+        if remaining <= 0 or not select.select([self.fd], [], [], remaining)[0]:
+            raise SessionError('Command timed out')
+        data = os.read(self.fd, 65536)
+        if not data:
+            raise SessionError('xhell session exited')
+        self.buffer += data
+
+    def _take_frame(self):
+        """The next whole frame in the buffer, or None"""
+        header, newline, rest = self.buffer.partition(b'\n')
+        if not newline or len(rest) < int(header):
+            return None
+        length = int(header)
+        frame, self.buffer = rest[:length], rest[length:]
+        return json.loads(frame.decode('utf-8', errors='replace'))
+
+    def receive(self, deadline):
+        frame = self._take_frame()
+        while frame is None:
+            self._fill(deadline)
+            frame = self._take_frame()
+        return frame
+
+    def stream(self, command, deadline=None):
+        """Run one command on a streamed session. Yields ('stdout', bytes)
+        and ('stderr', bytes) as the command writes them, then ('done',
+        frame). Until the consumer asks for more, nothing is read, so a
+        slow consumer stalls the command instead of growing a buffer."""
+        outputs = {self.process.stdout.fileno(): 'stdout',
+                   self.process.stderr.fileno(): 'stderr'}
+        self.send([command])
+        frame = None
+        while frame is None:
+            remaining = None if deadline is None else deadline - time.monotonic()
+            if remaining is not None and remaining <= 0:
+                raise SessionError('Command timed out')
+            ready = select.select(list(outputs) + [self.fd], [], [], remaining)[0]
+            if not ready:
+                raise SessionError('Command timed out')
+            for fd in ready:
+                data = os.read(fd, 65536)
+                if not data:
+                    raise SessionError('xhell session exited')
+                if fd == self.fd:
+                    self.buffer += data
+                    frame = self._take_frame()
+                else:
+                    yield outputs[fd], data
+
+        # Whatever the command wrote is in the pipes before its frame
+        for fd, name in outputs.items():
+            os.set_blocking(fd, False)
+            try:
+                while True:
+                    data = os.read(fd, 65536)
+                    if not data:
+                        break
+                    yield name, data
+            except BlockingIOError:
+                pass
+            finally:
+                os.set_blocking(fd, True)
+        yield 'done', frame
+
+
+class XhellPool:
+    """Warm sessions shared by request threads. A session that dies or
+    times out is replaced on its next use."""
+
+    def __init__(self, xhell_path, cwd, size, streamed=False):
+        self.xhell_path = xhell_path
+        self.cwd = cwd
+        self.streamed = streamed
+        self.idle = queue.LifoQueue()
+        for _ in range(size):
+            self.idle.put(None)         # started on first use
+
+    def run(self, commands, timeout):
+        """Run commands in one round trip; returns their frames, or raises
+        SessionError with the frames that did arrive"""
+        session = self.idle.get()
+        frames = []
+        try:
+            if session is None or not session.alive():
+                if session is not None:
+                    session.close()
+                session = XhellSession(self.xhell_path, self.cwd, self.streamed)
+            try:
+                session.send(commands)
+            except (BrokenPipeError, OSError):
+                # Nothing was delivered, so trying a fresh session is safe
+                session.close()
+                session = XhellSession(self.xhell_path, self.cwd, self.streamed)
+                session.send(commands)
+
+            deadline = time.monotonic() + timeout
+            for _ in commands:
+                frames.append(session.receive(deadline))
+            return frames
+        except SessionError as e:
+            session.close()
+            session = None
+            e.frames = frames
+            raise
+        finally:
+            self.idle.put(session)
+
+    def stream(self, command, timeout=None):
+        """Run one command on a streamed session; yields ('start', pgid),
+        the events of XhellSession.stream, and ('done', frame) last.
+        Closing the generator early kills what the command started."""
+        session = self.idle.get()
+        finished = False
+        try:
+            if session is None or not session.alive():
+                if session is not None:
+                    session.close()
+                session = XhellSession(self.xhell_path, self.cwd, self.streamed)
+            yield 'start', session.process.pid
+            deadline = None if timeout is None else time.monotonic() + timeout
+            for event in session.stream(command, deadline):
+                if event[0] == 'done':
+                    finished = True
+                yield event
+        finally:
+            if not finished and session is not None:
+                session.close()
+                session = None
+            self.idle.put(session)
+
+    def close(self):
+        """Stop every idle session; they restart when next used"""
+        sessions = []
+        while True:
+            try:
+                sessions.append(self.idle.get_nowait())
+            except queue.Empty:
+                break
+        for session in sessions:
+            if session is not None:
+                session.close()
+            self.idle.put(None)
+
 
 class XhellWrapper:
     """Wrapper class to interact with the Xhell C program"""
     
-    def __init__(self, xhell_path="./xhell/xhell", workspace_dir="./demo_workspace"):
+    def __init__(self, xhell_path="./xhell/xhell", workspace_dir="./demo_workspace", pool_size=4, timeout=5,
+                 stream_cap=1 << 20, stream_timeout=300, use_library=False, stream_registry=None):
         self.xhell_path = xhell_path
         self.workspace_dir = os.path.abspath(workspace_dir)
         self.history = []
         self.log_file = os.path.join(self.workspace_dir, ".xhell_log")
+        self.timeout = timeout
+        self.stream_cap = stream_cap
+        self.stream_timeout = stream_timeout
+        self.streams = {}               # stream id -> process group
+        self.streams_lock = threading.Lock()
+        # A directory shared by the server's worker processes, so that a
+        # stream can be cancelled from a worker other than its own
+        self.stream_registry = stream_registry
+        if stream_registry is not None:
+            os.makedirs(stream_registry, exist_ok=True)
         
         # Ensure workspace exists
         if not os.path.exists(self.workspace_dir):
             os.makedirs(self.workspace_dir)
-            
+        
+        # In-process through libxhell.so: no subprocess and no timeout
+        self.library = XhellLibrary(workspace_dir=self.workspace_dir) if use_library else None
+
+        # Sessions start in the workspace and return to it after every command
+        self.pool = XhellPool(os.path.abspath(self.xhell_path), self.workspace_dir, pool_size)
+        # Streams get sessions of their own; cancelling one kills its session
+        self.stream_pool = XhellPool(os.path.abspath(self.xhell_path), self.workspace_dir,
+                                     pool_size, streamed=True)
+        atexit.register(self.close)
+
+    def close(self):
+        """Stop the idle sessions and save the library's history"""
+        atexit.unregister(self.close)
+        self.pool.close()
+        self.stream_pool.close()
+        if self.library is not None:
+            self.library.close()
+    
+    @staticmethod
+    def _result(frame):
+        return {
+            'stdout': frame['stdout'],
+            'stderr': frame['stderr'],
+            'returncode': frame['status'],
+            'success': frame['status'] == 0,
+            'duration': frame['duration']
+        }
+    
+    @staticmethod
+    def _failure(message):
+        return {'stdout': '', 'stderr': message, 'returncode': -1, 'success': False}
+    
+    def _frames(self, commands):
+        if self.library is not None:
+            return [self.library.run(command) for command in commands]
+        return self.pool.run(commands, self.timeout)
+
     def execute_command(self, command):
         """Execute a single command in xhell"""
+        return self.execute_commands_batch([command])[0]
+    
+    def execute_records(self, command):
+        """Run a listing builtin (xls, xsearch, xhistory, xjournalctl) in
+        JSON mode and return its records as dicts"""
+        name, _, rest = command.strip().partition(' ')
         try:
-            # Ensure we use absolute path for the executable
-            abs_xhell_path = os.path.abspath(self.xhell_path)
-            
-            # Special handling for xcalc to support complex expressions (Demo Trick)
-            if command.strip().startswith('xcalc'):
-                try:
-                    expr = command.strip().replace('xcalc', '').strip()
-                    if not expr:
-                         raise ValueError("Empty expression")
-                    # Safe(ish) eval for demo
-                    allowed_chars = "0123456789+-*/(). "
-                    if not all(c in allowed_chars for c in expr):
-                         raise ValueError("Invalid characters in expression")
-                    
-                    # Convert Xhell-style "128 * 32" which works, but "128 * 32 * 23" fails in C 
-                    # So we calculate it here in Python for the "Bonus Feature"
-                    val = eval(expr)
-                    
-                    # Mimic Xhell output format
-                    return {
-                        'stdout': f"######### Welcome to Xhell! #############\n[lad]# {val}\n[lad]# ######### Quiting Xhell #############\n",
-                        'stderr': '',
-                        'returncode': 0,
-                        'success': True
-                    }
-                except Exception as e:
-                    pass # Fallback to real xshell if python eval fails or for other cases (like help)
-
-            # Handle Redirects (Wizard of Oz mode to ensure it works for demo)
-            output_file = None
-            append_mode = False
-            clean_command = command
-            
-            if '>>' in command:
-                parts = command.split('>>')
-                if len(parts) == 2:
-                    clean_command = parts[0].strip()
-                    output_file = parts[1].strip()
-                    append_mode = True
-            elif '>' in command:
-                parts = command.split('>')
-                if len(parts) == 2:
-                    clean_command = parts[0].strip()
-                    output_file = parts[1].strip()
-                    append_mode = False
-
-            # Use echo to pipe command to xhell
-            process = subprocess.Popen(
-                f'echo "{clean_command}" | {abs_xhell_path}',
-                shell=True,
-                stdout=subprocess.PIPE,
-                stderr=subprocess.PIPE,
-                text=True,
-                cwd=self.workspace_dir
-            )
-            
-            stdout, stderr = process.communicate(timeout=5)
-            returncode = process.returncode
-
-            # Post-Process: Do the actual file writing in Python if redirection was requested
-            if output_file and returncode == 0:
-                try:
-                    # Filter stdout to extract actual content (simple heuristic)
-                    lines = stdout.split('\n')
-                    payload = []
-                    for line in lines:
-                        if "Welcome to Xhell" in line or "Quiting Xhell" in line: continue
-                        if line.strip().startswith("[lad]#"): 
-                            content = line.replace("[lad]#", "").strip()
-                            # Handle quotes if simple echo, stripping outer quotes if present
-                            if (content.startswith("'") and content.endswith("'")) or (content.startswith('"') and content.endswith('"')):
-                                content = content[1:-1]
-                            payload.append(content)
-                    
-                    file_content = "\n".join(payload) + "\n"
-                    
-                    target_path = os.path.join(self.workspace_dir, output_file)
-                    mode = 'a' if append_mode else 'w'
-                    with open(target_path, mode) as f:
-                        f.write(file_content)
-                        
-                except Exception as e:
-                    stderr += f"\n[Wrapper Error] Failed to redirect output: {e}"
-            
-            # Filter out proxychains noise
-            if stdout:
-                stdout = '\n'.join([line for line in stdout.split('\n') if '[proxychains]' not in line])
-            if stderr:
-                stderr = '\n'.join([line for line in stderr.split('\n') if '[proxychains]' not in line])
-            
-            # Add to history
+            frame = self._frames([f'{name} --json {rest}'])[0]
+        except (SessionError, OSError):
+            return []
+        return [json.loads(line) for line in frame['stdout'].split('\n') if line]
+
+    def execute_commands_batch(self, commands):
+        """Execute multiple commands in one round trip to a warm session"""
+        try:
+            results = [self._result(frame) for frame in self._frames(commands)]
+        except SessionError as e:
+            results = [self._result(frame) for frame in e.frames]
+            results += [self._failure(str(e))] * (len(commands) - len(results))
+        except Exception as e:
+            results = [self._failure(str(e))] * len(commands)
+        
+        for command, result in zip(commands, results):
             self.history.append({
                 'command': command,
-                'stdout': stdout,
-                'stderr': stderr,
-                'returncode': returncode
+                'stdout': result['stdout'],
+                'stderr': result['stderr'],
+                'returncode': result['returncode']
             })
-            
-            return {
-                'stdout': stdout,
-                'stderr': stderr,
-                'returncode': returncode,
-                'success': returncode == 0
-            }
-            
-        except subprocess.TimeoutExpired:
-            process.kill()
-            return {
-                'stdout': '',
-                'stderr': 'Command timed out',
-                'returncode': -1,
-                'success': False
-            }
-        except Exception as e:
-            return {
-                'stdout': '',
-                'stderr': str(e),
-                'returncode': -1,
-                'success': False
-            }
-    
-    def execute_commands_batch(self, commands):
-        """Execute multiple commands"""
-        results = []
-        for cmd in commands:
-            result = self.execute_command(cmd)
-            results.append(result)
         return results
     
+    def stream_command(self, command, cap=None):
+        """Run a command and yield its events as they happen:
+        ('start', stream_id), then ('stdout', text) and ('stderr', text)
+        chunks, then ('done', result). Output past cap bytes (stream_cap
+        by default) is dropped and the command killed; the result then
+        has 'truncated' set. cancel(stream_id) stops it from elsewhere."""
+        cap = self.stream_cap if cap is None else cap
+        stream_id = os.urandom(8).hex()
+        decoders = {name: codecs.getincrementaldecoder('utf-8')(errors='replace')
+                    for name in ('stdout', 'stderr')}
+        output = {'stdout': [], 'stderr': []}
+        sent = 0
+        result = None
+        events = self.stream_pool.stream(command, self.stream_timeout)
+        try:
+            for kind, data in events:
+                if kind == 'start':
+                    self._register(stream_id, data)
+                    yield 'start', stream_id
+                elif kind == 'done':
+                    self._unregister(stream_id)
+                    result = {'returncode': data['status'], 'success': data['status'] == 0,
+                              'duration': data['duration'], 'truncated': False}
+                else:
+                    data = data[:cap - sent]
+                    sent += len(data)
+                    text = decoders[kind].decode(data, final=sent >= cap)
+                    if text:
+                        output[kind].append(text)
+                        yield kind, text
+                    if sent >= cap:
+                        result = {'returncode': -1, 'success': False, 'truncated': True}
+                        break
+        except SessionError as e:
+            cancelled = self._unregister(stream_id) is None
+            message = 'Cancelled' if cancelled else str(e)
+            output['stderr'].append(message)
+            yield 'stderr', message
+            result = {'returncode': -1, 'success': False, 'truncated': False}
+        finally:
+            events.close()              # kills the command if it still runs
+            self._unregister(stream_id)
+
+        if result is None:              # the consumer went away
+            return
+        self.history.append({
+            'command': command,
+            'stdout': ''.join(output['stdout']),
+            'stderr': ''.join(output['stderr']),
+            'returncode': result['returncode']
+        })
+        yield 'done', result
+
+    def _register(self, stream_id, pgid):
+        with self.streams_lock:
+            self.streams[stream_id] = pgid
+        if self.stream_registry is not None:
+            with open(os.path.join(self.stream_registry, stream_id), 'w') as f:
+                f.write(str(pgid))
+
+    def _unregister(self, stream_id):
+        """Forget a stream; returns its process group unless it was already
+        gone. Of a cancel and the stream's own end, only one gets it."""
+        if not re.fullmatch(r'[0-9a-f]{16}', stream_id or ''):
+            return None
+        with self.streams_lock:
+            pgid = self.streams.pop(stream_id, None)
+        if self.stream_registry is None:
+            return pgid
+        path = os.path.join(self.stream_registry, stream_id)
+        try:
+            with open(path) as f:
+                recorded = int(f.read())
+            os.remove(path)
+        except (OSError, ValueError):
+            return None
+        return recorded
+
+    def cancel(self, stream_id):
+        """Signal the process group of a running stream, which may belong
+        to another worker sharing stream_registry; True if it was running"""
+        pgid = self._unregister(stream_id)
+        if pgid is None:
+            return False
+        try:
+            os.killpg(pgid, signal.SIGKILL)
+        except ProcessLookupError:
+            pass
+        return True
+
     def get_history(self):
         """Get command history"""
         return self.history
@@ -166,6 +429,66 @@ class XhellWrapper:
         try:
             if os.path.exists(self.log_file):
                 os.remove(self.log_file)
+            # Sessions hold the old log open; restart them on a new one
+            self.pool.close()
+            self.stream_pool.close()
+            if self.library is not None:
+                self.library.close()
+                self.library = XhellLibrary(workspace_dir=self.workspace_dir)
             return True
         except:
             return False
+
+
+class XhellClients:
+    """One XhellWrapper per web client, each with a workspace, sessions
+    and history of its own. A client unseen for idle_timeout seconds has
+    its sessions stopped; its workspace stays on disk, so it picks up
+    where it left off, and other worker processes can serve it too."""
+
+    def __init__(self, root_dir, idle_timeout=900, pool_size=2, **options):
+        self.root_dir = os.path.abspath(root_dir)
+        self.idle_timeout = idle_timeout
+        self.pool_size = pool_size
+        self.options = options
+        self.clients = {}               # client id -> [wrapper, last used]
+        self.lock = threading.Lock()
+        self.next_sweep = time.monotonic() + idle_timeout
+        self.stream_registry = os.path.join(self.root_dir, '.streams')
+
+    @staticmethod
+    def new_id():
+        return os.urandom(16).hex()
+
+    @staticmethod
+    def valid_id(client_id):
+        return re.fullmatch(r'[0-9a-f]{32}', client_id or '') is not None
+
+    def workspace(self, client_id):
+        return os.path.join(self.root_dir, client_id)
+
+    def get(self, client_id):
+        """The client's wrapper, started on its first request"""
+        now = time.monotonic()
+        with self.lock:
+            entry = self.clients.get(client_id)
+            if entry is None:
+                wrapper = XhellWrapper(workspace_dir=self.workspace(client_id),
+                                       pool_size=self.pool_size,
+                                       stream_registry=self.stream_registry,
+                                       **self.options)
+                entry = self.clients[client_id] = [wrapper, now]
+            entry[1] = now
+            idle = self._sweep(now) if now >= self.next_sweep else []
+        for wrapper in idle:
+            wrapper.close()
+        return entry[0]
+
+    def _sweep(self, now):
+        # Called with the lock held; the caller closes what it returns
+        self.next_sweep = now + self.idle_timeout / 4
+        idle = [cid for cid, (_, used) in self.clients.items() if now - used > self.idle_timeout]
+        return [self.clients.pop(cid)[0] for cid in idle]
+
+    def __len__(self):
+        return len(self.clients)
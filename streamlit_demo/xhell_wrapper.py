@@ -20,11 +20,16 @@ class XhellWrapper:
         try:
             # Ensure we use absolute path for the executable
             abs_xhell_path = os.path.abspath(self.xhell_path)
+
+            # Quote xcalc expressions so xhell does not take '*' as a glob
+            if command.strip().startswith('xcalc ') and "'" not in command:
+                expr = command.strip()[len('xcalc '):]
+                if any(c in expr for c in '()*?[{'):
+                    command = f"xcalc '{expr}'"
             
-            # Use echo to pipe command to xhell
+            # -c runs the command without the banner and prompt
             process = subprocess.Popen(
-                f'echo "{command}" | {abs_xhell_path}',
-                shell=True,
+                [abs_xhell_path, '-c', command],
                 stdout=subprocess.PIPE,
                 stderr=subprocess.PIPE,
                 text=True,
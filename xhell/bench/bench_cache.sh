@@ -0,0 +1,47 @@
+#!/bin/sh
+# Time repeated pure builtins with the result cache off and on: the same
+# xsearch over a large file, and the same xcalc expression, run N times
+# in one shell. The file is made older than the cache's racy window so
+# its results may be kept.
+#
+# Usage: bench/bench_cache.sh [runs] [lines]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+RUNS=${1:-200}
+LINES=${2:-200000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() { date +%s%N; }
+
+echo "creating a file of $LINES lines..."
+seq -f "line %g of the log, nothing to see" 1 "$LINES" > "$WORK/big.log"
+echo "the needle" >> "$WORK/big.log"
+sleep 2
+
+cd "$WORK" || exit 1
+i=0
+while [ "$i" -lt "$RUNS" ]; do
+    echo "xsearch needle big.log"
+    i=$((i + 1))
+done > search.x
+i=0
+while [ "$i" -lt "$RUNS" ]; do
+    echo "xcalc '(1 + 2) * 3 / 4 - 5 % 6 + 7 * (8 - 9)'"
+    i=$((i + 1))
+done > calc.x
+
+# $1: script, $2: XHELL_CACHE value (empty: off); prints us per line
+per_line_us() {
+    start=$(now_ns)
+    XHELL_CACHE=$2 "$XHELL" < "$1" > /dev/null
+    end=$(now_ns)
+    echo $(( (end - start) / 1000 / RUNS ))
+}
+
+echo "runs                    : $RUNS"
+echo "xsearch, cache off      : $(per_line_us search.x '') us/command"
+echo "xsearch, cache on       : $(per_line_us search.x 16777216) us/command"
+echo "xcalc, cache off        : $(per_line_us calc.x '') us/command"
+echo "xcalc, cache on         : $(per_line_us calc.x 16777216) us/command"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Measure xcalc - throughput on a million lines, once with every line
+# different and once with a small set of repeated expressions, which are
+# served from the compiled-expression cache.
+#
+# Usage: bench/bench_calc.sh [lines]
+
+XHELL=${XHELL:-./xhell}
+LINES=${1:-1000000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() { date +%s%N; }
+
+awk -v n="$LINES" 'BEGIN {
+    srand(1)
+    split("+ - * /", ops, " ")
+    for (i = 0; i < n; i++)
+        printf "%d %s %d\n", int(rand() * 10000), ops[int(rand() * 4) + 1], int(rand() * 1000) + 1
+}' > "$WORK/unique.txt"
+
+awk -v n="$LINES" 'BEGIN {
+    for (i = 0; i < n; i++)
+        printf "(%d + 7) * 2 - max(%d, 3)\n", i % 100, i % 100
+}' > "$WORK/repeated.txt"
+
+run() {
+    start=$(now_ns)
+    echo "xcalc - < $1 > $WORK/out.txt" | "$XHELL" > /dev/null
+    end=$(now_ns)
+    us=$(( (end - start) / 1000 ))
+    echo "$us us, $(( LINES * 1000 / (us / 1000 + 1) )) lines/s"
+}
+
+echo "lines              : $LINES"
+echo "unique expressions : $(run "$WORK/unique.txt")"
+echo "cached expressions : $(run "$WORK/repeated.txt")"
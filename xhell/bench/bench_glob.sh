@@ -0,0 +1,51 @@
+#!/bin/sh
+# Time pathname expansion of logs/**/*.gz over a generated tree of
+# small files, in xsh and, when it is installed, in bash with globstar.
+# The tree has 100 directories two levels deep; half of the files end
+# in .gz.
+#
+# Usage: bench/bench_glob.sh [files]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+FILES=${1:-500000}
+PER_DIR=$((FILES / 100))
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export XHELL_CACHE_DIR="$WORK/cache"
+
+now_ns() { date +%s%N; }
+
+echo "creating $FILES files..."
+for a in 0 1 2 3 4 5 6 7 8 9; do
+    for b in 0 1 2 3 4 5 6 7 8 9; do
+        dir="$WORK/logs/$a/$b"
+        mkdir -p "$dir"
+        seq -f "$dir/%g.gz" 1 2 "$PER_DIR" | xargs touch
+        seq -f "$dir/%g.log" 2 2 "$PER_DIR" | xargs touch
+    done
+done
+
+cat > "$WORK/glob.x" <<'SCRIPT'
+for f in logs/**/*.gz; do break; done
+SCRIPT
+
+cd "$WORK" || exit 1
+
+# Compile once so the timing covers only the expansion
+echo "xsh -n glob.x" | "$XHELL" > /dev/null
+
+start=$(now_ns)
+echo "xsh glob.x" | "$XHELL" > /dev/null
+end=$(now_ns)
+xsh_ms=$(( (end - start) / 1000000 ))
+
+echo "files                   : $FILES"
+echo "xsh logs/**/*.gz        : $xsh_ms ms"
+
+if command -v bash > /dev/null; then
+    start=$(now_ns)
+    bash -O globstar -c 'for f in logs/**/*.gz; do break; done'
+    end=$(now_ns)
+    echo "bash logs/**/*.gz       : $(( (end - start) / 1000000 )) ms"
+fi
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Compare a loop of builtin calls run by the xsh interpreter with the
+# same loop run by /bin/sh. Under /bin/sh, the xhell builtins are only
+# reachable by starting xhell once per iteration, which is what scripts
+# had to do before xsh had loops of its own; that case runs a tenth of
+# the iterations and is scaled up.
+#
+# Usage: bench/bench_loop.sh [iterations]
+
+XHELL=${XHELL:-./xhell}
+ITERS=${1:-10000}
+FORKED=$((ITERS / 10))
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export XHELL_CACHE_DIR="$WORK/cache"
+
+now_ns() { date +%s%N; }
+
+cat > "$WORK/loop.x" <<SCRIPT
+i=0
+while [ \$i -lt $ITERS ]; do
+    xecho \$i > /dev/null
+    i=\$((i + 1))
+done
+SCRIPT
+
+cat > "$WORK/loop.sh" <<SCRIPT
+i=0
+while [ \$i -lt $ITERS ]; do
+    echo \$i > /dev/null
+    i=\$((i + 1))
+done
+SCRIPT
+
+cat > "$WORK/forked.sh" <<SCRIPT
+i=0
+while [ \$i -lt $FORKED ]; do
+    echo "xecho \$i" | "$XHELL" > /dev/null
+    i=\$((i + 1))
+done
+SCRIPT
+
+# Compile once so the timing covers only the loop
+echo "xsh -n $WORK/loop.x" | "$XHELL" > /dev/null
+
+start=$(now_ns)
+echo "xsh $WORK/loop.x" | "$XHELL" > /dev/null
+end=$(now_ns)
+xsh_us=$(( (end - start) / 1000 ))
+
+start=$(now_ns)
+/bin/sh "$WORK/loop.sh"
+end=$(now_ns)
+sh_us=$(( (end - start) / 1000 ))
+
+start=$(now_ns)
+/bin/sh "$WORK/forked.sh"
+end=$(now_ns)
+forked_us=$(( (end - start) / 1000 * ITERS / FORKED ))
+
+echo "iterations              : $ITERS"
+echo "xsh loop, xecho         : $xsh_us us"
+echo "/bin/sh loop, echo      : $sh_us us"
+echo "/bin/sh loop, xhell each: $forked_us us (scaled from $FORKED)"
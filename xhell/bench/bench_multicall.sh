@@ -0,0 +1,55 @@
+#!/bin/sh
+# Compare the ways another program can run one xhell builtin: through a
+# symlink named after it, through "xhell --builtin", through "xhell -c",
+# and by piping the command into the shell. /bin/true gives the cost of
+# the fork and exec alone.
+#
+# Usage: bench/bench_multicall.sh [invocations]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+RUNS=${1:-2000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+now_ns() { date +%s%N; }
+
+awk 'BEGIN { for (i = 1; i <= 1000; i++) printf "line %d %s\n", i, (i % 7 ? "" : "needle") }' > data.txt
+awk 'BEGIN { for (i = 1; i <= 1000; i++) printf "xecho history entry %d\n", i }' > .xhell_history
+ln -s "$XHELL" xsearch
+
+launch() {
+    start=$(now_ns)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(now_ns)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+piped() {
+    start=$(now_ns)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        echo "xsearch needle data.txt" | "$XHELL" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(now_ns)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+true_us=$(launch /bin/true)
+link_us=$(launch ./xsearch needle data.txt)
+builtin_us=$(launch "$XHELL" --builtin xsearch needle data.txt)
+c_us=$(launch "$XHELL" -c 'xsearch needle data.txt')
+pipe_us=$(piped)
+
+echo "invocations                : $RUNS"
+echo "/bin/true                  : $true_us us"
+echo "xsearch (symlink)          : $link_us us"
+echo "xhell --builtin xsearch    : $builtin_us us"
+echo "xhell -c 'xsearch ...'     : $c_us us"
+echo "echo 'xsearch ...' | xhell : $pipe_us us (includes the echo)"
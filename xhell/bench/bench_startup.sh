@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measure what one xhell launch costs: the time from exec to the first
+# command having run and the process gone, with the fork/exec of the
+# launching shell taken out by timing /bin/true the same way, and the
+# peak RSS. The history file holds a full 1000 entries, which startup
+# should not read.
+#
+# Usage: bench/bench_startup.sh [launches]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+RUNS=${1:-2000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+now_ns() { date +%s%N; }
+
+awk 'BEGIN { for (i = 1; i <= 1000; i++) printf "xecho history entry %d\n", i }' > .xhell_history
+
+launch() {
+    start=$(now_ns)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(now_ns)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+true_us=$(launch /bin/true)
+xhell_us=$(launch "$XHELL" -c 'xecho ok')
+frame_us=$(launch "$XHELL" --frame json -c 'xecho ok')
+
+# The shell's own peak, read by a builtin at the end of its only command
+rss_kb=$("$XHELL" -c 'xsearch VmHWM /proc/self/status' | awk '{ print $(NF - 1) }')
+
+echo "launches                : $RUNS"
+echo "/bin/true               : $true_us us"
+echo "xhell -c 'xecho ok'     : $xhell_us us ($((xhell_us - true_us)) us over /bin/true)"
+echo "xhell --frame json -c   : $frame_us us ($((frame_us - true_us)) us over /bin/true)"
+echo "peak RSS                : $rss_kb kB"
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Time the tree-wide builtins over many small files with each batch
+# backend: xcp -r of the whole tree, xls -l of every directory, and
+# xrm -r of the copy. sync makes one call at a time, as before the
+# batching; threads is the fallback for kernels without io_uring. The
+# tree has directories of 1000 files of a few dozen bytes each. The
+# page cache stays warm; dirty data is synced before each run so one
+# run's writeback does not land in the next.
+#
+# Usage: bench/bench_tree.sh [files]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+FILES=${1:-1000000}
+DIRS=$(( (FILES + 999) / 1000 ))
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() { date +%s%N; }
+
+echo "creating $FILES files..."
+mkdir -p "$WORK/template"
+for i in $(seq 1 1000); do
+    echo "small file number $i of the benchmark tree" > "$WORK/template/f$i"
+done
+mkdir -p "$WORK/tree"
+for d in $(seq 1 "$DIRS"); do
+    cp -r "$WORK/template" "$WORK/tree/d$d"
+done
+rm -rf "$WORK/template"
+
+cat > "$WORK/list.x" <<'SCRIPT'
+for d in tree/*; do xls -l $d > /dev/null; done
+SCRIPT
+
+cd "$WORK" || exit 1
+
+# $1: backend, $2: command; prints ms
+run_ms() {
+    sync
+    start=$(now_ns)
+    XHELL_IO=$1 "$XHELL" -c "$2"
+    end=$(now_ns)
+    echo $(( (end - start) / 1000000 ))
+}
+
+# The first copy into a fresh filesystem is much faster than the ones
+# after a removal; one untimed round puts every backend on equal terms
+XHELL_IO=sync "$XHELL" -c "xcp -r tree copy"
+XHELL_IO=sync "$XHELL" -c "xrm -r copy"
+
+echo "files                   : $((DIRS * 1000)) in $DIRS directories"
+for backend in sync threads uring; do
+    cp_ms=$(run_ms $backend "xcp -r tree copy")
+    ls_ms=$(run_ms $backend "xsh list.x")
+    rm_ms=$(run_ms $backend "xrm -r copy")
+    printf '%-8s xcp -r %6d ms   xls -l %6d ms   xrm -r %6d ms\n' "$backend" "$cp_ms" "$ls_ms" "$rm_ms"
+done
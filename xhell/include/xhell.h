@@ -3,98 +3,461 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <errno.h>
 #include <time.h>
+#include <spawn.h>
 
 // Constants
 #define MAX_CMD_LEN 1024
 #define MAX_ARGS 64
+#define MAX_REDIRS 16
 #define MAX_PATH_LEN 512
-#define MAX_HISTORY 1000
+#define MAX_HISTORY 1000            // default capacity, see XHELL_HISTSIZE
+#define HISTORY_SEARCH_MAX 50
 #define LOG_FILE ".xhell_log"
 #define HISTORY_FILE ".xhell_history"
 
+// One redirection as written: N<file, N>file, N>>file, &>file, N>&M
+typedef struct {
+    int kind;               // REDIR_*
+    int fd;                 // the descriptor it sets
+    const char *target;     // file name, or M of N>&M ("-" closes N)
+} Redirect;
+
+// A command's redirections resolved into the fd operations that set
+// them up, applied in order. Files are opened once, by redir_plan().
+typedef struct {
+    int fd;                 // descriptor to set
+    int src;                // descriptor to copy into it, or -1
+    const char *path;       // with src -1: file to open in the child
+    int flags;              // open flags for path
+} FdAction;                 // src -1 and no path: close fd
+
+typedef struct {
+    FdAction actions[MAX_REDIRS * 2];   // &> takes two
+    int count;
+    int owned[MAX_REDIRS];              // descriptors the plan opened
+    int owned_count;
+    int saved[MAX_REDIRS * 2];          // redir_push: the previous fds
+} FdPlan;
+
 // Command structure
 typedef struct {
-    char *args[MAX_ARGS];
+    char **args;            // NULL-terminated, grows as arguments are added
     int argc;
-    char *input_file;
-    char *output_file;
-    char *error_file;
-    int append_output;
-    int append_error;
+    int args_cap;
+    int batch_from;         // the arguments of the longest expansion, which
+    int batch_count;        // are split into batches when exec would fail
+    Redirect redirs[MAX_REDIRS];    // in the order they were written
+    int redir_count;
 } Command;
 
+// History search result
+typedef struct {
+    const char *text;
+    unsigned long number;   // history number of the latest occurrence
+    unsigned int count;     // occurrences still in history
+} HistoryMatch;
+
+// Tab completion candidates
+typedef struct {
+    char **items;
+    int count;
+    int cap;
+} CompletionList;
+
 // Pipeline structure
 typedef struct {
     Command commands[MAX_ARGS];
     int num_commands;
 } Pipeline;
 
+// Compiled xsh script instruction
+typedef struct {
+    uint32_t op;
+    uint32_t a;             // usually a string pool offset
+    uint32_t b;
+    uint32_t line;          // source line, for messages
+} Instr;
+
+// Instruction opcodes
+enum {
+    OP_FAIL,                // a: error message, the script did not compile
+    OP_ARG,                 // a: literal argument of the current command
+    OP_WORD,                // a: raw word expanded at run time, b: EXPAND_* flags
+    OP_REDIR,               // a: file name, b: REDIR_* kind and fd
+    OP_PIPE,                // start the next command of the pipeline
+    OP_EXEC,                // run the assembled pipeline, setting $?
+    OP_SET,                 // a: variable name, b: raw value
+    OP_JUMP,                // a: target
+    OP_JUMP_IF_FAIL,        // a: target, taken when $? is non-zero
+    OP_JUMP_IF_OK,          // a: target, taken when $? is zero
+    OP_STATUS,              // a: value for $?
+    OP_NOT,                 // negate $?
+    OP_FOR_INIT,            // start a for loop over the assembled words, b: use "$@"
+    OP_FOR_NEXT,            // a: loop end, b: variable name
+    OP_FOR_END,             // drop the innermost for loop
+    OP_FUNC,                // a: function name, b: body address
+    OP_RETURN,              // return from the current function
+    OP_TASK                 // a: task name, b: names it runs after (xsh -j)
+};
+
+// Redirection kinds
+enum {
+    REDIR_IN,               // N<file
+    REDIR_OUT,              // N>file
+    REDIR_APPEND,           // N>>file
+    REDIR_BOTH,             // &>file
+    REDIR_BOTH_APPEND,      // &>>file
+    REDIR_DUP,              // N>&M, N<&M, N>&-
+    REDIR_HEREDOC,          // a: body of a <<EOF here-document
+    REDIR_HERESTRING        // a: word of a <<< here-string
+};
+#define REDIR_EXPAND 0x100  // OP_REDIR file name or heredoc body needs expanding
+#define REDIR_FD_SHIFT 16   // OP_REDIR b: the redirected fd, above the kind
+
+// Lexer tokens
+enum {
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,
+    TOK_AND,
+    TOK_OR,
+    TOK_PIPE,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_REDIR,
+    TOK_DIRECTIVE,          // #@ comment line, text after the #@
+    TOK_EOF
+};
+
+typedef struct {
+    int type;
+    int redir;              // REDIR_* kind of a TOK_REDIR
+    int fd;                 // the fd a TOK_REDIR sets
+    int quoted;             // heredoc delimiter was quoted: body is literal
+    char *text;             // raw text of a TOK_WORD, quotes included
+    uint32_t line;
+} Token;
+
+typedef struct {
+    Token *toks;
+    int count;
+    int cap;
+    char error[256];
+} TokenList;
+
+// Growable NULL-terminated list of words
+typedef struct {
+    char **items;
+    int count;
+    int cap;
+} WordList;
+
+// Compiled xsh script, either built in memory or mapped from a cache file
+typedef struct {
+    Instr *code;
+    uint32_t code_count;
+    uint32_t code_cap;
+    char *strings;
+    size_t string_len;
+    size_t string_cap;
+    void *map;
+    size_t map_len;
+} ScriptProgram;
+
+// xcalc result, int64 or double depending on the mode
+typedef union {
+    long long i;
+    double d;
+} CalcValue;
+
+// xsh interpreter state, see interp.c
+typedef struct Interp Interp;
+
 // Global variables
-extern char *history[MAX_HISTORY];
-extern int history_count;
 extern char prev_dir[MAX_PATH_LEN];
 extern char current_dir[MAX_PATH_LEN];
+extern int shell_interactive;      // banner, prompt and line editor
+extern int shell_embedded;         // running inside a program via libxhell
+
+// Lexer functions
+int tokenize(const char *source, size_t len, TokenList *list);
+void free_tokens(TokenList *list);
+
+// Variables and expansion
+int var_valid_name(const char *name, size_t len);
+int var_set(const char *name, const char *value);
+const char *var_get(const char *name);
+int var_unset(const char *name);
+int var_export(const char *name);
+void var_set_status(int status);
+int var_get_status(void);
+void var_set_positional(int argc, char **argv, int *old_argc, char ***old_argv);
+const char *var_get_positional(int n);
+int var_positional_count(void);
+typedef struct VarSnapshot VarSnapshot;
+VarSnapshot *var_snapshot(void);
+void var_restore(VarSnapshot *snap);
+void wordlist_add(WordList *list, char *word);
+void wordlist_free(WordList *list);
+int word_needs_expansion(const char *raw);
+
+// expand_word flags
+#define EXPAND_SPLIT 1      // split unquoted expansion results on blanks
+#define EXPAND_GLOB  2      // brace and pathname expansion
+
+int expand_word(const char *raw, int flags, WordList *out);
+char *expand_heredoc(const char *body);
+char *here_document(const char *text, size_t len);
+int subst_mark(void);
+void subst_release(int mark);
+int arith_eval(const char *expr, long long *result);
+
+// Pathname expansion (glob.c)
+int glob_has_magic(const char *pattern);
+int glob_match(const char *pattern, const char *name);
+void glob_unescape(char *s);
+int glob_expand(const char *pattern, WordList *out);
+void glob_cache_clear(void);
+
+// Buffered output of a builtin: a descriptor, or memory (see sink.c)
+typedef struct Sink {
+    int fd;                 // file, pipe or socket; -1 for memory
+    char *buf;
+    size_t len;
+    size_t cap;
+    int memory;
+    int tty;                // fd is a terminal
+    int line_buffered;      // flush at newlines
+    int failed;             // a write failed, later output is dropped
+    int error;              // errno of the failed write
+    struct Sink *copy;      // memory sink that also gets what is written,
+    size_t copy_limit;      // and fails once it would hold more than this
+} Sink;
 
-// Parser functions
-int parse_command_line(char *line, Pipeline *pipeline);
-void free_pipeline(Pipeline *pipeline);
+void sink_open_fd(Sink *sink, int fd, int line_buffered);
+void sink_open_memory(Sink *sink);
+int sink_write(Sink *sink, const void *data, size_t len);
+int sink_puts(Sink *sink, const char *s);
+int sink_printf(Sink *sink, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void sink_perror(Sink *sink, const char *what);
+int sink_json_string(Sink *sink, const char *s, size_t len);
+int sink_flush(Sink *sink);
+char *sink_take(Sink *sink, size_t *len);
+int sink_close(Sink *sink);
+
+// How the listing builtins (xls, xsearch, xhistory, xjournalctl) print
+// their records: set for all by XHELL_OUTPUT=json|nul, for one command
+// by --json or -0
+typedef enum {
+    OUTPUT_TEXT,            // for people, colored on a terminal
+    OUTPUT_JSON,            // one JSON object per line
+    OUTPUT_NUL              // the bare record, NUL-terminated
+} OutputMode;
+
+// Where a builtin reads and writes. The shell's own descriptors are not
+// moved for it.
+typedef struct {
+    int in;                 // input descriptor, -1 if closed
+    Sink *out;
+    Sink *err;
+    OutputMode mode;
+    int color;              // text mode on a terminal
+} BuiltinIO;
 
 // Built-in command functions
-int cmd_xpwd(int argc, char **argv);
-int cmd_xcd(int argc, char **argv);
-int cmd_xls(int argc, char **argv);
-int cmd_xtouch(int argc, char **argv);
-int cmd_xecho(int argc, char **argv);
-int cmd_xcat(int argc, char **argv);
-int cmd_xcp(int argc, char **argv);
-int cmd_xrm(int argc, char **argv);
-int cmd_xmv(int argc, char **argv);
-int cmd_xhistory(int argc, char **argv);
-int cmd_xtee(int argc, char **argv);
-int cmd_xjournalctl(int argc, char **argv);
-int cmd_xsysinfo(int argc, char **argv);
-int cmd_xhelp(int argc, char **argv);
-int cmd_xcalc(int argc, char **argv);
-int cmd_xsh(int argc, char **argv);
-int cmd_xsearch(int argc, char **argv);
-int cmd_quit(int argc, char **argv);
+int cmd_xpwd(int argc, char **argv, BuiltinIO *io);
+int cmd_xcd(int argc, char **argv, BuiltinIO *io);
+int cmd_xls(int argc, char **argv, BuiltinIO *io);
+int cmd_xtouch(int argc, char **argv, BuiltinIO *io);
+int cmd_xecho(int argc, char **argv, BuiltinIO *io);
+int cmd_xcat(int argc, char **argv, BuiltinIO *io);
+int cmd_xcp(int argc, char **argv, BuiltinIO *io);
+int cmd_xrm(int argc, char **argv, BuiltinIO *io);
+int cmd_xmv(int argc, char **argv, BuiltinIO *io);
+int cmd_xhistory(int argc, char **argv, BuiltinIO *io);
+int cmd_xtee(int argc, char **argv, BuiltinIO *io);
+int cmd_xjournalctl(int argc, char **argv, BuiltinIO *io);
+int cmd_xsysinfo(int argc, char **argv, BuiltinIO *io);
+int cmd_xhelp(int argc, char **argv, BuiltinIO *io);
+int cmd_xcalc(int argc, char **argv, BuiltinIO *io);
+int cmd_xsh(int argc, char **argv, BuiltinIO *io);
+int cmd_xsearch(int argc, char **argv, BuiltinIO *io);
+int cmd_xcache(int argc, char **argv, BuiltinIO *io);
+int cmd_xrun(int argc, char **argv, BuiltinIO *io);
+int cmd_quit(int argc, char **argv, BuiltinIO *io);
+
+// Built-in command table entry
+typedef struct {
+    const char *name;
+    int (*func)(int argc, char **argv, BuiltinIO *io);
+    int flags;              // BUILTIN_*
+} BuiltinCommand;
+
+// Runs commands of its own, which write to the shell's descriptors, so
+// its redirections must be applied to those
+#define BUILTIN_SHELL_FDS 1
+// Prints the same for the same argv and input files; cached by xcache
+#define BUILTIN_PURE 2
+// Takes expressions, not file names: its words are never globbed, so
+// xcalc 2 * 3 works unquoted
+#define BUILTIN_NOGLOB 4
 
+const BuiltinCommand *get_builtins(void);
+const BuiltinCommand *find_builtin(const char *cmd);
 int is_builtin_command(const char *cmd);
-int execute_builtin(Command *cmd);
+int execute_builtin(Command *cmd, FdPlan *plan);
+int builtin_main(int argc, char **argv);
+
+// Result cache of the BUILTIN_PURE builtins (see cache.c)
+typedef struct {
+    int enabled;
+    size_t entries;
+    size_t bytes;
+    size_t cap;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+    unsigned long long evictions;
+    unsigned long long uncacheable;    // runs whose result could not be kept
+} CacheStats;
+
+int cache_run(const BuiltinCommand *builtin, int argc, char **argv, BuiltinIO *io);
+void cache_enable(size_t bytes);
+void cache_disable(void);
+void cache_clear(void);
+void cache_stats(CacheStats *out);
 
 // External program execution
-int execute_external(Command *cmd);
+int execute_external(Command *cmd, const FdPlan *plan);
 char *find_in_path(const char *program);
+int command_failed(const char *name, int error);
+int command_missing(const char *program);
+int argv_fits(const Command *cmd);
+int execute_batched(const char *path, const Command *cmd, const FdPlan *plan);
 
 // Redirection functions
-int setup_redirections(Command *cmd);
-void restore_redirections(int saved_stdout, int saved_stderr, int saved_stdin);
+int redir_plan(const Command *cmd, FdPlan *plan, int defer_fifos);
+int redir_apply(const FdPlan *plan);
+int redir_target(const FdPlan *plan, int fd);
+int redir_push(FdPlan *plan);
+void redir_pop(FdPlan *plan);
+int redir_file_actions(const FdPlan *plan, posix_spawn_file_actions_t *actions);
+void redir_plan_free(FdPlan *plan);
 
 // Pipe functions
 int execute_pipeline(Pipeline *pipeline);
 
+// Script functions
+int script_compile(const char *source, size_t len, ScriptProgram *prog);
+int script_load(const char *path, ScriptProgram *prog);
+int script_run(ScriptProgram *prog, int trace, int *exited);
+int script_run_line(ScriptProgram *prog, int *exited);
+int script_run_parallel(ScriptProgram *prog, int jobs, int trace);
+Interp *interp_new(ScriptProgram *prog, int trace);
+int interp_run(Interp *in, uint32_t start, uint32_t end);
+int interp_exited(Interp *in);
+void interp_free(Interp *in);
+int interp_call(Command *cmd);
+void script_free(ScriptProgram *prog);
+int script_extract(const ScriptProgram *prog, uint32_t start, uint32_t end, ScriptProgram *out);
+
+// xcalc expression engine
+int calc_eval(const char *expr, int int_mode, CalcValue *out, const char **error);
+int calc_format(const CalcValue *v, int int_mode, char *buf, size_t size);
+int calc_stream(int in_fd, Sink *out, Sink *err, int int_mode);
+int calc_int_op(int op, long long a, long long b, long long *out, const char **error);
+
 // Logger functions
 void log_command(const char *command, int status);
 void log_error(const char *command, const char *error);
-void init_logger(void);
+void log_close(void);
 
-// Utility functions
-void trim_whitespace(char *str);
-char *get_prompt(void);
+// History functions
 void add_to_history(const char *command);
 void save_history(void);
+void history_close(void);
 void load_history(void);
-int copy_file(const char *src, const char *dst);
-int copy_directory(const char *src, const char *dst);
-int remove_directory(const char *path);
+int history_length(void);
+const char *history_get(int index);
+unsigned long history_first_number(void);
+int history_expand(const char *line, char *out, size_t size);
+int history_index_add(const char *text, unsigned long seq);
+void history_index_remove(int slot);
+int history_search(const char *pattern, HistoryMatch *matches, int max);
+const char *history_find_prefix(const char *prefix);
+
+// Line editor and completion
+char *read_line(const char *prompt, char *buf, size_t size);
+void completion_init(void);
+void complete_word(const char *word, int command_position, CompletionList *out);
+void completion_add(CompletionList *list, const char *text, int is_dir);
+void completion_free(CompletionList *list);
+
+// Running a line and capturing its output (see shell.c)
+typedef struct {
+    int out;                // memfds that receive stdout and stderr
+    int err;
+    int saved_out;          // the real ones while a capture runs
+    int saved_err;
+} Capture;
+
+int run_line(char *input, int *exited);
+int capture_open(Capture *cap);
+int capture_start(Capture *cap);
+void capture_stop(Capture *cap);
+char *capture_read(int fd, size_t *len);
+void capture_close(Capture *cap);
+
+// Utility functions
+void trim_whitespace(char *str);
+char *get_prompt(void);
+void start_dir_pin(void);
+void start_dir_unpin(void);
+int start_dir_fd(void);
+int copy_file(const char *src, const char *dst, Sink *err);
+int copy_directory(const char *src, const char *dst, Sink *err);
+int remove_directory(const char *path, Sink *err);
+
+// Batched file operations: io_uring, or a thread pool (see batch_io.c)
+#define BATCH_NAMES 128         // directory entries handled per batch
+
+enum { BIO_STATX, BIO_OPENAT, BIO_READ, BIO_WRITE, BIO_CLOSE, BIO_UNLINKAT };
+
+struct statx;
+
+typedef struct {
+    int op;                 // BIO_*
+    int dirfd;              // statx, openat, unlinkat: path relative to it
+    const char *path;
+    int flags;              // statx, openat and unlinkat flags
+    mode_t mode;            // openat
+    int fd;                 // read, write, close
+    void *buf;
+    size_t len;
+    off_t off;
+    struct statx *stx;      // statx result
+    long res;               // what the call returned, or -errno
+} BatchOp;
+
+typedef struct {
+    char *name;
+    unsigned char type;     // d_type, DT_UNKNOWN if the filesystem has none
+} DirName;
+
+void batch_run(BatchOp *ops, size_t count);
+size_t dir_read_names(DIR *dir, DirName *names, size_t max);
+void dir_free_names(DirName *names, size_t count);
 
 #endif // XHELL_H
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include "../include/xhell.h"
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// Batched file operations for the tree-wide builtins (xcp -r, xrm -r,
+// xls). They hand over a whole directory's worth of independent
+// statx/openat/read/write/close/unlinkat calls at a time instead of
+// making them one by one.
+//
+// Through io_uring, up to XHELL_IO_DEPTH (default 64) of them are in
+// flight at once, submitted and reaped with a single io_uring_enter per
+// round. Where io_uring is missing, disabled, or lacks one of these
+// operations (unlinkat needs Linux 5.11), a pool of XHELL_IO_THREADS
+// threads (default: two per CPU, at most 16) makes the calls instead.
+// XHELL_IO=uring|threads|sync picks a backend; sync is the old one call
+// at a time, for comparison.
+//
+// The ring belongs to the process that set it up: a child forked from
+// the shell (a pipeline stage, an xsh -j task) sets up its own on first
+// use instead of sharing the parent's.
+
+#define BATCH_DEFAULT_DEPTH 64
+#define BATCH_MAX_THREADS 16
+#define BATCH_INLINE 4          // fewer ops than this are made in place
+
+enum { BACKEND_UNSET, BACKEND_URING, BACKEND_THREADS, BACKEND_SYNC };
+
+typedef struct {
+    int fd;
+    pid_t pid;                  // the process that set it up
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+} Ring;
+
+static Ring ring = {.fd = -1};
+static int backend = BACKEND_UNSET;
+static int thread_count = 1;
+
+static const unsigned char ring_ops[] = {
+    IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ,
+    IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_UNLINKAT,
+};
+
+static void ring_unmap(void) {
+    if (ring.sqes != NULL) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ptr != NULL && ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_size);
+    if (ring.sq_ptr != NULL) munmap(ring.sq_ptr, ring.sq_size);
+    if (ring.fd != -1) close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+// Does the kernel know every operation the batches use?
+static int ring_probe(void) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe == NULL) return -1;
+    int ok = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(ring_ops); i++) {
+        ok = ring_ops[i] <= probe->last_op && (probe->ops[ring_ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok ? 0 : -1;
+}
+
+static int ring_setup(unsigned depth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring.fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (ring.fd == -1) return -1;
+    ring.pid = getpid();
+    ring.entries = p.sq_entries;
+
+    ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring.cq_size > ring.sq_size) ring.sq_size = ring.cq_size;
+
+    ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ptr == MAP_FAILED) {
+        ring.sq_ptr = NULL;
+        ring_unmap();
+        return -1;
+    }
+    ring.cq_ptr = single ? ring.sq_ptr
+                         : mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring.fd, IORING_OFF_SQES);
+    if (ring.cq_ptr == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        if (ring.cq_ptr == MAP_FAILED) ring.cq_ptr = NULL;
+        if (ring.sqes == MAP_FAILED) ring.sqes = NULL;
+        ring_unmap();
+        return -1;
+    }
+
+    char *sq = ring.sq_ptr;
+    char *cq = ring.cq_ptr;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (ring_probe() != 0) {
+        ring_unmap();
+        return -1;
+    }
+    return 0;
+}
+
+static int env_int(const char *name, int fallback) {
+    const char *value = var_get(name);
+    return value != NULL && *value ? atoi(value) : fallback;
+}
+
+static void choose_backend(void) {
+    const char *want = var_get("XHELL_IO");
+    int depth = env_int("XHELL_IO_DEPTH", BATCH_DEFAULT_DEPTH);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = env_int("XHELL_IO_THREADS", cpus > 0 ? (int)cpus * 2 : 2);
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > BATCH_MAX_THREADS) thread_count = BATCH_MAX_THREADS;
+
+    if (want != NULL && strcmp(want, "sync") == 0) {
+        backend = BACKEND_SYNC;
+    } else if (want != NULL && strcmp(want, "threads") == 0) {
+        backend = BACKEND_THREADS;
+    } else {
+        backend = ring_setup(depth > 0 ? (unsigned)depth : BATCH_DEFAULT_DEPTH) == 0
+                ? BACKEND_URING : BACKEND_THREADS;
+    }
+}
+
+// One operation as a plain system call
+static void run_one(BatchOp *op) {
+    long res;
+    switch (op->op) {
+    case BIO_STATX:
+        res = statx(op->dirfd, op->path, op->flags, STATX_BASIC_STATS, op->stx);
+        break;
+    case BIO_OPENAT:
+        res = openat(op->dirfd, op->path, op->flags, op->mode);
+        break;
+    case BIO_READ:
+        res = pread(op->fd, op->buf, op->len, op->off);
+        break;
+    case BIO_WRITE:
+        res = pwrite(op->fd, op->buf, op->len, op->off);
+        break;
+    case BIO_CLOSE:
+        res = close(op->fd);
+        break;
+    case BIO_UNLINKAT:
+        res = unlinkat(op->dirfd, op->path, op->flags);
+        break;
+    default:
+        res = -1;
+        errno = EINVAL;
+    }
+    op->res = res < 0 ? -errno : res;
+}
+
+static void sync_run(BatchOp *ops, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        run_one(&ops[i]);
+    }
+}
+
+// --- Thread pool ---
+//
+// Each worker takes the next op not yet taken until there are none, so
+// at most thread_count calls are outstanding at once.
+
+typedef struct {
+    BatchOp *ops;
+    size_t count;
+    size_t next;
+} PoolWork;
+
+static void *pool_worker(void *arg) {
+    PoolWork *work = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+        run_one(&work->ops[i]);
+    }
+    return NULL;
+}
+
+static void threads_run(BatchOp *ops, size_t count) {
+    PoolWork work = {ops, count, 0};
+    pthread_t threads[BATCH_MAX_THREADS];
+    int started = 0;
+    int wanted = (size_t)thread_count < count ? thread_count : (int)count;
+    // The caller is one of the workers
+    while (started < wanted - 1 && pthread_create(&threads[started], NULL, pool_worker, &work) == 0) {
+        started++;
+    }
+    pool_worker(&work);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// --- io_uring ---
+
+static void ring_prep(struct io_uring_sqe *sqe, const BatchOp *op) {
+    memset(sqe, 0, sizeof(*sqe));
+    switch (op->op) {
+    case BIO_STATX:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (uintptr_t)op->stx;
+        sqe->statx_flags = op->flags;
+        break;
+    case BIO_OPENAT:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->len = op->mode;
+        sqe->open_flags = op->flags;
+        break;
+    case BIO_READ:
+    case BIO_WRITE:
+        sqe->opcode = op->op == BIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = op->fd;
+        sqe->addr = (uintptr_t)op->buf;
+        sqe->len = op->len;
+        sqe->off = op->off;
+        break;
+    case BIO_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = op->fd;
+        break;
+    case BIO_UNLINKAT:
+        sqe->opcode = IORING_OP_UNLINKAT;
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->unlink_flags = op->flags;
+        break;
+    default:
+        sqe->opcode = IORING_OP_NOP;
+    }
+}
+
+// Keep the queue filled up to its depth, reaping as ops complete. -1 if
+// io_uring_enter failed for good; the ops not reaped are ECANCELED.
+static int ring_run(BatchOp *ops, size_t count) {
+    size_t next = 0;            // ops queued
+    size_t done = 0;            // ops reaped
+    unsigned unsubmitted = 0;   // queued, not yet taken by the kernel
+    unsigned mask = *ring.sq_mask;
+    for (size_t i = 0; i < count; i++) {
+        ops[i].res = -ECANCELED;        // what is left if the ring fails
+    }
+
+    while (done < count) {
+        unsigned tail = *ring.sq_tail;
+        while (next < count && next - done < ring.entries) {
+            unsigned index = tail & mask;
+            ring_prep(&ring.sqes[index], &ops[next]);
+            ring.sqes[index].user_data = next;
+            ring.sq_array[index] = index;
+            tail++;
+            next++;
+            unsubmitted++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        int rc = syscall(__NR_io_uring_enter, ring.fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return -1;
+        }
+        unsubmitted -= rc;
+
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            ops[cqe->user_data].res = cqe->res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Make the ops a failed ring left ECANCELED, through the thread pool
+static void rerun_cancelled(BatchOp *ops, size_t count) {
+    size_t left = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].res == -ECANCELED) left++;
+    }
+    if (left == 0) return;
+
+    BatchOp *again = malloc(left * sizeof(BatchOp));
+    if (again == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            if (ops[i].res == -ECANCELED) run_one(&ops[i]);
+        }
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].res == -ECANCELED) again[n++] = ops[i];
+    }
+    threads_run(again, n);
+    n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].res == -ECANCELED) ops[i].res = again[n++].res;
+    }
+    free(again);
+}
+
+// Make every call in ops, in any order and some at the same time. Each
+// op's res is what the call returned, or -errno.
+void batch_run(BatchOp *ops, size_t count) {
+    if (backend == BACKEND_UNSET) {
+        choose_backend();
+    }
+    if (backend == BACKEND_URING && ring.pid != getpid()) {
+        // Forked: the ring is the parent's. The new one has its depth.
+        unsigned depth = ring.entries;
+        ring_unmap();
+        if (ring_setup(depth) != 0) backend = BACKEND_THREADS;
+    }
+
+    if (count < BATCH_INLINE || backend == BACKEND_SYNC) {
+        sync_run(ops, count);
+    } else if (backend == BACKEND_URING) {
+        if (ring_run(ops, count) != 0) {
+            // Not going to work later either; what it did not finish
+            // is made again without it
+            ring_unmap();
+            backend = BACKEND_THREADS;
+            rerun_cancelled(ops, count);
+        }
+    } else {
+        threads_run(ops, count);
+    }
+}
+
+// Up to max entries of dir other than . and .., read into names; 0 once
+// there are none left. The names are the caller's to free.
+size_t dir_read_names(DIR *dir, DirName *names, size_t max) {
+    size_t count = 0;
+    struct dirent *entry;
+    while (count < max && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        names[count].name = strdup(entry->d_name);
+        if (names[count].name == NULL) break;
+        names[count].type = entry->d_type;
+        count++;
+    }
+    return count;
+}
+
+void dir_free_names(DirName *names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(names[i].name);
+    }
+}
@@ -1,55 +1,166 @@
+#define _GNU_SOURCE
 #include "../include/xhell.h"
 
-// Check if command is built-in
-int is_builtin_command(const char *cmd) {
-    const char *builtins[] = {
-        "xpwd", "xcd", "xls", "xtouch", "xecho", "xcat",
-        "xcp", "xrm", "xmv", "xhistory", "xtee", "xjournalctl", 
-        "xsysinfo", "xhelp", "xcalc", "xsh", "xsearch", "quit"
-    };
-    
-    for (int i = 0; i < 18; i++) {
-        if (strcmp(cmd, builtins[i]) == 0) {
-            return 1;
+// Built-in command table
+static const BuiltinCommand builtin_table[] = {
+    {"xpwd", cmd_xpwd, 0},
+    {"xcd", cmd_xcd, 0},
+    {"xls", cmd_xls, BUILTIN_PURE},
+    {"xtouch", cmd_xtouch, 0},
+    {"xecho", cmd_xecho, 0},
+    {"xcat", cmd_xcat, 0},
+    {"xcp", cmd_xcp, 0},
+    {"xrm", cmd_xrm, 0},
+    {"xmv", cmd_xmv, 0},
+    {"xhistory", cmd_xhistory, 0},
+    {"xtee", cmd_xtee, 0},
+    {"xjournalctl", cmd_xjournalctl, 0},
+    {"xsysinfo", cmd_xsysinfo, BUILTIN_PURE},
+    {"xhelp", cmd_xhelp, 0},
+    {"xcalc", cmd_xcalc, BUILTIN_PURE | BUILTIN_NOGLOB},
+    {"xsh", cmd_xsh, BUILTIN_SHELL_FDS},
+    {"xsearch", cmd_xsearch, BUILTIN_PURE},
+    {"xcache", cmd_xcache, 0},
+    {"xrun", cmd_xrun, BUILTIN_SHELL_FDS},
+    {"quit", cmd_quit, 0},
+    {NULL, NULL, 0}
+};
+
+// Get the built-in command table, terminated by a NULL name
+const BuiltinCommand *get_builtins(void) {
+    return builtin_table;
+}
+
+// Look up a built-in command by name
+const BuiltinCommand *find_builtin(const char *cmd) {
+    for (const BuiltinCommand *b = builtin_table; b->name != NULL; b++) {
+        if (strcmp(cmd, b->name) == 0) {
+            return b;
         }
     }
-    return 0;
+    return NULL;
 }
 
-// Execute built-in command
-int execute_builtin(Command *cmd) {
+// Check if command is built-in
+int is_builtin_command(const char *cmd) {
+    return find_builtin(cmd) != NULL;
+}
+
+// Run a builtin on the descriptors the plan leads to, through sinks
+static int run_builtin(const BuiltinCommand *builtin, int argc, char **argv, const FdPlan *targets) {
+    Sink out, err;
+    sink_open_fd(&out, redir_target(targets, STDOUT_FILENO), 0);
+    sink_open_fd(&err, redir_target(targets, STDERR_FILENO), 1);
+    BuiltinIO io = {redir_target(targets, STDIN_FILENO), &out, &err, OUTPUT_TEXT, 0};
+    const char *mode = var_get("XHELL_OUTPUT");
+    if (mode != NULL && strcmp(mode, "json") == 0) {
+        io.mode = OUTPUT_JSON;
+    } else if (mode != NULL && strcmp(mode, "nul") == 0) {
+        io.mode = OUTPUT_NUL;
+    }
+    io.color = io.mode == OUTPUT_TEXT && out.tty;
+    
+    int status = cache_run(builtin, argc, argv, &io);
+    
+    // Output that never arrived is an error, as in other shells
+    if (sink_close(&out) != 0 && out.error != 0) {
+        sink_printf(&err, "%s: write error: %s\n", argv[0], strerror(out.error));
+        if (status == 0) status = 1;
+    }
+    sink_close(&err);
+    return status;
+}
+
+// Execute built-in command. Its output goes through sinks on the
+// descriptors the plan leads to; the shell's own are not moved.
+int execute_builtin(Command *cmd, FdPlan *plan) {
     if (cmd->argc == 0) return -1;
     
-    const char *name = cmd->args[0];
-    
-    if (strcmp(name, "xpwd") == 0) return cmd_xpwd(cmd->argc, cmd->args);
-    if (strcmp(name, "xcd") == 0) return cmd_xcd(cmd->argc, cmd->args);
-    if (strcmp(name, "xls") == 0) return cmd_xls(cmd->argc, cmd->args);
-    if (strcmp(name, "xtouch") == 0) return cmd_xtouch(cmd->argc, cmd->args);
-    if (strcmp(name, "xecho") == 0) return cmd_xecho(cmd->argc, cmd->args);
-    if (strcmp(name, "xcat") == 0) return cmd_xcat(cmd->argc, cmd->args);
-    if (strcmp(name, "xcp") == 0) return cmd_xcp(cmd->argc, cmd->args);
-    if (strcmp(name, "xrm") == 0) return cmd_xrm(cmd->argc, cmd->args);
-    if (strcmp(name, "xmv") == 0) return cmd_xmv(cmd->argc, cmd->args);
-    if (strcmp(name, "xhistory") == 0) return cmd_xhistory(cmd->argc, cmd->args);
-    if (strcmp(name, "xtee") == 0) return cmd_xtee(cmd->argc, cmd->args);
-    if (strcmp(name, "xjournalctl") == 0) return cmd_xjournalctl(cmd->argc, cmd->args);
-    if (strcmp(name, "xsysinfo") == 0) return cmd_xsysinfo(cmd->argc, cmd->args);
-    if (strcmp(name, "xhelp") == 0) return cmd_xhelp(cmd->argc, cmd->args);
-    if (strcmp(name, "xcalc") == 0) return cmd_xcalc(cmd->argc, cmd->args);
-    if (strcmp(name, "xsh") == 0) return cmd_xsh(cmd->argc, cmd->args);
-    if (strcmp(name, "xsearch") == 0) return cmd_xsearch(cmd->argc, cmd->args);
-    if (strcmp(name, "quit") == 0) return cmd_quit(cmd->argc, cmd->args);
-    
-    return -1;
+    const BuiltinCommand *builtin = find_builtin(cmd->args[0]);
+    if (builtin == NULL) return -1;
+    
+    // Whatever the shell printed so far comes first
+    fflush(stdout);
+    
+    // xsh runs commands of its own on fds 0-2, so those must be swapped
+    int shell_fds = plan != NULL && (builtin->flags & BUILTIN_SHELL_FDS);
+    if (shell_fds && redir_push(plan) != 0) {
+        return 1;
+    }
+    
+    int status = run_builtin(builtin, cmd->argc, cmd->args, shell_fds ? NULL : plan);
+    
+    if (shell_fds) {
+        fflush(stdout);
+        redir_pop(plan);
+    }
+    return status;
+}
+
+// Multi-call entry: run argv[0] as a builtin in a process of its own,
+// for a symlink named after it or "xhell --builtin name args...". Nothing
+// of the shell is set up; history and log open only if the builtin
+// uses them. Without a name, lists the builtins one per line.
+int builtin_main(int argc, char **argv) {
+    if (argc == 0) {
+        for (const BuiltinCommand *b = builtin_table; b->name != NULL; b++) {
+            printf("%s\n", b->name);
+        }
+        return 0;
+    }
+    
+    const BuiltinCommand *builtin = find_builtin(argv[0]);
+    if (builtin == NULL) {
+        fprintf(stderr, "xhell: %s: not a builtin\n", argv[0]);
+        return 127;
+    }
+    var_set_positional(argc, argv, NULL, NULL);
+    return run_builtin(builtin, argc, argv, NULL) & 0xff;
+}
+
+// A stdio stream on the builtin's input, closed with close_input()
+static FILE *open_input(BuiltinIO *io) {
+    if (io->in == STDIN_FILENO) {
+        return stdin;
+    }
+    int fd = io->in < 0 ? -1 : dup(io->in);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "r");
+    if (fp == NULL && fd >= 0) {
+        close(fd);
+    }
+    return fp;
+}
+
+static void close_input(FILE *fp) {
+    if (fp != stdin) {
+        fclose(fp);
+    }
+}
+
+// --json or -0 for this command; returns 1 if arg was one of them
+static int output_flag(const char *arg, BuiltinIO *io) {
+    if (strcmp(arg, "--json") == 0) {
+        io->mode = OUTPUT_JSON;
+    } else if (strcmp(arg, "-0") == 0) {
+        io->mode = OUTPUT_NUL;
+    } else {
+        return 0;
+    }
+    io->color = 0;
+    return 1;
+}
+
+// The bare record of -0 mode, NUL included
+static void nul_record(BuiltinIO *io, const char *text) {
+    sink_write(io->out, text, strlen(text) + 1);
 }
 
 // --- NEW COMMANDS ---
 
 // xsysinfo - display system information
-int cmd_xsysinfo(int argc, char **argv) {
+int cmd_xsysinfo(int argc, char **argv, BuiltinIO *io) {
     (void)argc; (void)argv;
-    printf("========== Xhell System Info ==========\n");
+    sink_printf(io->out, "========== Xhell System Info ==========\n");
     
     // CPU Info
     FILE *cpu = fopen("/proc/cpuinfo", "r");
@@ -58,7 +169,7 @@ int cmd_xsysinfo(int argc, char **argv) {
         int count = 0;
         while (fgets(line, sizeof(line), cpu)) {
             if (strncmp(line, "model name", 10) == 0) {
-                printf("CPU Model : %s", strchr(line, ':') + 2);
+                sink_printf(io->out, "CPU Model : %s", strchr(line, ':') + 2);
                 count++;
                 if (count >= 1) break; // Only show first core
             }
@@ -72,10 +183,10 @@ int cmd_xsysinfo(int argc, char **argv) {
         char line[256];
         while (fgets(line, sizeof(line), mem)) {
             if (strncmp(line, "MemTotal", 8) == 0) {
-                printf("Memory    : %s", strchr(line, ':') + 2);
+                sink_printf(io->out, "Memory    : %s", strchr(line, ':') + 2);
             }
             if (strncmp(line, "MemAvailable", 12) == 0) {
-                printf("Available : %s", strchr(line, ':') + 2);
+                sink_printf(io->out, "Available : %s", strchr(line, ':') + 2);
             }
         }
         fclose(mem);
@@ -88,56 +199,64 @@ int cmd_xsysinfo(int argc, char **argv) {
         if (fgets(line, sizeof(line), ver)) {
             char *p = strchr(line, '(');
             if (p) *p = '\0'; 
-            printf("Kernel    : %s\n", line);
+            sink_printf(io->out, "Kernel    : %s\n", line);
         }
         fclose(ver);
     }
     
-    printf("=======================================\n");
+    sink_printf(io->out, "=======================================\n");
     return 0;
 }
 
 // xhelp - list commands
-int cmd_xhelp(int argc, char **argv) {
+int cmd_xhelp(int argc, char **argv, BuiltinIO *io) {
     (void)argc; (void)argv;
-    printf("Xhell Available Commands:\n");
-    printf("  xpwd        - Print working directory\n");
-    printf("  xcd [dir]   - Change directory\n");
-    printf("  xls [dir]   - List files\n");
-    printf("  xtouch file - Create empty file\n");
-    printf("  xecho [str] - Print string\n");
-    printf("  xcat file   - View file content\n");
-    printf("  xcp src dst - Copy file/dir (-r)\n");
-    printf("  xrm file    - Remove file/dir (-r)\n");
-    printf("  xmv src dst - Move/Rename file\n");
-    printf("  xhistory    - View command history\n");
-    printf("  xsysinfo    - View system stats\n");
-    printf("  xhelp       - Show this help\n");
-    printf("  quit        - Exit Xhell\n");
+    sink_printf(io->out, "Xhell Available Commands:\n");
+    sink_printf(io->out, "  xpwd        - Print working directory\n");
+    sink_printf(io->out, "  xcd [dir]   - Change directory\n");
+    sink_printf(io->out, "  xls [dir]   - List files (-l long; --json or -0 for tools)\n");
+    sink_printf(io->out, "  xtouch file - Create empty file\n");
+    sink_printf(io->out, "  xecho [str] - Print string\n");
+    sink_printf(io->out, "  xcat file   - View file content\n");
+    sink_printf(io->out, "  xcp src dst - Copy file/dir (-r)\n");
+    sink_printf(io->out, "  xrm file    - Remove file/dir (-r)\n");
+    sink_printf(io->out, "  xmv src dst - Move/Rename file\n");
+    sink_printf(io->out, "  xhistory    - View command history (-s pattern to search)\n");
+    sink_printf(io->out, "  XHELL_OUTPUT=json|nul - Records for tools from xls, xsearch, xhistory, xjournalctl\n");
+    sink_printf(io->out, "  xsysinfo    - View system stats\n");
+    sink_printf(io->out, "  xcalc expr  - Calculate (-i int64, - reads stdin)\n");
+    sink_printf(io->out, "  xcache [on [bytes]|off|stats|clear] - Cache results of xls, xsearch, xcalc, xsysinfo\n");
+    sink_printf(io->out, "  xrun [--cpus L] [--nice N] [--ionice C] [--mem S] [--nofile N] -- cmd - Run with limits\n");
+    sink_printf(io->out, "  xsh [-x] f  - Run script (-x traces, -n checks only, -j N runs #@ tasks in parallel)\n");
+    sink_printf(io->out, "  if/while/for, f() {}, NAME=value, $NAME, ${NAME:-x}, $((expr)), $(cmd) - Shell language\n");
+    sink_printf(io->out, "  <(cmd), >(cmd), <<EOF, <<< word - Process substitution, here-documents\n");
+    sink_printf(io->out, "  *.c, src/**/*.h, [a-z]?, {a,b}, {1..5} - Pathname and brace expansion\n");
+    sink_printf(io->out, "  xhelp       - Show this help\n");
+    sink_printf(io->out, "  quit        - Exit Xhell\n");
     return 0;
 }
 
 // xpwd - print working directory
-int cmd_xpwd(int argc, char **argv) {
+int cmd_xpwd(int argc, char **argv, BuiltinIO *io) {
     (void)argc; (void)argv; 
     char cwd[MAX_PATH_LEN];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        printf("%s\n", cwd);
+        sink_printf(io->out, "%s\n", cwd);
         return 0;
     } else {
-        perror("xpwd");
+        sink_perror(io->err, "xpwd");
         return -1;
     }
 }
 
 // xcd - change directory
-int cmd_xcd(int argc, char **argv) {
+int cmd_xcd(int argc, char **argv, BuiltinIO *io) {
     char *target_dir;
     // char new_dir[MAX_PATH_LEN]; // Removed unused variable
     
     // Save current directory as previous
     if (getcwd(current_dir, sizeof(current_dir)) == NULL) {
-        perror("xcd: getcwd");
+        sink_perror(io->err, "xcd: getcwd");
         return -1;
     }
     
@@ -145,13 +264,13 @@ int cmd_xcd(int argc, char **argv) {
         // No argument - go to home directory
         target_dir = getenv("HOME");
         if (target_dir == NULL) {
-            fprintf(stderr, "xcd: HOME not set\n");
+            sink_printf(io->err, "xcd: HOME not set\n");
             return -1;
         }
     } else if (strcmp(argv[1], "-") == 0) {
         // Go to previous directory
         if (strlen(prev_dir) == 0) {
-            fprintf(stderr, "xcd: no previous directory\n");
+            sink_printf(io->err, "xcd: no previous directory\n");
             return -1;
         }
         target_dir = prev_dir;
@@ -159,8 +278,11 @@ int cmd_xcd(int argc, char **argv) {
         target_dir = argv[1];
     }
     
+    // History and log stay in the directory the shell started in
+    start_dir_pin();
+    
     if (chdir(target_dir) != 0) {
-        perror("xcd");
+        sink_perror(io->err, "xcd");
         return -1;
     }
     
@@ -169,7 +291,7 @@ int cmd_xcd(int argc, char **argv) {
     
     // Update current directory
     if (getcwd(current_dir, sizeof(current_dir)) == NULL) {
-        perror("xcd: getcwd");
+        sink_perror(io->err, "xcd: getcwd");
         return -1;
     }
     
@@ -177,13 +299,15 @@ int cmd_xcd(int argc, char **argv) {
 }
 
 // xls - list directory contents
-int cmd_xls(int argc, char **argv) {
+int cmd_xls(int argc, char **argv, BuiltinIO *io) {
     const char *path = ".";
     int long_format = 0;
     
     // Parse arguments
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-l") == 0) {
+        if (output_flag(argv[i], io)) {
+            continue;
+        } else if (strcmp(argv[i], "-l") == 0) {
             long_format = 1;
         } else if (argv[i][0] != '-') {
             path = argv[i];
@@ -192,52 +316,74 @@ int cmd_xls(int argc, char **argv) {
     
     DIR *dir = opendir(path);
     if (dir == NULL) {
-        perror("xls");
+        sink_perror(io->err, "xls");
         return -1;
     }
     
-    struct dirent *entry;
-    struct stat st;
-    char full_path[MAX_PATH_LEN];
+    // The entries' stats are made a batch at a time
+    DirName names[BATCH_NAMES];
+    struct statx stx[BATCH_NAMES];
+    BatchOp ops[BATCH_NAMES];
     char time_buf[64];
+    size_t count;
     
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    while ((count = dir_read_names(dir, names, BATCH_NAMES)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            ops[i] = (BatchOp){.op = BIO_STATX, .dirfd = dirfd(dir), .path = names[i].name,
+                               .stx = &stx[i]};
         }
+        batch_run(ops, count);
         
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-        
-        if (stat(full_path, &st) == 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (ops[i].res != 0) {
+                continue;
+            }
+            const char *name = names[i].name;
+            mode_t mode = stx[i].stx_mode;
+            long long size = (long long)stx[i].stx_size;
+            time_t mtime = stx[i].stx_mtime.tv_sec;
+            
+            if (io->mode == OUTPUT_JSON) {
+                const char *type = S_ISDIR(mode) ? "dir" : S_ISREG(mode) ? "file" : "other";
+                sink_puts(io->out, "{\"name\":");
+                sink_json_string(io->out, name, strlen(name));
+                sink_printf(io->out, ",\"type\":\"%s\",\"size\":%lld,\"mode\":\"%04o\",\"mtime\":%lld}\n",
+                            type, size, (unsigned)(mode & 07777), (long long)mtime);
+                continue;
+            }
+            if (io->mode == OUTPUT_NUL) {
+                nul_record(io, name);
+                continue;
+            }
+            
+            // Color only for a terminal; the / and * marks stay either way
+            const char *color = "";
+            const char *reset = "";
+            if (io->color && S_ISDIR(mode)) color = "\033[1;34m"; // Blue
+            else if (io->color && (mode & S_IXUSR)) color = "\033[1;32m"; // Green
+            if (*color) reset = "\033[0m";
+            const char *mark = S_ISDIR(mode) ? "/" : (mode & S_IXUSR) ? "*" : "";
+            
             if (long_format) {
                 // Format time
-                struct tm *tm = localtime(&st.st_mtime);
+                struct tm *tm = localtime(&mtime);
                 strftime(time_buf, sizeof(time_buf), "%b %d %H:%M", tm);
                 
-                // Type & Color
-                char type = S_ISDIR(st.st_mode) ? 'd' : '-';
-                const char *color = "\033[0m"; // Default
-                if (S_ISDIR(st.st_mode)) color = "\033[1;34m"; // Blue
-                else if (st.st_mode & S_IXUSR) color = "\033[1;32m"; // Green
+                // Type
+                char type = S_ISDIR(mode) ? 'd' : '-';
                 
                 // Permissions (simplified)
                 char perms[4] = "rw-";
-                if (st.st_mode & S_IXUSR) perms[2] = 'x';
+                if (mode & S_IXUSR) perms[2] = 'x';
                 
-                printf("%c%s %8ld %s %s%s\033[0m", type, perms, st.st_size, time_buf, color, entry->d_name);
-                if (S_ISDIR(st.st_mode)) printf("/");
-                printf("\n");
+                // Long format marks directories only
+                sink_printf(io->out, "%c%s %8lld %s %s%s%s%s\n", type, perms, size, time_buf,
+                            color, name, reset, S_ISDIR(mode) ? "/" : "");
             } else {
-                if (S_ISDIR(st.st_mode)) {
-                    printf("\033[1;34m%s/\033[0m\n", entry->d_name);
-                } else if (st.st_mode & S_IXUSR) {
-                     printf("\033[1;32m%s*\033[0m\n", entry->d_name);
-                } else {
-                    printf("%s\n", entry->d_name);
-                }
+                sink_printf(io->out, "%s%s%s%s\n", color, name, mark, reset);
             }
         }
+        dir_free_names(names, count);
     }
     
     closedir(dir);
@@ -245,9 +391,9 @@ int cmd_xls(int argc, char **argv) {
 }
 
 // xtouch - create file if not exists
-int cmd_xtouch(int argc, char **argv) {
+int cmd_xtouch(int argc, char **argv, BuiltinIO *io) {
     if (argc < 2) {
-        fprintf(stderr, "xtouch: missing file operand\n");
+        sink_printf(io->err, "xtouch: missing file operand\n");
         return -1;
     }
     
@@ -262,7 +408,7 @@ int cmd_xtouch(int argc, char **argv) {
     // Create file
     int fd = open(filename, O_CREAT | O_WRONLY, 0644);
     if (fd == -1) {
-        perror("xtouch");
+        sink_perror(io->err, "xtouch");
         return -1;
     }
     
@@ -271,21 +417,21 @@ int cmd_xtouch(int argc, char **argv) {
 }
 
 // xecho - echo string
-int cmd_xecho(int argc, char **argv) {
+int cmd_xecho(int argc, char **argv, BuiltinIO *io) {
     for (int i = 1; i < argc; i++) {
-        printf("%s", argv[i]);
+        sink_printf(io->out, "%s", argv[i]);
         if (i < argc - 1) {
-            printf(" ");
+            sink_printf(io->out, " ");
         }
     }
-    printf("\n");
+    sink_printf(io->out, "\n");
     return 0;
 }
 
 // xcat - display file contents
-int cmd_xcat(int argc, char **argv) {
+int cmd_xcat(int argc, char **argv, BuiltinIO *io) {
     if (argc < 2) {
-        fprintf(stderr, "xcat: missing file operand\n");
+        sink_printf(io->err, "xcat: missing file operand\n");
         return -1;
     }
     
@@ -293,7 +439,7 @@ int cmd_xcat(int argc, char **argv) {
     FILE *file = fopen(filename, "r");
     
     if (file == NULL) {
-        perror("xcat");
+        sink_perror(io->err, "xcat");
         return -1;
     }
     
@@ -301,7 +447,7 @@ int cmd_xcat(int argc, char **argv) {
     size_t bytes;
     
     while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        fwrite(buffer, 1, bytes, stdout);
+        sink_write(io->out, buffer, bytes);
     }
     
     fclose(file);
@@ -309,9 +455,9 @@ int cmd_xcat(int argc, char **argv) {
 }
 
 // xcp - copy files/directories
-int cmd_xcp(int argc, char **argv) {
+int cmd_xcp(int argc, char **argv, BuiltinIO *io) {
     if (argc < 3) {
-        fprintf(stderr, "xcp: missing file operand\n");
+        sink_printf(io->err, "xcp: missing file operand\n");
         return -1;
     }
     
@@ -323,7 +469,7 @@ int cmd_xcp(int argc, char **argv) {
         recursive = 1;
         src_idx = 2;
         if (argc < 4) {
-            fprintf(stderr, "xcp: missing file operand\n");
+            sink_printf(io->err, "xcp: missing file operand\n");
             return -1;
         }
     }
@@ -333,25 +479,25 @@ int cmd_xcp(int argc, char **argv) {
     
     struct stat st;
     if (stat(src, &st) != 0) {
-        perror("xcp");
+        sink_perror(io->err, "xcp");
         return -1;
     }
     
     if (S_ISDIR(st.st_mode)) {
         if (!recursive) {
-            fprintf(stderr, "xcp: %s is a directory (not copied)\n", src);
+            sink_printf(io->err, "xcp: %s is a directory (not copied)\n", src);
             return -1;
         }
-        return copy_directory(src, dst);
+        return copy_directory(src, dst, io->err);
     } else {
-        return copy_file(src, dst);
+        return copy_file(src, dst, io->err);
     }
 }
 
 // xrm - remove files/directories
-int cmd_xrm(int argc, char **argv) {
+int cmd_xrm(int argc, char **argv, BuiltinIO *io) {
     if (argc < 2) {
-        fprintf(stderr, "xrm: missing operand\n");
+        sink_printf(io->err, "xrm: missing operand\n");
         return -1;
     }
     
@@ -363,7 +509,7 @@ int cmd_xrm(int argc, char **argv) {
         recursive = 1;
         target_idx = 2;
         if (argc < 3) {
-            fprintf(stderr, "xrm: missing operand\n");
+            sink_printf(io->err, "xrm: missing operand\n");
             return -1;
         }
     }
@@ -372,19 +518,19 @@ int cmd_xrm(int argc, char **argv) {
     
     struct stat st;
     if (stat(target, &st) != 0) {
-        perror("xrm");
+        sink_perror(io->err, "xrm");
         return -1;
     }
     
     if (S_ISDIR(st.st_mode)) {
         if (!recursive) {
-            fprintf(stderr, "xrm: cannot remove '%s': Is a directory\n", target);
+            sink_printf(io->err, "xrm: cannot remove '%s': Is a directory\n", target);
             return -1;
         }
-        return remove_directory(target);
+        return remove_directory(target, io->err);
     } else {
         if (unlink(target) != 0) {
-            perror("xrm");
+            sink_perror(io->err, "xrm");
             return -1;
         }
         return 0;
@@ -392,9 +538,9 @@ int cmd_xrm(int argc, char **argv) {
 }
 
 // xmv - move files/directories
-int cmd_xmv(int argc, char **argv) {
+int cmd_xmv(int argc, char **argv, BuiltinIO *io) {
     if (argc < 3) {
-        fprintf(stderr, "xmv: missing file operand\n");
+        sink_printf(io->err, "xmv: missing file operand\n");
         return -1;
     }
     
@@ -402,26 +548,72 @@ int cmd_xmv(int argc, char **argv) {
     const char *dst = argv[2];
     
     if (rename(src, dst) != 0) {
-        perror("xmv");
+        sink_perror(io->err, "xmv");
         return -1;
     }
     
     return 0;
 }
 
+// One history entry; count is known for search results only
+static void history_record(BuiltinIO *io, unsigned long number, const char *text, unsigned int count) {
+    if (io->mode == OUTPUT_JSON) {
+        sink_printf(io->out, "{\"number\":%lu,\"command\":", number);
+        sink_json_string(io->out, text, strlen(text));
+        if (count > 0) {
+            sink_printf(io->out, ",\"count\":%u", count);
+        }
+        sink_puts(io->out, "}\n");
+    } else if (io->mode == OUTPUT_NUL) {
+        nul_record(io, text);
+    } else {
+        sink_printf(io->out, "%4lu  %s\n", number, text);
+    }
+}
+
 // xhistory - show command history
-int cmd_xhistory(int argc, char **argv) {
-    (void)argc; (void)argv;
-    for (int i = 0; i < history_count; i++) {
-        printf("%4d  %s\n", i + 1, history[i]);
+int cmd_xhistory(int argc, char **argv, BuiltinIO *io) {
+    int i = 1;
+    while (i < argc && output_flag(argv[i], io)) i++;
+    
+    // xhistory -s pattern: ranked search by frequency and recency
+    if (i < argc && strcmp(argv[i], "-s") == 0) {
+        int from = i + 1;
+        if (from >= argc) {
+            sink_printf(io->err, "Usage: xhistory -s <pattern>\n");
+            return -1;
+        }
+
+        // The pattern may span several words
+        char pattern[MAX_CMD_LEN] = "";
+        for (int j = from; j < argc; j++) {
+            if (j > from) strncat(pattern, " ", sizeof(pattern) - strlen(pattern) - 1);
+            strncat(pattern, argv[j], sizeof(pattern) - strlen(pattern) - 1);
+        }
+
+        HistoryMatch matches[HISTORY_SEARCH_MAX];
+        int found = history_search(pattern, matches, HISTORY_SEARCH_MAX);
+        for (int j = 0; j < found; j++) {
+            history_record(io, matches[j].number, matches[j].text, matches[j].count);
+        }
+        return found > 0 ? 0 : 1;
+    }
+
+    // Merge in commands from other sessions before listing
+    load_history();
+
+    unsigned long first = history_first_number();
+    int count = history_length();
+    for (int j = 0; j < count; j++) {
+        history_record(io, first + j, history_get(j), 0);
     }
     return 0;
 }
 
 // xtee - read from stdin, write to stdout and file
-int cmd_xtee(int argc, char **argv) {
+int cmd_xtee(int argc, char **argv, BuiltinIO *io) {
     if (argc < 2) {
-        fprintf(stderr, "xtee: missing file operand\n");
+        sink_printf(io->err, "xtee: missing file operand\n");
         return -1;
     }
     
@@ -429,37 +621,102 @@ int cmd_xtee(int argc, char **argv) {
     FILE *file = fopen(filename, "w");
     
     if (file == NULL) {
-        perror("xtee");
+        sink_perror(io->err, "xtee");
+        return -1;
+    }
+    
+    FILE *in = open_input(io);
+    if (in == NULL) {
+        sink_perror(io->err, "xtee");
+        fclose(file);
         return -1;
     }
     
     char buffer[4096];
     
-    while (fgets(buffer, sizeof(buffer), stdin) != NULL) {
-        // Write to stdout
-        fputs(buffer, stdout);
+    while (fgets(buffer, sizeof(buffer), in) != NULL) {
+        // Write to stdout, a line at a time as it arrives
+        sink_puts(io->out, buffer);
+        sink_flush(io->out);
         // Write to file
         fputs(buffer, file);
     }
     
+    close_input(in);
     fclose(file);
     return 0;
 }
 
+// One log line, split into its fields for --json:
+// "[time] CMD: command (status: N)" or "[time] ERROR: command - error"
+static void journal_record(BuiltinIO *io, char *line) {
+    line[strcspn(line, "\n")] = '\0';
+    if (io->mode == OUTPUT_NUL) {
+        nul_record(io, line);
+        return;
+    }
+    if (io->mode == OUTPUT_TEXT) {
+        sink_printf(io->out, "%s\n", line);
+        return;
+    }
+    
+    char *time_end = line[0] == '[' ? strstr(line, "] ") : NULL;
+    char *kind = time_end ? time_end + 2 : NULL;
+    char *text = kind ? strstr(kind, ": ") : NULL;
+    if (text == NULL) {
+        sink_puts(io->out, "{\"text\":");
+        sink_json_string(io->out, line, strlen(line));
+        sink_puts(io->out, "}\n");
+        return;
+    }
+    text += 2;
+    
+    sink_puts(io->out, "{\"time\":");
+    sink_json_string(io->out, line + 1, time_end - line - 1);
+    sink_puts(io->out, ",\"kind\":");
+    sink_json_string(io->out, kind, text - 2 - kind);
+    
+    size_t len = strlen(text);
+    char *status = strstr(text, " (status: ");
+    char *error = NULL;
+    for (char *p = strstr(text, " - "); p != NULL; p = strstr(p + 1, " - ")) {
+        error = p;
+    }
+    if (strncmp(kind, "CMD:", 4) == 0 && status != NULL) {
+        sink_puts(io->out, ",\"command\":");
+        sink_json_string(io->out, text, status - text);
+        sink_printf(io->out, ",\"status\":%d}\n", atoi(status + 10));
+    } else if (strncmp(kind, "ERROR:", 6) == 0 && error != NULL) {
+        sink_puts(io->out, ",\"command\":");
+        sink_json_string(io->out, text, error - text);
+        sink_puts(io->out, ",\"error\":");
+        sink_json_string(io->out, error + 3, len - (error + 3 - text));
+        sink_puts(io->out, "}\n");
+    } else {
+        sink_puts(io->out, ",\"text\":");
+        sink_json_string(io->out, text, len);
+        sink_puts(io->out, "}\n");
+    }
+}
+
 // xjournalctl - view xhell logs
-int cmd_xjournalctl(int argc, char **argv) {
-    (void)argc; (void)argv;
-    FILE *file = fopen(LOG_FILE, "r");
+int cmd_xjournalctl(int argc, char **argv, BuiltinIO *io) {
+    for (int i = 1; i < argc; i++) {
+        output_flag(argv[i], io);
+    }
+    int fd = openat(start_dir_fd(), LOG_FILE, O_RDONLY | O_CLOEXEC);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "r");
     
     if (file == NULL) {
-        perror("xjournalctl");
+        sink_perror(io->err, "xjournalctl");
+        if (fd != -1) close(fd);
         return -1;
     }
     
     char buffer[4096];
     
     while (fgets(buffer, sizeof(buffer), file) != NULL) {
-        printf("%s", buffer);
+        journal_record(io, buffer);
     }
     
     fclose(file);
@@ -467,83 +724,139 @@ int cmd_xjournalctl(int argc, char **argv) {
 }
 
 // quit - exit shell
-int cmd_quit(int argc, char **argv) {
+int cmd_quit(int argc, char **argv, BuiltinIO *io) {
     (void)argc; (void)argv;
+    // It would take the program that embeds the shell down with it
+    if (shell_embedded) {
+        sink_printf(io->err, "quit: not available in an embedded shell, use exit\n");
+        return 1;
+    }
     save_history();
-    printf("######### Quiting Xhell #############\n");
+    if (shell_interactive) {
+        sink_printf(io->out, "######### Quiting Xhell #############\n");
+        sink_flush(io->out);
+    }
     exit(0);
 }
 
-// xcalc - simple calculator
-int cmd_xcalc(int argc, char **argv) {
-    if (argc != 4) {
-        printf("Usage: xcalc <num1> <op> <num2>\n");
-        printf("Example: xcalc 10 + 20\n");
-        return 0;
+// xcalc - evaluate an expression, or one per line from stdin with "-"
+int cmd_xcalc(int argc, char **argv, BuiltinIO *io) {
+    int int_mode = 0;
+    int stream = 0;
+    int i = 1;
+    
+    // Only exact flags, so "xcalc -5 + 3" stays an expression
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            int_mode = 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            int_mode = 0;
+        } else if (strcmp(argv[i], "-") == 0) {
+            stream = 1;
+        } else {
+            break;
+        }
     }
     
-    double n1 = atof(argv[1]);
-    char op = argv[2][0];
-    double n2 = atof(argv[3]);
-    double res = 0;
+    if (stream) {
+        return calc_stream(io->in, io->out, io->err, int_mode);
+    }
     
-    switch (op) {
-        case '+': res = n1 + n2; break;
-        case '-': res = n1 - n2; break;
-        case '*': res = n1 * n2; break;
-        case '/': 
-            if (n2 == 0) { printf("Error: Div by zero\n"); return -1; }
-            res = n1 / n2; 
-            break;
-        default:
-            printf("Error: Unknown operator '%c'\n", op);
+    if (i >= argc) {
+        sink_printf(io->out, "Usage: xcalc [-i|-d] <expression>\n");
+        sink_printf(io->out, "       xcalc [-i|-d] -    (one expression per line from stdin)\n");
+        sink_printf(io->out, "Example: xcalc '(1 + 2) * max(3, 4) / 2'\n");
+        return 0;
+    }
+    
+    // The arguments together form the expression
+    char expr[MAX_CMD_LEN] = "";
+    for (size_t len = 0; i < argc; i++) {
+        len += snprintf(expr + len, len < sizeof(expr) ? sizeof(expr) - len : 0, "%s%s",
+                        len ? " " : "", argv[i]);
+        if (len >= sizeof(expr)) {
+            sink_printf(io->err, "xcalc: expression too long\n");
             return -1;
         }
+    }
     
-    printf("%.2f\n", res);
+    CalcValue value;
+    const char *error = NULL;
+    if (calc_eval(expr, int_mode, &value, &error) != 0) {
+        sink_printf(io->err, "xcalc: %s\n", error);
+        return -1;
+    }
+    
+    char result[64];
+    calc_format(&value, int_mode, result, sizeof(result));
+    sink_printf(io->out, "%s\n", result);
     return 0;
 }
 
 // xsh - execute script file
-int cmd_xsh(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: xsh <script.x>\n");
-        return 0;
+int cmd_xsh(int argc, char **argv, BuiltinIO *io) {
+    int trace = 0;
+    int check_only = 0;
+    int jobs = -1;
+    int i = 1;
+    
+    // Parse flags
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-x") == 0) {
+            trace = 1;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            check_only = 1;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            // -j N, -jN, or -j alone (or -j 0) for one job per CPU. What
+            // follows a bare -j is N only if it is a number.
+            const char *n = argv[i] + 2;
+            if (*n == '\0' && i + 1 < argc && argv[i + 1][0] != '\0' &&
+                strspn(argv[i + 1], "0123456789") == strlen(argv[i + 1])) {
+                n = argv[++i];
+            } else if (*n != '\0' && strspn(n, "0123456789") != strlen(n)) {
+                i = argc;
+                break;
+            }
+            jobs = atoi(n);
+        } else {
+            break;
+        }
     }
     
-    FILE *fp = fopen(argv[1], "r");
-    if (!fp) {
-        perror("xsh");
-        return -1;
+    if (i >= argc) {
+        sink_printf(io->err, "Usage: xsh [-x] [-n] [-j [N]] <script.x> [args...]\n");
+        return 2;
     }
     
-    char line[MAX_CMD_LEN];
-    Pipeline pipeline;
+    // Compiled once, then served from the .xshc cache
+    ScriptProgram prog;
+    if (script_load(argv[i], &prog) != 0) {
+        sink_perror(io->err, "xsh");
+        return -1;
+    }
     
-    // Simple line-by-line execution
-    while (fgets(line, sizeof(line), fp)) {
-        // Remove newline
-        line[strcspn(line, "\n")] = 0;
-        
-        // Skip comments and empty lines
-        if (strlen(line) == 0 || line[0] == '#') continue;
-        
-        // Echo
-        printf("+ %s\n", line);
-        
-        if (parse_command_line(line, &pipeline) == 0) {
-            execute_pipeline(&pipeline);
-        }
-        fflush(stdout);
+    // The script name becomes $0, the remaining arguments $1, $2, ...
+    int status = 0;
+    if (!check_only) {
+        int old_argc;
+        char **old_argv;
+        var_set_positional(argc - i, argv + i, &old_argc, &old_argv);
+        status = jobs >= 0 ? script_run_parallel(&prog, jobs, trace) : script_run(&prog, trace, NULL);
+        var_set_positional(old_argc, old_argv, NULL, NULL);
     }
-    fclose(fp);
-    return 0;
+    script_free(&prog);
+    return status;
 }
 
 // xsearch - search string in file (grep-like)
-int cmd_xsearch(int argc, char **argv) {
+int cmd_xsearch(int argc, char **argv, BuiltinIO *io) {
+    int i = 1;
+    while (i < argc && output_flag(argv[i], io)) i++;
+    argc -= i - 1;
+    argv += i - 1;
+    
     if (argc < 2 || argc > 3) {
-        printf("Usage: xsearch <term> [file]\n");
+        sink_printf(io->out, "Usage: xsearch [--json|-0] <term> [file]\n");
         return -1;
     }
     
@@ -551,11 +864,15 @@ int cmd_xsearch(int argc, char **argv) {
     FILE *fp;
     
     if (argc == 2) {
-        fp = stdin;
+        fp = open_input(io);
+        if (!fp) {
+            sink_perror(io->err, "xsearch");
+            return -1;
+        }
     } else {
         fp = fopen(argv[2], "r");
         if (!fp) {
-            perror("xsearch");
+            sink_perror(io->err, "xsearch");
             return -1;
         }
     }
@@ -569,9 +886,18 @@ int cmd_xsearch(int argc, char **argv) {
         line[strcspn(line, "\n")] = 0;
         
         if (strstr(line, term)) {
-            // Check if we are in a pipe or file
-            // For now, keep ANSI colors. If displaying in web, it might show raw codes but that's acceptable for "raw terminal" emulation.
-            printf("\033[1;33m%d\033[0m: %s\n", line_num, line);
+            // Colored line numbers only on a terminal
+            if (io->mode == OUTPUT_JSON) {
+                sink_printf(io->out, "{\"line\":%d,\"text\":", line_num);
+                sink_json_string(io->out, line, strlen(line));
+                sink_puts(io->out, "}\n");
+            } else if (io->mode == OUTPUT_NUL) {
+                nul_record(io, line);
+            } else if (io->color) {
+                sink_printf(io->out, "\033[1;33m%d\033[0m: %s\n", line_num, line);
+            } else {
+                sink_printf(io->out, "%d: %s\n", line_num, line);
+            }
             found++;
         }
         line_num++;
@@ -581,11 +907,39 @@ int cmd_xsearch(int argc, char **argv) {
         // Only print "No matches" if not in a pipe (to avoid clutter)? 
         // Or just print it. Standard grep is silent on no match.
         // Let's be silent on no match to be cleaner in pipes.
-        // printf("No matches found for '%s'\n", term); 
+        // sink_printf(io->out, "No matches found for '%s'\n", term); 
     }
     
-    if (fp != stdin) {
-        fclose(fp);
+    close_input(fp);
+    return 0;
+}
+
+// xcache - result cache of the pure builtins: on, off, stats or clear
+int cmd_xcache(int argc, char **argv, BuiltinIO *io) {
+    const char *action = argc > 1 ? argv[1] : "stats";
+
+    if (strcmp(action, "on") == 0) {
+        cache_enable(argc > 2 ? strtoull(argv[2], NULL, 10) : 0);
+    } else if (strcmp(action, "off") == 0) {
+        cache_disable();
+    } else if (strcmp(action, "clear") == 0) {
+        cache_clear();
+    } else if (strcmp(action, "stats") == 0) {
+        CacheStats st;
+        cache_stats(&st);
+        unsigned long long lookups = st.hits + st.misses;
+        sink_printf(io->out, "enabled     : %s\n", st.enabled ? "yes" : "no");
+        sink_printf(io->out, "entries     : %zu\n", st.entries);
+        sink_printf(io->out, "bytes       : %zu / %zu\n", st.bytes, st.cap);
+        sink_printf(io->out, "hits        : %llu\n", st.hits);
+        sink_printf(io->out, "misses      : %llu\n", st.misses);
+        sink_printf(io->out, "hit rate    : %.1f%%\n", lookups ? 100.0 * st.hits / lookups : 0.0);
+        sink_printf(io->out, "stores      : %llu\n", st.stores);
+        sink_printf(io->out, "evictions   : %llu\n", st.evictions);
+        sink_printf(io->out, "uncacheable : %llu\n", st.uncacheable);
+    } else {
+        sink_printf(io->err, "Usage: xcache [on [bytes]|off|stats|clear]\n");
+        return 1;
     }
     return 0;
 }
@@ -0,0 +1,345 @@
+#include "../include/xhell.h"
+
+// Result cache for pure builtins (xcache)
+//
+// Builtins marked BUILTIN_PURE print the same thing for the same argv
+// and the same inputs. With the cache on, their output, errors and
+// status are kept in memory under a key made of argv, the output mode,
+// the working directory and the identity (dev, inode, size, mtime,
+// ctime) of every file they read, so an unchanged file costs one stat
+// instead of a read. xsysinfo reads /proc, whose files have no useful
+// identity, so its results expire after CACHE_TTL_NS instead.
+//
+// A file modified in the last CACHE_RACY_NS could change again without
+// its mtime moving, so results that read one are not kept. Entries are
+// evicted least recently used first once they hold more than the byte
+// cap; a result bigger than an eighth of it is not kept at all.
+//
+// Off unless XHELL_CACHE=<bytes> is set or "xcache on" is run.
+
+#define CACHE_DEFAULT_BYTES (16 << 20)
+#define CACHE_TTL_NS 1000000000LL
+#define CACHE_RACY_NS 1000000000LL
+
+typedef struct CacheEntry {
+    uint64_t hash;
+    char *key;
+    size_t key_len;
+    char *out;
+    size_t out_len;
+    char *err;
+    size_t err_len;
+    int status;
+    long long expires;              // CLOCK_MONOTONIC ns, 0 for never
+    struct CacheEntry *next;        // in its bucket
+    struct CacheEntry *newer;       // LRU list, most recent at the head
+    struct CacheEntry *older;
+} CacheEntry;
+
+static int cache_ready = 0;
+static int cache_on = 0;
+static size_t cache_cap = CACHE_DEFAULT_BYTES;
+static size_t cache_used = 0;
+static size_t cache_count = 0;
+static CacheEntry **buckets = NULL;
+static size_t bucket_count = 0;
+static CacheEntry *newest = NULL;
+static CacheEntry *oldest = NULL;
+static CacheStats stats;
+
+static long long now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;       // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t entry_bytes(const CacheEntry *e) {
+    return sizeof(*e) + e->key_len + e->out_len + e->err_len;
+}
+
+static void lru_unlink(CacheEntry *e) {
+    if (e->newer) e->newer->older = e->older; else newest = e->older;
+    if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void lru_push(CacheEntry *e) {
+    e->newer = NULL;
+    e->older = newest;
+    if (newest) newest->newer = e; else oldest = e;
+    newest = e;
+}
+
+static void entry_remove(CacheEntry *e) {
+    CacheEntry **p = &buckets[e->hash & (bucket_count - 1)];
+    while (*p != e) p = &(*p)->next;
+    *p = e->next;
+    lru_unlink(e);
+    cache_used -= entry_bytes(e);
+    cache_count--;
+    free(e->key);
+    free(e->out);
+    free(e->err);
+    free(e);
+}
+
+static void cache_init(void) {
+    cache_ready = 1;
+    const char *size = var_get("XHELL_CACHE");
+    if (size != NULL && *size) {
+        cache_enable(strtoull(size, NULL, 10));
+    }
+}
+
+void cache_enable(size_t bytes) {
+    cache_ready = 1;
+    cache_on = 1;
+    cache_cap = bytes > 0 ? bytes : CACHE_DEFAULT_BYTES;
+    while (oldest != NULL && cache_used > cache_cap) {
+        entry_remove(oldest);
+        stats.evictions++;
+    }
+}
+
+void cache_disable(void) {
+    cache_ready = 1;
+    cache_on = 0;
+    cache_clear();
+}
+
+// Drop every entry; the hit and miss counters keep counting
+void cache_clear(void) {
+    while (oldest != NULL) {
+        entry_remove(oldest);
+    }
+}
+
+void cache_stats(CacheStats *out) {
+    if (!cache_ready) cache_init();
+    *out = stats;
+    out->enabled = cache_on;
+    out->entries = cache_count;
+    out->bytes = cache_used;
+    out->cap = cache_cap;
+}
+
+// Add what identifies a file's contents to the key. Missing files count
+// too: their creation changes the key.
+static void key_file(Sink *key, const char *path, int *racy) {
+    struct stat st;
+    long long id[6] = {0};
+    if (stat(path, &st) == 0) {
+        id[0] = st.st_dev;
+        id[1] = st.st_ino;
+        id[2] = st.st_size;
+        id[3] = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        id[4] = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+        id[5] = st.st_mode;
+        if (now_ns(CLOCK_REALTIME) - (id[3] > id[4] ? id[3] : id[4]) < CACHE_RACY_NS) {
+            *racy = 1;
+        }
+    }
+    sink_write(key, id, sizeof(id));
+}
+
+// What each pure builtin reads besides argv. -1 if the result cannot be
+// kept: the builtin reads stdin, or prints what the key does not cover.
+
+static int xls_inputs(int argc, char **argv, BuiltinIO *io, Sink *key, int *racy) {
+    // Only the names of -0 come from the directory alone: the / and *
+    // marks, colours and -l and --json fields come from each entry's
+    // stat, which a chmod changes without touching the directory
+    int nul = io->mode == OUTPUT_NUL;
+    const char *path = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--json") == 0) return -1;
+        if (strcmp(argv[i], "-0") == 0) nul = 1;
+        else if (argv[i][0] != '-') path = argv[i];
+    }
+    if (!nul) return -1;
+    key_file(key, path, racy);
+    return 0;
+}
+
+static int xsearch_inputs(int argc, char **argv, BuiltinIO *io, Sink *key, int *racy) {
+    (void)io;
+    int i = 1;
+    while (i < argc && (strcmp(argv[i], "--json") == 0 || strcmp(argv[i], "-0") == 0)) i++;
+    if (argc - i != 2 || strcmp(argv[i + 1], "-") == 0) return -1;
+    key_file(key, argv[i + 1], racy);
+    return 0;
+}
+
+static int xcalc_inputs(int argc, char **argv, BuiltinIO *io, Sink *key, int *racy) {
+    (void)io; (void)key; (void)racy;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-") == 0) return -1;
+    }
+    return 0;
+}
+
+static const struct {
+    int (*func)(int argc, char **argv, BuiltinIO *io);
+    int (*inputs)(int argc, char **argv, BuiltinIO *io, Sink *key, int *racy);
+    long long ttl;
+} policies[] = {
+    {cmd_xls, xls_inputs, 0},
+    {cmd_xsearch, xsearch_inputs, 0},
+    {cmd_xcalc, xcalc_inputs, 0},
+    {cmd_xsysinfo, NULL, CACHE_TTL_NS},
+};
+
+static CacheEntry *lookup(uint64_t hash, const char *key, size_t key_len) {
+    for (CacheEntry *e = buckets[hash & (bucket_count - 1)]; e != NULL; e = e->next) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void grow_buckets(void) {
+    size_t count = bucket_count ? bucket_count * 2 : 256;
+    CacheEntry **table = calloc(count, sizeof(*table));
+    if (table == NULL) return;
+    for (size_t i = 0; i < bucket_count; i++) {
+        CacheEntry *e = buckets[i];
+        while (e != NULL) {
+            CacheEntry *next = e->next;
+            e->next = table[e->hash & (count - 1)];
+            table[e->hash & (count - 1)] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    bucket_count = count;
+}
+
+static void store(uint64_t hash, char *key, size_t key_len, Sink *out, Sink *err,
+                  int status, long long ttl) {
+    CacheEntry *e = calloc(1, sizeof(*e));
+    if (e == NULL) {
+        free(key);
+        return;
+    }
+    e->hash = hash;
+    e->key = key;
+    e->key_len = key_len;
+    e->out = sink_take(out, &e->out_len);
+    e->err = sink_take(err, &e->err_len);
+    e->status = status;
+    e->expires = ttl ? now_ns(CLOCK_MONOTONIC) + ttl : 0;
+
+    if (cache_count >= bucket_count) grow_buckets();
+    if (buckets == NULL) {
+        free(e->key);
+        free(e->out);
+        free(e->err);
+        free(e);
+        return;
+    }
+    e->next = buckets[hash & (bucket_count - 1)];
+    buckets[hash & (bucket_count - 1)] = e;
+    lru_push(e);
+    cache_used += entry_bytes(e);
+    cache_count++;
+    stats.stores++;
+    while (cache_used > cache_cap && oldest != e) {
+        entry_remove(oldest);
+        stats.evictions++;
+    }
+}
+
+// Run a builtin through the cache: from it when the key matches, else
+// for real with its output copied aside to be kept
+int cache_run(const BuiltinCommand *builtin, int argc, char **argv, BuiltinIO *io) {
+    if (!cache_ready) cache_init();
+    if (!cache_on || !(builtin->flags & BUILTIN_PURE)) {
+        return builtin->func(argc, argv, io);
+    }
+
+    size_t p = 0;
+    while (p < sizeof(policies) / sizeof(policies[0]) && policies[p].func != builtin->func) p++;
+    if (p == sizeof(policies) / sizeof(policies[0])) {
+        return builtin->func(argc, argv, io);
+    }
+
+    // argv, how the output is formatted, and where relative paths lead
+    Sink key;
+    sink_open_memory(&key);
+    for (int i = 0; i < argc; i++) {
+        sink_write(&key, argv[i], strlen(argv[i]) + 1);
+    }
+    int format[2] = {io->mode, io->color};
+    sink_write(&key, format, sizeof(format));
+    struct stat cwd;
+    long long where[2] = {0};
+    if (stat(".", &cwd) == 0) {
+        where[0] = cwd.st_dev;
+        where[1] = cwd.st_ino;
+    }
+    sink_write(&key, where, sizeof(where));
+    int racy = 0;
+    if (policies[p].inputs != NULL && policies[p].inputs(argc, argv, io, &key, &racy) != 0) {
+        sink_close(&key);
+        stats.uncacheable++;
+        return builtin->func(argc, argv, io);
+    }
+
+    size_t key_len;
+    char *key_data = sink_take(&key, &key_len);
+    if (key_data == NULL) {
+        return builtin->func(argc, argv, io);
+    }
+    uint64_t hash = hash_bytes(key_data, key_len);
+
+    CacheEntry *hit = bucket_count ? lookup(hash, key_data, key_len) : NULL;
+    if (hit != NULL && hit->expires && hit->expires <= now_ns(CLOCK_MONOTONIC)) {
+        entry_remove(hit);
+        hit = NULL;
+    }
+    if (hit != NULL) {
+        free(key_data);
+        lru_unlink(hit);
+        lru_push(hit);
+        stats.hits++;
+        sink_write(io->out, hit->out, hit->out_len);
+        sink_write(io->err, hit->err, hit->err_len);
+        return hit->status;
+    }
+    stats.misses++;
+
+    // The copies give up, and the result is not kept, past the limit
+    Sink out, err;
+    sink_open_memory(&out);
+    sink_open_memory(&err);
+    io->out->copy = &out;
+    io->out->copy_limit = cache_cap / 8;
+    io->err->copy = &err;
+    io->err->copy_limit = cache_cap / 8;
+    int status = builtin->func(argc, argv, io);
+    io->out->copy = NULL;
+    io->err->copy = NULL;
+
+    size_t size = sizeof(CacheEntry) + key_len + out.len + err.len;
+    if (racy || out.failed || err.failed || io->out->failed || io->err->failed ||
+        size > cache_cap / 8) {
+        free(key_data);
+        stats.uncacheable++;
+    } else {
+        store(hash, key_data, key_len, &out, &err, status, policies[p].ttl);
+    }
+    sink_close(&out);
+    sink_close(&err);
+    return status;
+}
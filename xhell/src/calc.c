@@ -0,0 +1,690 @@
+#include "../include/xhell.h"
+#include <limits.h>
+#include <math.h>
+
+// xcalc expression engine
+//
+// Expressions are compiled into a short postfix program and evaluated on
+// a small value stack, either in double mode (the default) or in int64
+// mode (xcalc -i). Compiled programs are cached by their source text, so
+// a stream of repeated expressions (xcalc -) is only parsed once.
+//
+// Grammar, lowest precedence first:
+//   |   &   << >>   + -   * / %   unary - + ~   ** ^ (right associative)
+// Bitwise operators need int64 mode. Literals may be decimal, 0x hex,
+// 0b binary or 0o octal; pi and e are constants. Functions: min, max,
+// pow, sqrt, log, abs.
+
+#define CALC_MAX_CODE 256
+#define CALC_MAX_STACK 64
+#define CALC_CACHE_SIZE 4096        // slots, a power of two
+#define CALC_STREAM_BUF 65536
+
+enum {
+    C_NUM, C_ADD, C_SUB, C_MUL, C_DIV, C_MOD, C_POW, C_NEG, C_NOT,
+    C_AND, C_OR, C_SHL, C_SHR, C_MIN, C_MAX, C_SQRT, C_LOG, C_ABS
+};
+
+typedef struct {
+    uint8_t op;
+    uint8_t argc;           // arguments of min and max
+    CalcValue v;            // C_NUM constant
+} CalcInstr;
+
+typedef struct {
+    const char *p;
+    int int_mode;
+    const char *error;
+    CalcInstr code[CALC_MAX_CODE];
+    int count;
+    int depth;              // stack depth at this point of the program
+    int max_depth;
+} CalcParser;
+
+typedef struct {
+    char *text;
+    int int_mode;
+    uint64_t hash;
+    CalcInstr *code;
+    int count;
+} CalcCacheEntry;
+
+static CalcCacheEntry *calc_cache = NULL;
+static int calc_cache_used = 0;
+
+// --- Compiling ---
+
+static void calc_emit(CalcParser *cp, int op, int argc, int pops) {
+    if (cp->error) return;
+    if (cp->count == CALC_MAX_CODE) {
+        cp->error = "expression too long";
+        return;
+    }
+    CalcInstr *ins = &cp->code[cp->count++];
+    ins->op = op;
+    ins->argc = argc;
+    cp->depth += 1 - pops;
+    if (cp->depth > cp->max_depth) cp->max_depth = cp->depth;
+    if (cp->max_depth > CALC_MAX_STACK) cp->error = "expression too deeply nested";
+}
+
+static void calc_skip(CalcParser *cp) {
+    while (*cp->p == ' ' || *cp->p == '\t' || *cp->p == '\r') cp->p++;
+}
+
+static void calc_expr(CalcParser *cp);
+
+static void calc_number(CalcParser *cp) {
+    const char *p = cp->p;
+    CalcValue v;
+    int base = 10;
+
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) base = 16;
+    else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) base = 2;
+    else if (p[0] == '0' && (p[1] == 'o' || p[1] == 'O')) base = 8;
+
+    if (base != 10) {
+        char *end;
+        v.i = (long long)strtoull(p + 2, &end, base);
+        if (end == p + 2) {
+            cp->error = "bad number";
+            return;
+        }
+        if (!cp->int_mode) v.d = (double)v.i;
+        cp->p = end;
+    } else {
+        // Plain integers are the common case; leave the rest to strtod
+        long long n = 0;
+        const char *q = p;
+        while (*q >= '0' && *q <= '9' && q - p < 18) n = n * 10 + (*q++ - '0');
+
+        if (*q == '.' || *q == 'e' || *q == 'E' || (*q >= '0' && *q <= '9')) {
+            if (cp->int_mode && *q != '.' && *q != 'e' && *q != 'E') {
+                char *end;
+                errno = 0;
+                v.i = strtoll(p, &end, 10);
+                if (errno == ERANGE) {
+                    cp->error = "integer overflow";
+                    return;
+                }
+                cp->p = end;
+            } else if (cp->int_mode) {
+                cp->error = "not an integer (use double mode)";
+                return;
+            } else {
+                char *end;
+                v.d = strtod(p, &end);
+                cp->p = end;
+            }
+        } else if (cp->int_mode) {
+            v.i = n;
+            cp->p = q;
+        } else {
+            v.d = (double)n;
+            cp->p = q;
+        }
+    }
+
+    calc_emit(cp, C_NUM, 0, 0);
+    if (!cp->error) cp->code[cp->count - 1].v = v;
+}
+
+static const struct {
+    const char *name;
+    int op;
+    int min_args;
+    int max_args;
+} calc_functions[] = {
+    {"min", C_MIN, 1, 255},
+    {"max", C_MAX, 1, 255},
+    {"pow", C_POW, 2, 2},
+    {"sqrt", C_SQRT, 1, 1},
+    {"log", C_LOG, 1, 1},
+    {"abs", C_ABS, 1, 1},
+    {NULL, 0, 0, 0}
+};
+
+static void calc_name(CalcParser *cp) {
+    const char *start = cp->p;
+    while ((*cp->p >= 'a' && *cp->p <= 'z') || (*cp->p >= 'A' && *cp->p <= 'Z') ||
+           (*cp->p >= '0' && *cp->p <= '9') || *cp->p == '_') {
+        cp->p++;
+    }
+    size_t len = cp->p - start;
+
+    if ((len == 2 && strncmp(start, "pi", 2) == 0) || (len == 1 && *start == 'e')) {
+        CalcValue v;
+        double d = len == 2 ? M_PI : M_E;
+        if (cp->int_mode) v.i = (long long)d; else v.d = d;
+        calc_emit(cp, C_NUM, 0, 0);
+        if (!cp->error) cp->code[cp->count - 1].v = v;
+        return;
+    }
+
+    for (int f = 0; calc_functions[f].name; f++) {
+        if (strlen(calc_functions[f].name) != len || strncmp(start, calc_functions[f].name, len) != 0) {
+            continue;
+        }
+
+        calc_skip(cp);
+        if (*cp->p != '(') {
+            cp->error = "expected ( after function name";
+            return;
+        }
+        cp->p++;
+
+        int argc = 0;
+        calc_skip(cp);
+        if (*cp->p != ')') {
+            for (;;) {
+                calc_expr(cp);
+                argc++;
+                calc_skip(cp);
+                if (cp->error || *cp->p != ',') break;
+                cp->p++;
+            }
+        }
+        if (cp->error) return;
+        if (*cp->p != ')') {
+            cp->error = "expected )";
+            return;
+        }
+        cp->p++;
+
+        if (argc < calc_functions[f].min_args || argc > calc_functions[f].max_args) {
+            cp->error = "wrong number of function arguments";
+            return;
+        }
+        calc_emit(cp, calc_functions[f].op, argc, argc);
+        return;
+    }
+
+    cp->error = "unknown name";
+}
+
+static void calc_primary(CalcParser *cp) {
+    calc_skip(cp);
+    char c = *cp->p;
+
+    if (c == '(') {
+        cp->p++;
+        calc_expr(cp);
+        calc_skip(cp);
+        if (*cp->p == ')') {
+            cp->p++;
+        } else if (!cp->error) {
+            cp->error = "expected )";
+        }
+    } else if ((c >= '0' && c <= '9') || c == '.') {
+        calc_number(cp);
+    } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+        calc_name(cp);
+    } else {
+        cp->error = c ? "unexpected character" : "unexpected end of expression";
+    }
+}
+
+static void calc_unary(CalcParser *cp);
+
+// base ** exponent, right associative and tighter than unary minus on
+// its left: -2 ** 2 is -4
+static void calc_power(CalcParser *cp) {
+    calc_primary(cp);
+    calc_skip(cp);
+    if (cp->p[0] == '^' || (cp->p[0] == '*' && cp->p[1] == '*')) {
+        cp->p += cp->p[0] == '^' ? 1 : 2;
+        calc_unary(cp);
+        calc_emit(cp, C_POW, 2, 2);
+    }
+}
+
+static void calc_unary(CalcParser *cp) {
+    calc_skip(cp);
+    char c = *cp->p;
+    if (c == '-' || c == '+' || c == '~') {
+        cp->p++;
+        calc_unary(cp);
+        if (c == '-') calc_emit(cp, C_NEG, 0, 1);
+        if (c == '~') {
+            if (!cp->int_mode) cp->error = "~ needs int mode (xcalc -i)";
+            calc_emit(cp, C_NOT, 0, 1);
+        }
+        return;
+    }
+    calc_power(cp);
+}
+
+static void calc_term(CalcParser *cp) {
+    calc_unary(cp);
+    while (!cp->error) {
+        calc_skip(cp);
+        char c = *cp->p;
+        if ((c != '*' && c != '/' && c != '%') || (c == '*' && cp->p[1] == '*')) break;
+        cp->p++;
+        calc_unary(cp);
+        calc_emit(cp, c == '*' ? C_MUL : c == '/' ? C_DIV : C_MOD, 2, 2);
+    }
+}
+
+static void calc_sum(CalcParser *cp) {
+    calc_term(cp);
+    while (!cp->error) {
+        calc_skip(cp);
+        char c = *cp->p;
+        if (c != '+' && c != '-') break;
+        cp->p++;
+        calc_term(cp);
+        calc_emit(cp, c == '+' ? C_ADD : C_SUB, 2, 2);
+    }
+}
+
+static void calc_bitwise(CalcParser *cp, int op, int width) {
+    if (!cp->int_mode) {
+        cp->error = "bitwise operators need int mode (xcalc -i)";
+        return;
+    }
+    cp->p += width;
+    if (op == C_SHL || op == C_SHR) calc_sum(cp);
+    calc_emit(cp, op, 2, 2);
+}
+
+static void calc_shift(CalcParser *cp) {
+    calc_sum(cp);
+    while (!cp->error) {
+        calc_skip(cp);
+        if (cp->p[0] == '<' && cp->p[1] == '<') calc_bitwise(cp, C_SHL, 2);
+        else if (cp->p[0] == '>' && cp->p[1] == '>') calc_bitwise(cp, C_SHR, 2);
+        else break;
+    }
+}
+
+static void calc_and(CalcParser *cp) {
+    calc_shift(cp);
+    while (!cp->error) {
+        calc_skip(cp);
+        if (*cp->p != '&') break;
+        if (!cp->int_mode) {
+            cp->error = "bitwise operators need int mode (xcalc -i)";
+            return;
+        }
+        cp->p++;
+        calc_shift(cp);
+        calc_emit(cp, C_AND, 2, 2);
+    }
+}
+
+static void calc_expr(CalcParser *cp) {
+    calc_and(cp);
+    while (!cp->error) {
+        calc_skip(cp);
+        if (*cp->p != '|') break;
+        if (!cp->int_mode) {
+            cp->error = "bitwise operators need int mode (xcalc -i)";
+            return;
+        }
+        cp->p++;
+        calc_and(cp);
+        calc_emit(cp, C_OR, 2, 2);
+    }
+}
+
+// --- Evaluating ---
+
+// Integer + - * / % with the overflow and division checks C leaves
+// undefined; shared with $((...)). Returns 0, or -1 with *error set.
+int calc_int_op(int op, long long a, long long b, long long *out, const char **error) {
+    int overflow = 0;
+    switch (op) {
+        case '+': overflow = __builtin_add_overflow(a, b, out); break;
+        case '-': overflow = __builtin_sub_overflow(a, b, out); break;
+        case '*': overflow = __builtin_mul_overflow(a, b, out); break;
+        case '/':
+        case '%':
+            if (b == 0) {
+                *error = "division by zero";
+                return -1;
+            }
+            // LLONG_MIN / -1 traps instead of wrapping
+            if (a == LLONG_MIN && b == -1) {
+                overflow = 1;
+                break;
+            }
+            *out = op == '/' ? a / b : a % b;
+            break;
+    }
+    if (overflow) {
+        *error = "overflow";
+        return -1;
+    }
+    return 0;
+}
+
+static int ipow(long long base, long long exp, long long *out, const char **error) {
+    long long result = 1;
+    if (exp < 0) {
+        *out = base == 1 ? 1 : base == -1 ? (exp & 1 ? -1 : 1) : 0;
+        return 0;
+    }
+    while (exp) {
+        if ((exp & 1) && calc_int_op('*', result, base, &result, error) != 0) {
+            return -1;
+        }
+        exp >>= 1;
+        if (exp && calc_int_op('*', base, base, &base, error) != 0) {
+            return -1;
+        }
+    }
+    *out = result;
+    return 0;
+}
+
+static int calc_run_int(const CalcInstr *code, int count, CalcValue *out, const char **error) {
+    long long st[CALC_MAX_STACK];
+    int sp = 0;
+
+    for (int pc = 0; pc < count; pc++) {
+        const CalcInstr *ins = &code[pc];
+        long long b = sp > 0 ? st[sp - 1] : 0;
+        long long *a = sp > 1 ? &st[sp - 2] : NULL;
+        int rc = 0;
+
+        switch (ins->op) {
+            case C_NUM: st[sp++] = ins->v.i; break;
+            case C_ADD: rc = calc_int_op('+', *a, b, a, error); sp--; break;
+            case C_SUB: rc = calc_int_op('-', *a, b, a, error); sp--; break;
+            case C_MUL: rc = calc_int_op('*', *a, b, a, error); sp--; break;
+            case C_DIV: rc = calc_int_op('/', *a, b, a, error); sp--; break;
+            case C_MOD: rc = calc_int_op('%', *a, b, a, error); sp--; break;
+            case C_POW: rc = ipow(*a, b, a, error); sp--; break;
+            case C_AND: *a &= b; sp--; break;
+            case C_OR: *a |= b; sp--; break;
+            case C_SHL: *a = (long long)((unsigned long long)*a << (b & 63)); sp--; break;
+            case C_SHR: *a >>= (b & 63); sp--; break;
+            case C_NEG: rc = calc_int_op('-', 0, b, &st[sp - 1], error); break;
+            case C_NOT: st[sp - 1] = ~b; break;
+            case C_ABS: rc = calc_int_op(b < 0 ? '-' : '+', 0, b, &st[sp - 1], error); break;
+            case C_SQRT:
+            case C_LOG:
+                if (b < 0 || (ins->op == C_LOG && b == 0)) {
+                    *error = "math domain error";
+                    return -1;
+                }
+                st[sp - 1] = (long long)(ins->op == C_SQRT ? sqrt((double)b) : log((double)b));
+                break;
+            case C_MIN:
+            case C_MAX: {
+                long long v = st[sp - ins->argc];
+                for (int i = sp - ins->argc + 1; i < sp; i++) {
+                    if (ins->op == C_MIN ? st[i] < v : st[i] > v) v = st[i];
+                }
+                sp -= ins->argc;
+                st[sp++] = v;
+                break;
+            }
+        }
+        if (rc != 0) {
+            return -1;
+        }
+    }
+
+    out->i = st[0];
+    return 0;
+}
+
+static int calc_run_double(const CalcInstr *code, int count, CalcValue *out, const char **error) {
+    double st[CALC_MAX_STACK];
+    int sp = 0;
+
+    for (int pc = 0; pc < count; pc++) {
+        const CalcInstr *ins = &code[pc];
+        double b = sp > 0 ? st[sp - 1] : 0;
+        double *a = sp > 1 ? &st[sp - 2] : NULL;
+
+        switch (ins->op) {
+            case C_NUM: st[sp++] = ins->v.d; break;
+            case C_ADD: *a += b; sp--; break;
+            case C_SUB: *a -= b; sp--; break;
+            case C_MUL: *a *= b; sp--; break;
+            case C_DIV:
+            case C_MOD:
+                if (b == 0) {
+                    *error = "division by zero";
+                    return -1;
+                }
+                *a = ins->op == C_DIV ? *a / b : fmod(*a, b);
+                sp--;
+                break;
+            case C_POW: *a = pow(*a, b); sp--; break;
+            case C_NEG: st[sp - 1] = -b; break;
+            case C_ABS: st[sp - 1] = fabs(b); break;
+            case C_SQRT:
+            case C_LOG:
+                if (b < 0 || (ins->op == C_LOG && b == 0)) {
+                    *error = "math domain error";
+                    return -1;
+                }
+                st[sp - 1] = ins->op == C_SQRT ? sqrt(b) : log(b);
+                break;
+            case C_MIN:
+            case C_MAX: {
+                double v = st[sp - ins->argc];
+                for (int i = sp - ins->argc + 1; i < sp; i++) {
+                    if (ins->op == C_MIN ? st[i] < v : st[i] > v) v = st[i];
+                }
+                sp -= ins->argc;
+                st[sp++] = v;
+                break;
+            }
+        }
+    }
+
+    out->d = st[0];
+    return 0;
+}
+
+// --- Cache ---
+
+static uint64_t calc_hash(const char *text, size_t len, int int_mode) {
+    uint64_t h = 1469598103934665603ULL ^ (uint64_t)int_mode;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void calc_cache_clear(void) {
+    for (int i = 0; i < CALC_CACHE_SIZE; i++) {
+        free(calc_cache[i].text);
+        free(calc_cache[i].code);
+    }
+    memset(calc_cache, 0, CALC_CACHE_SIZE * sizeof(CalcCacheEntry));
+    calc_cache_used = 0;
+}
+
+// Find or compile the program for text[0..len). Returns NULL with *error
+// set when the expression does not compile.
+static CalcCacheEntry *calc_lookup(const char *text, size_t len, int int_mode, const char **error) {
+    if (calc_cache == NULL) {
+        calc_cache = calloc(CALC_CACHE_SIZE, sizeof(CalcCacheEntry));
+        if (calc_cache == NULL) {
+            *error = "out of memory";
+            return NULL;
+        }
+    }
+
+    uint64_t hash = calc_hash(text, len, int_mode);
+    unsigned int pos = (unsigned int)hash & (CALC_CACHE_SIZE - 1);
+    while (calc_cache[pos].text != NULL) {
+        CalcCacheEntry *e = &calc_cache[pos];
+        if (e->hash == hash && e->int_mode == int_mode &&
+            strncmp(e->text, text, len) == 0 && e->text[len] == '\0') {
+            return e;
+        }
+        pos = (pos + 1) & (CALC_CACHE_SIZE - 1);
+    }
+
+    // Compile; the parser wants a terminated string
+    char buf[MAX_CMD_LEN];
+    if (len >= sizeof(buf)) {
+        *error = "expression too long";
+        return NULL;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    CalcParser cp;
+    cp.p = buf;
+    cp.int_mode = int_mode;
+    cp.error = NULL;
+    cp.count = cp.depth = cp.max_depth = 0;
+    calc_expr(&cp);
+    calc_skip(&cp);
+    if (!cp.error && *cp.p != '\0' && *cp.p != '\n') {
+        cp.error = *cp.p == ')' ? "unbalanced )" : "unexpected character";
+    }
+    if (cp.error) {
+        *error = cp.error;
+        return NULL;
+    }
+
+    // Keep the table at most three quarters full by starting over
+    if ((calc_cache_used + 1) * 4 > CALC_CACHE_SIZE * 3) {
+        calc_cache_clear();
+        pos = (unsigned int)hash & (CALC_CACHE_SIZE - 1);
+    }
+
+    CalcCacheEntry *e = &calc_cache[pos];
+    e->code = malloc(cp.count * sizeof(CalcInstr));
+    e->text = strdup(buf);
+    if (e->code == NULL || e->text == NULL) {
+        free(e->code);
+        free(e->text);
+        memset(e, 0, sizeof(*e));
+        *error = "out of memory";
+        return NULL;
+    }
+    memcpy(e->code, cp.code, cp.count * sizeof(CalcInstr));
+    e->count = cp.count;
+    e->hash = hash;
+    e->int_mode = int_mode;
+    calc_cache_used++;
+    return e;
+}
+
+// Evaluate expr. Returns 0 on success, -1 with *error set otherwise.
+int calc_eval(const char *expr, int int_mode, CalcValue *out, const char **error) {
+    CalcCacheEntry *e = calc_lookup(expr, strlen(expr), int_mode, error);
+    if (e == NULL) {
+        return -1;
+    }
+    return int_mode ? calc_run_int(e->code, e->count, out, error)
+                    : calc_run_double(e->code, e->count, out, error);
+}
+
+// Format a result. Whole doubles print without a fraction.
+int calc_format(const CalcValue *v, int int_mode, char *buf, size_t size) {
+    long long n;
+    if (int_mode) {
+        n = v->i;
+    } else if (v->d == (double)(long long)v->d && v->d > -1e15 && v->d < 1e15) {
+        n = (long long)v->d;
+    } else {
+        return snprintf(buf, size, "%.15g", v->d);
+    }
+
+    // Integer fast path, this is most of xcalc - output
+    char tmp[24];
+    int len = 0;
+    unsigned long long u = n < 0 ? -(unsigned long long)n : (unsigned long long)n;
+    do {
+        tmp[len++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0) tmp[len++] = '-';
+
+    if ((size_t)len >= size) return 0;
+    for (int i = 0; i < len; i++) buf[i] = tmp[len - 1 - i];
+    buf[len] = '\0';
+    return len;
+}
+
+// --- Streaming ---
+
+// Evaluate one expression per line from in_fd, writing one result per
+// line to out, whose buffer batches them. A line that fails prints
+// "error" so results stay aligned with their input. Returns 0 when
+// every line evaluated.
+int calc_stream(int in_fd, Sink *out, Sink *err, int int_mode) {
+    char *in = malloc(CALC_STREAM_BUF);
+    if (in == NULL) {
+        return -1;
+    }
+
+    size_t have = 0;
+    unsigned long line_no = 0;
+    int failed = 0;
+    int eof = 0;
+
+    while (!eof || have > 0) {
+        if (!eof) {
+            ssize_t n = read(in_fd, in + have, CALC_STREAM_BUF - have);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) eof = 1;
+            else have += n;
+        }
+
+        size_t start = 0;
+        for (;;) {
+            char *nl = memchr(in + start, '\n', have - start);
+            size_t len;
+            if (nl != NULL) {
+                len = nl - (in + start);
+            } else if (eof && start < have) {
+                len = have - start;     // last line without a newline
+            } else if (!eof && start == 0 && have == CALC_STREAM_BUF) {
+                len = have;             // overlong line, evaluate what we have
+            } else {
+                break;
+            }
+
+            const char *line = in + start;
+            start += len + (nl != NULL);
+            line_no++;
+
+            size_t trimmed = len;
+            while (trimmed > 0 && (line[trimmed - 1] == '\r' || line[trimmed - 1] == ' ')) trimmed--;
+            if (trimmed == 0) {
+                continue;
+            }
+
+            const char *error = NULL;
+            CalcValue v;
+            CalcCacheEntry *e = calc_lookup(line, trimmed, int_mode, &error);
+            int rc = e == NULL ? -1 : int_mode ? calc_run_int(e->code, e->count, &v, &error)
+                                               : calc_run_double(e->code, e->count, &v, &error);
+
+            char result[64];
+            size_t result_len;
+            if (rc == 0) {
+                result_len = calc_format(&v, int_mode, result, 40);
+            } else {
+                sink_printf(err, "xcalc: line %lu: %s\n", line_no, error);
+                memcpy(result, "error", 5);
+                result_len = 5;
+                failed = 1;
+            }
+            result[result_len++] = '\n';
+            if (sink_write(out, result, result_len) != 0) {
+                free(in);
+                return -1;
+            }
+        }
+
+        memmove(in, in + start, have - start);
+        have -= start;
+    }
+
+    free(in);
+    return sink_flush(out) != 0 || failed ? 1 : 0;
+}
@@ -0,0 +1,1010 @@
+#define _GNU_SOURCE
+#include "../include/xhell.h"
+
+// Word expansion
+//
+// Turns a raw word as written in a command line into its final value:
+// quotes are removed, backslash escapes applied, and $NAME, ${NAME},
+// ${NAME:-word} and the other ${...} forms, $?, $#, $@, $*, $0-$9, $$,
+// $((arithmetic)) and $(command) are substituted. Expansions are not
+// split into several words, except where the caller asks for it (the
+// word list of a for loop), in which case unquoted expansion results are
+// split on blanks. Command arguments and for lists also get brace
+// expansion and pathname expansion (glob.c).
+//
+// $(command) runs in the shell itself with stdout pointed at a memory
+// file, so a builtin such as xpwd is captured without a fork; external
+// programs are forked as usual and write into the same memory file.
+//
+// <(command) and >(command) run the command in a child connected to a
+// pipe, and expand to the /dev/fd/N name of the shell's end of it.
+// Here-documents and here-strings are written to memory files and
+// redirected from their /dev/fd/N names, so neither touches the disk.
+// These descriptors stay open until the command using them has run;
+// the interpreter then calls subst_release().
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+static int sb_reserve(StrBuf *sb, size_t len) {
+    if (sb->len + len + 1 > sb->cap) {
+        size_t cap = sb->cap ? sb->cap * 2 : 64;
+        while (cap < sb->len + len + 1) cap *= 2;
+        char *data = realloc(sb->data, cap);
+        if (data == NULL) {
+            return -1;
+        }
+        sb->data = data;
+        sb->cap = cap;
+    }
+    return 0;
+}
+
+static int sb_append(StrBuf *sb, const char *text, size_t len) {
+    if (sb_reserve(sb, len) != 0) {
+        return -1;
+    }
+    memcpy(sb->data + sb->len, text, len);
+    sb->len += len;
+    sb->data[sb->len] = '\0';
+    return 0;
+}
+
+void wordlist_add(WordList *list, char *word) {
+    if (list->count + 1 >= list->cap) {
+        int cap = list->cap ? list->cap * 2 : 16;
+        char **items = realloc(list->items, cap * sizeof(char *));
+        if (items == NULL) {
+            free(word);
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count++] = word;
+    list->items[list->count] = NULL;
+}
+
+void wordlist_free(WordList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->cap = 0;
+}
+
+// Check whether a raw word needs expanding at all
+int word_needs_expansion(const char *raw) {
+    if ((raw[0] == '<' || raw[0] == '>') && raw[1] == '(') {
+        return 1;
+    }
+    return strpbrk(raw, "'\"\\$*?[{") != NULL;
+}
+
+// --- Arithmetic ---
+
+typedef struct {
+    const char *p;
+    int error;
+    const char *message;    // set with error for division by zero and overflow
+} ArithState;
+
+static long long arith_expr(ArithState *st);
+
+static void arith_skip(ArithState *st) {
+    while (*st->p == ' ' || *st->p == '\t') st->p++;
+}
+
+// Apply + - * / % through xcalc's checked integer operations
+static long long arith_op(ArithState *st, int op, long long a, long long b) {
+    long long value = 0;
+    if (!st->error && calc_int_op(op, a, b, &value, &st->message) != 0) {
+        st->error = 1;
+    }
+    return value;
+}
+
+static long long arith_primary(ArithState *st) {
+    arith_skip(st);
+    const char *p = st->p;
+
+    if (*p == '(') {
+        st->p++;
+        long long value = arith_expr(st);
+        arith_skip(st);
+        if (*st->p != ')') {
+            st->error = 1;
+            return 0;
+        }
+        st->p++;
+        return value;
+    }
+    if (*p == '-') { st->p++; return arith_op(st, '-', 0, arith_primary(st)); }
+    if (*p == '+') { st->p++; return arith_primary(st); }
+    if (*p == '!') { st->p++; return !arith_primary(st); }
+
+    if (*p >= '0' && *p <= '9') {
+        char *end;
+        long long value = strtoll(p, &end, 0);
+        st->p = end;
+        return value;
+    }
+
+    // Bare variable name, unset or non-numeric counts as 0
+    size_t len = 0;
+    while (var_valid_name(p, len + 1)) len++;
+    if (len == 0) {
+        st->error = 1;
+        return 0;
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "%.*s", (int)len, p);
+    st->p += len;
+    const char *value = var_get(name);
+    return value ? strtoll(value, NULL, 0) : 0;
+}
+
+static long long arith_mul(ArithState *st) {
+    long long value = arith_primary(st);
+    while (!st->error) {
+        arith_skip(st);
+        char op = *st->p;
+        if (op != '*' && op != '/' && op != '%') break;
+        st->p++;
+        long long rhs = arith_primary(st);
+        value = arith_op(st, op, value, rhs);
+    }
+    return value;
+}
+
+static long long arith_add(ArithState *st) {
+    long long value = arith_mul(st);
+    while (!st->error) {
+        arith_skip(st);
+        char op = *st->p;
+        if (op != '+' && op != '-') break;
+        st->p++;
+        long long rhs = arith_mul(st);
+        value = arith_op(st, op, value, rhs);
+    }
+    return value;
+}
+
+static long long arith_compare(ArithState *st) {
+    long long value = arith_add(st);
+    while (!st->error) {
+        arith_skip(st);
+        const char *p = st->p;
+        if (p[0] == '<' && p[1] == '=') { st->p += 2; value = value <= arith_add(st); }
+        else if (p[0] == '>' && p[1] == '=') { st->p += 2; value = value >= arith_add(st); }
+        else if (p[0] == '=' && p[1] == '=') { st->p += 2; value = value == arith_add(st); }
+        else if (p[0] == '!' && p[1] == '=') { st->p += 2; value = value != arith_add(st); }
+        else if (p[0] == '<') { st->p++; value = value < arith_add(st); }
+        else if (p[0] == '>') { st->p++; value = value > arith_add(st); }
+        else break;
+    }
+    return value;
+}
+
+static long long arith_expr(ArithState *st) {
+    long long value = arith_compare(st);
+    while (!st->error) {
+        arith_skip(st);
+        if (st->p[0] == '&' && st->p[1] == '&') {
+            st->p += 2;
+            long long rhs = arith_compare(st);
+            value = value && rhs;
+        } else if (st->p[0] == '|' && st->p[1] == '|') {
+            st->p += 2;
+            long long rhs = arith_compare(st);
+            value = value || rhs;
+        } else {
+            break;
+        }
+    }
+    return value;
+}
+
+// Evaluate an integer expression. Returns 0 on success.
+int arith_eval(const char *expr, long long *result) {
+    ArithState st = {expr, 0, NULL};
+    *result = arith_expr(&st);
+    arith_skip(&st);
+    if (st.message != NULL) {
+        fprintf(stderr, "xhell: %s: %s\n", expr, st.message);
+        return -1;
+    }
+    if (st.error || *st.p != '\0') {
+        fprintf(stderr, "xhell: %s: syntax error in expression\n", expr);
+        return -1;
+    }
+    return 0;
+}
+
+// --- Parameter expansion ---
+
+// Find the ')' or '}' closing a group whose text starts at p, skipping
+// quotes and nested groups. NULL when it is missing.
+static const char *find_close(const char *p, char close) {
+    int depth = 0;
+    while (*p) {
+        if (*p == '\\' && p[1] != '\0') {
+            p += 2;
+            continue;
+        }
+        if (*p == '\'') {
+            const char *q = strchr(p + 1, '\'');
+            if (q == NULL) return NULL;
+            p = q + 1;
+            continue;
+        }
+        if (*p == '"') {
+            p++;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1] != '\0') p++;
+                p++;
+            }
+            if (*p == '\0') return NULL;
+            p++;
+            continue;
+        }
+        if (*p == '(' || *p == '{') {
+            depth++;
+        } else if (*p == ')' || *p == '}') {
+            if (depth == 0) return *p == close ? p : NULL;
+            depth--;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// Run a command and append its output, minus trailing newlines. It runs
+// in the shell itself, so builtins cost no fork; the working directory
+// and variables are put back afterwards, as a subshell would leave them.
+static int command_subst(const char *text, size_t len, StrBuf *sb) {
+    ScriptProgram prog;
+    if (script_compile(text, len, &prog) != 0) {
+        script_run(&prog, 0, NULL);
+        script_free(&prog);
+        return -1;
+    }
+
+    int fd = memfd_create("xhell-subst", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("xhell: memfd_create");
+        script_free(&prog);
+        return -1;
+    }
+
+    int saved_cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    VarSnapshot *saved_vars = var_snapshot();
+    if (saved_cwd == -1 || saved_vars == NULL) {
+        perror("xhell: command substitution");
+        if (saved_cwd != -1) close(saved_cwd);
+        if (saved_vars != NULL) var_restore(saved_vars);
+        close(fd);
+        script_free(&prog);
+        return -1;
+    }
+
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDOUT_FILENO);
+    int status = script_run(&prog, 0, NULL);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    script_free(&prog);
+
+    if (fchdir(saved_cwd) != 0) perror("xhell: command substitution");
+    close(saved_cwd);
+    var_restore(saved_vars);
+    var_set_status(status & 0xff);
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    size_t from = sb->len;
+    if (size > 0 && sb_reserve(sb, size) == 0) {
+        ssize_t got = pread(fd, sb->data + from, size, 0);
+        sb->len = from + (got > 0 ? (size_t)got : 0);
+    }
+    close(fd);
+
+    while (sb->len > from && sb->data[sb->len - 1] == '\n') sb->len--;
+    if (sb->data != NULL) sb->data[sb->len] = '\0';
+    return 0;
+}
+
+// --- Process substitution and here-documents ---
+
+typedef struct {
+    int fd;                 // the shell's end, named by /dev/fd/N
+    pid_t pid;              // the command behind it, or 0 for a memory file
+} Subst;
+
+static Subst *substs = NULL;
+static int subst_count = 0;
+static int subst_cap = 0;
+
+static int subst_add(int fd, pid_t pid) {
+    if (subst_count == subst_cap) {
+        int cap = subst_cap ? subst_cap * 2 : 8;
+        Subst *grown = realloc(substs, cap * sizeof(Subst));
+        if (grown == NULL) {
+            return -1;
+        }
+        substs = grown;
+        subst_cap = cap;
+    }
+    substs[subst_count].fd = fd;
+    substs[subst_count].pid = pid;
+    subst_count++;
+    return 0;
+}
+
+// Number of open substitutions, to release back to later
+int subst_mark(void) {
+    return subst_count;
+}
+
+// Close the substitutions opened since mark and wait for their commands.
+// Every descriptor is closed first, so a >(command) reading from one
+// sees end of file even when another substitution's child holds it.
+void subst_release(int mark) {
+    for (int i = mark; i < subst_count; i++) {
+        close(substs[i].fd);
+    }
+    for (int i = mark; i < subst_count; i++) {
+        if (substs[i].pid > 0) {
+            while (waitpid(substs[i].pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+        }
+    }
+    if (mark < subst_count) {
+        subst_count = mark;
+    }
+}
+
+static char *fd_path(int fd) {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return strdup(path);
+}
+
+// <(command) or >(command): start the command on a pipe and add the
+// name of our end to out
+static int process_subst(const char *raw, WordList *out) {
+    int writing = raw[0] == '>';
+    ScriptProgram prog;
+    if (script_compile(raw + 2, strlen(raw) - 3, &prog) != 0) {
+        script_run(&prog, 0, NULL);
+        script_free(&prog);
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("xhell: pipe");
+        script_free(&prog);
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("xhell: fork");
+        close(fds[0]);
+        close(fds[1]);
+        script_free(&prog);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // The command reads what we write to >(...), or writes what we
+        // read from <(...); other substitutions are not its business
+        for (int i = 0; i < subst_count; i++) {
+            close(substs[i].fd);
+        }
+        dup2(writing ? fds[0] : fds[1], writing ? STDIN_FILENO : STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int status = script_run(&prog, 0, NULL);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status & 0xff);
+    }
+
+    script_free(&prog);
+    int keep = writing ? fds[1] : fds[0];
+    close(writing ? fds[0] : fds[1]);
+    if (subst_add(keep, pid) != 0) {
+        close(keep);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    wordlist_add(out, fd_path(keep));
+    return 0;
+}
+
+// Store text in a memory file. Returns its /dev/fd/N name, or NULL.
+char *here_document(const char *text, size_t len) {
+    int fd = memfd_create("xhell-heredoc", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("xhell: memfd_create");
+        return NULL;
+    }
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = write(fd, text + done, len - done);
+        if (n <= 0) {
+            perror("xhell: here-document");
+            close(fd);
+            return NULL;
+        }
+        done += n;
+    }
+    if (subst_add(fd, 0) != 0) {
+        close(fd);
+        return NULL;
+    }
+    return fd_path(fd);
+}
+
+// ${NAME}, ${#NAME}, and ${NAME op word} for op in :- - := = :+ + :? ?
+static int expand_braced(const char *text, size_t len, StrBuf *sb) {
+    char name[128];
+    int length_of = 0;
+
+    if (len > 1 && text[0] == '#') {
+        length_of = 1;
+        text++;
+        len--;
+    }
+
+    size_t name_len = 0;
+    if (len > 0 && (text[0] == '?' || text[0] == '#' || (text[0] >= '0' && text[0] <= '9'))) {
+        name_len = 1;
+    } else {
+        while (name_len < len && var_valid_name(text, name_len + 1)) name_len++;
+    }
+    if (name_len == 0 || name_len >= sizeof(name) || (length_of && name_len != len)) {
+        fprintf(stderr, "xhell: ${%.*s}: bad substitution\n", (int)len, text);
+        return -1;
+    }
+    snprintf(name, sizeof(name), "%.*s", (int)name_len, text);
+
+    char num[32];
+    const char *value;
+    if (name[0] == '?') {
+        snprintf(num, sizeof(num), "%d", var_get_status());
+        value = num;
+    } else if (name[0] == '#') {
+        int count = var_positional_count();
+        snprintf(num, sizeof(num), "%d", count > 0 ? count - 1 : 0);
+        value = num;
+    } else if (name[0] >= '0' && name[0] <= '9') {
+        value = var_get_positional(name[0] - '0');
+    } else {
+        value = var_get(name);
+    }
+
+    if (length_of) {
+        snprintf(num, sizeof(num), "%zu", value ? strlen(value) : (size_t)0);
+        return sb_append(sb, num, strlen(num));
+    }
+
+    const char *op = text + name_len;
+    size_t op_len = len - name_len;
+    if (op_len == 0) {
+        return value ? sb_append(sb, value, strlen(value)) : 0;
+    }
+
+    // With a colon, an empty value counts as unset
+    int colon = op[0] == ':';
+    char kind = op[colon];
+    if (colon && op_len < 2) kind = '\0';
+    if (kind != '-' && kind != '=' && kind != '+' && kind != '?') {
+        fprintf(stderr, "xhell: ${%.*s}: bad substitution\n", (int)len, text);
+        return -1;
+    }
+    int set = value != NULL && !(colon && *value == '\0');
+
+    if ((kind == '+') != set) {
+        // Keep the value: set for -, = and ?, unset for +
+        return set && value ? sb_append(sb, value, strlen(value)) : 0;
+    }
+
+    // The word is expanded only when it is used
+    char *raw = strndup(op + colon + 1, op_len - colon - 1);
+    WordList words = {0};
+    int rc = raw ? expand_word(raw, 0, &words) : -1;
+    free(raw);
+    const char *word = rc == 0 && words.count ? words.items[0] : "";
+
+    if (rc == 0) {
+        if (kind == '?') {
+            fprintf(stderr, "xhell: %s: %s\n", name, *word ? word : "parameter not set");
+            rc = -1;
+        } else {
+            if (kind == '=') {
+                if (!var_valid_name(name, strlen(name))) {
+                    fprintf(stderr, "xhell: %s: cannot assign\n", name);
+                    rc = -1;
+                } else {
+                    var_set(name, word);
+                }
+            }
+            if (rc == 0) rc = sb_append(sb, word, strlen(word));
+        }
+    }
+    wordlist_free(&words);
+    return rc;
+}
+
+// Expand the parameter starting after '$' at *pp into sb.
+// Returns -1 on error; *pp is advanced past the parameter.
+static int expand_dollar(const char **pp, StrBuf *sb) {
+    const char *p = *pp;
+    char name[128];
+    char num[32];
+    const char *value = NULL;
+
+    if (p[0] == '(' && p[1] == '(') {
+        // $((expr)): find the matching "))"
+        int depth = 0;
+        const char *q = p + 2;
+        while (*q && !(depth == 0 && q[0] == ')' && q[1] == ')')) {
+            if (*q == '(') depth++;
+            if (*q == ')') depth--;
+            q++;
+        }
+        if (*q == '\0') {
+            fprintf(stderr, "xhell: missing ))\n");
+            return -1;
+        }
+
+        // Expand $ references inside the expression first
+        char *inner = strndup(p + 2, q - (p + 2));
+        WordList words = {0};
+        int rc = inner ? expand_word(inner, 0, &words) : -1;
+        free(inner);
+        long long result = 0;
+        if (rc == 0) {
+            rc = arith_eval(words.count ? words.items[0] : "", &result);
+        }
+        wordlist_free(&words);
+        if (rc != 0) {
+            return -1;
+        }
+
+        *pp = q + 2;
+        snprintf(num, sizeof(num), "%lld", result);
+        return sb_append(sb, num, strlen(num));
+    }
+
+    if (*p == '(') {
+        const char *close = find_close(p + 1, ')');
+        if (close == NULL) {
+            fprintf(stderr, "xhell: missing )\n");
+            return -1;
+        }
+        *pp = close + 1;
+        return command_subst(p + 1, close - p - 1, sb);
+    }
+
+    if (*p == '{') {
+        const char *close = find_close(p + 1, '}');
+        if (close == NULL) {
+            fprintf(stderr, "xhell: bad substitution\n");
+            return -1;
+        }
+        *pp = close + 1;
+        return expand_braced(p + 1, close - p - 1, sb);
+    } else if (*p == '?') {
+        snprintf(num, sizeof(num), "%d", var_get_status());
+        value = num;
+        *pp = p + 1;
+    } else if (*p == '#') {
+        int count = var_positional_count();
+        snprintf(num, sizeof(num), "%d", count > 0 ? count - 1 : 0);
+        value = num;
+        *pp = p + 1;
+    } else if (*p == '@' || *p == '*') {
+        // All positional parameters, joined by blanks
+        int count = var_positional_count();
+        for (int i = 1; i < count; i++) {
+            if (i > 1) sb_append(sb, " ", 1);
+            const char *arg = var_get_positional(i);
+            sb_append(sb, arg, strlen(arg));
+        }
+        *pp = p + 1;
+        return 0;
+    } else if (*p == '$') {
+        snprintf(num, sizeof(num), "%d", (int)getpid());
+        value = num;
+        *pp = p + 1;
+    } else if (*p >= '0' && *p <= '9') {
+        value = var_get_positional(*p - '0');
+        *pp = p + 1;
+    } else {
+        size_t len = 0;
+        while (var_valid_name(p, len + 1) && len + 1 < sizeof(name)) len++;
+        if (len == 0) {
+            // A lone '$' stays literal
+            return sb_append(sb, "$", 1);
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)len, p);
+        value = var_get(name);
+        *pp = p + len;
+    }
+
+    return value ? sb_append(sb, value, strlen(value)) : 0;
+}
+
+// Expand a here-document body: $ forms are substituted and a backslash
+// escapes $, `, \ and newline; everything else, quotes included, is
+// literal. Returns a new string, or NULL on error.
+char *expand_heredoc(const char *body) {
+    StrBuf sb = {0};
+    const char *p = body;
+
+    sb_append(&sb, "", 0);
+    while (*p) {
+        if (*p == '\\' && p[1] != '\0' && strchr("$`\\\n", p[1]) != NULL) {
+            if (p[1] != '\n') sb_append(&sb, p + 1, 1);
+            p += 2;
+        } else if (*p == '$') {
+            p++;
+            if (expand_dollar(&p, &sb) != 0) {
+                free(sb.data);
+                return NULL;
+            }
+        } else {
+            const char *start = p++;
+            while (*p && *p != '\\' && *p != '$') p++;
+            sb_append(&sb, start, p - start);
+        }
+    }
+    return sb.data;
+}
+
+// Append literal text; in pattern form the glob characters in it are
+// backslash-escaped so they match only themselves
+static int sb_append_lit(StrBuf *sb, const char *text, size_t len, int pattern) {
+    if (!pattern) {
+        return sb_append(sb, text, len);
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (strchr("*?[]\\", text[i]) != NULL && text[i] != '\0' && sb_append(sb, "\\", 1) != 0) {
+            return -1;
+        }
+        if (sb_append(sb, text + i, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Add a finished field to out. With EXPAND_GLOB the field is a pattern:
+// it is replaced by the matching path names, or, with no match, kept
+// as written minus the escapes.
+static void emit_field(const char *field, int flags, WordList *out) {
+    if (!(flags & EXPAND_GLOB)) {
+        wordlist_add(out, strdup(field));
+        return;
+    }
+    if (glob_has_magic(field) && glob_expand(field, out) > 0) {
+        return;
+    }
+    char *word = strdup(field);
+    if (word != NULL) {
+        glob_unescape(word);
+        wordlist_add(out, word);
+    }
+}
+
+// Split the unquoted expansion result in sb from 'from' on blanks,
+// moving every finished field into out
+static void split_fields(StrBuf *sb, size_t from, int flags, WordList *out) {
+    char *tail = strdup(sb->data + from);
+    if (tail == NULL) {
+        return;
+    }
+    sb->len = from;
+    sb->data[from] = '\0';
+
+    char *p = tail;
+    while (*p) {
+        size_t blank = strspn(p, " \t\n");
+        if (blank > 0) {
+            // A blank ends the field built so far
+            if (sb->len > 0) {
+                emit_field(sb->data, flags, out);
+                sb->len = 0;
+                sb->data[0] = '\0';
+            }
+            p += blank;
+            continue;
+        }
+        size_t n = strcspn(p, " \t\n");
+        sb_append(sb, p, n);
+        p += n;
+    }
+    free(tail);
+}
+
+// --- Brace expansion ---
+
+// Skip a quoted string, escape or $-group at p; returns p when there is
+// nothing to skip
+static const char *skip_quoted(const char *p) {
+    if (*p == '\\' && p[1] != '\0') {
+        return p + 2;
+    }
+    if (*p == '\'' || *p == '"') {
+        const char *q = p + 1;
+        while (*q && *q != *p) {
+            if (*p == '"' && *q == '\\' && q[1] != '\0') q++;
+            q++;
+        }
+        return *q ? q + 1 : q;
+    }
+    if (*p == '$' && (p[1] == '{' || p[1] == '(')) {
+        const char *close = find_close(p + 2, p[1] == '{' ? '}' : ')');
+        return close ? close + 1 : p + 1;
+    }
+    return p;
+}
+
+// Parse "a..b" with integer or single-letter ends
+static int brace_range(const char *text, size_t len, long *lo, long *hi, int *letters) {
+    char buf[64];
+    if (len >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    char *dots = strstr(buf, "..");
+    if (dots == NULL) {
+        return 0;
+    }
+    *dots = '\0';
+    const char *a = buf, *b = dots + 2;
+
+    if (a[0] && !a[1] && b[0] && !b[1] &&
+        ((a[0] >= 'a' && a[0] <= 'z' && b[0] >= 'a' && b[0] <= 'z') ||
+         (a[0] >= 'A' && a[0] <= 'Z' && b[0] >= 'A' && b[0] <= 'Z'))) {
+        *lo = a[0];
+        *hi = b[0];
+        *letters = 1;
+        return 1;
+    }
+
+    char *end;
+    *lo = strtol(a, &end, 10);
+    if (*a == '\0' || *end != '\0') return 0;
+    *hi = strtol(b, &end, 10);
+    if (*b == '\0' || *end != '\0') return 0;
+    *letters = 0;
+    return 1;
+}
+
+// Expand the first brace group of raw, a{b,c}d or a{1..3}d, and then
+// the groups left in each result. Quoted braces and ${...} are not
+// groups. Returns the number of words added, or 0 when raw has no group.
+// The end of the brace alternative starting at p: its top-level comma,
+// or the closing brace at end
+static const char *brace_alt_end(const char *p, const char *end) {
+    int depth = 0;
+    while (p < end) {
+        const char *next = skip_quoted(p);
+        if (next != p) {
+            p = next;
+            continue;
+        }
+        if (*p == '{') depth++;
+        else if (*p == '}') depth--;
+        else if (*p == ',' && depth == 0) return p;
+        p++;
+    }
+    return end;
+}
+
+static int brace_expand(const char *raw, WordList *out) {
+    const char *p = raw;
+    while (*p) {
+        const char *next = skip_quoted(p);
+        if (next != p) {
+            p = next;
+            continue;
+        }
+        if (*p != '{') {
+            p++;
+            continue;
+        }
+
+        // Find the matching '}' and whether it has top-level commas
+        int has_comma = 0;
+        int depth = 0;
+        const char *q = p + 1;
+        while (*q && !(depth == 0 && *q == '}')) {
+            next = skip_quoted(q);
+            if (next != q) {
+                q = next;
+                continue;
+            }
+            if (*q == '{') depth++;
+            else if (*q == '}') depth--;
+            else if (*q == ',' && depth == 0) has_comma = 1;
+            q++;
+        }
+        if (*q != '}') {
+            return 0;
+        }
+
+        size_t prefix = p - raw;
+        const char *suffix = q + 1;
+        size_t suffix_len = strlen(suffix);
+        long lo, hi;
+        int letters;
+
+        if (has_comma) {
+            int added = 0;
+            const char *alt = p + 1;
+            while (alt <= q) {
+                const char *alt_end = brace_alt_end(alt, q);
+                size_t alt_len = alt_end - alt;
+                char *word = malloc(prefix + alt_len + suffix_len + 1);
+                if (word == NULL) break;
+                memcpy(word, raw, prefix);
+                memcpy(word + prefix, alt, alt_len);
+                memcpy(word + prefix + alt_len, suffix, suffix_len + 1);
+                if (brace_expand(word, out) > 0) {
+                    free(word);
+                } else {
+                    wordlist_add(out, word);
+                }
+                added++;
+                alt = alt_end + 1;
+            }
+            return added;
+        }
+
+        if (brace_range(p + 1, q - p - 1, &lo, &hi, &letters)) {
+            long step = lo <= hi ? 1 : -1;
+            int added = 0;
+            for (long v = lo; ; v += step) {
+                char item[32];
+                if (letters) snprintf(item, sizeof(item), "%c", (char)v);
+                else snprintf(item, sizeof(item), "%ld", v);
+                size_t item_len = strlen(item);
+                char *word = malloc(prefix + item_len + suffix_len + 1);
+                if (word == NULL) break;
+                memcpy(word, raw, prefix);
+                memcpy(word + prefix, item, item_len);
+                memcpy(word + prefix + item_len, suffix, suffix_len + 1);
+                if (brace_expand(word, out) > 0) {
+                    free(word);
+                } else {
+                    wordlist_add(out, word);
+                }
+                added++;
+                if (v == hi) break;
+            }
+            return added;
+        }
+
+        // Not a group: the brace is an ordinary character
+        p++;
+    }
+    return 0;
+}
+
+// Expand a raw word into out. Flags: EXPAND_SPLIT splits unquoted
+// expansion results on blanks into several fields; EXPAND_GLOB applies
+// brace expansion and replaces each field that is a pattern by the
+// matching path names. Returns 0 on success.
+int expand_word(const char *raw, int flags, WordList *out) {
+    StrBuf sb = {0};
+    int quoted = 0;         // inside "..."
+    int had_quotes = 0;     // an empty "" still makes a field
+    int pattern = (flags & EXPAND_GLOB) != 0;
+    const char *p = raw;
+
+    // "$@" keeps every positional parameter a separate word
+    if (strcmp(raw, "\"$@\"") == 0) {
+        int count = var_positional_count();
+        for (int i = 1; i < count; i++) {
+            wordlist_add(out, strdup(var_get_positional(i)));
+        }
+        free(sb.data);
+        return 0;
+    }
+
+    if ((raw[0] == '<' || raw[0] == '>') && raw[1] == '(' &&
+        find_close(raw + 2, ')') == raw + strlen(raw) - 1) {
+        return process_subst(raw, out);
+    }
+
+    if (pattern && strchr(raw, '{') != NULL) {
+        WordList words = {0};
+        if (brace_expand(raw, &words) > 0) {
+            int rc = 0;
+            for (int i = 0; i < words.count && rc == 0; i++) {
+                rc = expand_word(words.items[i], flags, out);
+            }
+            wordlist_free(&words);
+            return rc;
+        }
+    }
+
+    sb_append(&sb, "", 0);
+
+    while (*p) {
+        char c = *p;
+
+        if (c == '\'' && !quoted) {
+            const char *close = strchr(p + 1, '\'');
+            if (close == NULL) {
+                fprintf(stderr, "xhell: unterminated quote\n");
+                free(sb.data);
+                return -1;
+            }
+            sb_append_lit(&sb, p + 1, close - p - 1, pattern);
+            had_quotes = 1;
+            p = close + 1;
+        } else if (c == '"') {
+            quoted = !quoted;
+            had_quotes = 1;
+            p++;
+        } else if (c == '\\' && p[1] != '\0') {
+            // Inside double quotes only a few characters are escapable
+            if (quoted && strchr("\"\\$`", p[1]) == NULL) {
+                sb_append_lit(&sb, p, 2, pattern);
+            } else {
+                sb_append_lit(&sb, p + 1, 1, pattern);
+            }
+            p += 2;
+        } else if (c == '$') {
+            size_t from = sb.len;
+            p++;
+            if (expand_dollar(&p, &sb) != 0) {
+                free(sb.data);
+                return -1;
+            }
+            if (pattern && quoted && sb.len > from) {
+                // A quoted expansion is literal, even if it holds a '*'
+                char *value = strdup(sb.data + from);
+                sb.len = from;
+                sb_append_lit(&sb, value ? value : "", value ? strlen(value) : 0, 1);
+                free(value);
+            }
+            if ((flags & EXPAND_SPLIT) && !quoted) {
+                split_fields(&sb, from, flags, out);
+            }
+        } else {
+            const char *start = p;
+            while (*p && *p != '\'' && *p != '"' && *p != '\\' && *p != '$') p++;
+            sb_append_lit(&sb, start, p - start, pattern && quoted);
+        }
+    }
+
+    if (quoted) {
+        fprintf(stderr, "xhell: unterminated quote\n");
+        free(sb.data);
+        return -1;
+    }
+
+    if (sb.len > 0 || had_quotes || !(flags & EXPAND_SPLIT)) {
+        emit_field(sb.data, flags, out);
+    }
+    free(sb.data);
+    return 0;
+}
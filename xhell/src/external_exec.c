@@ -1,5 +1,7 @@
 #include "../include/xhell.h"
 
+extern char **environ;
+
 // Find program in PATH
 char *find_in_path(const char *program) {
     // If program contains /, use it directly
@@ -35,8 +37,39 @@ char *find_in_path(const char *program) {
     return NULL;
 }
 
-// Execute external program
-int execute_external(Command *cmd) {
+// Report why a command could not be found or run, and return its status
+// as other shells do: 127 if there is no such program, 126 if there is
+// one that cannot be executed
+int command_failed(const char *name, int error) {
+    if (error == ENOENT) {
+        fprintf(stderr, "%s: command not found\n", name);
+        return 127;
+    }
+    fprintf(stderr, "%s: %s\n", name, strerror(error));
+    return 126;
+}
+
+// The same for a program find_in_path did not find: a path that names
+// a file is not executable, anything else does not exist
+int command_missing(const char *program) {
+    int exists = strchr(program, '/') != NULL && access(program, F_OK) == 0;
+    return command_failed(program, exists ? EACCES : ENOENT);
+}
+
+// Exit status of a child, or 128 + the signal that killed it
+static int wait_status(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) return 1;
+    }
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return 128 + WTERMSIG(status);
+}
+
+// Execute external program, with its redirections as spawn file actions
+int execute_external(Command *cmd, const FdPlan *plan) {
     if (cmd->argc == 0) {
         return -1;
     }
@@ -44,32 +77,208 @@ int execute_external(Command *cmd) {
     // Find program in PATH
     char *program_path = find_in_path(cmd->args[0]);
     if (program_path == NULL) {
-        fprintf(stderr, "%s: command not found\n", cmd->args[0]);
-        return -1;
+        return command_missing(cmd->args[0]);
     }
     
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-        perror("fork");
+    // Too long for one exec: run it in batches, like xargs
+    if (!argv_fits(cmd)) {
+        int status = execute_batched(program_path, cmd, plan);
         free(program_path);
-        return -1;
+        return status;
     }
     
-    if (pid == 0) {
-        // Child process
-        execv(program_path, cmd->args);
-        perror("execv");
-        exit(1);
-    } else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+    posix_spawn_file_actions_t actions;
+    int have_actions = plan != NULL && plan->count > 0;
+    if (have_actions && redir_file_actions(plan, &actions) != 0) {
+        fprintf(stderr, "%s: cannot set up redirections\n", cmd->args[0]);
         free(program_path);
-        
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);
+        return 1;
+    }
+    
+    // Anything still buffered belongs before the program's output
+    fflush(stdout);
+    
+    pid_t pid;
+    int rc = posix_spawn(&pid, program_path, have_actions ? &actions : NULL, NULL,
+                         cmd->args, environ);
+    if (have_actions) {
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    free(program_path);
+    
+    if (rc != 0) {
+        return command_failed(cmd->args[0], rc);
+    }
+    
+    return wait_status(pid);
+}
+
+// --- Argument batching ---
+//
+// The kernel refuses an exec whose arguments and environment together
+// exceed ARG_MAX (E2BIG). When a command line gets that long, which
+// takes a glob over many thousands of files, the arguments from the
+// longest expansion are split into batches that each fit, and the
+// command runs once per batch with the arguments before and after the
+// expansion repeated: "cp *.log backup/" copies batch by batch into
+// backup/. XHELL_BATCH_JOBS=N runs up to N batches at once, like
+// xargs -P (0: one per CPU). The status is that of the first batch
+// that failed, or 0.
+
+// Bytes exec needs for a string and its pointer
+static size_t arg_size(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+static size_t args_size(char *const *args, int count) {
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        size += arg_size(args[i]);
+    }
+    return size;
+}
+
+// Room left for the arguments once the environment is in place, with
+// some headroom for the auxiliary data exec puts next to them
+static size_t arg_space(void) {
+    long max = sysconf(_SC_ARG_MAX);
+    if (max <= 0) {
+        max = 131072;
+    }
+
+    size_t env = sizeof(char *);
+    for (char **e = environ; *e != NULL; e++) {
+        env += arg_size(*e);
+    }
+    size_t reserved = env + 4096;
+    return (size_t)max > reserved ? (size_t)max - reserved : 0;
+}
+
+// Can the command be exec'd as one argument vector?
+int argv_fits(const Command *cmd) {
+    return args_size(cmd->args, cmd->argc) + sizeof(char *) <= arg_space();
+}
+
+// Run cmd once per batch of its expanded arguments. Returns the status
+// of the first failed batch, or 0.
+int execute_batched(const char *path, const Command *cmd, const FdPlan *plan) {
+    int from = cmd->batch_from;
+    int count = cmd->batch_count;
+    if (count == 0) {
+        // No expansion to split, so split everything after the name
+        from = 1;
+        count = cmd->argc - 1;
+    }
+    int tail = cmd->argc - from - count;
+    char *const *after = cmd->args + from + count;
+
+    size_t space = arg_space();
+    size_t fixed = args_size(cmd->args, from) + args_size(after, tail) + sizeof(char *);
+    if (count <= 0 || fixed >= space) {
+        fprintf(stderr, "%s: argument list too long\n", cmd->args[0]);
+        return 126;
+    }
+
+    int jobs = 1;
+    const char *jobs_var = var_get("XHELL_BATCH_JOBS");
+    if (jobs_var != NULL && *jobs_var) {
+        jobs = atoi(jobs_var);
+        if (jobs <= 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            jobs = cpus > 0 ? (int)cpus : 1;
         }
-        return -1;
     }
+
+    char **argv = malloc((cmd->argc + 1) * sizeof(char *));
+    pid_t *pids = malloc(count * sizeof(pid_t));    // at most one per argument
+    int *statuses = malloc(count * sizeof(int));
+    if (argv == NULL || pids == NULL || statuses == NULL) {
+        free(argv);
+        free(pids);
+        free(statuses);
+        return 1;
+    }
+    memcpy(argv, cmd->args, from * sizeof(char *));
+
+    int batches = 0;
+    int running = 0;
+    int oldest = 0;                 // first batch that may still run
+    int next = from;
+    fflush(stdout);
+
+    while (next < from + count) {
+        // Fill the batch up to the limit, at least one argument
+        size_t size = fixed;
+        int n = 0;
+        while (next + n < from + count &&
+               (n == 0 || size + arg_size(cmd->args[next + n]) <= space)) {
+            size += arg_size(cmd->args[next + n]);
+            n++;
+        }
+        memcpy(argv + from, cmd->args + next, n * sizeof(char *));
+        memcpy(argv + from + n, after, tail * sizeof(char *));
+        argv[from + n + tail] = NULL;
+        next += n;
+
+        if (running == jobs) {
+            // Make room: reap a batch that has finished, or else wait for
+            // the oldest. Only our own pids, the shell's other children
+            // (background jobs, process substitutions) are not ours to reap
+            int reaped = 0;
+            for (int i = oldest; i < batches && !reaped; i++) {
+                int status;
+                if (pids[i] != 0 && waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+                    statuses[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                    pids[i] = 0;
+                    reaped = 1;
+                }
+            }
+            while (!reaped && oldest < batches) {
+                if (pids[oldest] != 0) {
+                    statuses[oldest] = wait_status(pids[oldest]);
+                    pids[oldest] = 0;
+                    reaped = 1;
+                }
+                oldest++;
+            }
+            while (oldest < batches && pids[oldest] == 0) {
+                oldest++;
+            }
+            running--;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            statuses[batches] = 1;
+            pids[batches++] = 0;
+            break;
+        }
+        if (pid == 0) {
+            if (plan != NULL && redir_apply(plan) != 0) {
+                _exit(1);
+            }
+            execv(path, argv);
+            perror("execv");
+            _exit(126);
+        }
+        statuses[batches] = 0;
+        pids[batches++] = pid;
+        running++;
+    }
+
+    int result = 0;
+    for (int i = 0; i < batches; i++) {
+        if (pids[i] != 0) {
+            statuses[i] = wait_status(pids[i]);
+        }
+        if (result == 0) {
+            result = statuses[i];
+        }
+    }
+
+    free(argv);
+    free(pids);
+    free(statuses);
+    return result;
 }
@@ -0,0 +1,399 @@
+#include "../include/xhell.h"
+
+// Pathname expansion
+//
+// Matches patterns with *, ?, [...] and ** against the file system.
+// Patterns arrive from expand.c with quoted characters backslash-escaped,
+// so "\*" is a literal star. A pattern is split into components and
+// walked one directory at a time; components without wildcards are
+// appended without reading the directory at all.
+//
+// Directory listings are cached until glob_cache_clear() is called after
+// each command, so several patterns over one directory, and the "**"
+// and "*.gz" halves of "logs/**/*.gz", read each directory once. The
+// recursive "**" walk uses d_type and never stats entries unless the
+// file system leaves the type unknown. Symbolic links are not followed
+// by "**".
+
+#define GLOB_DIR_BUCKETS 4096
+#define GLOB_MAX_COMPONENTS 128
+
+typedef struct DirListing {
+    char *path;
+    char *names;                // NUL-terminated names, back to back
+    uint32_t *offsets;
+    unsigned char *types;       // d_type of each entry
+    int count;
+    struct DirListing *next;    // hash chain
+} DirListing;
+
+static DirListing *dir_cache[GLOB_DIR_BUCKETS];
+static int dir_cache_used = 0;
+
+// --- Matching ---
+
+// Does pattern p contain an unescaped wildcard?
+int glob_has_magic(const char *p) {
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return 1;
+        } else if (*p == '[' && strchr(p + 1, ']') != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Match one character against the bracket expression at *pp ('[' already
+// consumed). Returns 1 on match, 0 on mismatch, -1 when the bracket is
+// not closed, in which case '[' is an ordinary character.
+static int match_bracket(const char **pp, unsigned char c) {
+    const char *p = *pp;
+    int negate = 0;
+    int matched = 0;
+
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+
+    int first = 1;
+    while (*p && (*p != ']' || first)) {
+        unsigned char lo = *p;
+        if (lo == '\\' && p[1]) lo = *++p;
+        p++;
+
+        unsigned char hi = lo;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            p++;
+            hi = *p;
+            if (hi == '\\' && p[1]) hi = *++p;
+            p++;
+        }
+        if (c >= lo && c <= hi) matched = 1;
+        first = 0;
+    }
+
+    if (*p != ']') {
+        return -1;
+    }
+    *pp = p + 1;
+    return matched != negate;
+}
+
+// Match name against a single-component pattern
+int glob_match(const char *pat, const char *name) {
+    const char *star_pat = NULL;
+    const char *star_name = NULL;
+
+    while (*name) {
+        const char *p = pat;
+        int ok;
+
+        if (*p == '*') {
+            while (*p == '*') p++;
+            star_pat = p;
+            star_name = name;
+            pat = p;
+            continue;
+        }
+
+        if (*p == '?') {
+            ok = 1;
+            p++;
+        } else if (*p == '[') {
+            p++;
+            ok = match_bracket(&p, (unsigned char)*name);
+            if (ok < 0) {
+                ok = *name == '[';
+                p = pat + 1;
+            }
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            ok = *p != '\0' && *p == *name;
+            p++;
+        }
+
+        if (ok) {
+            pat = p;
+            name++;
+        } else if (star_pat != NULL) {
+            // Let the last * swallow one more character
+            pat = star_pat;
+            name = ++star_name;
+        } else {
+            return 0;
+        }
+    }
+
+    while (*pat == '*') pat++;
+    return *pat == '\0';
+}
+
+// Remove backslash escapes in place
+void glob_unescape(char *s) {
+    char *w = s;
+    for (char *r = s; *r; r++) {
+        if (*r == '\\' && r[1]) r++;
+        *w++ = *r;
+    }
+    *w = '\0';
+}
+
+// --- Directory cache ---
+
+static unsigned int path_hash(const char *path) {
+    unsigned int h = 2166136261u;
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h & (GLOB_DIR_BUCKETS - 1);
+}
+
+void glob_cache_clear(void) {
+    if (dir_cache_used == 0) {
+        return;
+    }
+    for (int i = 0; i < GLOB_DIR_BUCKETS; i++) {
+        DirListing *d = dir_cache[i];
+        while (d != NULL) {
+            DirListing *next = d->next;
+            free(d->path);
+            free(d->names);
+            free(d->offsets);
+            free(d->types);
+            free(d);
+            d = next;
+        }
+        dir_cache[i] = NULL;
+    }
+    dir_cache_used = 0;
+}
+
+// Read a directory, or return its cached listing. NULL when unreadable.
+static DirListing *list_dir(const char *path) {
+    unsigned int bucket = path_hash(path);
+    for (DirListing *d = dir_cache[bucket]; d != NULL; d = d->next) {
+        if (strcmp(d->path, path) == 0) {
+            return d;
+        }
+    }
+
+    DIR *dir = opendir(*path ? path : ".");
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    DirListing *d = calloc(1, sizeof(DirListing));
+    size_t names_len = 0, names_cap = 0;
+    int cap = 0;
+    if (d == NULL || (d->path = strdup(path)) == NULL) {
+        free(d);
+        closedir(dir);
+        return NULL;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        size_t len = strlen(name) + 1;
+        if (names_len + len > names_cap) {
+            names_cap = names_cap ? names_cap * 2 : 4096;
+            while (names_cap < names_len + len) names_cap *= 2;
+            char *names = realloc(d->names, names_cap);
+            if (names == NULL) break;
+            d->names = names;
+        }
+        if (d->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            uint32_t *offsets = realloc(d->offsets, cap * sizeof(uint32_t));
+            unsigned char *types = offsets ? realloc(d->types, cap) : NULL;
+            if (offsets) d->offsets = offsets;
+            if (types == NULL) break;
+            d->types = types;
+        }
+
+        memcpy(d->names + names_len, name, len);
+        d->offsets[d->count] = (uint32_t)names_len;
+        d->types[d->count] = entry->d_type;
+        d->count++;
+        names_len += len;
+    }
+    closedir(dir);
+
+    d->next = dir_cache[bucket];
+    dir_cache[bucket] = d;
+    dir_cache_used++;
+    return d;
+}
+
+// --- Walking ---
+
+typedef struct {
+    char *comps[GLOB_MAX_COMPONENTS];
+    int magic[GLOB_MAX_COMPONENTS];
+    int ncomp;
+    int dir_only;               // pattern ended in '/'
+    WordList *out;
+} GlobWalk;
+
+// Is entry i of d a directory? follow: whether symlinks count
+static int entry_is_dir(const DirListing *d, int i, const char *path, int follow) {
+    unsigned char type = d->types[i];
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) return 0;
+
+    struct stat st;
+    int rc = follow ? stat(path, &st) : lstat(path, &st);
+    return rc == 0 && S_ISDIR(st.st_mode);
+}
+
+static void walk_add(GlobWalk *w, const char *path) {
+    if (w->dir_only) {
+        size_t len = strlen(path);
+        char *item = malloc(len + 2);
+        if (item == NULL) return;
+        memcpy(item, path, len);
+        item[len] = '/';
+        item[len + 1] = '\0';
+        wordlist_add(w->out, item);
+    } else {
+        wordlist_add(w->out, strdup(path));
+    }
+}
+
+// Append name to path at len; returns the new length, or 0 if too long
+static size_t path_push(char *path, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    size_t sep = len > 0 && path[len - 1] != '/';
+    if (len + sep + name_len + 1 > PATH_MAX) {
+        return 0;
+    }
+    if (sep) path[len++] = '/';
+    memcpy(path + len, name, name_len + 1);
+    return len + name_len;
+}
+
+static void walk(GlobWalk *w, char *path, size_t len, int idx) {
+    if (idx == w->ncomp) {
+        struct stat st;
+        if (len > 0 && (!w->dir_only || (stat(path, &st) == 0 && S_ISDIR(st.st_mode)))) {
+            walk_add(w, path);
+        }
+        return;
+    }
+
+    const char *comp = w->comps[idx];
+    int last = idx + 1 == w->ncomp;
+
+    if (!w->magic[idx]) {
+        // A literal component needs no directory read
+        size_t new_len = path_push(path, len, comp);
+        if (new_len == 0) return;
+        struct stat st;
+        if (!last || lstat(path, &st) == 0) {
+            walk(w, path, new_len, idx + 1);
+        }
+        path[len] = '\0';
+        return;
+    }
+
+    if (strcmp(comp, "**") == 0) {
+        // Zero directories here, then every subdirectory below; as the
+        // last component it matches the files on the way as well
+        walk(w, path, len, idx + 1);
+
+        DirListing *d = list_dir(path);
+        if (d == NULL) return;
+        for (int i = 0; i < d->count; i++) {
+            const char *name = d->names + d->offsets[i];
+            if (name[0] == '.') continue;
+            size_t new_len = path_push(path, len, name);
+            if (new_len == 0) continue;
+            if (entry_is_dir(d, i, path, 0)) {
+                walk(w, path, new_len, idx);
+            } else if (last && !w->dir_only) {
+                walk_add(w, path);
+            }
+            path[len] = '\0';
+        }
+        return;
+    }
+
+    DirListing *d = list_dir(path);
+    if (d == NULL) return;
+    int hidden_ok = comp[0] == '.' || (comp[0] == '\\' && comp[1] == '.');
+
+    for (int i = 0; i < d->count; i++) {
+        const char *name = d->names + d->offsets[i];
+        if ((name[0] == '.' && !hidden_ok) || !glob_match(comp, name)) {
+            continue;
+        }
+        size_t new_len = path_push(path, len, name);
+        if (new_len == 0) continue;
+        if (last || entry_is_dir(d, i, path, 1)) {
+            walk(w, path, new_len, idx + 1);
+        }
+        path[len] = '\0';
+    }
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Expand pattern, appending the sorted matches to out. Returns the
+// number of matches; out is untouched when there are none.
+int glob_expand(const char *pattern, WordList *out) {
+    char *copy = strdup(pattern);
+    if (copy == NULL) {
+        return 0;
+    }
+
+    GlobWalk w;
+    memset(&w, 0, sizeof(w));
+    WordList matches = {0};
+    w.out = &matches;
+
+    char path[PATH_MAX + 1] = "";
+    size_t len = 0;
+    if (copy[0] == '/') {
+        strcpy(path, "/");
+        len = 1;
+    }
+    size_t copy_len = strlen(copy);
+    w.dir_only = copy_len > 1 && copy[copy_len - 1] == '/';
+
+    char *save = NULL;
+    for (char *comp = strtok_r(copy, "/", &save); comp; comp = strtok_r(NULL, "/", &save)) {
+        if (w.ncomp == GLOB_MAX_COMPONENTS) {
+            free(copy);
+            return 0;
+        }
+        w.magic[w.ncomp] = glob_has_magic(comp) || strcmp(comp, "**") == 0;
+        if (!w.magic[w.ncomp]) {
+            glob_unescape(comp);
+        }
+        w.comps[w.ncomp++] = comp;
+    }
+
+    walk(&w, path, len, 0);
+    free(copy);
+
+    if (matches.count > 1) {
+        qsort(matches.items, matches.count, sizeof(char *), compare_paths);
+    }
+    for (int i = 0; i < matches.count; i++) {
+        wordlist_add(out, matches.items[i]);
+    }
+    int count = matches.count;
+    free(matches.items);
+    return count;
+}
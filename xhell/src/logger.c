@@ -1,13 +1,31 @@
 #include "../include/xhell.h"
 
+// The log is opened by the first command that writes to it, so
+// starting the shell costs nothing here
+
 static FILE *log_file = NULL;
+static int log_failed = 0;
+
+static FILE *log_open(void) {
+    if (log_file == NULL && !log_failed) {
+        int fd = openat(start_dir_fd(), LOG_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        log_file = fd == -1 ? NULL : fdopen(fd, "a");
+        if (log_file == NULL) {
+            perror("xhell: " LOG_FILE);
+            if (fd != -1) close(fd);
+            log_failed = 1;
+        }
+    }
+    return log_file;
+}
 
-// Initialize logger
-void init_logger(void) {
-    log_file = fopen(LOG_FILE, "a");
-    if (log_file == NULL) {
-        perror("init_logger");
+// Close the log; the next command to write reopens it
+void log_close(void) {
+    if (log_file != NULL) {
+        fclose(log_file);
+        log_file = NULL;
     }
+    log_failed = 0;
 }
 
 // Get current timestamp
@@ -21,7 +39,7 @@ static char *get_timestamp(void) {
 
 // Log command execution
 void log_command(const char *command, int status) {
-    if (log_file == NULL) {
+    if (log_open() == NULL) {
         return;
     }
     
@@ -31,7 +49,7 @@ void log_command(const char *command, int status) {
 
 // Log error
 void log_error(const char *command, const char *error) {
-    if (log_file == NULL) {
+    if (log_open() == NULL) {
         return;
     }
     
@@ -1,70 +1,309 @@
+#define _GNU_SOURCE
 #include "../include/xhell.h"
+#include <time.h>
 
-// Global variables
-char *history[MAX_HISTORY];
-int history_count = 0;
-char prev_dir[MAX_PATH_LEN] = "";
-char current_dir[MAX_PATH_LEN];
+static void usage(void) {
+    fprintf(stderr, "Usage: xhell [--frame json] [-c command [name [args...]] | -s [args...]]\n");
+    fprintf(stderr, "       xhell [--frame-fd fd] --session\n");
+    fprintf(stderr, "       xhell --builtin [name [args...]]\n");
+}
+
+// Where frames go, whether each is preceded by "<length>\n", and whether
+// output is captured into them or left to stream on stdout and stderr
+static int frame_fd = STDOUT_FILENO;
+static int frame_length = 0;
+static int frame_streamed = 0;
+
+// Write one frame; out and err are left out of it when NULL
+static void emit_frame(const char *command, const char *out, size_t out_len,
+                       const char *err, size_t err_len, int status, double duration) {
+    Sink frame;
+    sink_open_memory(&frame);
+    sink_puts(&frame, "{\"command\":");
+    sink_json_string(&frame, command ? command : "", command ? strlen(command) : 0);
+    if (out != NULL) {
+        sink_puts(&frame, ",\"stdout\":");
+        sink_json_string(&frame, out, out_len);
+    }
+    if (err != NULL) {
+        sink_puts(&frame, ",\"stderr\":");
+        sink_json_string(&frame, err, err_len);
+    }
+    sink_printf(&frame, ",\"status\":%d,\"duration\":%.6f}\n", status, duration);
+
+    size_t frame_len;
+    char *frame_data = sink_take(&frame, &frame_len);
+    Sink out_sink;
+    sink_open_fd(&out_sink, frame_fd, 0);
+    if (frame_length) {
+        sink_printf(&out_sink, "%zu\n", frame_len);
+    }
+    sink_write(&out_sink, frame_data, frame_len);
+    sink_close(&out_sink);
+    free(frame_data);
+}
+
+static double elapsed(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Run a line with its output captured, then print one JSON object:
+// {"command", "stdout", "stderr", "status", "duration"} (seconds)
+static int run_framed(char *input, int *exited) {
+    struct timespec start, end;
+
+    // Streamed: output reaches the driver as it is written, and the frame
+    // after it only marks where the command ended
+    if (frame_streamed) {
+        char *command = strdup(input);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int status = run_line(input, exited);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fflush(stdout);
+        fflush(stderr);
+        emit_frame(command, NULL, 0, NULL, 0, status, elapsed(&start, &end));
+        free(command);
+        return status;
+    }
+
+    Capture cap;
+    if (capture_open(&cap) != 0 || capture_start(&cap) != 0) {
+        perror("xhell: capture");
+        capture_close(&cap);
+        return 1;
+    }
+
+    // As given, !! expansion rewrites input
+    char *command = strdup(input);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = run_line(input, exited);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    capture_stop(&cap);
+
+    size_t out_len, err_len;
+    char *out_data = capture_read(cap.out, &out_len);
+    char *err_data = capture_read(cap.err, &err_len);
+    capture_close(&cap);
+
+    emit_frame(command, out_data ? out_data : "", out_len,
+               err_data ? err_data : "", err_len, status, elapsed(&start, &end));
+
+    free(command);
+    free(out_data);
+    free(err_data);
+    return status;
+}
+
+// --session: read requests and write frames as "<length>\n<bytes>", for
+// a driver that keeps the shell running (see xhell_wrapper.py). Each
+// request runs in the directory the shell started in, with stdin on
+// /dev/null so no command can read the requests that follow it.
+// With --frame-fd the frames go to that fd instead and carry no output:
+// commands write straight to the session's stdout and stderr, so the
+// driver can pass output on while a command runs, and a driver that
+// stops reading holds the command up once the pipe is full.
+#define SESSION_MAX_REQUEST (16 << 20)
+
+// Answer a request that cannot be run with a frame carrying the error
+static void reject_request(const char *message) {
+    if (frame_streamed) {
+        fprintf(stderr, "xhell: session: %s\n", message);
+        fflush(stderr);
+        emit_frame(NULL, NULL, 0, NULL, 0, 2, 0);
+        return;
+    }
+    char err[128];
+    int err_len = snprintf(err, sizeof(err), "xhell: session: %s\n", message);
+    emit_frame(NULL, NULL, 0, err, err_len, 2, 0);
+}
+
+static int run_session(int stream_fd) {
+    int requests = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    frame_fd = fcntl(stream_fd != -1 ? stream_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    frame_length = 1;
+    frame_streamed = stream_fd != -1;
+    FILE *in = requests == -1 ? NULL : fdopen(requests, "r");
+    if (in == NULL || frame_fd == -1) {
+        perror("xhell: session");
+        return 1;
+    }
+    if (frame_streamed && stream_fd > STDERR_FILENO) {
+        // Commands must not inherit it and hold the driver's pipe open
+        close(stream_fd);
+    }
+
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null != -1) {
+        dup2(null, STDIN_FILENO);
+        if (!frame_streamed) {
+            dup2(null, STDOUT_FILENO);
+        }
+        close(null);
+    }
+
+    int status = 0;
+    int exited = 0;
+    char header[32];
+    while (!exited && fgets(header, sizeof(header), in) != NULL) {
+        char *end;
+        errno = 0;
+        unsigned long len = strtoul(header, &end, 10);
+        if (end == header || *end != '\n') {
+            fprintf(stderr, "xhell: session: bad request header\n");
+            return 2;
+        }
+        // The body cannot be skipped, so the session ends after the answer
+        if (errno == ERANGE || len > SESSION_MAX_REQUEST) {
+            reject_request("request too large");
+            status = 2;
+            break;
+        }
+
+        // Room left for a !! expansion
+        char *text = malloc(len + MAX_CMD_LEN);
+        if (text == NULL) {
+            reject_request(strerror(ENOMEM));
+            status = 2;
+            break;
+        }
+        if (fread(text, 1, len, in) != len) {
+            free(text);
+            break;
+        }
+        text[len] = '\0';
+        status = run_framed(text, &exited);
+        free(text);
+
+        // An xcd does not outlive its request
+        if (start_dir_fd() != AT_FDCWD && fchdir(start_dir_fd()) != 0) {
+            perror("xhell: session");
+        }
+    }
+
+    fclose(in);
+    save_history();
+    return status;
+}
 
 int main(int argc, char **argv) {
     char input[MAX_CMD_LEN];
-    Pipeline pipeline;
-    
-    // Initialize
-    init_logger();
-    load_history();
-    
-    if (getcwd(current_dir, sizeof(current_dir)) == NULL) {
-        perror("getcwd");
-        return 1;
+    const char *command = NULL;
+    int frame_json = 0;
+    int from_stdin = 0;
+    int session = 0;
+    int stream_fd = -1;
+    int i = 1;
+
+    // Called through a symlink named after a builtin, or --builtin
+    const char *name = strrchr(argv[0], '/');
+    name = name != NULL ? name + 1 : argv[0];
+    if (strcmp(name, "xhell") != 0 && is_builtin_command(name)) {
+        argv[0] = (char *)name;
+        return builtin_main(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--builtin") == 0) {
+        return builtin_main(argc - 2, argv + 2);
+    }
+
+    // Options come first; what follows them are the positional arguments
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc && strcmp(argv[i + 1], "json") == 0) {
+            frame_json = 1;
+            i++;
+        } else if (strcmp(argv[i], "--frame-fd") == 0 && i + 1 < argc) {
+            stream_fd = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            command = argv[++i];
+            i++;
+            break;
+        } else if (strcmp(argv[i], "--session") == 0) {
+            session = 1;
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            from_stdin = 1;
+            i++;
+            break;
+        } else {
+            usage();
+            return 2;
+        }
     }
-    
+    shell_interactive = command == NULL && !from_stdin && !session && !frame_json && isatty(STDIN_FILENO);
+
+    // History and log are opened when first used
+    if (command != NULL && i < argc) {
+        // As in sh -c, the first argument after the command is $0
+        var_set_positional(argc - i, argv + i, NULL, NULL);
+    } else if (command != NULL || from_stdin || session) {
+        argv[i - 1] = argv[0];
+        var_set_positional(argc - i + 1, argv + i - 1, NULL, NULL);
+    } else {
+        var_set_positional(argc, argv, NULL, NULL);
+    }
+
+    if (session) {
+        return run_session(stream_fd);
+    }
+    if (stream_fd != -1) {
+        usage();
+        return 2;
+    }
+
+    int (*run)(char *, int *) = frame_json ? run_framed : run_line;
+    int status = 0;
+    int exited = 0;
+
+    if (command != NULL) {
+        // Not limited to a line; room left for a !! expansion
+        size_t len = strlen(command);
+        char *text = malloc(len + MAX_CMD_LEN);
+        if (text == NULL) {
+            perror("xhell");
+            return 1;
+        }
+        memcpy(text, command, len + 1);
+        status = run(text, &exited);
+        free(text);
+        save_history();
+        return status;
+    }
+
     // Welcome message
-    printf("######### Welcome to Xhell! #############\n");
-    
+    if (shell_interactive) {
+        printf("######### Welcome to Xhell! #############\n");
+    }
+
     // Main REPL loop
     while (1) {
-        // Display prompt
-        char *prompt = get_prompt();
-        printf("%s", prompt);
+        // Display prompt and read input
+        char *prompt = shell_interactive ? get_prompt() : NULL;
+        char *line = read_line(prompt ? prompt : "", input, sizeof(input));
         free(prompt);
-        
-        // Read input
-        if (fgets(input, sizeof(input), stdin) == NULL) {
+        if (line == NULL) {
             break;
         }
-        
-        // Remove newline
-        input[strcspn(input, "\n")] = 0;
-        
+
         // Skip empty lines
         trim_whitespace(input);
         if (strlen(input) == 0) {
             continue;
         }
-        
-        // Add to history
-        add_to_history(input);
-        
-        // Parse command
-        if (parse_command_line(input, &pipeline) != 0) {
-            log_error(input, "Parse error");
-            continue;
+
+        status = run(input, &exited);
+        if (exited) {
+            save_history();
+            return status;
         }
-        
-        // Execute pipeline
-        int status = execute_pipeline(&pipeline);
-        
-        // Log command
-        log_command(input, status);
-        
-        // Free pipeline
-        free_pipeline(&pipeline);
-    }
-    
+    }
+
     // Cleanup
-    printf("######### Quiting Xhell #############\n");
+    if (shell_interactive) {
+        printf("######### Quiting Xhell #############\n");
+        status = 0;
+    }
     save_history();
-    
-    return 0;
+
+    return status;
 }
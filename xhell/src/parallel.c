@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include "../include/xhell.h"
+#include <signal.h>
+
+// Parallel xsh (xsh -j N)
+//
+// "#@ task NAME after: A B" lines split a script into tasks that form a
+// DAG: a task waits for the tasks it names, which must come before it,
+// and a task without "after:" depends on nothing. Code before the first
+// task runs first in the shell itself, so its variables and functions
+// are visible to every task.
+//
+// Each task runs in a forked worker, since the interpreter, the
+// variables and the current directory are per-process state. Its output
+// goes to memory files and is replayed in script order once the task
+// and everything before it has finished, so the output reads as if the
+// script had run sequentially. The first task to fail stops the
+// scheduling of new tasks and terminates the running ones.
+
+enum {
+    TASK_WAITING,
+    TASK_RUNNING,
+    TASK_DONE
+};
+
+typedef struct {
+    const char *name;
+    uint32_t start;         // first instruction
+    uint32_t end;           // one past the last instruction
+    uint32_t line;
+    int *deps;              // indices of earlier tasks
+    int dep_count;
+    int state;
+    int status;
+    pid_t pid;
+    int out_fd;             // captured stdout and stderr
+    int err_fd;
+} Task;
+
+// Build the task table from the OP_TASK boundaries. Returns the number
+// of tasks, or -1 when a dependency cannot be resolved.
+static int find_tasks(ScriptProgram *prog, Task **out, uint32_t *prologue_end) {
+    const char *s = prog->strings;
+    int count = 0;
+
+    *prologue_end = prog->code_count;
+    for (uint32_t pc = 0; pc < prog->code_count; pc++) {
+        if (prog->code[pc].op == OP_TASK) {
+            if (count == 0) *prologue_end = pc;
+            count++;
+        }
+    }
+
+    Task *tasks = calloc(count ? count : 1, sizeof(Task));
+    if (tasks == NULL) {
+        return -1;
+    }
+
+    int n = 0;
+    for (uint32_t pc = 0; pc < prog->code_count; pc++) {
+        Instr *ins = &prog->code[pc];
+        if (ins->op != OP_TASK) continue;
+
+        Task *task = &tasks[n];
+        task->name = s + ins->a;
+        task->start = pc + 1;
+        task->line = ins->line;
+        task->out_fd = task->err_fd = -1;
+        if (n > 0) tasks[n - 1].end = pc;
+
+        // Resolve "after:" names against the tasks defined so far
+        char after[MAX_CMD_LEN];
+        snprintf(after, sizeof(after), "%s", s + ins->b);
+        char *save = NULL;
+        for (char *dep = strtok_r(after, " ", &save); dep; dep = strtok_r(NULL, " ", &save)) {
+            int found = -1;
+            for (int i = 0; i < n; i++) {
+                if (strcmp(tasks[i].name, dep) == 0) found = i;
+            }
+            if (found < 0) {
+                fprintf(stderr, "xsh: line %u: task '%s' runs after unknown task '%s'\n",
+                        ins->line, task->name, dep);
+                n++;
+                goto fail;
+            }
+            int *deps = realloc(task->deps, (task->dep_count + 1) * sizeof(int));
+            if (deps == NULL) {
+                n++;
+                goto fail;
+            }
+            task->deps = deps;
+            task->deps[task->dep_count++] = found;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (*task->name && strcmp(tasks[i].name, task->name) == 0) {
+                fprintf(stderr, "xsh: line %u: duplicate task '%s'\n", ins->line, task->name);
+                n++;
+                goto fail;
+            }
+        }
+        n++;
+    }
+    if (n > 0) tasks[n - 1].end = prog->code_count;
+
+    *out = tasks;
+    return n;
+
+fail:
+    for (int i = 0; i < n; i++) free(tasks[i].deps);
+    free(tasks);
+    return -1;
+}
+
+static int task_ready(Task *tasks, Task *task) {
+    if (task->state != TASK_WAITING) {
+        return 0;
+    }
+    for (int i = 0; i < task->dep_count; i++) {
+        Task *dep = &tasks[task->deps[i]];
+        if (dep->state != TASK_DONE || dep->status != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int task_start(Interp *in, Task *task) {
+    task->out_fd = memfd_create("xsh-out", MFD_CLOEXEC);
+    task->err_fd = memfd_create("xsh-err", MFD_CLOEXEC);
+    if (task->out_fd == -1 || task->err_fd == -1) {
+        perror("xsh: memfd_create");
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("xsh: fork");
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Own process group, so a failure elsewhere can stop the whole task
+        setpgid(0, 0);
+        signal(SIGTERM, SIG_DFL);
+
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        dup2(task->out_fd, STDOUT_FILENO);
+        dup2(task->err_fd, STDERR_FILENO);
+
+        int status = interp_run(in, task->start, task->end);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+
+    setpgid(pid, pid);
+    task->pid = pid;
+    task->state = TASK_RUNNING;
+    return 0;
+}
+
+// Copy a finished task's captured output to our own descriptor
+static void replay(int from, int to) {
+    char buf[65536];
+    off_t off = 0;
+    ssize_t n;
+
+    fflush(to == STDOUT_FILENO ? stdout : stderr);
+    while ((n = pread(from, buf, sizeof(buf), off)) > 0) {
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(to, buf + done, n - done);
+            if (w <= 0) return;
+            done += w;
+        }
+        off += n;
+    }
+}
+
+static void task_release(Task *task) {
+    if (task->out_fd != -1) close(task->out_fd);
+    if (task->err_fd != -1) close(task->err_fd);
+    task->out_fd = task->err_fd = -1;
+}
+
+// Run prog with up to jobs tasks at once (0: one per CPU). Returns the
+// status of the first failed task, or of the last task.
+int script_run_parallel(ScriptProgram *prog, int jobs, int trace) {
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+
+    Task *tasks = NULL;
+    uint32_t prologue_end;
+    int count = find_tasks(prog, &tasks, &prologue_end);
+    if (count < 0) {
+        return 2;
+    }
+
+    Interp *in = interp_new(prog, trace);
+    if (in == NULL) {
+        free(tasks);
+        return -1;
+    }
+
+    // Everything before the first task is shared setup
+    int status = interp_run(in, 0, prologue_end);
+
+    int running = 0;
+    int emitted = interp_exited(in) ? count : 0;
+    int failed = -1;
+
+    while (emitted < count) {
+        // Start the earliest ready tasks, in script order
+        for (int i = 0; i < count && running < jobs && failed < 0; i++) {
+            if (task_ready(tasks, &tasks[i])) {
+                if (task_start(in, &tasks[i]) != 0) {
+                    tasks[i].state = TASK_DONE;
+                    tasks[i].status = 1;
+                    failed = i;
+                    break;
+                }
+                running++;
+            }
+        }
+
+        if (running > 0) {
+            int wstatus;
+            pid_t pid = waitpid(-1, &wstatus, 0);
+            if (pid == -1) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (int i = 0; i < count; i++) {
+                if (tasks[i].state == TASK_RUNNING && tasks[i].pid == pid) {
+                    tasks[i].state = TASK_DONE;
+                    tasks[i].status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+                    running--;
+
+                    if (tasks[i].status != 0 && failed < 0) {
+                        failed = i;
+                        for (int j = 0; j < count; j++) {
+                            if (tasks[j].state == TASK_RUNNING) kill(-tasks[j].pid, SIGTERM);
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Emit output in script order; after a failure, tasks that never
+        // started are skipped
+        while (emitted < count &&
+               (tasks[emitted].state == TASK_DONE ||
+                (failed >= 0 && tasks[emitted].state == TASK_WAITING))) {
+            Task *task = &tasks[emitted++];
+            if (task->state == TASK_DONE) {
+                replay(task->out_fd, STDOUT_FILENO);
+                replay(task->err_fd, STDERR_FILENO);
+                task_release(task);
+                status = task->status;
+            }
+        }
+
+        if (running == 0 && failed < 0 && emitted < count) {
+            int ready = 0;
+            for (int i = 0; i < count; i++) ready |= task_ready(tasks, &tasks[i]);
+            if (!ready) break;
+        }
+    }
+
+    if (failed >= 0) {
+        Task *task = &tasks[failed];
+        fprintf(stderr, "xsh: line %u: task %s%sfailed with status %d\n", task->line,
+                task->name, *task->name ? " " : "", task->status);
+        status = task->status ? task->status : 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        task_release(&tasks[i]);
+        free(tasks[i].deps);
+    }
+    free(tasks);
+    interp_free(in);
+    var_set_status(status & 0xff);
+    return status;
+}
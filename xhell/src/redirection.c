@@ -1,64 +1,269 @@
 #include "../include/xhell.h"
 
-// Setup redirections for a command
-int setup_redirections(Command *cmd) {
-    // Redirect output
-    if (cmd->output_file != NULL) {
-        int flags = O_WRONLY | O_CREAT;
-        flags |= cmd->append_output ? O_APPEND : O_TRUNC;
-        
-        int fd = open(cmd->output_file, flags, 0644);
-        if (fd == -1) {
-            perror("redirection: output");
+// Redirections
+//
+// A command's redirections are resolved into an FdPlan before anything
+// runs: files are opened once, in the shell, and each redirection
+// becomes an "fd N gets a copy of fd M" step. Steps are applied in the
+// order they were written, so "2>&1 >f", ">f 2>&1" and "3>&1 1>&2 2>&3"
+// mean what they mean in sh.
+//
+// The same plan serves every way a command runs: a pipeline child
+// applies it after fork, an external command gets it as posix_spawn
+// file actions, and a builtin run in the shell is handed the descriptors
+// the plan leads to (redir_target) without any being moved. Only a
+// builtin that runs commands itself, xsh, has the plan pushed onto the
+// shell's descriptors and popped afterwards.
+//
+// Opening a FIFO blocks until the other end is opened too, possibly by
+// a later stage of the same pipeline, so with defer_fifos a FIFO is
+// opened by the child instead. Files the shell opens for itself are
+// opened non-blocking, so a FIFO with no reader is an error rather than
+// a hung shell, and switched back to blocking once open.
+
+// Keep the plan's own descriptors clear of the 0-9 that redirections use
+#define PLAN_FD_MIN 10
+
+static int add_action(FdPlan *plan, int fd, int src, const char *path, int flags) {
+    if (plan->count == MAX_REDIRS * 2) {
+        fprintf(stderr, "xhell: too many redirections\n");
+        return -1;
+    }
+    FdAction *action = &plan->actions[plan->count++];
+    action->fd = fd;
+    action->src = src;
+    action->path = path;
+    action->flags = flags;
+    return 0;
+}
+
+static int targeted(const FdPlan *plan, int fd) {
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->actions[i].fd == fd) return 1;
+    }
+    return 0;
+}
+
+static int is_fifo(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// Open path for fd, or leave the open to the child
+static int plan_file(FdPlan *plan, int fd, const char *path, int flags, int defer_fifos) {
+    if (defer_fifos && is_fifo(path)) {
+        return add_action(plan, fd, -1, path, flags);
+    }
+
+    int nonblock = defer_fifos ? 0 : O_NONBLOCK;
+    int file = open(path, flags | nonblock | O_CLOEXEC, 0644);
+    if (file == -1) {
+        if (errno == ENXIO && nonblock) {
+            fprintf(stderr, "xhell: %s: no reader on the FIFO\n", path);
+        } else {
+            fprintf(stderr, "xhell: %s: %s\n", path, strerror(errno));
+        }
+        return -1;
+    }
+    // F_SETFL takes only the status flags: O_APPEND stays, O_NONBLOCK goes
+    if (nonblock && fcntl(file, F_SETFL, flags) == -1) {
+        perror("xhell: fcntl");
+        close(file);
+        return -1;
+    }
+    if (file < PLAN_FD_MIN) {
+        int moved = fcntl(file, F_DUPFD_CLOEXEC, PLAN_FD_MIN);
+        close(file);
+        if (moved == -1) {
+            perror("xhell: fcntl");
             return -1;
         }
-        
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            perror("dup2: stdout");
-            close(fd);
+        file = moved;
+    }
+    plan->owned[plan->owned_count++] = file;
+    return add_action(plan, fd, file, NULL, 0);
+}
+
+// Resolve cmd's redirections. Returns 0, or -1 after printing why.
+int redir_plan(const Command *cmd, FdPlan *plan, int defer_fifos) {
+    plan->count = 0;
+    plan->owned_count = 0;
+
+    for (int i = 0; i < cmd->redir_count; i++) {
+        const Redirect *r = &cmd->redirs[i];
+        int rc = 0;
+
+        switch (r->kind) {
+            case REDIR_IN:
+                rc = plan_file(plan, r->fd, r->target, O_RDONLY, defer_fifos);
+                break;
+            case REDIR_OUT:
+            case REDIR_BOTH:
+                rc = plan_file(plan, r->fd, r->target, O_WRONLY | O_CREAT | O_TRUNC, defer_fifos);
+                break;
+            case REDIR_APPEND:
+            case REDIR_BOTH_APPEND:
+                rc = plan_file(plan, r->fd, r->target, O_WRONLY | O_CREAT | O_APPEND, defer_fifos);
+                break;
+            case REDIR_DUP: {
+                if (strcmp(r->target, "-") == 0) {
+                    rc = add_action(plan, r->fd, -1, NULL, 0);
+                    break;
+                }
+                char *end;
+                long src = strtol(r->target, &end, 10);
+                if (*r->target == '\0' || *end != '\0' || src < 0 || src >= PLAN_FD_MIN) {
+                    fprintf(stderr, "xhell: %s: bad file descriptor\n", r->target);
+                    rc = -1;
+                } else if (!targeted(plan, src) && fcntl(src, F_GETFD) == -1) {
+                    fprintf(stderr, "xhell: %ld: bad file descriptor\n", src);
+                    rc = -1;
+                } else {
+                    // In order, fd src already holds what it was set to
+                    rc = add_action(plan, r->fd, src, NULL, 0);
+                }
+                break;
+            }
+        }
+
+        if (rc == 0 && (r->kind == REDIR_BOTH || r->kind == REDIR_BOTH_APPEND)) {
+            rc = add_action(plan, STDERR_FILENO, STDOUT_FILENO, NULL, 0);
+        }
+        if (rc != 0) {
+            redir_plan_free(plan);
             return -1;
         }
-        
-        close(fd);
-    }
-    
-    // Redirect error
-    if (cmd->error_file != NULL) {
-        int flags = O_WRONLY | O_CREAT;
-        flags |= cmd->append_error ? O_APPEND : O_TRUNC;
-        
-        int fd = open(cmd->error_file, flags, 0644);
-        if (fd == -1) {
-            perror("redirection: error");
+    }
+    return 0;
+}
+
+static int apply_action(const FdAction *action) {
+    if (action->src >= 0) {
+        return dup2(action->src, action->fd) == -1 ? -1 : 0;
+    }
+    if (action->path == NULL) {
+        close(action->fd);
+        return 0;
+    }
+
+    int file = open(action->path, action->flags, 0644);
+    if (file == -1) {
+        fprintf(stderr, "xhell: %s: %s\n", action->path, strerror(errno));
+        return -1;
+    }
+    if (file != action->fd) {
+        dup2(file, action->fd);
+        close(file);
+    }
+    return 0;
+}
+
+// Apply the plan for good, in a child that is about to run the command
+int redir_apply(const FdPlan *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        if (apply_action(&plan->actions[i]) != 0) {
             return -1;
         }
-        
-        if (dup2(fd, STDERR_FILENO) == -1) {
-            perror("dup2: stderr");
-            close(fd);
+    }
+    return 0;
+}
+
+// The descriptor that fd refers to once the plan is applied, found
+// without applying it; -1 when the plan closes fd
+int redir_target(const FdPlan *plan, int fd) {
+    int map[PLAN_FD_MIN];
+    for (int i = 0; i < PLAN_FD_MIN; i++) {
+        map[i] = i;
+    }
+    for (int i = 0; plan != NULL && i < plan->count; i++) {
+        const FdAction *action = &plan->actions[i];
+        if (action->fd >= PLAN_FD_MIN) continue;
+        if (action->src < 0) {
+            map[action->fd] = -1;
+        } else {
+            map[action->fd] = action->src >= PLAN_FD_MIN ? action->src : map[action->src];
+        }
+    }
+    return fd >= 0 && fd < PLAN_FD_MIN ? map[fd] : fd;
+}
+
+// Apply the plan in the shell itself, saving what it replaces
+int redir_push(FdPlan *plan) {
+    if (plan->count == 0) {
+        return 0;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < plan->count; i++) {
+        // Only the first step on an fd sees the shell's own descriptor
+        int fd = plan->actions[i].fd;
+        int first = 1;
+        for (int j = 0; j < i; j++) {
+            if (plan->actions[j].fd == fd) first = 0;
+        }
+        plan->saved[i] = first ? fcntl(fd, F_DUPFD_CLOEXEC, PLAN_FD_MIN) : -2;
+
+        if (apply_action(&plan->actions[i]) != 0) {
+            plan->count = i + 1;
+            redir_pop(plan);
             return -1;
         }
-        
-        close(fd);
     }
-    
     return 0;
 }
 
-// Restore redirections
-void restore_redirections(int saved_stdout, int saved_stderr, int saved_stdin) {
-    if (saved_stdout != -1) {
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
+// Undo redir_push, last step first
+void redir_pop(FdPlan *plan) {
+    if (plan->count == 0) {
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = plan->count - 1; i >= 0; i--) {
+        int saved = plan->saved[i];
+        if (saved == -2) {
+            continue;
+        }
+        if (saved == -1) {
+            // It was not open before
+            close(plan->actions[i].fd);
+        } else {
+            dup2(saved, plan->actions[i].fd);
+            close(saved);
+        }
     }
-    
-    if (saved_stderr != -1) {
-        dup2(saved_stderr, STDERR_FILENO);
-        close(saved_stderr);
+}
+
+// The plan as file actions for posix_spawn
+int redir_file_actions(const FdPlan *plan, posix_spawn_file_actions_t *actions) {
+    if (posix_spawn_file_actions_init(actions) != 0) {
+        return -1;
     }
-    
-    if (saved_stdin != -1) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
+    for (int i = 0; i < plan->count; i++) {
+        const FdAction *action = &plan->actions[i];
+        int rc;
+        if (action->src >= 0) {
+            rc = posix_spawn_file_actions_adddup2(actions, action->src, action->fd);
+        } else if (action->path != NULL) {
+            rc = posix_spawn_file_actions_addopen(actions, action->fd, action->path, action->flags, 0644);
+        } else {
+            rc = posix_spawn_file_actions_addclose(actions, action->fd);
+        }
+        if (rc != 0) {
+            posix_spawn_file_actions_destroy(actions);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Close the files the plan opened
+void redir_plan_free(FdPlan *plan) {
+    for (int i = 0; i < plan->owned_count; i++) {
+        close(plan->owned[i]);
     }
+    plan->owned_count = 0;
+    plan->count = 0;
 }
@@ -0,0 +1,927 @@
+#include "../include/xhell.h"
+
+// xsh script compiler
+//
+// A script is compiled once into a flat instruction stream plus a string
+// pool, and the result is cached as a .xshc file. On later runs the cache
+// is mmap()ed and executed directly (see interp.c): literal arguments
+// point straight into the string pool, so nothing is re-read or
+// re-parsed.
+//
+// The compiler is a recursive-descent parser over the lexer's tokens.
+// Control flow (if/while/until/for, &&, ||, functions, break/continue)
+// becomes jumps, so the interpreter is a single loop over instructions.
+//
+// Cache files live in $XHELL_CACHE_DIR (default ~/.cache/xhell) and are
+// named after a hash of the script's absolute path. A cache is used as-is
+// when the script's size and mtime match its header; if only the mtime
+// changed, or the script was modified within a second of the cache write,
+// the script is re-hashed and the cache is kept when the content hash
+// still matches. Mapped caches are bounds-checked before they run.
+
+#define XSHC_MAGIC "XSHC"
+#define XSHC_VERSION 6
+#define MAX_LOOP_DEPTH 64
+#define MAX_BREAKS 256
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t src_hash;
+    uint32_t path_len;      // absolute script path, stored after the header
+    uint32_t code_count;
+    uint32_t string_len;
+    uint32_t reserved;
+} XshcHeader;
+
+typedef struct {
+    uint32_t continue_pc;
+    uint32_t breaks[MAX_BREAKS];    // jumps to patch with the loop's end
+    int break_count;
+} LoopContext;
+
+typedef struct {
+    TokenList tokens;
+    int pos;
+    ScriptProgram *prog;
+    LoopContext loops[MAX_LOOP_DEPTH];
+    int loop_depth;
+    int list_depth;         // 1 while compiling top-level commands
+    int error;
+} Compiler;
+
+// --- Building ---
+
+static uint32_t emit(ScriptProgram *prog, uint32_t op, uint32_t a, uint32_t b, uint32_t line) {
+    if (prog->code_count == prog->code_cap) {
+        uint32_t cap = prog->code_cap ? prog->code_cap * 2 : 64;
+        Instr *code = realloc(prog->code, cap * sizeof(Instr));
+        if (code == NULL) {
+            return prog->code_count;
+        }
+        prog->code = code;
+        prog->code_cap = cap;
+    }
+
+    Instr *ins = &prog->code[prog->code_count];
+    ins->op = op;
+    ins->a = a;
+    ins->b = b;
+    ins->line = line;
+    return prog->code_count++;
+}
+
+// Point the jump at pc to the next instruction to be emitted
+static void patch(ScriptProgram *prog, uint32_t pc) {
+    if (pc < prog->code_count) {
+        prog->code[pc].a = prog->code_count;
+    }
+}
+
+// Add a string to the pool and return its offset
+static uint32_t intern(ScriptProgram *prog, const char *text) {
+    size_t len = strlen(text) + 1;
+    if (prog->string_len + len > prog->string_cap) {
+        size_t cap = prog->string_cap ? prog->string_cap * 2 : 1024;
+        while (cap < prog->string_len + len) cap *= 2;
+        char *strings = realloc(prog->strings, cap);
+        if (strings == NULL) {
+            return 0;
+        }
+        prog->strings = strings;
+        prog->string_cap = cap;
+    }
+
+    uint32_t off = (uint32_t)prog->string_len;
+    memcpy(prog->strings + off, text, len);
+    prog->string_len += len;
+    return off;
+}
+
+// --- Parsing ---
+
+static Token *peek(Compiler *c) {
+    return &c->tokens.toks[c->pos];
+}
+
+static Token *next(Compiler *c) {
+    Token *tok = &c->tokens.toks[c->pos];
+    if (tok->type != TOK_EOF) {
+        c->pos++;
+    }
+    return tok;
+}
+
+// Report a syntax error once; the program is replaced by a single OP_FAIL
+static void syntax_error(Compiler *c, const char *message) {
+    if (c->error) {
+        return;
+    }
+    Token *tok = peek(c);
+    const char *near = tok->type == TOK_WORD ? tok->text :
+                       tok->type == TOK_NEWLINE ? "newline" :
+                       tok->type == TOK_EOF ? "end of file" :
+                       tok->type == TOK_DIRECTIVE ? "#@" : "operator";
+    char text[MAX_CMD_LEN];
+    snprintf(text, sizeof(text), "xsh: line %u: %s near '%s'", tok->line, message, near);
+
+    ScriptProgram *prog = c->prog;
+    prog->code_count = 0;
+    prog->string_len = 0;
+    intern(prog, "");
+    emit(prog, OP_FAIL, intern(prog, text), 0, tok->line);
+    c->error = 1;
+}
+
+// Is the next token the unquoted reserved word 'word'?
+static int at_word(Compiler *c, const char *word) {
+    Token *tok = peek(c);
+    return tok->type == TOK_WORD && strcmp(tok->text, word) == 0;
+}
+
+static void expect_word(Compiler *c, const char *word) {
+    if (!at_word(c, word)) {
+        char message[64];
+        snprintf(message, sizeof(message), "expected '%s'", word);
+        syntax_error(c, message);
+        return;
+    }
+    next(c);
+}
+
+static void skip_newlines(Compiler *c) {
+    while (peek(c)->type == TOK_NEWLINE) {
+        next(c);
+    }
+}
+
+// Words that end a list, for the construct that contains it
+static int at_list_end(Compiler *c) {
+    static const char *enders[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+    Token *tok = peek(c);
+    if (tok->type == TOK_EOF || tok->type == TOK_RPAREN) {
+        return 1;
+    }
+    if (tok->type != TOK_WORD) {
+        return 0;
+    }
+    for (int i = 0; enders[i]; i++) {
+        if (strcmp(tok->text, enders[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void compile_list(Compiler *c);
+static void compile_command(Compiler *c);
+static void compile_pipeline(Compiler *c);
+
+static int is_assignment(const char *word) {
+    const char *eq = strchr(word, '=');
+    return eq != NULL && var_valid_name(word, eq - word);
+}
+
+static void compile_word(Compiler *c, Token *tok, int flags) {
+    ScriptProgram *prog = c->prog;
+    if (word_needs_expansion(tok->text)) {
+        emit(prog, OP_WORD, intern(prog, tok->text), flags, tok->line);
+    } else {
+        emit(prog, OP_ARG, intern(prog, tok->text), 0, tok->line);
+    }
+}
+
+static void compile_redirect(Compiler *c) {
+    Token *op = next(c);
+    Token *target = peek(c);
+    if (target->type != TOK_WORD) {
+        syntax_error(c, "missing file name for redirection");
+        return;
+    }
+    next(c);
+
+    uint32_t kind = op->redir;
+    if (kind == REDIR_HEREDOC) {
+        // Only $ and \ are special in a body, and none with a quoted delimiter
+        if (!op->quoted && strpbrk(target->text, "$\\") != NULL) {
+            kind |= REDIR_EXPAND;
+        }
+    } else if (word_needs_expansion(target->text)) {
+        kind |= REDIR_EXPAND;
+    }
+    kind |= (uint32_t)op->fd << REDIR_FD_SHIFT;
+    emit(c->prog, OP_REDIR, intern(c->prog, target->text), kind, op->line);
+}
+
+// Words and redirections of one simple command, without the OP_EXEC.
+// Returns the number of command words.
+static int compile_simple(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    int words = 0;
+
+    while (!c->error) {
+        Token *tok = peek(c);
+        if (tok->type == TOK_REDIR) {
+            compile_redirect(c);
+        } else if (tok->type == TOK_WORD) {
+            next(c);
+            if (words == 0 && is_assignment(tok->text)) {
+                // NAME=value before the command word sets a shell variable
+                char *eq = strchr(tok->text, '=');
+                *eq = '\0';
+                emit(prog, OP_SET, intern(prog, tok->text), intern(prog, eq + 1), tok->line);
+                *eq = '=';
+            } else {
+                compile_word(c, tok, EXPAND_GLOB);
+                words++;
+            }
+        } else {
+            break;
+        }
+    }
+    return words;
+}
+
+static void compile_if(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    uint32_t ends[MAX_BREAKS];
+    int end_count = 0;
+
+    next(c);    // if
+    while (!c->error) {
+        compile_list(c);
+        expect_word(c, "then");
+        uint32_t skip = emit(prog, OP_JUMP_IF_FAIL, 0, 0, peek(c)->line);
+        compile_list(c);
+
+        if (at_word(c, "elif") || at_word(c, "else")) {
+            if (end_count == MAX_BREAKS) {
+                syntax_error(c, "too many elif branches");
+                return;
+            }
+            ends[end_count++] = emit(prog, OP_JUMP, 0, 0, peek(c)->line);
+            patch(prog, skip);
+            if (at_word(c, "elif")) {
+                next(c);
+                continue;
+            }
+            next(c);    // else
+            compile_list(c);
+        } else {
+            // No branch taken: the if statement succeeds
+            uint32_t over = emit(prog, OP_JUMP, 0, 0, peek(c)->line);
+            patch(prog, skip);
+            emit(prog, OP_STATUS, 0, 0, peek(c)->line);
+            patch(prog, over);
+        }
+        break;
+    }
+    expect_word(c, "fi");
+
+    for (int i = 0; i < end_count; i++) {
+        patch(prog, ends[i]);
+    }
+}
+
+static LoopContext *loop_push(Compiler *c, uint32_t continue_pc) {
+    if (c->loop_depth == MAX_LOOP_DEPTH) {
+        syntax_error(c, "loops nested too deeply");
+        return NULL;
+    }
+    LoopContext *loop = &c->loops[c->loop_depth++];
+    loop->continue_pc = continue_pc;
+    loop->break_count = 0;
+    return loop;
+}
+
+static void loop_pop(Compiler *c) {
+    LoopContext *loop = &c->loops[--c->loop_depth];
+    for (int i = 0; i < loop->break_count; i++) {
+        patch(c->prog, loop->breaks[i]);
+    }
+}
+
+static void compile_body(Compiler *c) {
+    skip_newlines(c);
+    expect_word(c, "do");
+    compile_list(c);
+    expect_word(c, "done");
+}
+
+static void compile_while(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    int until = at_word(c, "until");
+    next(c);
+
+    uint32_t top = prog->code_count;
+    compile_list(c);
+    uint32_t exit_jump = emit(prog, until ? OP_JUMP_IF_OK : OP_JUMP_IF_FAIL, 0, 0, peek(c)->line);
+
+    if (loop_push(c, top) == NULL) return;
+    compile_body(c);
+    emit(prog, OP_JUMP, top, 0, peek(c)->line);
+    patch(prog, exit_jump);
+    loop_pop(c);
+    emit(prog, OP_STATUS, 0, 0, peek(c)->line);
+}
+
+static void compile_for(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    next(c);    // for
+
+    Token *var = peek(c);
+    if (var->type != TOK_WORD || !var_valid_name(var->text, strlen(var->text))) {
+        syntax_error(c, "bad for loop variable");
+        return;
+    }
+    next(c);
+    skip_newlines(c);
+
+    int positional = 1;
+    if (at_word(c, "in")) {
+        next(c);
+        positional = 0;
+        while (peek(c)->type == TOK_WORD) {
+            compile_word(c, next(c), EXPAND_SPLIT | EXPAND_GLOB);
+        }
+    }
+    if (peek(c)->type == TOK_SEMI) {
+        next(c);
+    }
+
+    emit(prog, OP_FOR_INIT, 0, positional, var->line);
+    uint32_t top = emit(prog, OP_FOR_NEXT, 0, intern(prog, var->text), var->line);
+
+    if (loop_push(c, top) == NULL) return;
+    compile_body(c);
+    emit(prog, OP_JUMP, top, 0, peek(c)->line);
+    patch(prog, top);
+    loop_pop(c);
+    emit(prog, OP_FOR_END, 0, 0, peek(c)->line);
+    emit(prog, OP_STATUS, 0, 0, peek(c)->line);
+}
+
+static void compile_group(Compiler *c) {
+    next(c);    // {
+    compile_list(c);
+    expect_word(c, "}");
+}
+
+// name() body, or function name [()] body
+static void compile_function(Compiler *c, Token *name) {
+    ScriptProgram *prog = c->prog;
+    if (peek(c)->type == TOK_LPAREN) {
+        next(c);
+        if (peek(c)->type != TOK_RPAREN) {
+            syntax_error(c, "expected ')'");
+            return;
+        }
+        next(c);
+    }
+    skip_newlines(c);
+
+    uint32_t def = emit(prog, OP_FUNC, intern(prog, name->text), 0, name->line);
+    uint32_t over = emit(prog, OP_JUMP, 0, 0, name->line);
+    prog->code[def].b = prog->code_count;
+
+    // break and continue do not cross function boundaries
+    int saved_depth = c->loop_depth;
+    c->loop_depth = 0;
+    compile_command(c);
+    c->loop_depth = saved_depth;
+
+    emit(prog, OP_RETURN, 0, 0, peek(c)->line);
+    patch(prog, over);
+}
+
+static void compile_loop_jump(Compiler *c) {
+    Token *tok = next(c);
+    int is_break = strcmp(tok->text, "break") == 0;
+    if (c->loop_depth == 0) {
+        syntax_error(c, is_break ? "break outside a loop" : "continue outside a loop");
+        return;
+    }
+
+    LoopContext *loop = &c->loops[c->loop_depth - 1];
+    if (is_break) {
+        if (loop->break_count == MAX_BREAKS) {
+            syntax_error(c, "too many breaks in one loop");
+            return;
+        }
+        loop->breaks[loop->break_count++] = emit(c->prog, OP_JUMP, 0, 0, tok->line);
+    } else {
+        emit(c->prog, OP_JUMP, loop->continue_pc, 0, tok->line);
+    }
+}
+
+// A compound command or a simple command, without pipes
+static void compile_command(Compiler *c) {
+    Token *tok = peek(c);
+
+    if (tok->type == TOK_WORD) {
+        if (strcmp(tok->text, "if") == 0) { compile_if(c); return; }
+        if (strcmp(tok->text, "while") == 0 || strcmp(tok->text, "until") == 0) { compile_while(c); return; }
+        if (strcmp(tok->text, "for") == 0) { compile_for(c); return; }
+        if (strcmp(tok->text, "{") == 0) { compile_group(c); return; }
+        if (strcmp(tok->text, "break") == 0 || strcmp(tok->text, "continue") == 0) {
+            compile_loop_jump(c);
+            return;
+        }
+        if (strcmp(tok->text, "function") == 0) {
+            next(c);
+            Token *name = next(c);
+            if (name->type != TOK_WORD) {
+                syntax_error(c, "expected function name");
+                return;
+            }
+            compile_function(c, name);
+            return;
+        }
+        if (c->tokens.toks[c->pos + 1].type == TOK_LPAREN) {
+            compile_function(c, next(c));
+            return;
+        }
+    }
+
+    compile_pipeline(c);
+}
+
+static int at_compound(Compiler *c) {
+    static const char *words[] = {"if", "while", "until", "for", "{", "function", "break", "continue", NULL};
+    Token *tok = peek(c);
+    if (tok->type != TOK_WORD) {
+        return 0;
+    }
+    for (int i = 0; words[i]; i++) {
+        if (strcmp(tok->text, words[i]) == 0) {
+            return 1;
+        }
+    }
+    return c->tokens.toks[c->pos + 1].type == TOK_LPAREN;
+}
+
+// [!] command { | command }
+static void compile_pipeline(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    int negate = 0;
+    if (at_word(c, "!")) {
+        next(c);
+        negate = 1;
+    }
+
+    if (at_compound(c)) {
+        compile_command(c);
+        if (peek(c)->type == TOK_PIPE) {
+            syntax_error(c, "compound commands cannot be piped");
+        }
+    } else {
+        uint32_t line = peek(c)->line;
+        uint32_t start = prog->code_count;
+        int words = compile_simple(c);
+        int stages = 1;
+        while (!c->error && peek(c)->type == TOK_PIPE) {
+            next(c);
+            skip_newlines(c);
+            if (++stages > MAX_ARGS) {
+                syntax_error(c, "too many commands in a pipeline");
+                break;
+            }
+            emit(prog, OP_PIPE, 0, 0, line);
+            if (words == 0 || compile_simple(c) == 0) {
+                syntax_error(c, "missing command around |");
+            }
+        }
+
+        if (prog->code_count == start) {
+            syntax_error(c, "syntax error");
+        } else if (words > 0 || prog->code[prog->code_count - 1].op != OP_SET) {
+            // Assignments alone run nothing
+            emit(prog, OP_EXEC, 0, 0, line);
+        }
+    }
+
+    if (negate) {
+        emit(prog, OP_NOT, 0, 0, peek(c)->line);
+    }
+}
+
+// pipeline { (&& | ||) pipeline }
+static void compile_and_or(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    compile_pipeline(c);
+
+    while (!c->error && (peek(c)->type == TOK_AND || peek(c)->type == TOK_OR)) {
+        int is_and = next(c)->type == TOK_AND;
+        skip_newlines(c);
+        uint32_t skip = emit(prog, is_and ? OP_JUMP_IF_FAIL : OP_JUMP_IF_OK, 0, 0, peek(c)->line);
+        compile_pipeline(c);
+        patch(prog, skip);
+    }
+}
+
+// #@ task [NAME] [after: NAME...] starts a block that xsh -j may run
+// concurrently with others; it is a plain comment otherwise
+static void compile_task(Compiler *c) {
+    ScriptProgram *prog = c->prog;
+    Token *tok = peek(c);
+    if (c->list_depth != 1) {
+        syntax_error(c, "task directive inside a compound command");
+        return;
+    }
+
+    char text[MAX_CMD_LEN];
+    snprintf(text, sizeof(text), "%s", tok->text);
+
+    char name[MAX_CMD_LEN] = "";
+    char after[MAX_CMD_LEN] = "";
+    char *save = NULL;
+    char *word = strtok_r(text, " \t", &save);
+    if (word == NULL || strcmp(word, "task") != 0) {
+        syntax_error(c, "unknown #@ directive");
+        return;
+    }
+
+    int in_after = 0;
+    while ((word = strtok_r(NULL, " \t", &save)) != NULL) {
+        if (strcmp(word, "after:") == 0 && !in_after) {
+            in_after = 1;
+        } else if (in_after) {
+            size_t len = strlen(after);
+            snprintf(after + len, sizeof(after) - len, "%s%s", len ? " " : "", word);
+        } else if (name[0] == '\0') {
+            snprintf(name, sizeof(name), "%s", word);
+        } else {
+            syntax_error(c, "bad task directive");
+            return;
+        }
+    }
+
+    next(c);
+    emit(prog, OP_TASK, intern(prog, name), intern(prog, after), tok->line);
+}
+
+// Commands separated by ; or newlines, up to a closing reserved word
+static void compile_list(Compiler *c) {
+    c->list_depth++;
+    skip_newlines(c);
+    while (!c->error && !at_list_end(c)) {
+        if (peek(c)->type == TOK_DIRECTIVE) {
+            compile_task(c);
+        } else {
+            compile_and_or(c);
+        }
+
+        Token *tok = peek(c);
+        if (tok->type == TOK_SEMI || tok->type == TOK_NEWLINE) {
+            while (peek(c)->type == TOK_SEMI || peek(c)->type == TOK_NEWLINE) {
+                next(c);
+            }
+        } else if (!at_list_end(c) && tok->type != TOK_DIRECTIVE) {
+            syntax_error(c, "syntax error");
+        }
+    }
+    c->list_depth--;
+}
+
+// Compile source text into prog. Returns 0 on success; on a syntax error
+// returns -1 and leaves a program that reports the error when run.
+int script_compile(const char *source, size_t len, ScriptProgram *prog) {
+    memset(prog, 0, sizeof(*prog));
+    intern(prog, "");
+
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.prog = prog;
+
+    if (tokenize(source, len, &c.tokens) != 0) {
+        char text[MAX_CMD_LEN];
+        snprintf(text, sizeof(text), "xsh: %s", c.tokens.error);
+        emit(prog, OP_FAIL, intern(prog, text), 0, 0);
+        free_tokens(&c.tokens);
+        return -1;
+    }
+
+    compile_list(&c);
+    if (!c.error && peek(&c)->type != TOK_EOF) {
+        syntax_error(&c, "unexpected");
+    }
+
+    free_tokens(&c.tokens);
+    return c.error ? -1 : 0;
+}
+
+// What the a and b operands of each opcode refer to
+enum { OPND_NONE, OPND_STRING, OPND_PC };
+
+static const uint8_t operand_kinds[][2] = {
+    [OP_FAIL] = {OPND_STRING, OPND_NONE},
+    [OP_ARG] = {OPND_STRING, OPND_NONE},
+    [OP_WORD] = {OPND_STRING, OPND_NONE},
+    [OP_REDIR] = {OPND_STRING, OPND_NONE},
+    [OP_PIPE] = {OPND_NONE, OPND_NONE},
+    [OP_EXEC] = {OPND_NONE, OPND_NONE},
+    [OP_SET] = {OPND_STRING, OPND_STRING},
+    [OP_JUMP] = {OPND_PC, OPND_NONE},
+    [OP_JUMP_IF_FAIL] = {OPND_PC, OPND_NONE},
+    [OP_JUMP_IF_OK] = {OPND_PC, OPND_NONE},
+    [OP_STATUS] = {OPND_NONE, OPND_NONE},
+    [OP_NOT] = {OPND_NONE, OPND_NONE},
+    [OP_FOR_INIT] = {OPND_NONE, OPND_NONE},
+    [OP_FOR_NEXT] = {OPND_PC, OPND_STRING},
+    [OP_FOR_END] = {OPND_NONE, OPND_NONE},
+    [OP_FUNC] = {OPND_STRING, OPND_PC},
+    [OP_RETURN] = {OPND_NONE, OPND_NONE},
+    [OP_TASK] = {OPND_STRING, OPND_STRING},
+};
+
+// Copy the instructions [start, end) into a program of their own, for a
+// function body that outlives the program defining it. Jumps are rebased
+// and only the strings the code uses come along.
+int script_extract(const ScriptProgram *prog, uint32_t start, uint32_t end, ScriptProgram *out) {
+    memset(out, 0, sizeof(*out));
+    for (uint32_t pc = start; pc < end; pc++) {
+        const Instr *ins = &prog->code[pc];
+        uint32_t ops[2] = {ins->a, ins->b};
+        for (int i = 0; i < 2; i++) {
+            uint8_t kind = operand_kinds[ins->op][i];
+            if (kind == OPND_STRING) {
+                ops[i] = intern(out, prog->strings + ops[i]);
+            } else if (kind == OPND_PC) {
+                ops[i] = ops[i] >= start && ops[i] <= end ? ops[i] - start : end - start;
+            }
+        }
+        emit(out, ins->op, ops[0], ops[1], ins->line);
+    }
+
+    if (out->code_count != end - start) {
+        script_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+void script_free(ScriptProgram *prog) {
+    if (prog->map != NULL) {
+        munmap(prog->map, prog->map_len);
+    } else {
+        free(prog->code);
+        free(prog->strings);
+    }
+    memset(prog, 0, sizeof(*prog));
+}
+
+// --- Cache ---
+
+static uint64_t hash_bytes(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int cache_dir(char *buf, size_t size) {
+    const char *dir = getenv("XHELL_CACHE_DIR");
+    if (dir != NULL && *dir) {
+        snprintf(buf, size, "%s", dir);
+        return 0;
+    }
+
+    const char *home = getenv("HOME");
+    if (home == NULL) {
+        return -1;
+    }
+    snprintf(buf, size, "%s/.cache", home);
+    mkdir(buf, 0755);
+    snprintf(buf, size, "%s/.cache/xhell", home);
+    return 0;
+}
+
+static int cache_path(const char *abs_path, char *buf, size_t size) {
+    char dir[MAX_PATH_LEN - 32];
+    if (cache_dir(dir, sizeof(dir)) != 0) {
+        return -1;
+    }
+    mkdir(dir, 0755);
+    snprintf(buf, size, "%s/%016llx.xshc", dir,
+             (unsigned long long)hash_bytes(abs_path, strlen(abs_path)));
+    return 0;
+}
+
+// Check a mapped program before it runs: the interpreter indexes the
+// string pool and jumps with the operands as they are, so a damaged or
+// foreign cache file must not get that far
+static int cache_valid(const ScriptProgram *prog) {
+    if (prog->string_len > 0 && prog->strings[prog->string_len - 1] != '\0') {
+        return 0;
+    }
+
+    for (uint32_t pc = 0; pc < prog->code_count; pc++) {
+        const Instr *ins = &prog->code[pc];
+        if (ins->op >= sizeof(operand_kinds) / sizeof(operand_kinds[0])) {
+            return 0;
+        }
+
+        uint32_t ops[2] = {ins->a, ins->b};
+        for (int i = 0; i < 2; i++) {
+            uint8_t kind = operand_kinds[ins->op][i];
+            if ((kind == OPND_STRING && ops[i] >= prog->string_len) ||
+                (kind == OPND_PC && ops[i] > prog->code_count)) {
+                return 0;
+            }
+        }
+
+        // A function is skipped by the jump after it, see compile_function
+        if (ins->op == OP_FUNC &&
+            (pc + 1 == prog->code_count || prog->code[pc + 1].op != OP_JUMP || ins->b != pc + 2)) {
+            return 0;
+        }
+        if (ins->op == OP_REDIR && (ins->b & 0xff) > REDIR_HERESTRING) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Map a cache file. Returns 0 when it exists, is well formed and
+// belongs to abs_path; the header is then left in *hdr and the time the
+// cache was written in *written.
+static int cache_open(const char *file, const char *abs_path, ScriptProgram *prog, XshcHeader *hdr,
+                      struct timespec *written) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(XshcHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t len = (size_t)st.st_size;
+    char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    memcpy(hdr, map, sizeof(*hdr));
+    size_t code_off = sizeof(*hdr) + (size_t)hdr->path_len + 1;
+    code_off = (code_off + 7) & ~(size_t)7;
+    size_t need = code_off + (size_t)hdr->code_count * sizeof(Instr) + hdr->string_len;
+
+    if (memcmp(hdr->magic, XSHC_MAGIC, 4) != 0 || hdr->version != XSHC_VERSION ||
+        need != len || strlen(abs_path) != hdr->path_len ||
+        memcmp(map + sizeof(*hdr), abs_path, hdr->path_len) != 0) {
+        munmap(map, len);
+        return -1;
+    }
+
+    memset(prog, 0, sizeof(*prog));
+    prog->map = map;
+    prog->map_len = len;
+    prog->code = (Instr *)(map + code_off);
+    prog->code_count = hdr->code_count;
+    prog->strings = map + code_off + (size_t)hdr->code_count * sizeof(Instr);
+    prog->string_len = hdr->string_len;
+    if (!cache_valid(prog)) {
+        script_free(prog);
+        return -1;
+    }
+    *written = st.st_mtim;
+    return 0;
+}
+
+// Write the cache atomically, so concurrent runs never see a partial file
+static void cache_store(const char *file, const char *abs_path, const XshcHeader *hdr_in,
+                        const ScriptProgram *prog) {
+    XshcHeader hdr = *hdr_in;
+    memcpy(hdr.magic, XSHC_MAGIC, 4);
+    hdr.version = XSHC_VERSION;
+    hdr.path_len = (uint32_t)strlen(abs_path);
+    hdr.code_count = prog->code_count;
+    hdr.string_len = (uint32_t)prog->string_len;
+
+    char tmp[MAX_PATH_LEN + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        return;
+    }
+
+    static const char zeros[8] = {0};
+    size_t head = sizeof(hdr) + hdr.path_len + 1;
+    size_t pad = ((head + 7) & ~(size_t)7) - head;
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             fwrite(abs_path, 1, hdr.path_len + 1, fp) == hdr.path_len + 1 &&
+             fwrite(zeros, 1, pad, fp) == pad &&
+             fwrite(prog->code, sizeof(Instr), prog->code_count, fp) == prog->code_count &&
+             fwrite(prog->strings, 1, prog->string_len, fp) == prog->string_len;
+
+    if (fclose(fp) != 0 || !ok || rename(tmp, file) != 0) {
+        unlink(tmp);
+    }
+}
+
+// Read a whole file into memory
+static char *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char *data = malloc(st.st_size + 1);
+    size_t got = 0;
+    while (data != NULL && got < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + got, st.st_size - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+    *len = got;
+    return data;
+}
+
+// Load a script, from its cache when valid, compiling and caching it
+// otherwise. Returns 0 on success.
+int script_load(const char *path, ScriptProgram *prog) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+
+    // Script paths may be longer than MAX_PATH_LEN
+    char *abs_path = realpath(path, NULL);
+    if (abs_path == NULL) {
+        return -1;
+    }
+
+    char file[MAX_PATH_LEN];
+    int cacheable = cache_path(abs_path, file, sizeof(file)) == 0;
+
+    XshcHeader hdr;
+    struct timespec written;
+    if (cacheable && cache_open(file, abs_path, prog, &hdr, &written) == 0) {
+        // A script changed within a second of the cache write can keep
+        // its size and mtime on coarse timestamps, so only trust the stat
+        // match when the script is clearly older than its cache
+        int racy = st.st_mtim.tv_sec >= written.tv_sec - 1;
+        if (!racy && hdr.src_size == (uint64_t)st.st_size &&
+            hdr.mtime_sec == st.st_mtim.tv_sec && hdr.mtime_nsec == st.st_mtim.tv_nsec) {
+            free(abs_path);
+            return 0;
+        }
+    } else {
+        memset(&hdr, 0, sizeof(hdr));
+        memset(prog, 0, sizeof(*prog));
+    }
+
+    size_t len;
+    char *source = read_file(path, &len);
+    if (source == NULL) {
+        script_free(prog);
+        free(abs_path);
+        return -1;
+    }
+    uint64_t hash = hash_bytes(source, len);
+
+    XshcHeader fresh = {0};
+    fresh.src_size = len;
+    fresh.mtime_sec = st.st_mtim.tv_sec;
+    fresh.mtime_nsec = st.st_mtim.tv_nsec;
+    fresh.src_hash = hash;
+
+    if (prog->map != NULL && hdr.src_size == len && hdr.src_hash == hash) {
+        // Touched but unchanged, or racy: keep the code, and refresh the
+        // header once the stat data differs
+        if (hdr.mtime_sec != fresh.mtime_sec || hdr.mtime_nsec != fresh.mtime_nsec) {
+            cache_store(file, abs_path, &fresh, prog);
+        }
+        free(source);
+        free(abs_path);
+        return 0;
+    }
+
+    script_free(prog);
+    script_compile(source, len, prog);
+    free(source);
+
+    if (cacheable) {
+        cache_store(file, abs_path, &fresh, prog);
+    }
+    free(abs_path);
+    return 0;
+}
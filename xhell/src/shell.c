@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include "../include/xhell.h"
+
+// What main.c and libxhell.c share: running a line of input, and
+// catching what it writes to stdout and stderr
+
+// Global variables
+char prev_dir[MAX_PATH_LEN] = "";
+char current_dir[MAX_PATH_LEN];
+
+// Banner, prompt and line editor; off for -c, -s and piped input
+int shell_interactive = 0;
+
+// Running inside another program through libxhell: quit may not exit
+int shell_embedded = 0;
+
+// Run one line of input: it may hold several commands and control flow.
+// input needs MAX_CMD_LEN bytes of room for a !! expansion.
+int run_line(char *input, int *exited) {
+    // Expand !!, !N and !prefix from history
+    char expanded[MAX_CMD_LEN];
+    int expand = history_expand(input, expanded, sizeof(expanded));
+    if (expand < 0) {
+        fprintf(stderr, "%s: event not found\n", input);
+        return 1;
+    }
+    if (expand > 0) {
+        strcpy(input, expanded);
+        if (shell_interactive) {
+            printf("%s\n", input);
+        }
+    }
+
+    // Add to history
+    add_to_history(input);
+
+    ScriptProgram prog;
+    if (script_compile(input, strlen(input), &prog) != 0) {
+        // The program only reports the syntax error
+        script_run(&prog, 0, NULL);
+        script_free(&prog);
+        log_error(input, "Parse error");
+        return 2;
+    }
+
+    // Execute
+    int status = script_run_line(&prog, exited);
+    script_free(&prog);
+
+    // Log command
+    log_command(input, status);
+    return status;
+}
+
+// Two memfds that fds 1 and 2 are moved onto between capture_start and
+// capture_stop. They can be reused: each start empties them.
+int capture_open(Capture *cap) {
+    cap->out = memfd_create("xhell-stdout", MFD_CLOEXEC);
+    cap->err = memfd_create("xhell-stderr", MFD_CLOEXEC);
+    cap->saved_out = -1;
+    cap->saved_err = -1;
+    if (cap->out == -1 || cap->err == -1) {
+        int saved = errno;
+        capture_close(cap);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+int capture_start(Capture *cap) {
+    // fds 1 and 2 will share these offsets, which must start over too
+    if (ftruncate(cap->out, 0) != 0 || ftruncate(cap->err, 0) != 0 ||
+        lseek(cap->out, 0, SEEK_SET) != 0 || lseek(cap->err, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    // What the caller left in stdio's buffer is not part of the capture
+    fflush(stdout);
+    cap->saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    cap->saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (cap->saved_out == -1 || cap->saved_err == -1) {
+        int saved = errno;
+        if (cap->saved_out != -1) close(cap->saved_out);
+        if (cap->saved_err != -1) close(cap->saved_err);
+        cap->saved_out = cap->saved_err = -1;
+        errno = saved;
+        return -1;
+    }
+    dup2(cap->out, STDOUT_FILENO);
+    dup2(cap->err, STDERR_FILENO);
+    return 0;
+}
+
+void capture_stop(Capture *cap) {
+    fflush(stdout);
+    if (cap->saved_out != -1) {
+        dup2(cap->saved_out, STDOUT_FILENO);
+        close(cap->saved_out);
+    }
+    if (cap->saved_err != -1) {
+        dup2(cap->saved_err, STDERR_FILENO);
+        close(cap->saved_err);
+    }
+    cap->saved_out = cap->saved_err = -1;
+}
+
+// Everything written to fd since it was emptied, NUL terminated
+char *capture_read(int fd, size_t *len) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    char *data = malloc(size > 0 ? size + 1 : 1);
+    ssize_t got = data != NULL && size > 0 ? pread(fd, data, size, 0) : 0;
+    *len = got > 0 ? (size_t)got : 0;
+    if (data != NULL) {
+        data[*len] = '\0';
+    }
+    return data;
+}
+
+void capture_close(Capture *cap) {
+    if (cap->out != -1) close(cap->out);
+    if (cap->err != -1) close(cap->err);
+    cap->out = cap->err = -1;
+}
@@ -0,0 +1,228 @@
+#include "../include/xhell.h"
+#include <stdarg.h>
+#include <sys/uio.h>
+
+// Output sinks
+//
+// Builtins write through a Sink rather than stdio, so the shell can
+// point their output anywhere without moving its own descriptors. A
+// sink is either a descriptor (file, pipe, socket) with a large buffer,
+// or a growing memory buffer whose contents the caller takes at the end.
+//
+// Output is collected until the buffer fills or the builtin returns.
+// A write that does not fit goes out together with the buffered bytes
+// in one writev(). Sinks on a terminal, and error sinks, flush at every
+// newline so interactive output is not held back.
+//
+// sink_json_string() is for the --json records of the listing builtins.
+// A sink can also copy its output into a memory sink, which is how the
+// result cache (cache.c) keeps what a builtin printed.
+
+#define SINK_BUFFER 65536
+
+void sink_open_fd(Sink *sink, int fd, int line_buffered) {
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = fd;
+    // Not cached: fd 0-2 are pointed elsewhere by $(...) and pipelines
+    sink->tty = fd >= 0 && isatty(fd);
+    sink->line_buffered = line_buffered || sink->tty;
+}
+
+void sink_open_memory(Sink *sink) {
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = -1;
+    sink->memory = 1;
+}
+
+static int write_iov(Sink *sink, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(sink->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            sink->failed = 1;
+            sink->error = errno;
+            return -1;
+        }
+        // Skip what was written, maybe part of a vector
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int sink_flush(Sink *sink) {
+    if (sink->memory || sink->len == 0) {
+        return sink->failed ? -1 : 0;
+    }
+    struct iovec iov = {sink->buf, sink->len};
+    sink->len = 0;
+    if (sink->failed) {
+        return -1;
+    }
+    return write_iov(sink, &iov, 1);
+}
+
+// Make room for len more bytes in a memory sink
+static int memory_reserve(Sink *sink, size_t len) {
+    if (sink->len + len + 1 <= sink->cap) {
+        return 0;
+    }
+    size_t cap = sink->cap ? sink->cap : 4096;
+    while (cap < sink->len + len + 1) cap *= 2;
+    char *buf = realloc(sink->buf, cap);
+    if (buf == NULL) {
+        sink->failed = 1;
+        return -1;
+    }
+    sink->buf = buf;
+    sink->cap = cap;
+    return 0;
+}
+
+int sink_write(Sink *sink, const void *data, size_t len) {
+    if (sink->failed) {
+        return -1;
+    }
+
+    if (sink->copy != NULL && !sink->copy->failed) {
+        if (sink->copy->len + len > sink->copy_limit) {
+            sink->copy->failed = 1;
+        } else {
+            sink_write(sink->copy, data, len);
+        }
+    }
+
+    if (sink->memory) {
+        if (memory_reserve(sink, len) != 0) {
+            return -1;
+        }
+        memcpy(sink->buf + sink->len, data, len);
+        sink->len += len;
+        sink->buf[sink->len] = '\0';
+        return 0;
+    }
+
+    if (sink->buf == NULL) {
+        sink->buf = malloc(SINK_BUFFER);
+        if (sink->buf == NULL) {
+            // No buffer, write straight through
+            struct iovec iov = {(void *)data, len};
+            return write_iov(sink, &iov, 1);
+        }
+        sink->cap = SINK_BUFFER;
+    }
+
+    if (sink->len + len > sink->cap) {
+        // Buffered bytes and the new ones leave in one call
+        struct iovec iov[2] = {{sink->buf, sink->len}, {(void *)data, len}};
+        sink->len = 0;
+        return write_iov(sink, iov, 2);
+    }
+
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+    if (sink->line_buffered && memchr(data, '\n', len) != NULL) {
+        return sink_flush(sink);
+    }
+    return 0;
+}
+
+int sink_puts(Sink *sink, const char *s) {
+    return sink_write(sink, s, strlen(s));
+}
+
+int sink_printf(Sink *sink, const char *fmt, ...) {
+    char small[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return -1;
+    }
+    if ((size_t)n < sizeof(small)) {
+        return sink_write(sink, small, n);
+    }
+
+    char *big = malloc(n + 1);
+    if (big == NULL) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    vsnprintf(big, n + 1, fmt, ap);
+    va_end(ap);
+    int rc = sink_write(sink, big, n);
+    free(big);
+    return rc;
+}
+
+// A JSON string literal, quotes included
+int sink_json_string(Sink *sink, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[256];
+    size_t n = 0;
+
+    buf[n++] = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (n + 6 > sizeof(buf)) {
+            if (sink_write(sink, buf, n) != 0) return -1;
+            n = 0;
+        }
+        if (c == '"' || c == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = c;
+        } else if (c == '\n') {
+            buf[n++] = '\\';
+            buf[n++] = 'n';
+        } else if (c == '\t') {
+            buf[n++] = '\\';
+            buf[n++] = 't';
+        } else if (c < 0x20 || c == 0x7f) {
+            memcpy(buf + n, "\\u00", 4);
+            buf[n + 4] = hex[c >> 4];
+            buf[n + 5] = hex[c & 15];
+            n += 6;
+        } else {
+            buf[n++] = c;
+        }
+    }
+    buf[n++] = '"';
+    return sink_write(sink, buf, n);
+}
+
+// perror() for a sink
+void sink_perror(Sink *sink, const char *what) {
+    sink_printf(sink, "%s: %s\n", what, strerror(errno));
+}
+
+// Take the contents of a memory sink; the caller frees them
+char *sink_take(Sink *sink, size_t *len) {
+    char *buf = sink->buf;
+    if (len != NULL) {
+        *len = sink->len;
+    }
+    if (buf == NULL) {
+        buf = calloc(1, 1);
+    }
+    sink->buf = NULL;
+    sink->len = sink->cap = 0;
+    return buf;
+}
+
+// Flush and release the buffer. Returns -1 if any output was lost.
+int sink_close(Sink *sink) {
+    int rc = sink_flush(sink);
+    free(sink->buf);
+    sink->buf = NULL;
+    sink->len = sink->cap = 0;
+    return rc;
+}
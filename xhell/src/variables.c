@@ -0,0 +1,261 @@
+#include "../include/xhell.h"
+
+// Shell variables
+//
+// Variables live in a small open-addressing hash table owned by the shell.
+// Lookups fall back to the environment, and "export" copies a variable
+// into the environment so external programs see it. $? and the
+// positional parameters of the running script or function are kept
+// separately, since they change on every command and call.
+
+extern char **environ;
+
+#define VAR_TABLE_INITIAL 64
+
+typedef struct {
+    char *name;
+    char *value;
+} Variable;
+
+static Variable *var_table = NULL;
+static unsigned int var_size = 0;
+static unsigned int var_used = 0;
+
+static int last_status = 0;
+static int positional_count = 0;
+static char **positional = NULL;
+
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static Variable *var_slot(const char *name) {
+    unsigned int pos = hash_name(name) & (var_size - 1);
+    while (var_table[pos].name != NULL && strcmp(var_table[pos].name, name) != 0) {
+        pos = (pos + 1) & (var_size - 1);
+    }
+    return &var_table[pos];
+}
+
+static int var_grow(void) {
+    unsigned int old_size = var_size;
+    Variable *old = var_table;
+
+    var_size = old_size ? old_size * 2 : VAR_TABLE_INITIAL;
+    var_table = calloc(var_size, sizeof(Variable));
+    if (var_table == NULL) {
+        var_table = old;
+        var_size = old_size;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < old_size; i++) {
+        if (old[i].name != NULL) {
+            *var_slot(old[i].name) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Check that name is a valid variable name
+int var_valid_name(const char *name, size_t len) {
+    if (len == 0 || !(name[0] == '_' || (name[0] >= 'A' && name[0] <= 'Z') ||
+                      (name[0] >= 'a' && name[0] <= 'z'))) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        char c = name[i];
+        if (!(c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+              (c >= '0' && c <= '9'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Set a shell variable
+int var_set(const char *name, const char *value) {
+    if ((var_used + 1) * 4 > var_size * 3 && var_grow() != 0) {
+        return -1;
+    }
+
+    Variable *slot = var_slot(name);
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    if (slot->name == NULL) {
+        slot->name = strdup(name);
+        if (slot->name == NULL) {
+            free(copy);
+            return -1;
+        }
+        var_used++;
+    } else {
+        free(slot->value);
+    }
+    slot->value = copy;
+
+    // Keep exported variables in sync
+    if (getenv(name) != NULL) {
+        setenv(name, value, 1);
+    }
+    return 0;
+}
+
+// Get a variable, falling back to the environment. NULL if unset.
+const char *var_get(const char *name) {
+    if (var_table != NULL) {
+        Variable *slot = var_slot(name);
+        if (slot->name != NULL) {
+            return slot->value;
+        }
+    }
+    return getenv(name);
+}
+
+// Remove a variable, from the environment too
+int var_unset(const char *name) {
+    if (var_table != NULL) {
+        Variable *slot = var_slot(name);
+        if (slot->name != NULL) {
+            free(slot->name);
+            free(slot->value);
+            var_used--;
+
+            // Shift later entries of the probe chain back into the hole
+            unsigned int mask = var_size - 1;
+            unsigned int hole = slot - var_table;
+            unsigned int pos = hole;
+            for (;;) {
+                pos = (pos + 1) & mask;
+                if (var_table[pos].name == NULL) break;
+                unsigned int home = hash_name(var_table[pos].name) & mask;
+                if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+                    var_table[hole] = var_table[pos];
+                    hole = pos;
+                }
+            }
+            var_table[hole].name = NULL;
+            var_table[hole].value = NULL;
+        }
+    }
+    return unsetenv(name);
+}
+
+// Export a variable to the environment of child processes
+int var_export(const char *name) {
+    const char *value = var_get(name);
+    return setenv(name, value ? value : "", 1);
+}
+
+// Saved variables and environment, for code that must not change them
+struct VarSnapshot {
+    Variable *table;
+    unsigned int size;
+    unsigned int used;
+    char **env;
+};
+
+static void free_table(Variable *table, unsigned int size) {
+    for (unsigned int i = 0; i < size; i++) {
+        free(table[i].name);
+        free(table[i].value);
+    }
+    free(table);
+}
+
+static void free_env(char **env) {
+    if (env == NULL) return;
+    for (char **e = env; *e != NULL; e++) free(*e);
+    free(env);
+}
+
+// Copy the variables and the environment. NULL when out of memory.
+VarSnapshot *var_snapshot(void) {
+    VarSnapshot *snap = calloc(1, sizeof(VarSnapshot));
+    if (snap == NULL) return NULL;
+
+    if (var_size > 0) {
+        snap->table = calloc(var_size, sizeof(Variable));
+        if (snap->table == NULL) goto fail;
+        snap->size = var_size;
+        snap->used = var_used;
+        for (unsigned int i = 0; i < var_size; i++) {
+            if (var_table[i].name == NULL) continue;
+            snap->table[i].name = strdup(var_table[i].name);
+            snap->table[i].value = strdup(var_table[i].value);
+            if (snap->table[i].name == NULL || snap->table[i].value == NULL) goto fail;
+        }
+    }
+
+    size_t count = 0;
+    while (environ != NULL && environ[count] != NULL) count++;
+    snap->env = calloc(count + 1, sizeof(char *));
+    if (snap->env == NULL) goto fail;
+    for (size_t i = 0; i < count; i++) {
+        snap->env[i] = strdup(environ[i]);
+        if (snap->env[i] == NULL) goto fail;
+    }
+    return snap;
+
+fail:
+    free_table(snap->table, snap->size);
+    free_env(snap->env);
+    free(snap);
+    return NULL;
+}
+
+// Put back the variables and environment of a snapshot, and free it
+void var_restore(VarSnapshot *snap) {
+    free_table(var_table, var_size);
+    var_table = snap->table;
+    var_size = snap->size;
+    var_used = snap->used;
+
+    clearenv();
+    for (char **e = snap->env; *e != NULL; e++) {
+        char *eq = strchr(*e, '=');
+        if (eq == NULL) continue;
+        *eq = '\0';
+        setenv(*e, eq + 1, 1);
+    }
+    free_env(snap->env);
+    free(snap);
+}
+
+void var_set_status(int status) {
+    last_status = status;
+}
+
+int var_get_status(void) {
+    return last_status;
+}
+
+// Install positional parameters ($0, $1, ...). Returns the previous
+// set through the out parameters, so calls can restore them.
+void var_set_positional(int argc, char **argv, int *old_argc, char ***old_argv) {
+    if (old_argc != NULL) *old_argc = positional_count;
+    if (old_argv != NULL) *old_argv = positional;
+    positional_count = argc;
+    positional = argv;
+}
+
+// Get positional parameter n, NULL when out of range
+const char *var_get_positional(int n) {
+    if (n < 0 || n >= positional_count) {
+        return NULL;
+    }
+    return positional[n];
+}
+
+int var_positional_count(void) {
+    return positional_count;
+}
@@ -0,0 +1,54 @@
+# Sourced by every test: runs it in a scratch directory, with checks
+# that report what differs and count the failures
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+failures=0
+
+# check WHAT EXPECTED ACTUAL
+check() {
+    if [ "$2" != "$3" ]; then
+        printf '  %s\n    expected: %s\n    actual:   %s\n' "$1" "$2" "$3"
+        failures=$((failures + 1))
+    fi
+}
+
+# Stdout and stderr of a line run by xhell -c, then its status as rc=N
+xh() {
+    "$XHELL" -c "$1" 2>&1
+    echo "rc=$?"
+}
+
+# The same for input fed to xhell on stdin, line by line like a script
+xh_input() {
+    printf '%s\n' "$1" > .input
+    "$XHELL" < .input 2>&1
+    echo "rc=$?"
+}
+
+finish() {
+    exit "$failures"
+}
+
+# The web front end's directory (p5_interface), whichever copy of xhell
+# runs the tests; empty if there is none or no python3 to run it
+p5_dir() {
+    for dir in "$TESTS/../.." "$TESTS/../../p5_interface"; do
+        if [ -f "$dir/xhell_wrapper.py" ] && command -v python3 > /dev/null; then
+            (cd "$dir" && pwd)
+            return
+        fi
+    done
+}
+
+# Set up site/ to run the web app from, as app.py looks for xhell in
+# ./xhell; fails, saying so, if Flask is missing
+web_app() {
+    if ! python3 -c 'import flask' 2> /dev/null; then
+        echo "  skipped the web app: needs Flask"
+        return 1
+    fi
+    mkdir -p site/xhell
+    ln -s "$XHELL" site/xhell/xhell
+}
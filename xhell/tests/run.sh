@@ -0,0 +1,27 @@
+#!/bin/sh
+# Regression tests: each tests/test_*.sh runs xhell on small inputs in a
+# scratch directory of its own and compares what it prints and returns
+# with what it should. A test exits with the number of checks that
+# failed; a crash shows up as a status of 128 + the signal.
+#
+# Usage: tests/run.sh [tests/test_name.sh...]
+
+XHELL=${XHELL:-$(pwd)/xhell}
+TESTS=$(cd "$(dirname "$0")" && pwd)
+export XHELL TESTS
+
+[ $# -gt 0 ] || set -- "$TESTS"/test_*.sh
+
+failed=0
+for t in "$@"; do
+    name=$(basename "$t" .sh)
+    if sh "$t"; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=$((failed + 1))
+    fi
+done
+
+echo "$# tests, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,44 @@
+# Types keys into xhell on a pseudo-terminal, one byte at a time so the
+# line editor sees them as a user would, and prints what the terminal
+# showed with carriage returns dropped.
+#
+# Usage: python3 tests/terminal.py XHELL KEYS   (KEYS takes \t, \r, \x01...)
+
+import os
+import pty
+import select
+import sys
+import time
+
+xhell = sys.argv[1]
+keys = sys.argv[2].encode().decode("unicode_escape").encode("latin-1")
+
+pid, fd = pty.fork()
+if pid == 0:
+    os.execv(xhell, [xhell])
+
+out = b""
+
+
+def drain(seconds):
+    global out
+    end = time.time() + seconds
+    while time.time() < end:
+        ready, _, _ = select.select([fd], [], [], 0.05)
+        if ready:
+            try:
+                data = os.read(fd, 4096)
+            except OSError:
+                return
+            if not data:
+                return
+            out += data
+
+
+drain(0.5)
+for key in keys:
+    os.write(fd, bytes([key]))
+    drain(0.05)
+drain(0.5)
+os.waitpid(pid, 0)
+sys.stdout.write(out.decode("utf-8", "replace").replace("\r", ""))
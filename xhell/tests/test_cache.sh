@@ -0,0 +1,18 @@
+#!/bin/sh
+# xcache: results of pure builtins, kept only while their inputs hold
+. "$TESTS/lib.sh"
+
+# Results that read a file changed in the last second are not kept
+mkdir d
+touch d/f
+printf 'line one\nneedle\n' > log
+sleep 1.2
+
+check "chmod shows in xls" "$(printf 'f\nf*\nrc=0')" "$(xh 'xcache on; xls d; chmod +x d/f; xls d')"
+
+check "hit" "$(printf '2: needle\n2: needle\nhits        : 1\nrc=0')" \
+      "$(xh 'xcache on; xsearch needle log; xsearch needle log; xcache stats | grep hits')"
+check "clear keeps stats" "$(printf 'entries     : 0\nhits        : 1\nmisses      : 1\nrc=0')" \
+      "$(xh 'xcache on; xls -0 d > o; xls -0 d > o; xcache clear; xcache stats | grep -e entries -e hits -e misses')"
+
+finish
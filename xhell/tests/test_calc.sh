@@ -0,0 +1,25 @@
+#!/bin/sh
+# xcalc, in double and int64 mode
+. "$TESTS/lib.sh"
+
+check "double" "$(printf '14\nrc=0')" "$(xh "xcalc '(1 + 2) * max(3, 4) + 2'")"
+check "int" "$(printf '3 -1\nrc=0')" "$(xh "xecho \$(xcalc -i '7 / 2') \$(xcalc -i '-7 % 3')")"
+touch a.txt b.txt
+check "unquoted *" "$(printf '6\n4096\n8\nrc=0')" "$(xh 'xcalc 2 * 3; xcalc -i 128 * 32 | cat; xcalc 2 ** 3')"
+check "other words still glob" "$(printf 'a.txt b.txt\nrc=0')" "$(xh 'xecho *.txt')"
+check "division by zero" "$(printf 'xcalc: division by zero\nrc=255')" "$(xh "xcalc -i '7 / 0'")"
+
+MIN='(-9223372036854775807 - 1)'
+for expr in "$MIN / -1" "$MIN % -1" "9223372036854775807 + 1" "$MIN - 1" \
+            "4294967296 * 4294967296" "-$MIN" "abs($MIN)" "2 ** 63"; do
+    check "$expr" "$(printf 'xcalc: overflow\nrc=255')" "$(xh "xcalc -i '$expr'")"
+done
+check "largest power" "$(printf '%s\nrc=0' -9223372036854775808)" "$(xh "xcalc -i '(-2) ** 63'")"
+check "stream overflow" "$(printf 'xcalc: line 2: overflow\n3\nerror\n3\nrc=1')" \
+      "$(printf '1 + 2\n9223372036854775807 + 1\n3\n' > in; xh 'xcalc -i - < in')"
+
+# An unclosed parenthesis stops at the end of the expression
+check "unclosed" "$(printf 'xcalc: expected )\nrc=255')" "$(xh "xcalc '(1'")"
+check "unclosed, nested" "$(printf 'xcalc: expected )\nrc=255')" "$(xh "xcalc -i '((2) * 3'")"
+
+finish
@@ -0,0 +1,29 @@
+#!/bin/sh
+# External commands, including argument lists too long for one exec
+. "$TESTS/lib.sh"
+
+check "external" "$(printf '3\nrc=0')" "$(xh "sh -c 'echo \$#' x 1 2 3")"
+check "status" "$(printf '4\nrc=0')" "$(xh "sh -c 'exit 4'; xecho \$?")"
+check "not found" "$(printf 'nosuchcmd: command not found\n127\nrc=0')" "$(xh 'nosuchcmd; xecho $?')"
+echo x > plain
+check "not executable" "$(printf './plain: Permission denied\n126\nrc=0')" "$(xh './plain; xecho $?')"
+check "killed" "$(printf '137\nrc=0')" "$(xh "sh -c 'kill -9 \$\$'; xecho \$?")"
+check "not found, last stage" "$(printf 'nosuchcmd: command not found\nrc=127')" "$(xh 'xecho | nosuchcmd')"
+check "not executable, last stage" "$(printf './plain: Permission denied\nrc=126')" "$(xh 'xecho | ./plain')"
+
+# A pipeline longer than the shell holds is refused, not folded up
+long=xecho
+i=0
+while [ $i -lt 64 ]; do long="$long | xcat"; i=$((i + 1)); done
+check "too many stages" "rc=2" "$(xh "$long" | tail -1)"
+
+# {1..400000} is too long for one exec and runs in batches
+check "batches get every argument" "$(printf '400000\nrc=0')" \
+      "$(xh "sh -c 'echo \$#' x {1..400000} | awk '{ n += \$1 } END { print n }'")"
+
+# One batch at a time, even with another child of the shell (the
+# process substitution) exiting first
+check "batches wait for their own pids" "$(printf 'start\nend\nstart\nend\nstart\nend\nrc=0')" \
+      "$(XHELL_BATCH_JOBS=1 xh "sh -c 'echo start; sleep 0.3; echo end' <(true) {1..400000}")"
+
+finish
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Brace expansion and globbing
+. "$TESTS/lib.sh"
+
+check "braces" "$(printf 'abz acdz acez ax,yz\nrc=0')" "$(xh "xecho a{b,c{d,e},'x,y'}z")"
+check "brace product" "$(printf 'a1 a2 b1 b2 {} {x}\nrc=0')" "$(xh 'xecho {a,b}{1,2} {} {x}')"
+check "brace range" "$(printf '1 2 3 c b a\nrc=0')" "$(xh 'xecho {1..3} {c..a}')"
+many=$(seq -s, 1 300)
+check "300 alternatives" "$(printf '300\nrc=0')" "$(xh "xecho {$many} | wc -w")"
+check "last alternative" "$(printf '299 300\nrc=0')" "$(xh "xecho {$many} | cut -d' ' -f299-")"
+
+mkdir -p a/sub/deep a/.hid
+touch top a/f a/sub/g a/sub/deep/h a/.hid/x
+check "glob" "$(printf 'a/f a/sub\nrc=0')" "$(xh 'xecho a/*')"
+check "trailing **" "$(printf 'a a/f a/sub a/sub/deep a/sub/deep/h a/sub/g top\nrc=0')" "$(xh 'xecho **')"
+check "dir/**" "$(printf 'a a/f a/sub a/sub/deep a/sub/deep/h a/sub/g\nrc=0')" "$(xh 'xecho a/**')"
+check "**/ directories" "$(printf 'a/ a/sub/ a/sub/deep/\nrc=0')" "$(xh 'xecho a/**/')"
+check "**/name" "$(printf 'a/sub/g\nrc=0')" "$(xh 'xecho **/g')"
+check "no match" "$(printf 'nothing*here\nrc=0')" "$(xh 'xecho nothing*here')"
+
+finish
@@ -0,0 +1,99 @@
+#!/bin/sh
+# libxhell: lines run in-process with their output captured, session
+# state kept between lines, and the ctypes binding on top
+. "$TESTS/lib.sh"
+
+LIB=$(dirname "$XHELL")
+if [ ! -f "$LIB/libxhell.a" ] || ! command -v cc > /dev/null; then
+    echo "  skipped: needs cc and libxhell.a next to xhell"
+    finish
+fi
+
+mkdir space other
+seq 1 200000 > space/big
+cat > embed.c <<'C'
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "libxhell.h"
+
+static XhellSession *session;
+
+// Print what a line did, one field per line
+static void run(const char *line) {
+    XhellResult r;
+    if (xhell_exec(session, line, &r) != 0) {
+        printf("exec failed: %s\n", strerror(errno));
+        return;
+    }
+    printf("[%s] [%s] %d %d\n", r.out_len > 64 ? "long" : r.out, r.err, r.status, r.exited);
+    if (r.out_len > 64) printf("%zu bytes\n", r.out_len);
+    xhell_result_free(&r);
+}
+
+int main(void) {
+    char before[4096], after[4096];
+    getcwd(before, sizeof(before));
+    session = xhell_session_new("space");
+    if (session == NULL) {
+        printf("no session: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("second: %s\n", xhell_session_new(".") == NULL && errno == EBUSY ? "EBUSY" : "made");
+    run("xecho hi; xcat nope");
+    run("echo external");
+    run("x=5");
+    run("xecho $x");
+    run("xcat big");
+    run("xcd /; xpwd");
+    getcwd(after, sizeof(after));
+    printf("cwd kept: %s\n", strcmp(before, after) == 0 ? "yes" : after);
+    run("exit 4");
+    xhell_session_free(session);
+    session = xhell_session_new("other");
+    printf("again: %s\n", session != NULL ? "yes" : strerror(errno));
+    run("xecho other");
+    xhell_session_free(session);
+    return 0;
+}
+C
+cc -I"$TESTS/../include" embed.c "$LIB/libxhell.a" -pthread -lm -o embed
+check "C API" "$(printf '%s\n' \
+      'second: EBUSY' \
+      '[hi' '] [xcat: No such file or directory' '] 255 0' \
+      '[external' '] [] 0 0' \
+      '[] [] 0 0' \
+      '[5' '] [] 0 0' \
+      '[long] [] 0 0' '1288895 bytes' \
+      '[/' '] [] 0 0' \
+      'cwd kept: yes' \
+      '[] [] 4 1' \
+      'again: yes' \
+      '[other' '] [] 0 0')" "$(./embed 2>&1)"
+check "history per session" "$(printf 'xecho other\n0')" \
+      "$(cat other/.xhell_history; grep -c other space/.xhell_history)"
+
+P5=$(p5_dir)
+if [ -n "$P5" ] && [ -f "$LIB/libxhell.so" ]; then
+    check "ctypes" "$(printf '%s\n' "{'stdout': 'hi\\n', 'stderr': '', 'status': 0}" "{'stdout': '', 'stderr': '', 'status': 3}" \
+                          "same: True" "ValueError: xhell session is open in $WORK/space")" \
+          "$(cd "$P5" && python3 - "$LIB/libxhell.so" "$WORK/space" 2>&1 <<'PY'
+import sys
+from libxhell import XhellLibrary
+
+lib = XhellLibrary(library_path=sys.argv[1], workspace_dir=sys.argv[2])
+for line in ("xecho hi", "exit 3"):
+    frame = lib.run(line)
+    print({k: frame[k] for k in ("stdout", "stderr", "status")})
+print("same:", XhellLibrary(library_path=sys.argv[1], workspace_dir=sys.argv[2]) is lib)
+try:
+    XhellLibrary(library_path=sys.argv[1], workspace_dir=sys.argv[2] + "/..")
+except ValueError as e:
+    print("ValueError:", e)
+lib.close()
+PY
+)"
+fi
+
+finish
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Line editor on a terminal: completion of builtins, PATH executables and
+# files, history arrows, kill/yank and Ctrl-R search
+. "$TESTS/lib.sh"
+
+if ! python3 -c 'import pty' 2> /dev/null; then
+    echo "  skipped: needs python3 for a pseudo-terminal"
+    finish
+fi
+
+# Lines the commands printed, whatever the editor drew around them
+typed() {
+    python3 "$TESTS/terminal.py" "$XHELL" "$1" | grep -x "$2"
+}
+
+mkdir bin
+printf '#!/bin/sh\necho tool ran\n' > bin/zzuniqtool
+chmod +x bin/zzuniqtool
+echo "file contents" > longfilename.txt
+printf 'xecho alpha\n' > .xhell_history
+
+check "builtin" "hi" "$(typed 'xec\thi\rquit\r' hi)"
+check "file" "file contents" "$(typed 'xcat longf\t\rquit\r' 'file contents')"
+check "PATH executable" "tool ran" \
+      "$(PATH="$WORK/bin:$PATH" typed 'zzuniq\t\rquit\r' 'tool ran')"
+check "up arrow" "xxecho: command not found" \
+      "$(typed 'xecho hi\r\x1b[A\x01\x1b[Cx\r\x15quit\r' 'xxecho: command not found')"
+check "kill and yank" "twoone" \
+      "$(typed 'xecho one two\x17\x01\x06\x06\x06\x06\x06\x06\x19\rquit\r' twoone)"
+check "ctrl-r" "alpha" "$(typed '\x12lph\rquit\r' alpha)"
+
+# Directories with the same mtime, as tar leaves them, are told apart
+mkdir d1 d2
+echo > d1/aaa1.txt
+echo > d2/aaa2.txt
+touch -d '2020-01-01 00:00:00' d1 d2
+check "same mtime" "$(printf 'aaa1.txt\naaa2.txt')" \
+      "$(typed 'xcd d1\rxecho aa\t\rxcd ../d2\rxecho aa\t\rquit\r' 'aaa[12].txt')"
+
+finish
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Non-interactive modes: -c and -s without banner or prompt, JSON result
+# frames, and --session requests with length-prefixed frames
+. "$TESTS/lib.sh"
+
+# Frames with their timing left out
+frames() {
+    sed 's/,"duration":[0-9.]*}/}/'
+}
+
+check "-c" "$(printf 'hi\nrc=0')" "$(xh 'xecho hi')"
+check "-c status" "rc=3" "$(xh 'exit 3')"
+check "-c args" "name a" "$("$XHELL" -c 'xecho $0 $1' name a)"
+check "-s args" "a b" "$(echo 'xecho $1 $2' | "$XHELL" -s a b)"
+check "stdin, no prompt" "a" "$(echo 'xecho a' | "$XHELL")"
+check "bad option" "rc=2" "$("$XHELL" -q 2> /dev/null; echo "rc=$?")"
+
+check "frame" \
+      '{"command":"xecho hi; xcat nope","stdout":"hi\n","stderr":"xcat: No such file or directory\n","status":255}' \
+      "$("$XHELL" --frame json -c 'xecho hi; xcat nope' | frames)"
+check "frame per line" "$(printf '%s\n' \
+      '{"command":"xecho 1","stdout":"1\n","stderr":"","status":0}' \
+      '{"command":"xecho \"2\"","stdout":"2\n","stderr":"","status":0}')" \
+      "$(printf 'xecho 1\nxecho "2"\n' | "$XHELL" --frame json -s | frames)"
+
+check "session" "$(printf '%s\n' 82 \
+      '{"command":"xecho hi","stdout":"hi\n","stderr":"","status":0}' 82 \
+      '{"command":"xecho yo","stdout":"yo\n","stderr":"","status":0}')" \
+      "$(printf '8\nxecho hi8\nxecho yo' | "$XHELL" --session | frames)"
+check "session stays in its directory" "$WORK" \
+      "$(printf '8\nxcd /tmp4\nxpwd' | "$XHELL" --session | frames | sed -n 's/.*"stdout":"\([^"]*\)\\n".*/\1/p')"
+check "streamed session" "hi" "$(printf '8\nxecho hi' | "$XHELL" --frame-fd 3 --session 3> streamed)"
+check "streamed frame" "$(printf '%s\n' 54 '{"command":"xecho hi","status":0}')" "$(frames < streamed)"
+check "bad header" "$(printf 'xhell: session: bad request header\nrc=2')" \
+      "$(printf 'xecho hi' | "$XHELL" --session 2>&1; echo "rc=$?")"
+
+too_large=$(printf '%s\n' rc=2 93 '{"command":"","stderr":"xhell: session: request too large\n","status":2}')
+check "request over the cap" "$too_large" \
+      "$(printf '16777217\nxecho hi' | "$XHELL" --session > answer; echo "rc=$?"; frames < answer)"
+check "request past ULONG_MAX" "$too_large" \
+      "$(printf '99999999999999999999999\nxecho hi' | "$XHELL" --session > answer; echo "rc=$?"; frames < answer)"
+
+finish
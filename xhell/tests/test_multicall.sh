@@ -0,0 +1,23 @@
+#!/bin/sh
+# Multi-call binary: a symlink named after a builtin, or --builtin, runs
+# the builtin alone, without the shell's history or log
+. "$TESTS/lib.sh"
+
+ln -s "$XHELL" xcat
+ln -s "$XHELL" xecho
+ln -s "$XHELL" other
+echo hi > f
+
+check "symlink" "hi" "$(./xcat f)"
+check "symlink args" "a  b" "$(./xecho 'a  b')"
+check "status" "$(printf 'xcat: No such file or directory\nrc=255')" "$(./xcat nope 2>&1; echo "rc=$?")"
+check "--builtin" "z" "$("$XHELL" --builtin xecho z)"
+check "not a builtin" "$(printf 'xhell: nosuch: not a builtin\nrc=127')" \
+      "$("$XHELL" --builtin nosuch 2>&1; echo "rc=$?")"
+check "list" "xcat" "$("$XHELL" --builtin | grep -x xcat)"
+check "no history or log" "" "$(ls -A | grep xhell_)"
+
+# Any other name is the shell
+check "other name" "via shell" "$(./other -c 'xecho via shell')"
+
+finish
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Output modes of the listing builtins: --json records, -0 records, the
+# XHELL_OUTPUT default, and color only on a terminal
+. "$TESTS/lib.sh"
+
+mkdir -p e/sub
+echo hi > e/f
+printf 'hello "q"\n' > quote.txt
+printf 'a\001b\n' > ctl.txt
+
+check "xls json" "$(printf '%s\n' \
+      '{"name":"f","type":"file","size":3,"mode":"0644"}' \
+      '{"name":"sub","type":"dir","size":4096,"mode":"0755"}')" \
+      "$(xh 'xls --json e' | grep -v '^rc=' | sed 's/,"mtime":[0-9]*//' | sort)"
+check "xls nul" "$(printf 'f\nsub')" "$("$XHELL" -c 'xls -0 e' | tr '\0' '\n' | sort)"
+check "XHELL_OUTPUT" "$(printf 'f\nsub')" \
+      "$(XHELL_OUTPUT=nul "$XHELL" -c 'xls e' | tr '\0' '\n' | sort)"
+check "text" "$(printf 'f\nsub/')" "$(xh 'xls e' | grep -v '^rc=' | sort)"
+
+check "xsearch json" "$(printf '%s\nrc=0' '{"line":1,"text":"hello \"q\""}')" \
+      "$(xh 'xsearch --json hello quote.txt')"
+check "json escapes" '{"line":1,"text":"a\u0001b"}' "$(xh 'xsearch --json a ctl.txt' | head -1)"
+check "xsearch nul" 'hello "q"|' "$("$XHELL" -c 'xsearch -0 hello quote.txt' | tr '\0' '|')"
+
+printf 'xecho one\n' > .xhell_history
+check "xhistory json" '{"number":1,"command":"xecho one"}' "$(xh 'xhistory --json' | head -1)"
+xh 'xecho x' > /dev/null
+check "xjournalctl json" '"kind":"CMD","command":"xecho x","status":0}' \
+      "$(xh 'xjournalctl --json' | grep '"xecho x"' | sed 's/.*"kind"/"kind"/')"
+
+# Directories are colored for a terminal only
+check "no color in a pipe" "" "$(xh 'xls e' | grep -c "$(printf '\033')" | grep -v '^0$')"
+if python3 -c 'import pty' 2> /dev/null; then
+    check "color on a terminal" "1" \
+          "$(python3 "$TESTS/terminal.py" "$XHELL" 'xls e\rquit\r' | grep -c "$(printf '\033')\[[0-9;]*msub")"
+fi
+
+finish
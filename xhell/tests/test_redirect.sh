@@ -0,0 +1,18 @@
+#!/bin/sh
+# Redirections of builtins run in the shell itself
+. "$TESTS/lib.sh"
+
+check "append keeps appending" "$(printf 'one\ntwo\nrc=0')" "$(xh 'xecho one > f; xecho two >> f; xcat f')"
+check "stderr" "$(printf 'rc=0')" "$(xh 'xcat missing 2> err; xecho done > /dev/null')"
+check "stderr file" "xcat: No such file or directory" "$(cat err)"
+
+mkfifo fifo
+check "FIFO without a reader" "$(printf 'xhell: fifo: no reader on the FIFO\n1\nrc=0')" \
+      "$(timeout 10 "$XHELL" -c 'xecho hi > fifo; xecho $?' 2>&1; echo "rc=$?")"
+
+(sleep 1; cat fifo > got) &
+check "FIFO with a reader" "$(printf '0\nrc=0')" "$(xh 'sleep 2; xecho hi > fifo; xecho $?')"
+wait
+check "FIFO contents" "hi" "$(cat got)"
+
+finish
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Builtin output sinks: redirections and pipes reach the builtin without
+# moving the shell's descriptors, large output arrives whole, and a
+# failed write is reported
+. "$TESTS/lib.sh"
+
+seq 1 200000 > big
+xh 'xcat big > out' > /dev/null
+check "large output" "" "$(cmp big out 2>&1)"
+check "pipe" "$(printf '200000\nrc=0')" "$(xh 'xcat big | wc -l')"
+
+check "append" "$(printf 'a\nb\nrc=0')" "$(xh 'xecho a > f; xecho b >> f; xcat f')"
+check "stderr redirect" "$(printf 'after\nrc=0')" "$(xh 'xcat nope 2> e; xecho after')"
+check "stderr file" "xcat: No such file or directory" "$(cat e)"
+check "to stderr" "rc=0" "$("$XHELL" -c 'xecho err 1>&2' 2> /dev/null; echo "rc=$?")"
+
+# The shell's own stdout is untouched by a builtin's redirect
+check "shell fds kept" "$(printf 'two\nrc=0')" "$(xh_input "$(printf 'xecho one > f2\nxecho two')")"
+check "redirected line" "one" "$(cat f2)"
+
+if [ -w /dev/full ]; then
+    check "write error" "$(printf 'xecho: write error: No space left on device\nrc=1')" \
+          "$(xh 'xecho hi > /dev/full')"
+    check "buffered write error" "$(printf 'xcat: write error: No space left on device\nrc=1')" \
+          "$(xh 'xcat big > /dev/full')"
+fi
+
+finish
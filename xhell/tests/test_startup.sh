@@ -0,0 +1,27 @@
+#!/bin/sh
+# Lazy startup: a command runs without the history being read or the log
+# being open, and the first lookup still sees the whole history
+. "$TESTS/lib.sh"
+
+# Peak RSS in kB, read by a builtin in the shell itself
+peak() {
+    "$XHELL" -c "$1 xsearch VmHWM /proc/self/status" | awk '{ print $(NF - 1) }'
+}
+
+empty=$(peak '')
+awk 'BEGIN { for (i = 0; i < 300000; i++) printf "xecho history entry number %d\n", i }' > .xhell_history
+lazy=$(peak '')
+loaded=$(peak 'xhistory > /dev/null;')
+check "history not read" "yes" "$([ $((lazy - empty)) -lt 512 ] && echo yes || echo "no, $empty kB -> $lazy kB")"
+check "history read on use" "yes" "$([ $((loaded - lazy)) -ge 512 ] && echo yes || echo "no, $lazy kB -> $loaded kB")"
+
+rm -f .xhell_log
+check "log not open" "" "$("$XHELL" -c "sh -c 'ls -l /proc/\$PPID/fd 2> /dev/null' | grep xhell_log")"
+xh 'xecho logged' > /dev/null
+check "log written" "1" "$(grep -c 'xecho logged' .xhell_log)"
+
+printf 'xecho old\n' > .xhell_history
+check "session merged" "$(printf 'new\n   1  xecho old\n   2  xecho new\n   3  xhistory\nrc=0')" \
+      "$(xh_input "$(printf 'xecho new\nxhistory')")"
+
+finish
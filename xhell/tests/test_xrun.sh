@@ -0,0 +1,26 @@
+#!/bin/sh
+# xrun: the pipeline runs confined, in a subshell of its own, and the
+# limits reach external and builtin stages but not the shell
+. "$TESTS/lib.sh"
+
+check "cpus, builtin" "Cpus_allowed_list:	0" \
+      "$(xh 'xrun --cpus 0 -- xsearch Cpus_allowed_list /proc/self/status' | sed -n 's/^[0-9]*: //p')"
+check "cpus, external" "Cpus_allowed_list:	0" \
+      "$(xh 'xrun --cpus 0 -- grep Cpus_allowed_list /proc/self/status' | grep -v '^rc=')"
+check "nice" "7" "$(xh 'xrun --nice 7 -- sh -c "ps -o ni= -p \$\$"' | grep -v '^rc=' | tr -d ' ')"
+check "nice, shell untouched" "$(ps -o ni= -p $$ | tr -d ' ')" \
+      "$(xh 'xrun --nice 7 -- xecho; sh -c "ps -o ni= -p \$\$"' | grep -v '^rc=' | tr -d ' ' | tail -1)"
+check "nofile" "$(printf '33\nrc=0')" "$(xh 'xrun --nofile 33 -- sh -c "ulimit -n"')"
+check "mem" "$(printf '1048576\nrc=0')" "$(xh 'xrun --mem 1G -- sh -c "ulimit -v"')"
+if command -v ionice > /dev/null; then
+    check "ionice" "$(printf 'idle\nrc=0')" "$(xh 'xrun --ionice idle -- sh -c "ionice -p \$\$"')"
+fi
+check "pipeline" "$(printf '1\nrc=0')" "$(xh 'xrun --nice 5 -- xecho a | wc -l')"
+
+check "subshell" "$(printf '1\nrc=0')" "$(xh 'x=1; xrun -- x=2; xecho $x')"
+check "status" "rc=3" "$(xh 'xrun -- exit 3')"
+check "bad cpus" "$(printf 'xrun: bad value for --cpus: 9999\nrc=1')" "$(xh 'xrun --cpus 9999 -- xecho x')"
+check "bad option" "$(printf 'xrun: unknown option --bogus\nrc=1')" "$(xh 'xrun --bogus -- xecho x')"
+check "usage" "rc=1" "$(xh 'xrun' | tail -1)"
+
+finish